@@ -0,0 +1,546 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#include "cc2520.h"
+#include "radio.h"
+#include "packet.h"
+#include "filter.h"
+#include "sack.h"
+#include "csma.h"
+#include "lpl.h"
+#include "unique.h"
+#include "stats.h"
+#include "env.h"
+#include "bench.h"
+#include "debug.h"
+
+// Measures what each MAC layer costs per frame, with
+// nothing else in the way. Every layer gets a scratch
+// radio of its own and is wedged between a fake upper and
+// lower layer: frames go in one side, the fakes count
+// what comes out the other and finish sends as soon as
+// the layer returns, so the time is the layer's own code.
+// The same runs check each layer got every frame through
+// the way it should, and each result ends in ok or FAIL.
+//
+// The chain row runs the layers stacked the way the
+// module stacks them, less TSCH, for the cost of a frame
+// through all of them.
+//
+// The scratch radios keep time on a clock of their own,
+// see struct cc2520_bench_env, which stands still while
+// frames go through. CSMA is run with no backoff, so each
+// send waits on a timer that's already due and a clear
+// channel. LPL is run on frames asking for an ACK, so
+// every train ends on its first send. No ACK timeout or
+// LPL window ever runs out.
+//
+// The KUnit tests drive the same scratch radios a frame
+// at a time, see cc2520_test.c. The runs build outside the
+// kernel too, see user/.
+
+#define CC2520_BENCH_PAYLOAD 20
+
+// How a layer treats the frames it's handed.
+#define CC2520_BENCH_RX_HELD   (1 << 0) // frames arrive with the RX buffer claimed
+#define CC2520_BENCH_RX_PASSED (1 << 1) // and it's still claimed when they leave
+#define CC2520_BENCH_ACKS      (1 << 2) // answers frames and waits on ACKs
+#define CC2520_BENCH_DEDUPS    (1 << 3) // drops a frame heard twice
+
+struct cc2520_bench_layer {
+	const char *name;
+	int (*init)(struct cc2520_dev *dev);
+	void (*free)(struct cc2520_dev *dev);
+	void (*setup)(struct cc2520_dev *dev);
+
+	// Where the layer's own interface pointers sit
+	// in struct cc2520_dev.
+	size_t top;
+	size_t bottom;
+
+	u8 flags;
+};
+
+#define CC2520_BENCH_LAYER(_name, _setup, _flags) \
+	{ #_name, cc2520_##_name##_init, cc2520_##_name##_free, _setup, \
+		offsetof(struct cc2520_dev, _name##_top), \
+		offsetof(struct cc2520_dev, _name##_bottom), _flags }
+
+static void cc2520_bench_csma_setup(struct cc2520_dev *dev)
+{
+	cc2520_csma_set_min_backoff(dev, 0);
+	cc2520_csma_set_init_backoff(dev, 0);
+	cc2520_csma_set_cong_backoff(dev, 0);
+}
+
+// Bound as setup_bindings has it, less TSCH, with the
+// ends left to the fakes.
+static int cc2520_bench_chain_init(struct cc2520_dev *dev)
+{
+	int err;
+
+	dev->filter_top = dev->sack_bottom = &dev->sack_to_filter;
+	dev->sack_top = dev->csma_bottom = &dev->tsch_to_sack;
+	dev->csma_top = dev->lpl_bottom = &dev->lpl_to_csma;
+	dev->lpl_top = dev->unique_bottom = &dev->unique_to_lpl;
+
+	err = cc2520_filter_init(dev);
+	if (err)
+		goto error4;
+
+	err = cc2520_sack_init(dev);
+	if (err)
+		goto error3;
+
+	err = cc2520_csma_init(dev);
+	if (err)
+		goto error2;
+
+	err = cc2520_lpl_init(dev);
+	if (err)
+		goto error1;
+
+	err = cc2520_unique_init(dev);
+	if (err)
+		goto error0;
+
+	return 0;
+
+	error0:
+		cc2520_lpl_free(dev);
+	error1:
+		cc2520_csma_free(dev);
+	error2:
+		cc2520_sack_free(dev);
+	error3:
+		cc2520_filter_free(dev);
+	error4:
+		return err;
+}
+
+static void cc2520_bench_chain_free(struct cc2520_dev *dev)
+{
+	cc2520_unique_free(dev);
+	cc2520_lpl_free(dev);
+	cc2520_csma_free(dev);
+	cc2520_sack_free(dev);
+	cc2520_filter_free(dev);
+}
+
+static const struct cc2520_bench_layer cc2520_bench_layers[] = {
+	CC2520_BENCH_LAYER(filter, NULL, CC2520_BENCH_RX_HELD | CC2520_BENCH_RX_PASSED),
+	CC2520_BENCH_LAYER(sack, NULL, CC2520_BENCH_RX_HELD | CC2520_BENCH_ACKS),
+	CC2520_BENCH_LAYER(csma, cc2520_bench_csma_setup, 0),
+	CC2520_BENCH_LAYER(lpl, NULL, 0),
+	CC2520_BENCH_LAYER(unique, NULL, CC2520_BENCH_DEDUPS),
+	{ "chain", cc2520_bench_chain_init, cc2520_bench_chain_free, cc2520_bench_csma_setup,
+		offsetof(struct cc2520_dev, unique_top), offsetof(struct cc2520_dev, filter_bottom),
+		CC2520_BENCH_RX_HELD | CC2520_BENCH_ACKS | CC2520_BENCH_DEDUPS },
+};
+
+static const struct cc2520_rx_record cc2520_bench_meta = {
+	.rssi = -40,
+	.lqi = 108,
+	.crc_ok = 1
+};
+
+//////////////////////////////
+// Clock
+/////////////////////////////
+
+static u64 cc2520_bench_now(struct cc2520_env *env)
+{
+	return container_of(env, struct cc2520_bench_env, env)->now;
+}
+
+// The slot timer is in, or a free one for NULL.
+static int cc2520_bench_slot(struct cc2520_bench_env *env, struct hrtimer *timer)
+{
+	int i;
+
+	for (i = 0; i < CC2520_BENCH_TIMERS; i++) {
+		if (env->timers[i].timer == timer)
+			return i;
+	}
+
+	return -1;
+}
+
+static void cc2520_bench_timer_start(struct cc2520_env *env, struct hrtimer *timer, int us)
+{
+	struct cc2520_bench_env *benv = container_of(env, struct cc2520_bench_env, env);
+	int i;
+
+	i = cc2520_bench_slot(benv, timer);
+	if (i < 0)
+		i = cc2520_bench_slot(benv, NULL);
+	if (i < 0) {
+		ERR((KERN_ALERT "[cc2520] - bench is out of timers.\n"));
+		return;
+	}
+
+	benv->timers[i].timer = timer;
+	benv->timers[i].expires = benv->now + 1000ULL * us;
+}
+
+static void cc2520_bench_timer_cancel(struct cc2520_env *env, struct hrtimer *timer)
+{
+	struct cc2520_bench_env *benv = container_of(env, struct cc2520_bench_env, env);
+	int i;
+
+	i = cc2520_bench_slot(benv, timer);
+	if (i >= 0)
+		benv->timers[i].timer = NULL;
+}
+
+static bool cc2520_bench_is_clear(struct cc2520_env *env)
+{
+	return container_of(env, struct cc2520_bench_env, env)->clear;
+}
+
+// The first timer due by until, or -1.
+static int cc2520_bench_next_timer(struct cc2520_bench_env *env, u64 until)
+{
+	int next = -1;
+	int i;
+
+	for (i = 0; i < CC2520_BENCH_TIMERS; i++) {
+		if (!env->timers[i].timer || env->timers[i].expires > until)
+			continue;
+		if (next < 0 || env->timers[i].expires < env->timers[next].expires)
+			next = i;
+	}
+
+	return next;
+}
+
+// A callback that returns HRTIMER_RESTART has already
+// forwarded its timer, which starts it again from now.
+void cc2520_bench_advance(struct cc2520_bench *b, int us)
+{
+	struct cc2520_bench_env *env = &b->env;
+	u64 until = env->now + 1000ULL * us;
+	struct hrtimer *timer;
+	int i;
+
+	while ((i = cc2520_bench_next_timer(env, until)) >= 0) {
+		timer = env->timers[i].timer;
+		env->now = env->timers[i].expires;
+		env->timers[i].timer = NULL;
+		timer->function(timer);
+
+		// CSMA sends from its workqueue once its
+		// backoff's up.
+		if (b->dev.csma)
+			cc2520_csma_flush(&b->dev);
+	}
+
+	env->now = until;
+}
+
+int cc2520_bench_timers(struct cc2520_bench *b)
+{
+	int running = 0;
+	int i;
+
+	for (i = 0; i < CC2520_BENCH_TIMERS; i++) {
+		if (b->env.timers[i].timer)
+			running++;
+	}
+
+	return running;
+}
+
+//////////////////////////////
+// Fake Layers
+/////////////////////////////
+
+static void cc2520_bench_tx_done(struct cc2520_dev *dev, u8 status)
+{
+	struct cc2520_bench *b = container_of(dev, struct cc2520_bench, dev);
+
+	b->tx_up++;
+	b->tx_status = status;
+}
+
+static void cc2520_bench_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len)
+{
+	struct cc2520_bench *b = container_of(dev, struct cc2520_bench, dev);
+
+	b->rx_up++;
+
+	// Normally the soft-ack layer above would let go.
+	if (b->layer->flags & CC2520_BENCH_RX_PASSED)
+		cc2520_radio_release_rx(dev);
+}
+
+static int cc2520_bench_tx(struct cc2520_dev *dev, u8 *buf, u8 len)
+{
+	struct cc2520_bench *b = container_of(dev, struct cc2520_bench, dev);
+
+	b->tx_down++;
+	b->tx_pending = true;
+	return 0;
+}
+
+// The radio finishes a send from its interrupt, long
+// after tx returns, so sends are finished here rather
+// than from inside the fake.
+void cc2520_bench_complete(struct cc2520_bench *b, u8 status)
+{
+	if (b->tx_pending) {
+		b->tx_pending = false;
+		b->lower.tx_done(&b->dev, status);
+	}
+}
+
+void cc2520_bench_receive(struct cc2520_bench *b, u8 *buf, u8 len)
+{
+	if (b->layer->flags & CC2520_BENCH_RX_HELD)
+		cc2520_radio_hold_rx(&b->dev, &cc2520_bench_meta);
+	b->lower.rx_done(&b->dev, buf, len);
+}
+
+u8 cc2520_bench_frame(u8 *buf)
+{
+	ieee154_simple_header_t *hdr = cc2520_packet_get_header(buf);
+	u8 len = sizeof(ieee154_simple_header_t) + CC2520_BENCH_PAYLOAD + 2;
+
+	memset(buf, 0x5A, len + 1);
+	buf[0] = len;
+	hdr->fcf = IEEE154_DATA_FRAME_VALUE | (1 << IEEE154_FCF_ACK_REQ);
+	hdr->dsn = 0;
+	hdr->destpan = CC2520_DEF_PAN;
+	hdr->dest = 1;
+	hdr->src = 2;
+
+	return len + 1;
+}
+
+//////////////////////////////
+// Scratch Radios
+/////////////////////////////
+
+static struct cc2520_bench *cc2520_bench_open(const struct cc2520_bench_layer *layer)
+{
+	struct cc2520_bench *b;
+	struct cc2520_dev *dev;
+	int err;
+
+	b = kzalloc(sizeof(struct cc2520_bench), GFP_KERNEL);
+	if (!b)
+		return ERR_PTR(-ENOMEM);
+
+	b->layer = layer;
+	dev = &b->dev;
+
+	// Clear of the ids any real radio can have.
+	dev->id = CC2520_MAX_RADIOS;
+
+	b->env.env.now = cc2520_bench_now;
+	b->env.env.timer_start = cc2520_bench_timer_start;
+	b->env.env.timer_forward = cc2520_bench_timer_start;
+	b->env.env.timer_cancel = cc2520_bench_timer_cancel;
+	b->env.env.is_clear = cc2520_bench_is_clear;
+	b->env.clear = true;
+	dev->env = &b->env.env;
+
+	dev->radio_top = &b->radio;
+	*(struct cc2520_interface **)((u8 *)dev + layer->top) = &b->upper;
+	*(struct cc2520_interface **)((u8 *)dev + layer->bottom) = &b->lower;
+	b->upper.tx_done = cc2520_bench_tx_done;
+	b->upper.rx_done = cc2520_bench_rx_done;
+	b->lower.tx = cc2520_bench_tx;
+
+	err = cc2520_stats_init(dev);
+	if (err)
+		goto error2;
+
+	err = cc2520_radio_init(dev);
+	if (err)
+		goto error1;
+
+	err = layer->init(dev);
+	if (err)
+		goto error0;
+
+	return b;
+
+	error0:
+		cc2520_radio_free(dev);
+	error1:
+		cc2520_stats_free(dev);
+	error2:
+		kfree(b);
+		return ERR_PTR(err);
+}
+
+struct cc2520_bench *cc2520_bench_alloc(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(cc2520_bench_layers); i++) {
+		if (!strcmp(cc2520_bench_layers[i].name, name))
+			return cc2520_bench_open(&cc2520_bench_layers[i]);
+	}
+
+	return ERR_PTR(-EINVAL);
+}
+
+void cc2520_bench_free(struct cc2520_bench *b)
+{
+	b->layer->free(&b->dev);
+	cc2520_radio_free(&b->dev);
+	cc2520_stats_free(&b->dev);
+	kfree(b);
+}
+
+//////////////////////////////
+// Runs
+/////////////////////////////
+
+// A send through the layer, with its timers run up to
+// now and the send finished below.
+static void cc2520_bench_send(struct cc2520_bench *b, u8 len)
+{
+	b->upper.tx(&b->dev, b->frame, len);
+	cc2520_bench_advance(b, 0);
+	cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+}
+
+static int cc2520_bench_run_layer(const struct cc2520_bench_layer *layer, u32 frames,
+	struct cc2520_bench_result *result)
+{
+	struct cc2520_bench *b;
+	u32 acks;
+	u32 rx;
+	u64 start;
+	u8 len;
+	u32 i;
+
+	b = cc2520_bench_open(layer);
+	if (IS_ERR(b))
+		return PTR_ERR(b);
+
+	if (layer->setup)
+		layer->setup(&b->dev);
+
+	len = cc2520_bench_frame(b->frame);
+	result->name = layer->name;
+
+	// A new DSN every frame, or the unique layer
+	// would drop it.
+	start = ktime_get_raw_ns();
+	for (i = 0; i < frames; i++) {
+		b->frame[3] = i;
+		cc2520_bench_receive(b, b->frame, len);
+		cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+	}
+	result->rx_ns = div_u64(ktime_get_raw_ns() - start, frames);
+
+	// Everything up, and every frame acked if the
+	// layer answers them.
+	acks = layer->flags & CC2520_BENCH_ACKS ? frames : 0;
+	result->ok = b->rx_up == frames && b->tx_down == acks && b->tx_up == 0;
+
+	// Then the last frame again.
+	rx = b->rx_up;
+	cc2520_bench_receive(b, b->frame, len);
+	cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+	if (b->rx_up != rx + (layer->flags & CC2520_BENCH_DEDUPS ? 0 : 1))
+		result->ok = false;
+
+	b->tx_down = 0;
+	b->tx_up = 0;
+
+	start = ktime_get_raw_ns();
+	for (i = 0; i < frames; i++) {
+		b->frame[3] = i;
+		cc2520_bench_send(b, len - 2);
+
+		if (layer->flags & CC2520_BENCH_ACKS) {
+			cc2520_packet_create_ack(b->frame, b->ack);
+			cc2520_bench_receive(b, b->ack, IEEE154_ACK_FRAME_LENGTH + 1);
+		}
+	}
+	result->tx_ns = div_u64(ktime_get_raw_ns() - start, frames);
+
+	// Every frame sent once and reported sent, with
+	// nothing left waiting on a timer.
+	if (b->tx_down != frames || b->tx_up != frames || b->tx_status != CC2520_TX_SUCCESS ||
+		cc2520_bench_timers(b))
+		result->ok = false;
+
+	cc2520_bench_free(b);
+	return 0;
+}
+
+// What the layers and the RX demux ask of every frame
+// that goes past.
+static void cc2520_bench_run_packet(u32 frames, struct cc2520_bench_result *result)
+{
+	struct cc2520_packet_info info;
+	u8 frame[PKT_BUFF_SIZE + 1];
+	u8 ack[PKT_BUFF_SIZE + 1];
+	u64 start;
+	u32 sum = 0;
+	u8 len;
+	u32 i;
+
+	len = cc2520_bench_frame(frame);
+	result->name = "packet";
+	result->ok = true;
+
+	start = ktime_get_raw_ns();
+	for (i = 0; i < frames; i++) {
+		frame[3] = i;
+		if (!cc2520_packet_is_ack(frame) && cc2520_packet_requires_ack_reply(frame))
+			sum += cc2520_packet_get_src(frame);
+		if (!cc2520_packet_parse(frame, len, &info) || info.dst_addr != 1)
+			result->ok = false;
+	}
+	result->rx_ns = div_u64(ktime_get_raw_ns() - start, frames);
+
+	if (sum != frames * 2)
+		result->ok = false;
+
+	start = ktime_get_raw_ns();
+	for (i = 0; i < frames; i++) {
+		frame[3] = i;
+		if (cc2520_packet_requires_ack_wait(frame)) {
+			cc2520_packet_create_ack(frame, ack);
+			if (!cc2520_packet_is_ack_to(frame, ack))
+				result->ok = false;
+		}
+	}
+	result->tx_ns = div_u64(ktime_get_raw_ns() - start, frames);
+}
+
+// Fills in CC2520_BENCH_ROWS results.
+int cc2520_bench_run(u32 frames, struct cc2520_bench_result *results)
+{
+	int result;
+	int i;
+
+	BUILD_BUG_ON(ARRAY_SIZE(cc2520_bench_layers) + 1 != CC2520_BENCH_ROWS);
+
+	for (i = 0; i < ARRAY_SIZE(cc2520_bench_layers); i++) {
+		result = cc2520_bench_run_layer(&cc2520_bench_layers[i], frames, &results[i]);
+		if (result)
+			return result;
+	}
+
+	cc2520_bench_run_packet(frames, &results[i]);
+
+	for (i = 0; i < CC2520_BENCH_ROWS; i++) {
+		INFO((KERN_INFO "[cc2520] - bench %s rx %llu nS tx %llu nS %s\n",
+			results[i].name, results[i].rx_ns, results[i].tx_ns,
+			results[i].ok ? "ok" : "FAIL"));
+	}
+
+	return 0;
+}
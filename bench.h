@@ -0,0 +1,89 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <linux/types.h>
+
+#include "cc2520.h"
+#include "env.h"
+
+// One per layer, the layers chained, and packet.c.
+#define CC2520_BENCH_ROWS 7
+
+// As many timers as the layers on a scratch radio
+// can have running at once, one each.
+#define CC2520_BENCH_TIMERS 4
+
+struct cc2520_bench_layer;
+
+// The env a scratch radio gets. Its clock stands still
+// until cc2520_bench_advance steps it, which runs the
+// timers that come due on the way in order.
+struct cc2520_bench_env {
+	struct cc2520_env env;
+	u64 now; // nS
+	bool clear; // the CCA pin
+
+	struct {
+		struct hrtimer *timer; // NULL when the slot's free
+		u64 expires;
+	} timers[CC2520_BENCH_TIMERS];
+};
+
+// A scratch radio with one layer, or the chain of them,
+// wedged between a fake upper and lower layer. The fakes
+// count what comes out either side, and a send stays
+// pending on the lower one until it's completed.
+struct cc2520_bench {
+	struct cc2520_dev dev;
+	struct cc2520_bench_env env;
+	const struct cc2520_bench_layer *layer;
+
+	struct cc2520_interface upper;
+	struct cc2520_interface lower;
+	struct cc2520_interface radio;
+
+	u8 frame[PKT_BUFF_SIZE + 1];
+	u8 ack[PKT_BUFF_SIZE + 1];
+
+	u32 rx_up;
+	u32 tx_up;
+	u32 tx_down;
+	u8 tx_status; // of the last tx_done up
+	bool tx_pending;
+};
+
+// Nanoseconds per frame.
+struct cc2520_bench_result {
+	const char *name;
+	u64 rx_ns;
+	u64 tx_ns;
+	bool ok;
+};
+
+// Per-layer cost of the MAC layers, run from user/ and
+// the KUnit tests.
+int cc2520_bench_run(u32 frames, struct cc2520_bench_result *results);
+
+// The scratch radios themselves, for the KUnit tests.
+// Layers go by their result names, chain included, and
+// start out in their defaults.
+struct cc2520_bench *cc2520_bench_alloc(const char *name);
+void cc2520_bench_free(struct cc2520_bench *b);
+
+// A data frame from short address 2 to 1 asking for an
+// ACK, with room for the RSSI and CRC/LQI bytes. Returns
+// its length on receive, 2 more than to send.
+u8 cc2520_bench_frame(u8 *buf);
+
+// Hands a frame up from the fake lower layer, as the
+// radio would.
+void cc2520_bench_receive(struct cc2520_bench *b, u8 *buf, u8 len);
+
+// Finishes the send pending on the fake lower layer,
+// if there is one.
+void cc2520_bench_complete(struct cc2520_bench *b, u8 status);
+
+void cc2520_bench_advance(struct cc2520_bench *b, int us);
+int cc2520_bench_timers(struct cc2520_bench *b); // running
+
+#endif
@@ -6,6 +6,8 @@
 #include <linux/workqueue.h>
 #include <linux/spinlock.h>
 
+#include "ioctl.h"
+
 
 //////////////////////////////
 // Configuration for driver
@@ -48,14 +50,24 @@
 // Start frame delimiter
 #define CC2520_SFD CC2520_GPIO_4
 
+// Most radios the driver will drive at once, real or
+// emulated, see the num_radios module parameter.
+#define CC2520_MAX_RADIOS 64
+// Most radios there are wiring parameters for.
+#define CC2520_MAX_HW_RADIOS 4
+
 // For Raspberry pi we're using the following
-// SPI bus and CS pin.
+// SPI bus and CS pin for the first radio.
 #define SPI_BUS 0
 #define SPI_BUS_CS0 0
 #define SPI_BUS_SPEED 500000
 #define SPI_BUFF_SIZE 256
 #define PKT_BUFF_SIZE 127
 
+// Frames each open file can have waiting to be read
+// before new ones are dropped.
+#define CC2520_RX_QUEUE_LEN 16
+
 // Defaults for Radio Operation
 #define CC2520_DEF_CHANNEL 26
 #define CC2520_DEF_RFPOWER 0x32 // 0 dBm
@@ -63,6 +75,46 @@
 #define CC2520_DEF_SHORT_ADDR 0x01
 #define CC2520_DEF_EXT_ADDR 0x01
 
+// Channel switching waits for the synthesizer to
+// lock before re-entering RX. The datasheet gives a
+// 192uS turnaround, we poll for roughly twice that.
+#define CC2520_SWITCH_LOCK_POLLS 40
+#define CC2520_SWITCH_LOCK_POLL_DELAY 10 // uS
+
+// RSSI is valid 8 symbol periods after entering RX.
+#define CC2520_RSSI_VALID_POLLS 20
+#define CC2520_RSSI_VALID_POLL_DELAY 10 // uS
+
+// ED scan defaults, times in uS. Writes wait out a scan,
+// so the whole sweep is capped as well as each dwell.
+#define CC2520_DEF_ED_DWELL 10000
+#define CC2520_DEF_ED_INTERVAL 100
+#define CC2520_DEF_ED_BUSY_THRESHOLD -80 // dBm
+#define CC2520_MAX_ED_DWELL 1000000
+#define CC2520_MAX_ED_SCAN 2000000
+#define CC2520_ED_CHANNEL_MASK 0x07FFF800 // channels 11-26
+
+// RSSI monitor. The ring has to be a power of two, and
+// the rate is capped at what a single read per sample
+// can keep up with on the bus.
+#define CC2520_RSSI_RING_LEN 4096
+#define CC2520_MAX_RSSI_MONITOR_RATE 10000 // Hz
+
+// Events kept by the flight recorder, has to be
+// a power of two.
+#define CC2520_FLIGHT_LEN 1024
+
+// TSCH timeslot defaults, from the 802.15.4e
+// default timeslot template.
+#define CC2520_DEF_TSCH_SLOT_LENGTH 10000 // uS
+#define CC2520_DEF_TSCH_TX_OFFSET 2120 // uS
+
+// RX polling mode: frames read per round, time between
+// rounds, and empty rounds before going back to interrupts.
+#define CC2520_DEF_RX_POLL_BUDGET 8
+#define CC2520_RX_POLL_INTERVAL 500 // uS
+#define CC2520_RX_POLL_IDLE_ROUNDS 8
+
 // All these timing parameters are in microseconds.
 #define CC2520_DEF_ACK_TIMEOUT 2500
 #define CC2520_DEF_MIN_BACKOFF 320
@@ -76,6 +128,12 @@
 #define CC2520_DEF_LPL_LISTEN_WINDOW 5120
 #define CC2520_DEF_LPL_ENABLED true
 
+// Drop frames with a bad CRC before they go anywhere,
+// don't filter on signal quality.
+#define CC2520_DEF_FILTER_CRC true
+#define CC2520_DEF_FILTER_MIN_RSSI -128
+#define CC2520_DEF_FILTER_MIN_LQI 0
+
 // Error codes
 #define CC2520_TX_SUCCESS 0
 #define CC2520_TX_BUSY 1
@@ -83,6 +141,14 @@
 #define CC2520_TX_ACK_TIMEOUT 3
 #define CC2520_TX_FAILED 4
 
+// Offset between the RSSI register/metadata byte
+// and the actual signal strength in dBm.
+#define CC2520_RSSI_OFFSET 76
+
+// Bits of the second appended metadata byte.
+#define CC2520_META_CRC_OK (1<<7)
+#define CC2520_META_LQI_MASK 0x7F
+
 // XOSC Period in nanoseconds.
 #define CC2520_XOSC_PERIOD 31
 
@@ -91,6 +157,8 @@
 // Structs and definitions
 /////////////////////////////
 
+struct cc2520_dev;
+
 struct cc2520_interface {
     // ALWAYS the length of the packet,
     // including the length byte itself,
@@ -98,8 +166,8 @@ struct cc2520_interface {
     // FCS bytes.
     // The packet should start with a valid
     // 802.15.4 length.
-    int (*tx)(u8 *buf, u8 len);
-    void (*tx_done)(u8 status);
+    int (*tx)(struct cc2520_dev *dev, u8 *buf, u8 len);
+    void (*tx_done)(struct cc2520_dev *dev, u8 status);
 
     // ALWAYS the length of the packet,
     // including the length byte itself,
@@ -107,30 +175,113 @@ struct cc2520_interface {
     // generated FCS bytes. The packet should
     // start with a valid 802.15.4 length and
     // end with valid FCS bytes.
-    void (*rx_done)(u8 *buf, u8 len);
+    void (*rx_done)(struct cc2520_dev *dev, u8 *buf, u8 len);
 };
 
-///
-// KEEP THESE AROUND FOR NOW, REFACTOR OUT LATER.
-//
-
 struct cc2520_gpio_state {
+	int fifo;
+	int fifop;
+	int cca;
+	int sfd;
+	int reset;
+
 	unsigned int fifop_irq;
 	unsigned int sfd_irq;
 };
 
-// DEPRECATED
-struct cc2520_state {
+// Private per-layer state, each layer defines its
+// own in its .c file and allocates it in its init.
+struct cc2520_radio_state;
+struct cc2520_filter_state;
+struct cc2520_sack_state;
+struct cc2520_tsch_state;
+struct cc2520_csma_state;
+struct cc2520_lpl_state;
+struct cc2520_unique_state;
+struct cc2520_interface_state;
+struct cc2520_wpan_state;
+struct cc2520_monitor_state;
+struct cc2520_stats;
+struct cc2520_flight_state;
+struct cc2520_emu_state;
+struct cc2520_env;
+struct dentry;
+
+// Everything belonging to one physical radio. The layers
+// only ever find their state through here, so any number
+// of radios can be stacked side by side.
+struct cc2520_dev {
+	int id;
+
 	// Hardware
 	struct cc2520_gpio_state gpios;
+	int spi_bus;
+	int spi_cs;
 	struct spi_device *spi_device;
 
-    // CURRENTLY UNUSED:
-	struct work_struct work;    /* for deferred work */
-    struct workqueue_struct *wq;
+	// Backed by the emulator rather than a real chip,
+	// see emu.h.
+	bool emulated;
+	struct cc2520_emu_state *emu;
+
+	// Stand-in time, timers and CCA for the layers,
+	// NULL outside the bench and tests, see env.h.
+	struct cc2520_env *env;
+
+	// Bindings between the layers, each layer
+	// talks to the one above through its top and
+	// the one below through its bottom.
+	struct cc2520_interface interface_to_unique;
+	struct cc2520_interface unique_to_lpl;
+	struct cc2520_interface lpl_to_csma;
+	struct cc2520_interface csma_to_tsch;
+	struct cc2520_interface tsch_to_sack;
+	struct cc2520_interface sack_to_filter;
+	struct cc2520_interface filter_to_radio;
+
+	struct cc2520_interface *radio_top;
+	struct cc2520_interface *filter_top;
+	struct cc2520_interface *filter_bottom;
+	struct cc2520_interface *sack_top;
+	struct cc2520_interface *sack_bottom;
+	struct cc2520_interface *tsch_top;
+	struct cc2520_interface *tsch_bottom;
+	struct cc2520_interface *csma_top;
+	struct cc2520_interface *csma_bottom;
+	struct cc2520_interface *lpl_top;
+	struct cc2520_interface *lpl_bottom;
+	struct cc2520_interface *unique_top;
+	struct cc2520_interface *unique_bottom;
+	struct cc2520_interface *interface_bottom;
+
+	struct cc2520_radio_state *radio;
+	struct cc2520_filter_state *filter;
+	struct cc2520_sack_state *sack;
+	struct cc2520_tsch_state *tsch;
+	struct cc2520_csma_state *csma;
+	struct cc2520_lpl_state *lpl;
+	struct cc2520_unique_state *unique;
+	struct cc2520_interface_state *interface;
+	struct cc2520_wpan_state *wpan;
+	struct cc2520_monitor_state *monitor;
+
+	// Event counters and latency histograms, see stats.h.
+	struct cc2520_stats __percpu *stats;
+	struct dentry *debugfs;
+	struct cc2520_flight_state *flight;
+
+	// Options for the frame currently being transmitted. Filled
+	// in by the character interface before tx and cleared once
+	// tx_done has bubbled back up. Zeroed flags means every
+	// layer uses its global configuration.
+	struct cc2520_tx_options tx_opts;
+
+	// When the frame currently being transmitted was handed
+	// to the stack, raw monotonic nS. Cleared once its SFD
+	// has been seen.
+	u64 tx_submitted;
 };
 
-extern struct cc2520_state state;
 extern const char cc2520_name[];
 
 //////////////////////////////
@@ -171,6 +322,20 @@ typedef union cc2520_status {
 	};
 } cc2520_status_t;
 
+typedef union cc2520_fsmstat1 {
+    u8 value;
+    struct {
+        unsigned rx_active   : 1;
+        unsigned tx_active   : 1;
+        unsigned lock_status : 1;
+        unsigned sampled_cca : 1;
+        unsigned cca         : 1;
+        unsigned sfd         : 1;
+        unsigned fifop       : 1;
+        unsigned fifo        : 1;
+    } f;
+} cc2520_fsmstat1_t;
+
 typedef union cc2520_frmctrl0 {
     u8 value;
     struct {
@@ -0,0 +1,472 @@
+#include <kunit/test.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+
+#include "cc2520.h"
+#include "packet.h"
+#include "sack.h"
+#include "csma.h"
+#include "lpl.h"
+#include "stats.h"
+#include "bench.h"
+#include "cc2520_test.h"
+#include "trace.h"
+
+// KUnit tests for the soft-ack, CSMA and LPL layers, on
+// the bench's scratch radios. A test steps the scratch
+// radio's clock itself, so the ACK timeout, the LPL window
+// and the CSMA backoffs only run out when it says, and
+// each state a layer moves through is caught from its
+// state tracepoint and checked in order.
+//
+// Built into the module when the kernel has KUnit, and
+// run as it loads:
+//
+//   insmod cc2520.ko emulate=1
+//   cat /sys/kernel/debug/kunit/cc2520/results
+
+#define CC2520_TEST_MAX_STATES 16
+#define CC2520_TEST_BENCH_FRAMES 1000
+
+struct cc2520_test_states {
+	int state[CC2520_TEST_MAX_STATES];
+	int count;
+};
+
+struct cc2520_test {
+	struct cc2520_bench *b;
+
+	struct cc2520_test_states sack;
+	struct cc2520_test_states csma;
+	struct cc2520_test_states lpl;
+};
+
+//////////////////////////////
+// Helpers
+/////////////////////////////
+
+static void cc2520_test_record(void *data, int id, int state)
+{
+	struct cc2520_test_states *states = data;
+
+	// Real radios may be running alongside.
+	if (id != CC2520_MAX_RADIOS)
+		return;
+
+	if (states->count < CC2520_TEST_MAX_STATES)
+		states->state[states->count] = state;
+	states->count++;
+}
+
+// Checks the states moved through since the last check.
+static void cc2520_test_expect(struct kunit *test, struct cc2520_test_states *states,
+	const int *expected, int count)
+{
+	int i;
+
+	KUNIT_EXPECT_EQ(test, states->count, count);
+	for (i = 0; i < min(states->count, count); i++) {
+		KUNIT_EXPECT_EQ_MSG(test, states->state[i], expected[i],
+			"state change %d", i + 1);
+	}
+
+	states->count = 0;
+}
+
+#define CC2520_TEST_EXPECT_STATES(test, states, ...) do { \
+		static const int _expected[] = { __VA_ARGS__ }; \
+		cc2520_test_expect(test, states, _expected, ARRAY_SIZE(_expected)); \
+	} while (0)
+
+#define CC2520_TEST_EXPECT_NO_STATES(test, states) \
+	cc2520_test_expect(test, states, NULL, 0)
+
+// A scratch radio for the test, freed once it's over.
+static struct cc2520_bench *cc2520_test_open(struct kunit *test, const char *name)
+{
+	struct cc2520_test *t = test->priv;
+
+	t->b = cc2520_bench_alloc(name);
+	KUNIT_ASSERT_FALSE(test, IS_ERR(t->b));
+
+	return t->b;
+}
+
+// Hands the bench's frame to the layer to send.
+static void cc2520_test_send(struct cc2520_bench *b)
+{
+	b->upper.tx(&b->dev, b->frame, cc2520_bench_frame(b->frame) - 2);
+}
+
+static u64 cc2520_test_stat(struct cc2520_bench *b, enum cc2520_stat stat)
+{
+	return cc2520_stats_read(&b->dev, stat);
+}
+
+static int cc2520_test_init(struct kunit *test)
+{
+	struct cc2520_test *t;
+	int err;
+
+	t = kunit_kzalloc(test, sizeof(struct cc2520_test), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	test->priv = t;
+
+	err = register_trace_cc2520_sack_state(cc2520_test_record, &t->sack);
+	if (err)
+		goto error2;
+
+	err = register_trace_cc2520_csma_state(cc2520_test_record, &t->csma);
+	if (err)
+		goto error1;
+
+	err = register_trace_cc2520_lpl_state(cc2520_test_record, &t->lpl);
+	if (err)
+		goto error0;
+
+	return 0;
+
+	error0:
+		unregister_trace_cc2520_csma_state(cc2520_test_record, &t->csma);
+	error1:
+		unregister_trace_cc2520_sack_state(cc2520_test_record, &t->sack);
+		tracepoint_synchronize_unregister();
+	error2:
+		return err;
+}
+
+static void cc2520_test_exit(struct kunit *test)
+{
+	struct cc2520_test *t = test->priv;
+
+	unregister_trace_cc2520_lpl_state(cc2520_test_record, &t->lpl);
+	unregister_trace_cc2520_csma_state(cc2520_test_record, &t->csma);
+	unregister_trace_cc2520_sack_state(cc2520_test_record, &t->sack);
+	tracepoint_synchronize_unregister();
+
+	if (t->b && !IS_ERR(t->b))
+		cc2520_bench_free(t->b);
+}
+
+//////////////////////////////
+// Soft-ack
+/////////////////////////////
+
+static void cc2520_test_sack_acked(struct kunit *test)
+{
+	struct cc2520_test *t = test->priv;
+	struct cc2520_bench *b = cc2520_test_open(test, "sack");
+
+	cc2520_sack_set_timeout(&b->dev, 1000);
+
+	cc2520_test_send(b);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 1U);
+	CC2520_TEST_EXPECT_STATES(test, &t->sack, CC2520_SACK_TX);
+
+	cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+	CC2520_TEST_EXPECT_STATES(test, &t->sack, CC2520_SACK_TX_WAIT);
+	KUNIT_EXPECT_EQ(test, cc2520_bench_timers(b), 1);
+
+	cc2520_bench_advance(b, 999);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 0U);
+
+	cc2520_packet_create_ack(b->frame, b->ack);
+	cc2520_bench_receive(b, b->ack, IEEE154_ACK_FRAME_LENGTH + 1);
+	CC2520_TEST_EXPECT_STATES(test, &t->sack, CC2520_SACK_IDLE);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 1U);
+	KUNIT_EXPECT_EQ(test, b->tx_status, (u8)CC2520_TX_SUCCESS);
+	KUNIT_EXPECT_EQ(test, cc2520_bench_timers(b), 0);
+	KUNIT_EXPECT_EQ(test, cc2520_test_stat(b, CC2520_STAT_SACK_ACK_OK), 1ULL);
+}
+
+static void cc2520_test_sack_ack_timeout(struct kunit *test)
+{
+	struct cc2520_test *t = test->priv;
+	struct cc2520_bench *b = cc2520_test_open(test, "sack");
+
+	cc2520_sack_set_timeout(&b->dev, 1000);
+
+	cc2520_test_send(b);
+	cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+	CC2520_TEST_EXPECT_STATES(test, &t->sack, CC2520_SACK_TX, CC2520_SACK_TX_WAIT);
+
+	cc2520_bench_advance(b, 999);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 0U);
+	CC2520_TEST_EXPECT_NO_STATES(test, &t->sack);
+
+	cc2520_bench_advance(b, 1);
+	CC2520_TEST_EXPECT_STATES(test, &t->sack, CC2520_SACK_IDLE);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 1U);
+	KUNIT_EXPECT_EQ(test, b->tx_status, (u8)-CC2520_TX_ACK_TIMEOUT);
+	KUNIT_EXPECT_EQ(test, cc2520_test_stat(b, CC2520_STAT_SACK_ACK_TIMEOUT), 1ULL);
+
+	// An ACK that turns up late is only counted.
+	cc2520_packet_create_ack(b->frame, b->ack);
+	cc2520_bench_receive(b, b->ack, IEEE154_ACK_FRAME_LENGTH + 1);
+	CC2520_TEST_EXPECT_NO_STATES(test, &t->sack);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 1U);
+	KUNIT_EXPECT_EQ(test, cc2520_test_stat(b, CC2520_STAT_SACK_STRAY_ACK), 1ULL);
+}
+
+static void cc2520_test_sack_reply(struct kunit *test)
+{
+	struct cc2520_test *t = test->priv;
+	struct cc2520_bench *b = cc2520_test_open(test, "sack");
+
+	cc2520_bench_receive(b, b->frame, cc2520_bench_frame(b->frame));
+	CC2520_TEST_EXPECT_STATES(test, &t->sack, CC2520_SACK_TX_ACK);
+	KUNIT_EXPECT_EQ(test, b->rx_up, 1U);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 1U);
+
+	cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+	CC2520_TEST_EXPECT_STATES(test, &t->sack, CC2520_SACK_IDLE);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 0U);
+	KUNIT_EXPECT_EQ(test, cc2520_bench_timers(b), 0);
+}
+
+//////////////////////////////
+// LPL
+/////////////////////////////
+
+// Every LPL test has a 1000uS wakeup interval and 100uS
+// listen window, so a train gives up 1200uS in.
+static struct cc2520_bench *cc2520_test_open_lpl(struct kunit *test)
+{
+	struct cc2520_bench *b = cc2520_test_open(test, "lpl");
+
+	cc2520_lpl_set_enabled(&b->dev, true);
+	cc2520_lpl_set_wakeup_interval(&b->dev, 1000);
+	cc2520_lpl_set_listen_length(&b->dev, 100);
+
+	return b;
+}
+
+static void cc2520_test_lpl_acked(struct kunit *test)
+{
+	struct cc2520_test *t = test->priv;
+	struct cc2520_bench *b = cc2520_test_open_lpl(test);
+
+	cc2520_test_send(b);
+	CC2520_TEST_EXPECT_STATES(test, &t->lpl, CC2520_LPL_TX);
+	KUNIT_EXPECT_EQ(test, cc2520_bench_timers(b), 1);
+
+	cc2520_bench_complete(b, -CC2520_TX_ACK_TIMEOUT);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 2U);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 0U);
+
+	cc2520_bench_advance(b, 500);
+	cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+	CC2520_TEST_EXPECT_STATES(test, &t->lpl, CC2520_LPL_IDLE);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 2U);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 1U);
+	KUNIT_EXPECT_EQ(test, b->tx_status, (u8)CC2520_TX_SUCCESS);
+	KUNIT_EXPECT_EQ(test, cc2520_bench_timers(b), 0);
+	KUNIT_EXPECT_EQ(test, cc2520_test_stat(b, CC2520_STAT_LPL_RETRANSMIT), 1ULL);
+}
+
+static void cc2520_test_lpl_window(struct kunit *test)
+{
+	struct cc2520_test *t = test->priv;
+	struct cc2520_bench *b = cc2520_test_open_lpl(test);
+
+	cc2520_test_send(b);
+	cc2520_bench_complete(b, -CC2520_TX_ACK_TIMEOUT);
+	cc2520_bench_advance(b, 1199);
+	cc2520_bench_complete(b, -CC2520_TX_ACK_TIMEOUT);
+	CC2520_TEST_EXPECT_STATES(test, &t->lpl, CC2520_LPL_TX);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 3U);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 0U);
+
+	// The send in flight when the window closes
+	// is the last.
+	cc2520_bench_advance(b, 1);
+	CC2520_TEST_EXPECT_STATES(test, &t->lpl, CC2520_LPL_TIMER_EXPIRED);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 0U);
+
+	cc2520_bench_complete(b, -CC2520_TX_ACK_TIMEOUT);
+	CC2520_TEST_EXPECT_STATES(test, &t->lpl, CC2520_LPL_IDLE);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 3U);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 1U);
+	KUNIT_EXPECT_EQ(test, b->tx_status, (u8)-CC2520_TX_FAILED);
+	KUNIT_EXPECT_EQ(test, cc2520_test_stat(b, CC2520_STAT_LPL_RETRANSMIT), 2ULL);
+}
+
+// Frames that don't ask for an ACK go out over and
+// over until the window closes.
+static void cc2520_test_lpl_train(struct kunit *test)
+{
+	struct cc2520_test *t = test->priv;
+	struct cc2520_bench *b = cc2520_test_open_lpl(test);
+	ieee154_simple_header_t *hdr;
+
+	cc2520_bench_frame(b->frame);
+	hdr = cc2520_packet_get_header(b->frame);
+	hdr->fcf &= ~(1 << IEEE154_FCF_ACK_REQ);
+	b->upper.tx(&b->dev, b->frame, b->frame[0] - 1);
+
+	cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+	cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 3U);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 0U);
+
+	cc2520_bench_advance(b, 1200);
+	CC2520_TEST_EXPECT_STATES(test, &t->lpl, CC2520_LPL_TX, CC2520_LPL_TIMER_EXPIRED);
+
+	cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+	CC2520_TEST_EXPECT_STATES(test, &t->lpl, CC2520_LPL_IDLE);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 3U);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 1U);
+	KUNIT_EXPECT_EQ(test, b->tx_status, (u8)CC2520_TX_SUCCESS);
+}
+
+//////////////////////////////
+// CSMA
+/////////////////////////////
+
+// Every CSMA test backs off exactly 100uS each time.
+static struct cc2520_bench *cc2520_test_open_csma(struct kunit *test)
+{
+	struct cc2520_bench *b = cc2520_test_open(test, "csma");
+
+	cc2520_csma_set_enabled(&b->dev, true);
+	cc2520_csma_set_min_backoff(&b->dev, 100);
+	cc2520_csma_set_init_backoff(&b->dev, 100);
+	cc2520_csma_set_cong_backoff(&b->dev, 100);
+
+	return b;
+}
+
+static void cc2520_test_csma_backoff(struct kunit *test)
+{
+	struct cc2520_test *t = test->priv;
+	struct cc2520_bench *b = cc2520_test_open_csma(test);
+
+	cc2520_test_send(b);
+	CC2520_TEST_EXPECT_STATES(test, &t->csma, CC2520_CSMA_TX);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 0U);
+
+	// Only one frame at a time.
+	cc2520_test_send(b);
+	CC2520_TEST_EXPECT_NO_STATES(test, &t->csma);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 1U);
+	KUNIT_EXPECT_EQ(test, b->tx_status, (u8)-CC2520_TX_BUSY);
+
+	cc2520_bench_advance(b, 99);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 0U);
+
+	cc2520_bench_advance(b, 1);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 1U);
+	KUNIT_EXPECT_EQ(test, cc2520_bench_timers(b), 0);
+
+	cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+	CC2520_TEST_EXPECT_STATES(test, &t->csma, CC2520_CSMA_IDLE);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 2U);
+	KUNIT_EXPECT_EQ(test, b->tx_status, (u8)CC2520_TX_SUCCESS);
+	KUNIT_EXPECT_EQ(test, cc2520_test_stat(b, CC2520_STAT_CSMA_BACKOFF), 1ULL);
+}
+
+static void cc2520_test_csma_congested(struct kunit *test)
+{
+	struct cc2520_test *t = test->priv;
+	struct cc2520_bench *b = cc2520_test_open_csma(test);
+
+	b->env.clear = false;
+	cc2520_test_send(b);
+	cc2520_bench_advance(b, 100);
+	CC2520_TEST_EXPECT_STATES(test, &t->csma, CC2520_CSMA_TX, CC2520_CSMA_CONG);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 0U);
+	KUNIT_EXPECT_EQ(test, cc2520_bench_timers(b), 1);
+	KUNIT_EXPECT_EQ(test, cc2520_test_stat(b, CC2520_STAT_CSMA_CONG_BACKOFF), 1ULL);
+
+	b->env.clear = true;
+	cc2520_bench_advance(b, 99);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 0U);
+
+	cc2520_bench_advance(b, 1);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 1U);
+
+	cc2520_bench_complete(b, CC2520_TX_SUCCESS);
+	CC2520_TEST_EXPECT_STATES(test, &t->csma, CC2520_CSMA_IDLE);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 1U);
+	KUNIT_EXPECT_EQ(test, b->tx_status, (u8)CC2520_TX_SUCCESS);
+}
+
+// Still busy after the congestion backoff, the
+// frame's given up on.
+static void cc2520_test_csma_busy(struct kunit *test)
+{
+	struct cc2520_test *t = test->priv;
+	struct cc2520_bench *b = cc2520_test_open_csma(test);
+
+	b->env.clear = false;
+	cc2520_test_send(b);
+	cc2520_bench_advance(b, 200);
+	CC2520_TEST_EXPECT_STATES(test, &t->csma, CC2520_CSMA_TX, CC2520_CSMA_CONG,
+		CC2520_CSMA_IDLE);
+	KUNIT_EXPECT_EQ(test, b->tx_down, 0U);
+	KUNIT_EXPECT_EQ(test, b->tx_up, 1U);
+	KUNIT_EXPECT_EQ(test, b->tx_status, (u8)-CC2520_TX_BUSY);
+	KUNIT_EXPECT_EQ(test, cc2520_bench_timers(b), 0);
+	KUNIT_EXPECT_EQ(test, cc2520_test_stat(b, CC2520_STAT_CSMA_BUSY), 1ULL);
+}
+
+//////////////////////////////
+// Bench
+/////////////////////////////
+
+static void cc2520_test_bench(struct kunit *test)
+{
+	struct cc2520_bench_result *results;
+	int i;
+
+	results = kunit_kzalloc(test, CC2520_BENCH_ROWS * sizeof(struct cc2520_bench_result),
+		GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, results);
+
+	KUNIT_ASSERT_EQ(test, cc2520_bench_run(CC2520_TEST_BENCH_FRAMES, results), 0);
+
+	for (i = 0; i < CC2520_BENCH_ROWS; i++) {
+		kunit_info(test, "%s rx %llu nS tx %llu nS\n", results[i].name,
+			results[i].rx_ns, results[i].tx_ns);
+		KUNIT_EXPECT_TRUE_MSG(test, results[i].ok, "%s", results[i].name);
+	}
+}
+
+static struct kunit_case cc2520_test_cases[] = {
+	KUNIT_CASE(cc2520_test_sack_acked),
+	KUNIT_CASE(cc2520_test_sack_ack_timeout),
+	KUNIT_CASE(cc2520_test_sack_reply),
+	KUNIT_CASE(cc2520_test_lpl_acked),
+	KUNIT_CASE(cc2520_test_lpl_window),
+	KUNIT_CASE(cc2520_test_lpl_train),
+	KUNIT_CASE(cc2520_test_csma_backoff),
+	KUNIT_CASE(cc2520_test_csma_congested),
+	KUNIT_CASE(cc2520_test_csma_busy),
+	KUNIT_CASE(cc2520_test_bench),
+	{}
+};
+
+static struct kunit_suite cc2520_test_suite = {
+	.name = "cc2520",
+	.init = cc2520_test_init,
+	.exit = cc2520_test_exit,
+	.test_cases = cc2520_test_cases,
+};
+
+static struct kunit_suite *cc2520_test_suites[] = { &cc2520_test_suite, NULL };
+
+// kunit_test_suite() would bring a module_init of its
+// own on 5.15, and the module has one, so the suite's
+// run from there instead.
+int cc2520_test_run(void)
+{
+	return __kunit_test_suites_init(cc2520_test_suites);
+}
+
+void cc2520_test_free(void)
+{
+	__kunit_test_suites_exit(cc2520_test_suites);
+}
@@ -0,0 +1,22 @@
+#ifndef CC2520_TEST_H
+#define CC2520_TEST_H
+
+#include <linux/kconfig.h>
+
+// The KUnit tests, run from the module's own init
+// when the kernel has KUnit, see cc2520_test.c.
+#if IS_ENABLED(CONFIG_KUNIT)
+int cc2520_test_run(void);
+void cc2520_test_free(void);
+#else
+static inline int cc2520_test_run(void)
+{
+	return 0;
+}
+
+static inline void cc2520_test_free(void)
+{
+}
+#endif
+
+#endif
@@ -8,98 +8,113 @@
 #include "csma.h"
 #include "cc2520.h"
 #include "radio.h"
+#include "env.h"
+#include "stats.h"
+#include "trace.h"
 #include "debug.h"
 
-struct cc2520_interface *csma_top;
-struct cc2520_interface *csma_bottom;
+struct cc2520_csma_state {
+	struct cc2520_dev *dev;
 
-static int backoff_min;
-static int backoff_max_init;
-static int backoff_max_cong;
-static bool csma_enabled;
+	int backoff_min;
+	int backoff_max_init;
+	int backoff_max_cong;
+	bool csma_enabled;
 
-static struct hrtimer backoff_timer;
+	struct hrtimer backoff_timer;
+	u64 backoff_deadline; // when the backoff should end, raw nS
 
-static u8* cur_tx_buf;
-static u8 cur_tx_len;
+	u8* cur_tx_buf;
+	u8 cur_tx_len;
+	bool cur_tx_csma;
 
-static spinlock_t state_sl;
+	spinlock_t state_sl;
 
-static struct workqueue_struct *wq;
-static struct work_struct work;
+	struct workqueue_struct *wq;
+	struct work_struct work;
 
-enum cc2520_csma_state_enum {
-	CC2520_CSMA_IDLE,
-	CC2520_CSMA_TX,
-	CC2520_CSMA_CONG
+	int csma_state;
 };
 
-static int csma_state;
-
-static unsigned long flags;
-
-static int cc2520_csma_tx(u8 * buf, u8 len);
-static void cc2520_csma_tx_done(u8 status);
-static void cc2520_csma_rx_done(u8 *buf, u8 len);
+static int cc2520_csma_tx(struct cc2520_dev *dev, u8 * buf, u8 len);
+static void cc2520_csma_tx_done(struct cc2520_dev *dev, u8 status);
+static void cc2520_csma_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len);
 static enum hrtimer_restart cc2520_csma_timer_cb(struct hrtimer *timer);
-static void cc2520_csma_start_timer(int us_period);
+static void cc2520_csma_start_timer(struct cc2520_csma_state *csma, int us_period);
 static int cc2520_csma_get_backoff(int min, int max);
 static void cc2520_csma_wq(struct work_struct *work);
 
-int cc2520_csma_init()
+int cc2520_csma_init(struct cc2520_dev *dev)
 {
-	csma_top->tx = cc2520_csma_tx;
-	csma_bottom->tx_done = cc2520_csma_tx_done;
-	csma_bottom->rx_done = cc2520_csma_rx_done;
+	struct cc2520_csma_state *csma;
+
+	csma = kzalloc(sizeof(struct cc2520_csma_state), GFP_KERNEL);
+	if (!csma)
+		return -ENOMEM;
+
+	csma->dev = dev;
+	dev->csma = csma;
+
+	dev->csma_top->tx = cc2520_csma_tx;
+	dev->csma_bottom->tx_done = cc2520_csma_tx_done;
+	dev->csma_bottom->rx_done = cc2520_csma_rx_done;
 
-	backoff_min = CC2520_DEF_MIN_BACKOFF;
-	backoff_max_init = CC2520_DEF_INIT_BACKOFF;
-	backoff_max_cong = CC2520_DEF_CONG_BACKOFF;
-	csma_enabled = CC2520_DEF_CSMA_ENABLED;
+	csma->backoff_min = CC2520_DEF_MIN_BACKOFF;
+	csma->backoff_max_init = CC2520_DEF_INIT_BACKOFF;
+	csma->backoff_max_cong = CC2520_DEF_CONG_BACKOFF;
+	csma->csma_enabled = CC2520_DEF_CSMA_ENABLED;
 
-	spin_lock_init(&state_sl);
-	csma_state = CC2520_CSMA_IDLE;
+	spin_lock_init(&csma->state_sl);
+	csma->csma_state = CC2520_CSMA_IDLE;
 
-	cur_tx_buf = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
-	if (!cur_tx_buf) {
+	csma->cur_tx_buf = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
+	if (!csma->cur_tx_buf) {
 		goto error;
 	}
 
-	wq = alloc_workqueue("csma_wq", WQ_HIGHPRI, 128);
-	if (!wq) {
+	csma->wq = alloc_workqueue("csma_wq", WQ_HIGHPRI, 128);
+	if (!csma->wq) {
 		goto error;
 	}
 
-	hrtimer_init(&backoff_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	backoff_timer.function = &cc2520_csma_timer_cb;
+	hrtimer_init(&csma->backoff_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	csma->backoff_timer.function = &cc2520_csma_timer_cb;
 
 	return 0;
 
 	error:
-		if (cur_tx_buf) {
-			kfree(cur_tx_buf);
-			cur_tx_buf = NULL;
+		if (csma->cur_tx_buf) {
+			kfree(csma->cur_tx_buf);
+			csma->cur_tx_buf = NULL;
 		}
 
-		if (wq) {
-			destroy_workqueue(wq);
+		if (csma->wq) {
+			destroy_workqueue(csma->wq);
 		}
 
+		kfree(csma);
+		dev->csma = NULL;
+
 		return -EFAULT;
 }
 
-void cc2520_csma_free()
+void cc2520_csma_free(struct cc2520_dev *dev)
 {
-	if (cur_tx_buf) {
-		kfree(cur_tx_buf);
-		cur_tx_buf = NULL;
+	struct cc2520_csma_state *csma = dev->csma;
+
+	if (csma->cur_tx_buf) {
+		kfree(csma->cur_tx_buf);
+		csma->cur_tx_buf = NULL;
 	}
 
-	if (wq) {
-		destroy_workqueue(wq);
+	if (csma->wq) {
+		destroy_workqueue(csma->wq);
 	}
 
-	hrtimer_cancel(&backoff_timer);
+	cc2520_env_timer_cancel(dev, &csma->backoff_timer);
+
+	kfree(csma);
+	dev->csma = NULL;
 }
 
 static int cc2520_csma_get_backoff(int min, int max)
@@ -108,23 +123,33 @@ static int cc2520_csma_get_backoff(int min, int max)
 	int span;
 
 	span = max - min;
+	if (span <= 0)
+		return min;
+
 	get_random_bytes(&rand_num, 4);
 	return min + (rand_num % span);
 }
 
-static void cc2520_csma_start_timer(int us_period)
+static void cc2520_csma_start_timer(struct cc2520_csma_state *csma, int us_period)
 {
-    ktime_t kt;
-    kt = ktime_set(0, 1000 * us_period);
-	hrtimer_start(&backoff_timer, kt, HRTIMER_MODE_REL);
+	csma->backoff_deadline = cc2520_env_now(csma->dev) + 1000 * us_period;
+	cc2520_env_timer_start(csma->dev, &csma->backoff_timer, us_period);
 }
 
 static enum hrtimer_restart cc2520_csma_timer_cb(struct hrtimer *timer)
 {
-	ktime_t kt;
+	struct cc2520_csma_state *csma =
+		container_of(timer, struct cc2520_csma_state, backoff_timer);
+	struct cc2520_dev *dev = csma->dev;
+	unsigned long flags;
 	int new_backoff;
+	u64 now;
 
-	if (cc2520_radio_is_clear()) {
+	now = cc2520_env_now(dev);
+	cc2520_hist_record(dev, CC2520_HIST_CSMA_LATE,
+		now > csma->backoff_deadline ? now - csma->backoff_deadline : 0);
+
+	if (cc2520_env_is_clear(dev)) {
 		// NOTE: We can absolutely not send from
 		// interrupt context, there's a few places
 		// where we spin lock and assume we can be
@@ -132,29 +157,33 @@ static enum hrtimer_restart cc2520_csma_timer_cb(struct hrtimer *timer)
 		// that promise is broken. We use a work queue.
 
 		// The workqueue adds about 30uS of latency.
-		INIT_WORK(&work, cc2520_csma_wq);
-		queue_work(wq, &work);
+		INIT_WORK(&csma->work, cc2520_csma_wq);
+		queue_work(csma->wq, &csma->work);
 		return HRTIMER_NORESTART;
 	}
 	else {
-		spin_lock_irqsave(&state_sl, flags);
-		if (csma_state == CC2520_CSMA_TX) {
-			csma_state = CC2520_CSMA_CONG;
-			spin_unlock_irqrestore(&state_sl, flags);
+		spin_lock_irqsave(&csma->state_sl, flags);
+		if (csma->csma_state == CC2520_CSMA_TX) {
+			csma->csma_state = CC2520_CSMA_CONG;
+			trace_cc2520_csma_state(dev->id, csma->csma_state);
+			spin_unlock_irqrestore(&csma->state_sl, flags);
 
 			new_backoff =
-				cc2520_csma_get_backoff(backoff_min, backoff_max_cong);
+				cc2520_csma_get_backoff(csma->backoff_min, csma->backoff_max_cong);
 
 			INFO((KERN_INFO "[cc2520] - channel still busy, waiting %d uS\n", new_backoff));
-			kt = ktime_set(0,1000 * new_backoff);
-			hrtimer_forward_now(&backoff_timer, kt);
+			cc2520_stat_inc(dev, CC2520_STAT_CSMA_CONG_BACKOFF);
+			csma->backoff_deadline = now + 1000 * new_backoff;
+			cc2520_env_timer_forward(dev, &csma->backoff_timer, new_backoff);
 			return HRTIMER_RESTART;
 		}
 		else {
-			csma_state = CC2520_CSMA_IDLE;
-			spin_unlock_irqrestore(&state_sl, flags);
+			csma->csma_state = CC2520_CSMA_IDLE;
+			trace_cc2520_csma_state(dev->id, csma->csma_state);
+			spin_unlock_irqrestore(&csma->state_sl, flags);
 
-			csma_top->tx_done(-CC2520_TX_BUSY);
+			cc2520_stat_inc(dev, CC2520_STAT_CSMA_BUSY);
+			dev->csma_top->tx_done(dev, -CC2520_TX_BUSY);
 			return HRTIMER_NORESTART;
 		}
 	}
@@ -162,71 +191,97 @@ static enum hrtimer_restart cc2520_csma_timer_cb(struct hrtimer *timer)
 
 static void cc2520_csma_wq(struct work_struct *work)
 {
-	csma_bottom->tx(cur_tx_buf, cur_tx_len);
+	struct cc2520_csma_state *csma =
+		container_of(work, struct cc2520_csma_state, work);
+	struct cc2520_dev *dev = csma->dev;
+
+	dev->csma_bottom->tx(dev, csma->cur_tx_buf, csma->cur_tx_len);
 }
 
-static int cc2520_csma_tx(u8 * buf, u8 len)
+static int cc2520_csma_tx(struct cc2520_dev *dev, u8 * buf, u8 len)
 {
+	struct cc2520_csma_state *csma = dev->csma;
+	unsigned long flags;
 	int backoff;
 
-	if (!csma_enabled) {
-		return csma_bottom->tx(buf, len);
+	csma->cur_tx_csma = csma->csma_enabled;
+	if (dev->tx_opts.flags & CC2520_TX_OPT_CSMA)
+		csma->cur_tx_csma = dev->tx_opts.csma_enabled;
+
+	if (!csma->cur_tx_csma) {
+		return dev->csma_bottom->tx(dev, buf, len);
 	}
 
-	spin_lock_irqsave(&state_sl, flags);
-	if (csma_state == CC2520_CSMA_IDLE) {
-		csma_state = CC2520_CSMA_TX;
-		spin_unlock_irqrestore(&state_sl, flags);
+	spin_lock_irqsave(&csma->state_sl, flags);
+	if (csma->csma_state == CC2520_CSMA_IDLE) {
+		csma->csma_state = CC2520_CSMA_TX;
+		trace_cc2520_csma_state(dev->id, csma->csma_state);
+		spin_unlock_irqrestore(&csma->state_sl, flags);
 
-		memcpy(cur_tx_buf, buf, len);
-		cur_tx_len = len;
+		memcpy(csma->cur_tx_buf, buf, len);
+		csma->cur_tx_len = len;
 
-		backoff = cc2520_csma_get_backoff(backoff_min, backoff_max_init);
+		backoff = cc2520_csma_get_backoff(csma->backoff_min, csma->backoff_max_init);
 
 		DBG((KERN_INFO "[cc2520] - waiting %d uS to send.\n", backoff));
-		cc2520_csma_start_timer(backoff);
+		cc2520_stat_inc(dev, CC2520_STAT_CSMA_BACKOFF);
+		cc2520_csma_start_timer(csma, backoff);
 	}
 	else {
-		spin_unlock_irqrestore(&state_sl, flags);
+		spin_unlock_irqrestore(&csma->state_sl, flags);
 		DBG((KERN_INFO "[cc2520] - csma layer busy.\n"));
-		csma_top->tx_done(-CC2520_TX_BUSY);
+		dev->csma_top->tx_done(dev, -CC2520_TX_BUSY);
 	}
 
 	return 0;
 }
 
-static void cc2520_csma_tx_done(u8 status)
+static void cc2520_csma_tx_done(struct cc2520_dev *dev, u8 status)
 {
-	if (csma_enabled) {
-		spin_lock_irqsave(&state_sl, flags);
-		csma_state = CC2520_CSMA_IDLE;
-		spin_unlock_irqrestore(&state_sl, flags);
+	struct cc2520_csma_state *csma = dev->csma;
+	unsigned long flags;
+
+	if (csma->cur_tx_csma) {
+		spin_lock_irqsave(&csma->state_sl, flags);
+		csma->csma_state = CC2520_CSMA_IDLE;
+		trace_cc2520_csma_state(dev->id, csma->csma_state);
+		spin_unlock_irqrestore(&csma->state_sl, flags);
 	}
 
-	csma_top->tx_done(status);
+	dev->csma_top->tx_done(dev, status);
+}
+
+static void cc2520_csma_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len)
+{
+	dev->csma_top->rx_done(dev, buf, len);
+}
+
+void cc2520_csma_flush(struct cc2520_dev *dev)
+{
+	flush_workqueue(dev->csma->wq);
 }
 
-static void cc2520_csma_rx_done(u8 *buf, u8 len)
+void cc2520_csma_set_enabled(struct cc2520_dev *dev, bool enabled)
 {
-	csma_top->rx_done(buf, len);
+	dev->csma->csma_enabled = enabled;
 }
 
-void cc2520_csma_set_enabled(bool enabled)
+bool cc2520_csma_get_enabled(struct cc2520_dev *dev)
 {
-	csma_enabled = enabled;
+	return dev->csma->csma_enabled;
 }
 
-void cc2520_csma_set_min_backoff(int backoff)
+void cc2520_csma_set_min_backoff(struct cc2520_dev *dev, int backoff)
 {
-	backoff_min = backoff;
+	dev->csma->backoff_min = backoff;
 }
 
-void cc2520_csma_set_init_backoff(int backoff)
+void cc2520_csma_set_init_backoff(struct cc2520_dev *dev, int backoff)
 {
-	backoff_max_init = backoff;
+	dev->csma->backoff_max_init = backoff;
 }
 
-void cc2520_csma_set_cong_backoff(int backoff)
+void cc2520_csma_set_cong_backoff(struct cc2520_dev *dev, int backoff)
 {
-	backoff_max_cong = backoff;
+	dev->csma->backoff_max_cong = backoff;
 }
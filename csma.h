@@ -3,15 +3,24 @@
 
 #include "cc2520.h"
 
-extern struct cc2520_interface *csma_top;
-extern struct cc2520_interface *csma_bottom;
+int cc2520_csma_init(struct cc2520_dev *dev);
+void cc2520_csma_free(struct cc2520_dev *dev);
 
-int cc2520_csma_init(void);
-void cc2520_csma_free(void);
+// Waits out a send the backoff timer has handed
+// to the workqueue.
+void cc2520_csma_flush(struct cc2520_dev *dev);
 
-void cc2520_csma_set_enabled(bool enabled);
-void cc2520_csma_set_min_backoff(int timeout);
-void cc2520_csma_set_init_backoff(int timeout);
-void cc2520_csma_set_cong_backoff(int timeout);
+void cc2520_csma_set_enabled(struct cc2520_dev *dev, bool enabled);
+bool cc2520_csma_get_enabled(struct cc2520_dev *dev);
+void cc2520_csma_set_min_backoff(struct cc2520_dev *dev, int timeout);
+void cc2520_csma_set_init_backoff(struct cc2520_dev *dev, int timeout);
+void cc2520_csma_set_cong_backoff(struct cc2520_dev *dev, int timeout);
+
+// States as they show in the cc2520_csma_state tracepoint.
+enum cc2520_csma_state_enum {
+	CC2520_CSMA_IDLE,
+	CC2520_CSMA_TX,
+	CC2520_CSMA_CONG
+};
 
 #endif
\ No newline at end of file
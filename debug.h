@@ -1,6 +1,9 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
+#include <linux/types.h>
+#include <linux/jump_label.h>
+
 // Define different levels of debug printing
 
 // print nothing
@@ -12,12 +15,37 @@
 // print a good amount of debugging output
 #define DEBUG_PRINT_DBG 3
 
-// Defines the level of debug output
+// The most verbose level compiled in at all, anything above
+// it compiles to nothing. Set from the Makefile, production
+// builds can leave out everything but errors with
+// make DEBUG_MAX=1.
+#ifndef CC2520_DEBUG_MAX
+#define CC2520_DEBUG_MAX DEBUG_PRINT_DBG
+#endif
+
+// Defines the level of debug output. Only read for
+// reporting, change it with cc2520_set_debug_level.
 extern uint8_t debug_print;
 
+// One key per level, on while debug_print is at or above
+// it, so a message that's turned off costs a NOP rather
+// than a load and a branch.
+DECLARE_STATIC_KEY_FALSE(cc2520_debug_err);
+DECLARE_STATIC_KEY_FALSE(cc2520_debug_info);
+DECLARE_STATIC_KEY_FALSE(cc2520_debug_dbg);
+
+void cc2520_set_debug_level(uint8_t level);
+
+#define DEBUG_ON(level, key) \
+	(CC2520_DEBUG_MAX >= (level) && static_branch_unlikely(&(key)))
+
+#define ERR_ON() DEBUG_ON(DEBUG_PRINT_ERR, cc2520_debug_err)
+#define INFO_ON() DEBUG_ON(DEBUG_PRINT_INFO, cc2520_debug_info)
+#define DBG_ON() DEBUG_ON(DEBUG_PRINT_DBG, cc2520_debug_dbg)
+
 // Define the printk macros.
-#define ERR(x) do {if (debug_print >= DEBUG_PRINT_ERR) { printk x; }} while (0)
-#define INFO(x) do {if (debug_print >= DEBUG_PRINT_INFO) { printk x; }} while (0)
-#define DBG(x) do {if (debug_print >= DEBUG_PRINT_DBG) { printk x; }} while (0)
+#define ERR(x) do {if (ERR_ON()) { printk x; }} while (0)
+#define INFO(x) do {if (INFO_ON()) { printk x; }} while (0)
+#define DBG(x) do {if (DBG_ON()) { printk x; }} while (0)
 
 #endif
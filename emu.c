@@ -0,0 +1,1216 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/atomic.h>
+#include <linux/random.h>
+#include <linux/spi/spi.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <asm/uaccess.h>
+
+#include "cc2520.h"
+#include "platform.h"
+#include "packet.h"
+#include "emu.h"
+#include "debug.h"
+
+// Software CC2520 for running the whole stack without a
+// chip, loaded with emulate=1. The radio code is none the
+// wiser, its SPI messages and pin reads land here instead
+// of on the bus.
+//
+// Messages are run in order off a worker, decoded the way
+// the chip would: register and memory accesses burst until
+// chip select drops, RXBUF and TXBUF stream the FIFOs, and
+// SRXON, STXON, SRFOFF and the flushes drive a small state
+// machine. Timing follows the 250kbps PHY. STXON takes the
+// 12 symbol turnaround, then the preamble and SFD go out
+// and SFD stays high for the rest of the frame. Frames
+// arrive the same way, SFD rises as the sender's does, the
+// length lands in the FIFO and FIFOP goes up once the last
+// byte is in. That matches the FIFOP threshold the radio
+// programs, complete frames only.
+//
+// Every emulated radio shares one medium. A frame is heard
+// by every other radio listening on the same channel, at
+// the signal level of the link between them, unless the
+// link drops it or it's below sensitivity. CCA and RSSI see
+// the strongest transmission on the channel. Frames that
+// overlap at a receiver collide, the one being received
+// survives only if it's at least the capture margin above
+// everything else, otherwise it arrives with a bad CRC.
+// The links, airtime and capture margin are set through
+// debugfs, see cc2520_emu_medium_write.
+//
+// The crypto engine, automatic acks, source matching and
+// the SPI clock itself aren't modeled.
+
+// 250kbps, 32uS a byte.
+#define CC2520_EMU_BYTE_NS 32000
+// RX to TX turnaround, 12 symbols.
+#define CC2520_EMU_TURNAROUND_BYTES 6
+// Preamble and SFD, sent ahead of the length byte.
+#define CC2520_EMU_SHR_BYTES 5
+
+#define CC2520_EMU_FIFO_LEN 128
+#define CC2520_EMU_MEM_LEN 0x400
+#define CC2520_EMU_CHANNELS 16
+
+// Signal levels, in dBm. Links default to LINK_RSSI, and
+// one set at or below LINK_NONE isn't there at all.
+#define CC2520_EMU_LINK_RSSI -40
+#define CC2520_EMU_LINK_NONE -128
+#define CC2520_EMU_NOISE_FLOOR -98
+#define CC2520_EMU_SENSITIVITY -98
+#define CC2520_EMU_CAPTURE 3 // dB
+// Correlation value reported with every frame.
+#define CC2520_EMU_LQI 108
+
+// EXCFLAG0
+#define CC2520_EMU_TX_OVERFLOW (1<<4)
+#define CC2520_EMU_RX_UNDERFLOW (1<<5)
+#define CC2520_EMU_RX_OVERFLOW (1<<6)
+
+enum cc2520_emu_fsm {
+	CC2520_EMU_IDLE,
+	CC2520_EMU_RX,
+	CC2520_EMU_TX_CAL,   // turning around
+	CC2520_EMU_TX_SHR,   // preamble and SFD
+	CC2520_EMU_TX_FRAME, // SFD high until the last byte
+};
+
+struct cc2520_emu_state {
+	struct cc2520_dev *dev;
+	struct list_head radios;
+
+	// Messages waiting on the bus.
+	struct workqueue_struct *wq;
+	struct work_struct spi_work;
+	struct list_head queue;
+	spinlock_t queue_sl;
+
+	// Everything from here on is the chip.
+	spinlock_t lock;
+	u8 fsm;
+	u8 mem[CC2520_EMU_MEM_LEN];
+
+	u8 rxfifo[CC2520_EMU_FIFO_LEN];
+	int rx_head;
+	int rx_count;
+	int rx_frames;   // complete frames not read into yet
+	int rx_boundary; // bytes left of the frame being read
+	int rx_partial;  // bytes of the arriving frame in the FIFO
+	bool rx_torn;    // the arriving frame got read into
+	bool rx_overflow;
+
+	u8 txfifo[CC2520_EMU_FIFO_LEN];
+	int tx_count;
+	bool tx_sent;
+
+	// Who we're receiving from.
+	struct cc2520_emu_state *rx_from;
+	bool rx_accept;
+	bool rx_corrupt;
+	s8 rx_rssi;
+
+	// The frame we're sending, on cc2520_emu_on_air
+	// from the preamble on.
+	struct hrtimer timer;
+	struct list_head on_air;
+	u8 air[CC2520_EMU_FIFO_LEN];
+	int air_channel;
+	bool air_abort;
+
+	// Pin levels as of the last edges raised.
+	u8 pins;
+	bool fifop_masked;
+};
+
+// Every emulated radio. cc2520_emu_sl is taken before any
+// radio's lock.
+static LIST_HEAD(cc2520_emu_radios);
+static DEFINE_SPINLOCK(cc2520_emu_sl);
+
+// Transmissions on the air. cc2520_emu_air_sl nests inside
+// everything else, so the chip can look at the channel.
+static LIST_HEAD(cc2520_emu_on_air);
+static DEFINE_SPINLOCK(cc2520_emu_air_sl);
+
+// The medium. Links are indexed by radio id, from then to.
+static s8 cc2520_emu_link_rssi[CC2520_MAX_RADIOS][CC2520_MAX_RADIOS];
+static u16 cc2520_emu_link_loss[CC2520_MAX_RADIOS][CC2520_MAX_RADIOS]; // per mille
+static u32 cc2520_emu_byte_ns = CC2520_EMU_BYTE_NS;
+static int cc2520_emu_capture = CC2520_EMU_CAPTURE;
+
+static atomic_t cc2520_emu_sent;
+static atomic_t cc2520_emu_delivered;
+static atomic_t cc2520_emu_lost;
+static atomic_t cc2520_emu_collided;
+
+static void cc2520_emu_air_end(struct cc2520_emu_state *tx, bool complete);
+
+//////////////////////////////
+// Chip State
+/////////////////////////////
+
+static int cc2520_emu_channel(struct cc2520_emu_state *emu)
+{
+	int freq = emu->mem[CC2520_FREQCTRL] & 0x7F;
+
+	if (freq < 11 || (freq - 11) % 5 || (freq - 11) / 5 >= CC2520_EMU_CHANNELS)
+		return -1;
+
+	return (freq - 11) / 5;
+}
+
+static s8 cc2520_emu_link(struct cc2520_emu_state *from, struct cc2520_emu_state *to)
+{
+	return READ_ONCE(cc2520_emu_link_rssi[from->dev->id][to->dev->id]);
+}
+
+static bool cc2520_emu_link_drops(struct cc2520_emu_state *from, struct cc2520_emu_state *to)
+{
+	u16 loss = READ_ONCE(cc2520_emu_link_loss[from->dev->id][to->dev->id]);
+
+	return loss && prandom_u32() % 1000 < loss;
+}
+
+// The strongest transmission emu can hear on its channel,
+// leaving out skip.
+static int cc2520_emu_energy(struct cc2520_emu_state *emu, struct cc2520_emu_state *skip)
+{
+	struct cc2520_emu_state *tx;
+	unsigned long flags;
+	int channel = cc2520_emu_channel(emu);
+	int energy = CC2520_EMU_LINK_NONE;
+
+	spin_lock_irqsave(&cc2520_emu_air_sl, flags);
+	list_for_each_entry(tx, &cc2520_emu_on_air, on_air) {
+		if (tx != emu && tx != skip && tx->air_channel == channel)
+			energy = max_t(int, energy, cc2520_emu_link(tx, emu));
+	}
+	spin_unlock_irqrestore(&cc2520_emu_air_sl, flags);
+
+	return energy;
+}
+
+// CCA goes by the threshold the radio programs.
+static bool cc2520_emu_channel_busy(struct cc2520_emu_state *emu)
+{
+	cc2520_ccactrl0_t ccactrl0;
+
+	ccactrl0.value = emu->mem[CC2520_CCACTRL0];
+	return cc2520_emu_energy(emu, NULL) >= (s8)ccactrl0.f.cca_thr - CC2520_RSSI_OFFSET;
+}
+
+static u8 cc2520_emu_levels(struct cc2520_emu_state *emu)
+{
+	u8 pins = 0;
+
+	// An overflow drops FIFO and holds FIFOP
+	// until the FIFO is flushed.
+	if (emu->rx_count > 0 && !emu->rx_overflow)
+		pins |= BIT(CC2520_PIN_FIFO);
+	if (emu->rx_frames > 0 || emu->rx_overflow)
+		pins |= BIT(CC2520_PIN_FIFOP);
+	if (emu->fsm == CC2520_EMU_TX_FRAME || emu->rx_from)
+		pins |= BIT(CC2520_PIN_SFD);
+	if (emu->fsm == CC2520_EMU_RX && !emu->rx_from && !cc2520_emu_channel_busy(emu))
+		pins |= BIT(CC2520_PIN_CCA);
+
+	return pins;
+}
+
+// Lock held. Returns the pins that moved since last time.
+static u8 cc2520_emu_update(struct cc2520_emu_state *emu)
+{
+	u8 pins = cc2520_emu_levels(emu);
+	u8 changed = pins ^ emu->pins;
+
+	emu->pins = pins;
+	return changed;
+}
+
+// Lock dropped, interrupts off. Runs the same handlers
+// the GPIO interrupts would.
+static void cc2520_emu_edges(struct cc2520_emu_state *emu, u8 changed)
+{
+	if (changed & BIT(CC2520_PIN_SFD))
+		cc2520_plat_sfd_edge(emu->dev);
+
+	if ((changed & BIT(CC2520_PIN_FIFOP)) && !READ_ONCE(emu->fifop_masked))
+		cc2520_plat_fifop_edge(emu->dev);
+}
+
+static u8 cc2520_emu_status(struct cc2520_emu_state *emu)
+{
+	cc2520_status_t status;
+
+	status.value = 0;
+	status.rx_active = emu->fsm == CC2520_EMU_RX;
+	status.tx_active = emu->fsm >= CC2520_EMU_TX_CAL;
+	status.rssi_valid = emu->fsm == CC2520_EMU_RX;
+	status.xosc_stable = 1;
+	return status.value;
+}
+
+static u8 cc2520_emu_read(struct cc2520_emu_state *emu, u16 addr)
+{
+	cc2520_fsmstat1_t fsmstat1;
+	u8 pins;
+	s8 rssi;
+
+	addr %= CC2520_EMU_MEM_LEN;
+
+	switch (addr) {
+		case CC2520_FSMSTAT1:
+			pins = cc2520_emu_levels(emu);
+			fsmstat1.value = 0;
+			fsmstat1.f.rx_active = emu->fsm == CC2520_EMU_RX;
+			fsmstat1.f.tx_active = emu->fsm >= CC2520_EMU_TX_CAL;
+			fsmstat1.f.lock_status = emu->fsm != CC2520_EMU_IDLE;
+			fsmstat1.f.cca = (pins & BIT(CC2520_PIN_CCA)) != 0;
+			fsmstat1.f.sampled_cca = fsmstat1.f.cca;
+			fsmstat1.f.sfd = (pins & BIT(CC2520_PIN_SFD)) != 0;
+			fsmstat1.f.fifop = (pins & BIT(CC2520_PIN_FIFOP)) != 0;
+			fsmstat1.f.fifo = (pins & BIT(CC2520_PIN_FIFO)) != 0;
+			return fsmstat1.value;
+
+		case CC2520_RSSI:
+			if (emu->rx_from)
+				rssi = emu->rx_rssi;
+			else
+				rssi = max(cc2520_emu_energy(emu, NULL), CC2520_EMU_NOISE_FLOOR);
+			return (u8)(rssi + CC2520_RSSI_OFFSET);
+
+		case CC2520_RSSISTAT:
+			return emu->fsm == CC2520_EMU_RX;
+
+		default:
+			return emu->mem[addr];
+	}
+}
+
+static void cc2520_emu_write(struct cc2520_emu_state *emu, u16 addr, u8 value)
+{
+	addr %= CC2520_EMU_MEM_LEN;
+
+	// Exception flags only clear, by writing zeroes.
+	if (addr >= CC2520_EXCFLAG0 && addr <= CC2520_EXCFLAG2)
+		emu->mem[addr] &= value;
+	else
+		emu->mem[addr] = value;
+}
+
+//////////////////////////////
+// FIFOs
+/////////////////////////////
+
+static void cc2520_emu_rx_push(struct cc2520_emu_state *emu, u8 value)
+{
+	emu->rxfifo[(emu->rx_head + emu->rx_count) % CC2520_EMU_FIFO_LEN] = value;
+	emu->rx_count++;
+}
+
+static u8 cc2520_emu_rx_pop(struct cc2520_emu_state *emu)
+{
+	bool partial;
+	u8 value;
+
+	if (emu->rx_count == 0) {
+		emu->mem[CC2520_EXCFLAG0] |= CC2520_EMU_RX_UNDERFLOW;
+		return 0;
+	}
+
+	partial = emu->rx_count <= emu->rx_partial;
+	if (partial) {
+		emu->rx_partial--;
+		emu->rx_torn = true;
+	}
+
+	value = emu->rxfifo[emu->rx_head];
+	emu->rx_head = (emu->rx_head + 1) % CC2520_EMU_FIFO_LEN;
+	emu->rx_count--;
+
+	// FIFOP drops as soon as the last complete
+	// frame starts being read.
+	if (emu->rx_boundary == 0) {
+		emu->rx_boundary = value;
+		if (!partial && emu->rx_frames > 0)
+			emu->rx_frames--;
+	}
+	else {
+		emu->rx_boundary--;
+	}
+
+	return value;
+}
+
+// Drops the frame that's arriving, if any.
+static void cc2520_emu_abort_rx(struct cc2520_emu_state *emu)
+{
+	if (!emu->rx_from)
+		return;
+
+	emu->rx_count -= min(emu->rx_partial, emu->rx_count);
+	emu->rx_partial = 0;
+	emu->rx_from = NULL;
+}
+
+static void cc2520_emu_flush_rx(struct cc2520_emu_state *emu)
+{
+	cc2520_emu_abort_rx(emu);
+	emu->rx_head = 0;
+	emu->rx_count = 0;
+	emu->rx_frames = 0;
+	emu->rx_boundary = 0;
+	emu->rx_overflow = false;
+}
+
+static void cc2520_emu_tx_push(struct cc2520_emu_state *emu, u8 value)
+{
+	// The chip keeps a sent frame around for resending,
+	// the first write after it starts a new one.
+	if (emu->tx_sent) {
+		emu->tx_count = 0;
+		emu->tx_sent = false;
+	}
+
+	if (emu->tx_count == CC2520_EMU_FIFO_LEN) {
+		emu->mem[CC2520_EXCFLAG0] |= CC2520_EMU_TX_OVERFLOW;
+		return;
+	}
+
+	emu->txfifo[emu->tx_count++] = value;
+}
+
+//////////////////////////////
+// Strobes
+/////////////////////////////
+
+static void cc2520_emu_start_tx(struct cc2520_emu_state *emu)
+{
+	if (emu->fsm >= CC2520_EMU_TX_CAL)
+		return;
+
+	cc2520_emu_abort_rx(emu);
+	emu->fsm = CC2520_EMU_TX_CAL;
+	hrtimer_start(&emu->timer,
+		ns_to_ktime((u64)CC2520_EMU_TURNAROUND_BYTES * cc2520_emu_byte_ns), HRTIMER_MODE_REL);
+}
+
+static void cc2520_emu_air_off(struct cc2520_emu_state *emu)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cc2520_emu_air_sl, flags);
+	if (!list_empty(&emu->on_air))
+		list_del_init(&emu->on_air);
+	spin_unlock_irqrestore(&cc2520_emu_air_sl, flags);
+}
+
+// Abandons whatever the radio is in the middle of,
+// the caller picks the state it ends up in.
+static void cc2520_emu_stop(struct cc2520_emu_state *emu)
+{
+	cc2520_emu_abort_rx(emu);
+
+	if (emu->fsm < CC2520_EMU_TX_CAL)
+		return;
+
+	hrtimer_try_to_cancel(&emu->timer);
+	cc2520_emu_air_off(emu);
+
+	// Receivers get let go once the lock is dropped.
+	if (emu->fsm == CC2520_EMU_TX_FRAME)
+		emu->air_abort = true;
+}
+
+static void cc2520_emu_reset(struct cc2520_emu_state *emu)
+{
+	cc2520_emu_stop(emu);
+	cc2520_emu_flush_rx(emu);
+	emu->fsm = CC2520_EMU_IDLE;
+	emu->tx_count = 0;
+	emu->tx_sent = false;
+
+	memset(emu->mem, 0, CC2520_EMU_MEM_LEN);
+	emu->mem[CC2520_FREQCTRL] = 0x0B;
+	emu->mem[CC2520_FRMFILT0] = 0x0D;
+	emu->mem[CC2520_FRMFILT1] = 0x78;
+}
+
+static void cc2520_emu_strobe(struct cc2520_emu_state *emu, u8 cmd)
+{
+	switch (cmd) {
+		case CC2520_CMD_SRXON:
+			cc2520_emu_stop(emu);
+			emu->fsm = CC2520_EMU_RX;
+			break;
+
+		case CC2520_CMD_STXONCCA:
+			if (!(cc2520_emu_levels(emu) & BIT(CC2520_PIN_CCA)))
+				break;
+			// fall through
+		case CC2520_CMD_STXON:
+			cc2520_emu_start_tx(emu);
+			break;
+
+		case CC2520_CMD_SRFOFF:
+			cc2520_emu_stop(emu);
+			emu->fsm = CC2520_EMU_IDLE;
+			break;
+
+		case CC2520_CMD_SFLUSHRX:
+			cc2520_emu_flush_rx(emu);
+			break;
+
+		case CC2520_CMD_SFLUSHTX:
+			emu->tx_count = 0;
+			emu->tx_sent = false;
+			break;
+
+		case CC2520_CMD_SRES:
+			cc2520_emu_reset(emu);
+			break;
+
+		default:
+			break;
+	}
+}
+
+//////////////////////////////
+// SPI
+/////////////////////////////
+
+static inline u8 cc2520_emu_out(const u8 *out, unsigned int i)
+{
+	return out ? out[i] : 0;
+}
+
+static inline void cc2520_emu_in(u8 *in, unsigned int i, u8 value)
+{
+	if (in)
+		in[i] = value;
+}
+
+// One chip select's worth. Strobes can be strung together,
+// anything that takes data runs to the end.
+static void cc2520_emu_xfer(struct cc2520_emu_state *emu, struct spi_transfer *xfer)
+{
+	const u8 *out = xfer->tx_buf;
+	u8 *in = xfer->rx_buf;
+	unsigned int i = 0;
+	u16 addr;
+	u8 cmd;
+
+	while (i < xfer->len) {
+		cmd = cc2520_emu_out(out, i);
+		cc2520_emu_in(in, i++, cc2520_emu_status(emu));
+
+		if ((cmd & 0xC0) == CC2520_CMD_REGISTER_WRITE) {
+			addr = cmd & CC2520_FREG_MASK;
+			for (; i < xfer->len; i++) {
+				cc2520_emu_in(in, i, cc2520_emu_status(emu));
+				cc2520_emu_write(emu, addr++, cc2520_emu_out(out, i));
+			}
+		}
+		else if ((cmd & 0xC0) == CC2520_CMD_REGISTER_READ) {
+			addr = cmd & CC2520_FREG_MASK;
+			for (; i < xfer->len; i++)
+				cc2520_emu_in(in, i, cc2520_emu_read(emu, addr++));
+		}
+		else if ((cmd & 0xF0) == CC2520_CMD_MEMORY_READ ||
+			(cmd & 0xF0) == CC2520_CMD_MEMORY_WRITE) {
+			if (i == xfer->len)
+				break;
+
+			addr = ((cmd & CC2520_CMD_MEMORY_MASK) << 8) | cc2520_emu_out(out, i);
+			cc2520_emu_in(in, i++, cc2520_emu_status(emu));
+
+			for (; i < xfer->len; i++) {
+				cc2520_emu_in(in, i, cc2520_emu_read(emu, addr));
+				if ((cmd & 0xF0) == CC2520_CMD_MEMORY_WRITE)
+					cc2520_emu_write(emu, addr, cc2520_emu_out(out, i));
+				addr++;
+			}
+		}
+		else if (cmd == CC2520_CMD_RXBUF) {
+			for (; i < xfer->len; i++)
+				cc2520_emu_in(in, i, cc2520_emu_rx_pop(emu));
+		}
+		else if (cmd == CC2520_CMD_TXBUF) {
+			for (; i < xfer->len; i++) {
+				cc2520_emu_in(in, i, cc2520_emu_status(emu));
+				cc2520_emu_tx_push(emu, cc2520_emu_out(out, i));
+			}
+		}
+		else if (cmd == CC2520_CMD_RANDOM) {
+			for (; i < xfer->len; i++)
+				cc2520_emu_in(in, i, prandom_u32() & 0xFF);
+		}
+		else {
+			cc2520_emu_strobe(emu, cmd);
+		}
+	}
+}
+
+static void cc2520_emu_spi_work(struct work_struct *work)
+{
+	struct cc2520_emu_state *emu =
+		container_of(work, struct cc2520_emu_state, spi_work);
+	struct spi_message *msg;
+	struct spi_transfer *xfer;
+	unsigned long flags;
+	bool abort;
+	u8 changed;
+
+	for (;;) {
+		spin_lock_irqsave(&emu->queue_sl, flags);
+		msg = list_first_entry_or_null(&emu->queue, struct spi_message, queue);
+		if (msg)
+			list_del_init(&msg->queue);
+		spin_unlock_irqrestore(&emu->queue_sl, flags);
+
+		if (!msg)
+			return;
+
+		spin_lock_irqsave(&emu->lock, flags);
+		list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+			cc2520_emu_xfer(emu, xfer);
+			msg->actual_length += xfer->len;
+		}
+		changed = cc2520_emu_update(emu);
+		abort = emu->air_abort;
+		emu->air_abort = false;
+		spin_unlock(&emu->lock);
+
+		if (abort)
+			cc2520_emu_air_end(emu, false);
+		cc2520_emu_edges(emu, changed);
+
+		// Completions run with interrupts off, as
+		// they would from a real controller.
+		msg->status = 0;
+		if (msg->complete)
+			msg->complete(msg->context);
+		local_irq_restore(flags);
+	}
+}
+
+int cc2520_emu_spi_async(struct cc2520_dev *dev, struct spi_message *msg)
+{
+	struct cc2520_emu_state *emu = dev->emu;
+	unsigned long flags;
+
+	msg->status = -EINPROGRESS;
+	msg->actual_length = 0;
+
+	spin_lock_irqsave(&emu->queue_sl, flags);
+	list_add_tail(&msg->queue, &emu->queue);
+	spin_unlock_irqrestore(&emu->queue_sl, flags);
+
+	queue_work(emu->wq, &emu->spi_work);
+	return 0;
+}
+
+static void cc2520_emu_sync_complete(void *arg)
+{
+	complete(arg);
+}
+
+// Queued behind anything already in flight, the same
+// as spi_sync.
+int cc2520_emu_spi_sync(struct cc2520_dev *dev, struct spi_message *msg)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	msg->complete = cc2520_emu_sync_complete;
+	msg->context = &done;
+
+	cc2520_emu_spi_async(dev, msg);
+	wait_for_completion(&done);
+	return msg->status;
+}
+
+//////////////////////////////
+// Pins
+/////////////////////////////
+
+int cc2520_emu_pin_get(struct cc2520_dev *dev, enum cc2520_pin pin)
+{
+	struct cc2520_emu_state *emu = dev->emu;
+	unsigned long flags;
+	u8 pins;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	pins = cc2520_emu_levels(emu);
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	return (pins >> pin) & 1;
+}
+
+void cc2520_emu_pin_set(struct cc2520_dev *dev, enum cc2520_pin pin, int value)
+{
+	struct cc2520_emu_state *emu = dev->emu;
+	unsigned long flags;
+	bool abort;
+	u8 changed;
+
+	if (pin != CC2520_PIN_RESET || value)
+		return;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	cc2520_emu_reset(emu);
+	changed = cc2520_emu_update(emu);
+	abort = emu->air_abort;
+	emu->air_abort = false;
+	spin_unlock(&emu->lock);
+
+	if (abort)
+		cc2520_emu_air_end(emu, false);
+	cc2520_emu_edges(emu, changed);
+	local_irq_restore(flags);
+}
+
+// Edges that come in while masked are lost, the radio
+// checks the level itself after unmasking.
+void cc2520_emu_fifop_irq(struct cc2520_dev *dev, bool enabled)
+{
+	WRITE_ONCE(dev->emu->fifop_masked, !enabled);
+}
+
+//////////////////////////////
+// The Air
+/////////////////////////////
+
+// Hardware frame filtering, as far as the radio sets it up.
+static bool cc2520_emu_accept(struct cc2520_emu_state *emu, const u8 *frame)
+{
+	cc2520_frmfilt0_t filt0;
+	cc2520_frmfilt1_t filt1;
+	const u8 *local = emu->mem + CC2520_MEM_ADDR_BASE;
+	const u8 *dst = frame + 4;
+	u8 len = frame[0];
+	u16 fcf;
+	u16 pan;
+	u16 addr;
+	u8 dst_mode;
+
+	filt0.value = emu->mem[CC2520_FRMFILT0];
+	filt1.value = emu->mem[CC2520_FRMFILT1];
+
+	if (!filt0.f.frame_filter_en)
+		return true;
+
+	// FCF, DSN and FCS at the least.
+	if (len < 5)
+		return false;
+
+	fcf = frame[1] | (frame[2] << 8);
+
+	switch ((fcf >> IEEE154_FCF_FRAME_TYPE) & IEEE154_TYPE_MASK) {
+		case IEEE154_TYPE_BEACON:
+			if (!filt1.f.accept_ft_0_beacon)
+				return false;
+			break;
+		case IEEE154_TYPE_DATA:
+			if (!filt1.f.accept_ft_1_data)
+				return false;
+			break;
+		case IEEE154_TYPE_ACK:
+			// Acks carry no addresses.
+			return filt1.f.accept_ft_2_ack;
+		case IEEE154_TYPE_MAC_CMD:
+			if (!filt1.f.accept_ft_3_mac_cmd)
+				return false;
+			break;
+		default:
+			return filt1.f.accept_ft_4to7_reserved;
+	}
+
+	if (((fcf >> 12) & 3) > filt0.f.max_frame_version)
+		return false;
+
+	dst_mode = (fcf >> IEEE154_FCF_DEST_ADDR_MODE) & IEEE154_ADDR_MASK;
+
+	if (dst_mode == IEEE154_ADDR_NONE)
+		return filt0.f.pan_coordinator ||
+			((fcf >> IEEE154_FCF_FRAME_TYPE) & IEEE154_TYPE_MASK) == IEEE154_TYPE_BEACON;
+
+	if (len < 5 + 2 + (dst_mode == IEEE154_ADDR_EXT ? 8 : 2))
+		return false;
+
+	// The radio keeps its extended address, PAN and
+	// short address, in that order, at MEM_ADDR_BASE.
+	pan = dst[0] | (dst[1] << 8);
+	if (pan != IEEE154_BROADCAST_PAN && pan != (local[8] | (local[9] << 8)))
+		return false;
+
+	if (dst_mode == IEEE154_ADDR_SHORT) {
+		addr = dst[2] | (dst[3] << 8);
+		return addr == IEEE154_BROADCAST_ADDR || addr == (local[10] | (local[11] << 8));
+	}
+
+	if (dst_mode == IEEE154_ADDR_EXT)
+		return memcmp(dst + 2, local, 8) == 0;
+
+	return false;
+}
+
+// Interrupts off, radio list lock held. The SFD of a
+// frame from tx has just gone out.
+static void cc2520_emu_rx_start(struct cc2520_emu_state *rx, struct cc2520_emu_state *tx)
+{
+	s8 rssi = cc2520_emu_link(tx, rx);
+	u8 changed;
+
+	spin_lock(&rx->lock);
+
+	if (rx->fsm != CC2520_EMU_RX || cc2520_emu_channel(rx) != tx->air_channel ||
+		rssi < CC2520_EMU_SENSITIVITY) {
+		// Doesn't hear it.
+	}
+	else if (rx->rx_from) {
+		// Landed on top of the frame being received.
+		if (!rx->rx_corrupt && rx->rx_rssi < rssi + READ_ONCE(cc2520_emu_capture)) {
+			rx->rx_corrupt = true;
+			atomic_inc(&cc2520_emu_collided);
+		}
+	}
+	else if (cc2520_emu_link_drops(tx, rx)) {
+		atomic_inc(&cc2520_emu_lost);
+	}
+	else {
+		rx->rx_from = tx;
+		rx->rx_rssi = rssi;
+		rx->rx_torn = false;
+		rx->rx_accept = cc2520_emu_accept(rx, tx->air);
+
+		// Or started under something already on the air.
+		rx->rx_corrupt = cc2520_emu_energy(rx, tx) > rssi - READ_ONCE(cc2520_emu_capture);
+		if (rx->rx_corrupt)
+			atomic_inc(&cc2520_emu_collided);
+
+		if (rx->rx_accept && !rx->rx_overflow) {
+			if (rx->rx_count < CC2520_EMU_FIFO_LEN) {
+				cc2520_emu_rx_push(rx, tx->air[0]);
+				rx->rx_partial = 1;
+			}
+			else {
+				rx->rx_overflow = true;
+				rx->mem[CC2520_EXCFLAG0] |= CC2520_EMU_RX_OVERFLOW;
+			}
+		}
+	}
+
+	changed = cc2520_emu_update(rx);
+	spin_unlock(&rx->lock);
+
+	cc2520_emu_edges(rx, changed);
+}
+
+// Interrupts off, radio list lock held. The radio puts
+// RSSI and CRC OK with the correlation value where the FCS
+// was. A collision garbles a bit somewhere and fails CRC.
+static void cc2520_emu_rx_end(struct cc2520_emu_state *rx, struct cc2520_emu_state *tx,
+	bool complete)
+{
+	u8 len = tx->air[0];
+	u8 changed;
+	int start;
+	int i;
+
+	spin_lock(&rx->lock);
+
+	if (rx->rx_from == tx) {
+		if (complete && rx->rx_accept && rx->rx_partial && !rx->rx_torn && len >= 2) {
+			if (rx->rx_count + len > CC2520_EMU_FIFO_LEN) {
+				rx->rx_overflow = true;
+				rx->mem[CC2520_EXCFLAG0] |= CC2520_EMU_RX_OVERFLOW;
+				cc2520_emu_abort_rx(rx);
+			}
+			else {
+				start = rx->rx_count;
+				for (i = 1; i < len - 1; i++)
+					cc2520_emu_rx_push(rx, tx->air[i]);
+
+				if (rx->rx_corrupt && len > 2) {
+					i = (rx->rx_head + start + prandom_u32() % (len - 2)) % CC2520_EMU_FIFO_LEN;
+					rx->rxfifo[i] ^= 1 << (prandom_u32() % 8);
+				}
+
+				cc2520_emu_rx_push(rx, (u8)(rx->rx_rssi + CC2520_RSSI_OFFSET));
+				cc2520_emu_rx_push(rx, (rx->rx_corrupt ? 0 : CC2520_META_CRC_OK) | CC2520_EMU_LQI);
+				rx->rx_frames++;
+				if (!rx->rx_corrupt)
+					atomic_inc(&cc2520_emu_delivered);
+				rx->rx_partial = 0;
+				rx->rx_from = NULL;
+			}
+		}
+		else {
+			cc2520_emu_abort_rx(rx);
+		}
+	}
+
+	changed = cc2520_emu_update(rx);
+	spin_unlock(&rx->lock);
+
+	cc2520_emu_edges(rx, changed);
+}
+
+static void cc2520_emu_air_start(struct cc2520_emu_state *tx)
+{
+	struct cc2520_emu_state *rx;
+	unsigned long flags;
+	bool on_air;
+
+	spin_lock_irqsave(&cc2520_emu_sl, flags);
+
+	// An SRFOFF could have got in since the timer let go.
+	spin_lock(&tx->lock);
+	on_air = tx->fsm == CC2520_EMU_TX_FRAME;
+	spin_unlock(&tx->lock);
+
+	if (on_air) {
+		list_for_each_entry(rx, &cc2520_emu_radios, radios) {
+			if (rx != tx)
+				cc2520_emu_rx_start(rx, tx);
+		}
+	}
+
+	spin_unlock_irqrestore(&cc2520_emu_sl, flags);
+}
+
+static void cc2520_emu_air_end(struct cc2520_emu_state *tx, bool complete)
+{
+	struct cc2520_emu_state *rx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cc2520_emu_sl, flags);
+	list_for_each_entry(rx, &cc2520_emu_radios, radios) {
+		if (rx != tx)
+			cc2520_emu_rx_end(rx, tx, complete);
+	}
+	spin_unlock_irqrestore(&cc2520_emu_sl, flags);
+}
+
+// The radio appends the FCS itself, so the TX FIFO holds
+// the length and all but the last two bytes.
+static void cc2520_emu_load_air(struct cc2520_emu_state *emu)
+{
+	u8 len = emu->tx_count ? emu->txfifo[0] & 0x7F : 0;
+
+	memset(emu->air, 0, CC2520_EMU_FIFO_LEN);
+	memcpy(emu->air, emu->txfifo, min(emu->tx_count, len + 1));
+	emu->air[0] = len;
+
+	if (emu->tx_count < len - 1)
+		emu->mem[CC2520_EXCFLAG0] |= CC2520_TX_UNDERFLOW;
+}
+
+static enum hrtimer_restart cc2520_emu_timer_cb(struct hrtimer *timer)
+{
+	struct cc2520_emu_state *emu =
+		container_of(timer, struct cc2520_emu_state, timer);
+	bool start = false;
+	bool end = false;
+	u64 next = 0;
+	u8 changed;
+
+	spin_lock(&emu->lock);
+
+	// Stopped and started again while we were waiting
+	// on the lock, the new run has its own expiry.
+	if (ktime_before(ktime_get(), hrtimer_get_expires(timer))) {
+		spin_unlock(&emu->lock);
+		return HRTIMER_NORESTART;
+	}
+
+	switch (emu->fsm) {
+		case CC2520_EMU_TX_CAL:
+			emu->air_channel = cc2520_emu_channel(emu);
+			spin_lock(&cc2520_emu_air_sl);
+			list_add_tail(&emu->on_air, &cc2520_emu_on_air);
+			spin_unlock(&cc2520_emu_air_sl);
+			emu->fsm = CC2520_EMU_TX_SHR;
+			next = (u64)CC2520_EMU_SHR_BYTES * READ_ONCE(cc2520_emu_byte_ns);
+			break;
+
+		case CC2520_EMU_TX_SHR:
+			cc2520_emu_load_air(emu);
+			emu->fsm = CC2520_EMU_TX_FRAME;
+			next = (u64)(1 + emu->air[0]) * READ_ONCE(cc2520_emu_byte_ns);
+			atomic_inc(&cc2520_emu_sent);
+			start = true;
+			break;
+
+		case CC2520_EMU_TX_FRAME:
+			cc2520_emu_air_off(emu);
+			emu->tx_sent = true;
+			// Back to RX once it's out, as the chip does.
+			emu->fsm = CC2520_EMU_RX;
+			end = true;
+			break;
+
+		default:
+			break;
+	}
+
+	changed = cc2520_emu_update(emu);
+	spin_unlock(&emu->lock);
+
+	cc2520_emu_edges(emu, changed);
+	if (start)
+		cc2520_emu_air_start(emu);
+	if (end)
+		cc2520_emu_air_end(emu, true);
+
+	if (!next)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward(timer, hrtimer_get_expires(timer), ns_to_ktime(next));
+	return HRTIMER_RESTART;
+}
+
+//////////////////////////////
+// Medium
+/////////////////////////////
+
+// Counters, then one line per link between radios that
+// exist, from, to, RSSI in dBm and loss per mille.
+static int cc2520_emu_medium_show(struct seq_file *s, void *unused)
+{
+	struct cc2520_emu_state *from;
+	struct cc2520_emu_state *to;
+
+	seq_printf(s, "airtime %u\n", READ_ONCE(cc2520_emu_byte_ns));
+	seq_printf(s, "capture %d\n", READ_ONCE(cc2520_emu_capture));
+	seq_printf(s, "sent %d delivered %d lost %d collided %d\n",
+		atomic_read(&cc2520_emu_sent), atomic_read(&cc2520_emu_delivered),
+		atomic_read(&cc2520_emu_lost), atomic_read(&cc2520_emu_collided));
+
+	// Radios only come and go at load and unload,
+	// when nobody can have this open.
+	list_for_each_entry(from, &cc2520_emu_radios, radios) {
+		list_for_each_entry(to, &cc2520_emu_radios, radios) {
+			if (from != to)
+				seq_printf(s, "link %d %d %d %u\n", from->dev->id, to->dev->id,
+					cc2520_emu_link(from, to),
+					READ_ONCE(cc2520_emu_link_loss[from->dev->id][to->dev->id]));
+		}
+	}
+
+	return 0;
+}
+
+static int cc2520_emu_medium_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cc2520_emu_medium_show, inode->i_private);
+}
+
+// A radio id, or * for all of them.
+static int cc2520_emu_parse_ids(const char *str, int *first, int *last)
+{
+	int id;
+
+	if (!strcmp(str, "*")) {
+		*first = 0;
+		*last = CC2520_MAX_RADIOS - 1;
+		return 0;
+	}
+
+	if (kstrtoint(str, 10, &id) || id < 0 || id >= CC2520_MAX_RADIOS)
+		return -EINVAL;
+
+	*first = *last = id;
+	return 0;
+}
+
+static int cc2520_emu_medium_line(char *line)
+{
+	char from[8], to[8];
+	int f0, f1, t0, t1;
+	int rssi, loss;
+	int value;
+	int f, t;
+	int n;
+
+	if (!strcmp(line, "reset")) {
+		atomic_set(&cc2520_emu_sent, 0);
+		atomic_set(&cc2520_emu_delivered, 0);
+		atomic_set(&cc2520_emu_lost, 0);
+		atomic_set(&cc2520_emu_collided, 0);
+		return 0;
+	}
+
+	if (sscanf(line, "airtime %d", &value) == 1) {
+		if (value < 1)
+			return -EINVAL;
+		WRITE_ONCE(cc2520_emu_byte_ns, value);
+		return 0;
+	}
+
+	if (sscanf(line, "capture %d", &value) == 1) {
+		WRITE_ONCE(cc2520_emu_capture, value);
+		return 0;
+	}
+
+	loss = 0;
+	n = sscanf(line, "link %7s %7s %d %d", from, to, &rssi, &loss);
+	if (n < 3)
+		return -EINVAL;
+
+	if (cc2520_emu_parse_ids(from, &f0, &f1) || cc2520_emu_parse_ids(to, &t0, &t1))
+		return -EINVAL;
+
+	if (loss < 0 || loss > 1000)
+		return -EINVAL;
+
+	rssi = clamp(rssi, CC2520_EMU_LINK_NONE, 0);
+	for (f = f0; f <= f1; f++) {
+		for (t = t0; t <= t1; t++) {
+			WRITE_ONCE(cc2520_emu_link_rssi[f][t], rssi);
+			WRITE_ONCE(cc2520_emu_link_loss[f][t], loss);
+		}
+	}
+
+	return 0;
+}
+
+// One setting per line:
+//   airtime <ns>    time to send a byte
+//   capture <dB>    margin a frame needs to survive overlap
+//   link <from> <to> <rssi> [loss]
+//                   signal level and per mille loss from one
+//                   radio to another, either can be *
+//   reset           zero the counters
+// Changes apply to frames starting after the write.
+static ssize_t cc2520_emu_medium_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	char kbuf[256];
+	char *cur;
+	char *line;
+	int result;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+
+	cur = kbuf;
+	while ((line = strsep(&cur, "\n")) != NULL) {
+		line = strim(line);
+		if (!*line)
+			continue;
+
+		result = cc2520_emu_medium_line(line);
+		if (result)
+			return result;
+	}
+
+	return count;
+}
+
+static const struct file_operations cc2520_emu_medium_fops = {
+	.owner = THIS_MODULE,
+	.open = cc2520_emu_medium_open,
+	.read = seq_read,
+	.write = cc2520_emu_medium_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+// Every radio hears every other one at LINK_RSSI until
+// told otherwise.
+void cc2520_emu_medium_init(struct dentry *dir)
+{
+	int f, t;
+
+	for (f = 0; f < CC2520_MAX_RADIOS; f++) {
+		for (t = 0; t < CC2520_MAX_RADIOS; t++) {
+			cc2520_emu_link_rssi[f][t] = CC2520_EMU_LINK_RSSI;
+			cc2520_emu_link_loss[f][t] = 0;
+		}
+	}
+
+	debugfs_create_file("medium", 0600, dir, NULL, &cc2520_emu_medium_fops);
+}
+
+//////////////////////////////
+// Init
+/////////////////////////////
+
+int cc2520_emu_init(struct cc2520_dev *dev)
+{
+	struct cc2520_emu_state *emu;
+	unsigned long flags;
+
+	emu = kzalloc(sizeof(struct cc2520_emu_state), GFP_KERNEL);
+	if (!emu)
+		return -ENOMEM;
+
+	emu->dev = dev;
+	emu->air_channel = -1;
+	INIT_LIST_HEAD(&emu->on_air);
+	spin_lock_init(&emu->lock);
+	spin_lock_init(&emu->queue_sl);
+	INIT_LIST_HEAD(&emu->queue);
+	INIT_WORK(&emu->spi_work, cc2520_emu_spi_work);
+
+	emu->wq = alloc_ordered_workqueue("cc2520_emu%d", WQ_HIGHPRI, dev->id);
+	if (!emu->wq) {
+		kfree(emu);
+		return -ENOMEM;
+	}
+
+	hrtimer_init(&emu->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	emu->timer.function = &cc2520_emu_timer_cb;
+
+	cc2520_emu_reset(emu);
+	emu->pins = cc2520_emu_levels(emu);
+	dev->emu = emu;
+
+	spin_lock_irqsave(&cc2520_emu_sl, flags);
+	list_add_tail(&emu->radios, &cc2520_emu_radios);
+	spin_unlock_irqrestore(&cc2520_emu_sl, flags);
+
+	INFO((KERN_INFO "[cc2520] - radio%d is emulated.\n", dev->id));
+	return 0;
+}
+
+void cc2520_emu_free(struct cc2520_dev *dev)
+{
+	struct cc2520_emu_state *emu = dev->emu;
+	struct cc2520_emu_state *rx;
+	unsigned long flags;
+
+	if (!emu)
+		return;
+
+	// Drain the bus first so nothing restarts the timer.
+	destroy_workqueue(emu->wq);
+	hrtimer_cancel(&emu->timer);
+	cc2520_emu_air_off(emu);
+
+	// Off the air, and let go of anyone still
+	// listening to us.
+	spin_lock_irqsave(&cc2520_emu_sl, flags);
+	list_del(&emu->radios);
+	list_for_each_entry(rx, &cc2520_emu_radios, radios)
+		cc2520_emu_rx_end(rx, emu, false);
+	spin_unlock_irqrestore(&cc2520_emu_sl, flags);
+
+	kfree(emu);
+	dev->emu = NULL;
+}
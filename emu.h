@@ -0,0 +1,24 @@
+#ifndef EMU_H
+#define EMU_H
+
+#include "cc2520.h"
+#include "platform.h"
+
+struct spi_message;
+struct dentry;
+
+// Shared by every emulated radio, configured through
+// cc2520/medium in debugfs.
+void cc2520_emu_medium_init(struct dentry *dir);
+
+int cc2520_emu_init(struct cc2520_dev *dev);
+void cc2520_emu_free(struct cc2520_dev *dev);
+
+// Stand-ins for the bus and pins, see platform.h.
+int cc2520_emu_spi_async(struct cc2520_dev *dev, struct spi_message *msg);
+int cc2520_emu_spi_sync(struct cc2520_dev *dev, struct spi_message *msg);
+int cc2520_emu_pin_get(struct cc2520_dev *dev, enum cc2520_pin pin);
+void cc2520_emu_pin_set(struct cc2520_dev *dev, enum cc2520_pin pin, int value);
+void cc2520_emu_fifop_irq(struct cc2520_dev *dev, bool enabled);
+
+#endif
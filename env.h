@@ -0,0 +1,81 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+
+#include "cc2520.h"
+#include "radio.h"
+
+// What the MAC layers take from outside the stack: the
+// time, their timers and the CCA pin. On a real or an
+// emulated radio dev->env is NULL and these are the
+// kernel's clock, hrtimers and the radio. The bench and
+// the KUnit tests give their scratch radios an env of
+// their own, whose clock only moves when they step it,
+// see bench.h.
+struct cc2520_env {
+	u64 (*now)(struct cc2520_env *env);
+	void (*timer_start)(struct cc2520_env *env, struct hrtimer *timer, int us);
+	void (*timer_forward)(struct cc2520_env *env, struct hrtimer *timer, int us);
+	void (*timer_cancel)(struct cc2520_env *env, struct hrtimer *timer);
+	bool (*is_clear)(struct cc2520_env *env);
+};
+
+// Raw monotonic nS.
+static inline u64 cc2520_env_now(struct cc2520_dev *dev)
+{
+	if (dev->env)
+		return dev->env->now(dev->env);
+
+	return ktime_get_raw_ns();
+}
+
+static inline void cc2520_env_timer_start(struct cc2520_dev *dev, struct hrtimer *timer, int us)
+{
+	ktime_t kt;
+
+	if (dev->env) {
+		dev->env->timer_start(dev->env, timer, us);
+		return;
+	}
+
+	kt = ktime_set(0, 1000 * us);
+	hrtimer_start(timer, kt, HRTIMER_MODE_REL);
+}
+
+// Only from the timer's own callback, which then
+// returns HRTIMER_RESTART.
+static inline void cc2520_env_timer_forward(struct cc2520_dev *dev, struct hrtimer *timer, int us)
+{
+	ktime_t kt;
+
+	if (dev->env) {
+		dev->env->timer_forward(dev->env, timer, us);
+		return;
+	}
+
+	kt = ktime_set(0, 1000 * us);
+	hrtimer_forward_now(timer, kt);
+}
+
+static inline void cc2520_env_timer_cancel(struct cc2520_dev *dev, struct hrtimer *timer)
+{
+	if (dev->env) {
+		dev->env->timer_cancel(dev->env, timer);
+		return;
+	}
+
+	hrtimer_cancel(timer);
+}
+
+static inline bool cc2520_env_is_clear(struct cc2520_dev *dev)
+{
+	if (dev->env)
+		return dev->env->is_clear(dev->env);
+
+	return cc2520_radio_is_clear(dev);
+}
+
+#endif
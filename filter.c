@@ -0,0 +1,127 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+
+#include "filter.h"
+#include "cc2520.h"
+#include "radio.h"
+#include "debug.h"
+
+static int cc2520_filter_tx(struct cc2520_dev *dev, u8 * buf, u8 len);
+static void cc2520_filter_tx_done(struct cc2520_dev *dev, u8 status);
+static void cc2520_filter_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len);
+
+// Sits directly on top of the radio and throws away
+// frames nobody upstream wants before they get acked,
+// copied through the stack or handed to userspace:
+// - Frames that failed their CRC check.
+// - Optionally, frames below an RSSI or LQI threshold.
+
+struct cc2520_filter_state {
+	bool filter_crc;
+	s8 filter_min_rssi;
+	u8 filter_min_lqi;
+
+	u32 passed;
+	u32 dropped_crc;
+	u32 dropped_rssi;
+	u32 dropped_lqi;
+};
+
+int cc2520_filter_init(struct cc2520_dev *dev)
+{
+	struct cc2520_filter_state *filter;
+
+	filter = kzalloc(sizeof(struct cc2520_filter_state), GFP_KERNEL);
+	if (!filter)
+		return -ENOMEM;
+
+	dev->filter = filter;
+
+	dev->filter_top->tx = cc2520_filter_tx;
+	dev->filter_bottom->tx_done = cc2520_filter_tx_done;
+	dev->filter_bottom->rx_done = cc2520_filter_rx_done;
+
+	filter->filter_crc = CC2520_DEF_FILTER_CRC;
+	filter->filter_min_rssi = CC2520_DEF_FILTER_MIN_RSSI;
+	filter->filter_min_lqi = CC2520_DEF_FILTER_MIN_LQI;
+
+	return 0;
+}
+
+void cc2520_filter_free(struct cc2520_dev *dev)
+{
+	kfree(dev->filter);
+	dev->filter = NULL;
+}
+
+static int cc2520_filter_tx(struct cc2520_dev *dev, u8 * buf, u8 len)
+{
+	return dev->filter_bottom->tx(dev, buf, len);
+}
+
+static void cc2520_filter_tx_done(struct cc2520_dev *dev, u8 status)
+{
+	dev->filter_top->tx_done(dev, status);
+}
+
+static void cc2520_filter_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len)
+{
+	struct cc2520_filter_state *filter = dev->filter;
+	const struct cc2520_rx_record *meta;
+
+	meta = cc2520_radio_rx_meta(dev);
+
+	if (filter->filter_crc && !meta->crc_ok) {
+		filter->dropped_crc++;
+		DBG((KERN_INFO "[cc2520] - dropping frame, bad crc.\n"));
+		goto drop;
+	}
+
+	if (meta->rssi < filter->filter_min_rssi) {
+		filter->dropped_rssi++;
+		DBG((KERN_INFO "[cc2520] - dropping frame, rssi %d.\n", meta->rssi));
+		goto drop;
+	}
+
+	if (meta->lqi < filter->filter_min_lqi) {
+		filter->dropped_lqi++;
+		DBG((KERN_INFO "[cc2520] - dropping frame, lqi %d.\n", meta->lqi));
+		goto drop;
+	}
+
+	filter->passed++;
+	dev->filter_top->rx_done(dev, buf, len);
+	return;
+
+	drop:
+		// The soft-ack layer normally hands the RX buffer
+		// back to the radio, do it here for frames that
+		// never make it that far.
+		cc2520_radio_release_rx(dev);
+}
+
+void cc2520_filter_set_crc(struct cc2520_dev *dev, bool enabled)
+{
+	dev->filter->filter_crc = enabled;
+}
+
+void cc2520_filter_set_min_rssi(struct cc2520_dev *dev, s8 rssi)
+{
+	dev->filter->filter_min_rssi = rssi;
+}
+
+void cc2520_filter_set_min_lqi(struct cc2520_dev *dev, u8 lqi)
+{
+	dev->filter->filter_min_lqi = lqi;
+}
+
+void cc2520_filter_get_stats(struct cc2520_dev *dev, struct cc2520_rx_filter_stats *stats)
+{
+	struct cc2520_filter_state *filter = dev->filter;
+
+	stats->passed = filter->passed;
+	stats->dropped_crc = filter->dropped_crc;
+	stats->dropped_rssi = filter->dropped_rssi;
+	stats->dropped_lqi = filter->dropped_lqi;
+}
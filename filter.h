@@ -0,0 +1,14 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "cc2520.h"
+
+int cc2520_filter_init(struct cc2520_dev *dev);
+void cc2520_filter_free(struct cc2520_dev *dev);
+
+void cc2520_filter_set_crc(struct cc2520_dev *dev, bool enabled);
+void cc2520_filter_set_min_rssi(struct cc2520_dev *dev, s8 rssi);
+void cc2520_filter_set_min_lqi(struct cc2520_dev *dev, u8 lqi);
+void cc2520_filter_get_stats(struct cc2520_dev *dev, struct cc2520_rx_filter_stats *stats);
+
+#endif
@@ -0,0 +1,174 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/spi/spi.h>
+
+#include "flight.h"
+#include "cc2520.h"
+#include "debug.h"
+
+// Flight recorder. Always on, it keeps the last
+// CC2520_FLIGHT_LEN SPI commands, status bytes, interrupt
+// edges and frame headers so when the radio wedges there's
+// a history to look at in debugfs at
+// cc2520/radioN/flight, oldest first.
+//
+// Recording has to be cheap enough for the interrupt and
+// SPI paths. A writer claims a slot with one atomic
+// increment and fills it in without any locking, then
+// stamps it with its sequence number. The dump skips any
+// slot whose sequence number isn't the one it expects,
+// those are mid-write or already overwritten.
+//
+// The RSSI monitor's reads aren't recorded, at its
+// sample rates they'd push everything else out.
+
+#define CC2520_FLIGHT_DATA_LEN 16
+
+struct cc2520_flight_event {
+	u64 timestamp; // raw monotonic nS
+	u32 seq;
+	u8 type;
+	u8 len;
+	u16 arg;
+	u8 data[CC2520_FLIGHT_DATA_LEN];
+};
+
+struct cc2520_flight_state {
+	atomic_t head;
+	struct cc2520_flight_event *ring;
+};
+
+static const char * const cc2520_flight_names[CC2520_FLIGHT_TYPES] = {
+	[CC2520_FLIGHT_SPI] = "spi",
+	[CC2520_FLIGHT_SPI_DONE] = "spi_done",
+	[CC2520_FLIGHT_FIFOP] = "fifop",
+	[CC2520_FLIGHT_SFD] = "sfd",
+	[CC2520_FLIGHT_RX] = "rx",
+	[CC2520_FLIGHT_TX] = "tx",
+};
+
+int cc2520_flight_init(struct cc2520_dev *dev)
+{
+	struct cc2520_flight_state *flight;
+
+	flight = kzalloc(sizeof(struct cc2520_flight_state), GFP_KERNEL);
+	if (!flight)
+		return -ENOMEM;
+
+	flight->ring = vzalloc(CC2520_FLIGHT_LEN * sizeof(struct cc2520_flight_event));
+	if (!flight->ring) {
+		kfree(flight);
+		return -ENOMEM;
+	}
+
+	atomic_set(&flight->head, 0);
+	dev->flight = flight;
+	return 0;
+}
+
+void cc2520_flight_free(struct cc2520_dev *dev)
+{
+	struct cc2520_flight_state *flight = dev->flight;
+
+	vfree(flight->ring);
+	kfree(flight);
+	dev->flight = NULL;
+}
+
+// context: any
+void cc2520_flight_record(struct cc2520_dev *dev, u8 type, u16 arg, const void *data, u8 len)
+{
+	struct cc2520_flight_state *flight = dev->flight;
+	struct cc2520_flight_event *ev;
+	u32 seq;
+
+	seq = atomic_inc_return(&flight->head) - 1;
+	ev = &flight->ring[seq & (CC2520_FLIGHT_LEN - 1)];
+
+	// Invalidate the slot while it's being written.
+	WRITE_ONCE(ev->seq, seq - CC2520_FLIGHT_LEN);
+	smp_wmb();
+
+	ev->timestamp = ktime_get_raw_ns();
+	ev->type = type;
+	ev->arg = arg;
+	ev->len = min_t(u8, len, CC2520_FLIGHT_DATA_LEN);
+	memcpy(ev->data, data, ev->len);
+
+	smp_store_release(&ev->seq, seq);
+}
+
+// Records the first transfer of a message, which is where
+// the command and the status byte that answers it are.
+void cc2520_flight_spi(struct cc2520_dev *dev, u8 type, struct spi_message *msg)
+{
+	struct spi_transfer *t;
+	const void *buf;
+
+	t = list_first_entry(&msg->transfers, struct spi_transfer, transfer_list);
+	buf = type == CC2520_FLIGHT_SPI ? t->tx_buf : t->rx_buf;
+
+	cc2520_flight_record(dev, type, t->len, buf, buf ? t->len : 0);
+}
+
+static int cc2520_flight_show(struct seq_file *s, void *unused)
+{
+	struct cc2520_dev *dev = s->private;
+	struct cc2520_flight_state *flight = dev->flight;
+	struct cc2520_flight_event ev;
+	struct cc2520_flight_event *slot;
+	u32 head;
+	u32 seq;
+	int i;
+
+	// Slots that have never been written don't match
+	// the sequence numbers we look for, so start a full
+	// ring back even if it hasn't wrapped yet.
+	head = atomic_read(&flight->head);
+
+	for (seq = head - CC2520_FLIGHT_LEN; seq != head; seq++) {
+		slot = &flight->ring[seq & (CC2520_FLIGHT_LEN - 1)];
+		if (smp_load_acquire(&slot->seq) != seq)
+			continue;
+
+		memcpy(&ev, slot, sizeof(struct cc2520_flight_event));
+
+		// Lapped while we were copying it.
+		smp_rmb();
+		if (READ_ONCE(slot->seq) != seq)
+			continue;
+
+		seq_printf(s, "%llu %s %u", ev.timestamp,
+			ev.type < CC2520_FLIGHT_TYPES ? cc2520_flight_names[ev.type] : "?", ev.arg);
+		for (i = 0; i < ev.len; i++)
+			seq_printf(s, " %02X", ev.data[i]);
+		seq_putc(s, '\n');
+	}
+
+	return 0;
+}
+
+static int cc2520_flight_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cc2520_flight_show, inode->i_private);
+}
+
+static const struct file_operations cc2520_flight_fops = {
+	.owner = THIS_MODULE,
+	.open = cc2520_flight_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void cc2520_flight_debugfs(struct cc2520_dev *dev, struct dentry *dir)
+{
+	debugfs_create_file("flight", 0400, dir, dev, &cc2520_flight_fops);
+}
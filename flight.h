@@ -0,0 +1,29 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <linux/types.h>
+#include <linux/spi/spi.h>
+
+#include "cc2520.h"
+
+struct dentry;
+
+// Flight recorder events.
+enum cc2520_flight_type {
+	CC2520_FLIGHT_SPI,      // async SPI message queued, data is the first command bytes
+	CC2520_FLIGHT_SPI_DONE, // and completed, data is what came back including status
+	CC2520_FLIGHT_FIFOP,    // FIFOP interrupt
+	CC2520_FLIGHT_SFD,      // SFD interrupt, arg is the edge
+	CC2520_FLIGHT_RX,       // frame read from the radio, data is its header
+	CC2520_FLIGHT_TX,       // frame handed to the radio, data is its header
+	CC2520_FLIGHT_TYPES,
+};
+
+int cc2520_flight_init(struct cc2520_dev *dev);
+void cc2520_flight_free(struct cc2520_dev *dev);
+void cc2520_flight_debugfs(struct cc2520_dev *dev, struct dentry *dir);
+
+void cc2520_flight_record(struct cc2520_dev *dev, u8 type, u16 arg, const void *data, u8 len);
+void cc2520_flight_spi(struct cc2520_dev *dev, u8 type, struct spi_message *msg);
+
+#endif
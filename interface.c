@@ -9,6 +9,15 @@
 #include <linux/sched.h>
 #include <linux/cdev.h>
 #include <linux/device.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/skbuff.h>
+#include <linux/filter.h>
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
 
 #include "ioctl.h"
 #include "cc2520.h"
@@ -16,48 +25,138 @@
 #include "radio.h"
 #include "sack.h"
 #include "csma.h"
+#include "tsch.h"
 #include "lpl.h"
+#include "filter.h"
+#include "wpan.h"
+#include "monitor.h"
+#include "stats.h"
+#include "trace.h"
+#include "packet.h"
+#include "pcap.h"
 #include "debug.h"
 
-struct cc2520_interface *interface_bottom;
+// Readers bound to a frame type sit in that type's bucket of
+// the dispatch table, everyone else in the last one.
+#define CC2520_DISPATCH_ANY (IEEE154_TYPE_MASK + 1)
+#define CC2520_DISPATCH_BUCKETS (CC2520_DISPATCH_ANY + 1)
 
+// Shared by every radio, each radio gets
+// its own minor under the same major.
 static unsigned int major;
 static dev_t char_d_mm;
-static struct cdev char_d_cdev;
 static struct class* cl;
-static struct device* de;
 
-static u8 *tx_buf_c;
-static u8 *rx_buf_c;
-static size_t tx_pkt_len;
-static size_t rx_pkt_len;
+// A received frame. It's copied once and queued by reference
+// to every reader that wants it, the last one to read it
+// frees it.
+struct cc2520_rx_frame {
+	struct kref ref;
+	u64 received; // when it reached us, raw nS
+	struct cc2520_rx_record record;
+	size_t len;
+	u8 data[PKT_BUFF_SIZE + 1];
+};
+
+// Per open file. Each reader has its own queue, read format
+// and BPF filter, so several processes can read at once
+// without stealing frames from each other.
+struct cc2520_interface_reader {
+	struct cc2520_dev *dev;
+	struct list_head list;
+
+	spinlock_t queue_sl;
+	struct cc2520_rx_frame *queue[CC2520_RX_QUEUE_LEN];
+	int queue_head;
+	int queue_count;
+	wait_queue_head_t read_queue;
+
+	u8 rx_format;
+	bool pcap_header_pending;
+	struct cc2520_set_match_data match;
+
+	// Sniffing switches the format to pcap, the one it
+	// had before comes back when it stops.
+	bool sniffer;
+	u8 sniffer_prev_format;
+
+	struct bpf_prog __rcu *rx_prog;
+	struct mutex rx_prog_lock;
+	struct cc2520_rx_bpf_stats bpf_stats;
+	struct cc2520_reader_stats stats;
+};
+
+struct cc2520_interface_state {
+	struct cc2520_dev *dev;
 
-// Allows for only a single rx or tx
-// to occur simultaneously.
-static struct semaphore tx_sem;
-static struct semaphore rx_sem;
+	struct cdev char_d_cdev;
+	struct device* de;
 
-// Used by the character driver
-// to indicate when a blocking tx
-// or rx has completed.
-static struct semaphore tx_done_sem;
-static struct semaphore rx_done_sem;
+	u8 *tx_buf_c;
+	size_t tx_pkt_len;
 
-// Results, stored by the callbacks
-static int tx_result;
+	// Open files, bucketed by the frame type they want
+	// so the RX path only looks at readers that could
+	// possibly be interested.
+	struct list_head dispatch[CC2520_DISPATCH_BUCKETS];
+	spinlock_t readers_sl;
 
-DECLARE_WAIT_QUEUE_HEAD(cc2520_interface_read_queue);
+	// Readers sniffing. The radio is promiscuous while
+	// there's at least one.
+	struct mutex sniffer_lock;
+	int sniffers;
 
-static void cc2520_interface_tx_done(u8 status);
-static void cc2520_interface_rx_done(u8 *buf, u8 len);
+	// Allows for only a single rx or tx
+	// to occur simultaneously.
+	struct semaphore tx_sem;
+	struct semaphore rx_sem;
 
-static void interface_ioctl_set_channel(struct cc2520_set_channel_data *data);
-static void interface_ioctl_set_address(struct cc2520_set_address_data *data);
-static void interface_ioctl_set_txpower(struct cc2520_set_txpower_data *data);
-static void interface_ioctl_set_ack(struct cc2520_set_ack_data *data);
-static void interface_ioctl_set_lpl(struct cc2520_set_lpl_data *data);
-static void interface_ioctl_set_csma(struct cc2520_set_csma_data *data);
-static void interface_ioctl_set_print(struct cc2520_set_print_messages_data *data);
+	// Used by the character driver
+	// to indicate when a blocking tx
+	// or rx has completed.
+	struct semaphore tx_done_sem;
+	struct semaphore rx_done_sem;
+
+	// Results, stored by the callbacks
+	int tx_result;
+
+	// Holds each frame while the readers' BPF filters look
+	// at it. It's reused for every frame since the RX path
+	// only ever handles one frame at a time.
+	struct sk_buff *rx_skb;
+};
+
+static void cc2520_interface_tx_done(struct cc2520_dev *dev, u8 status);
+static void cc2520_interface_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len);
+
+static void interface_ioctl_set_channel(struct cc2520_dev *dev, struct cc2520_set_channel_data *data);
+static void interface_ioctl_set_address(struct cc2520_dev *dev, struct cc2520_set_address_data *data);
+static void interface_ioctl_set_txpower(struct cc2520_dev *dev, struct cc2520_set_txpower_data *data);
+static void interface_ioctl_set_ack(struct cc2520_dev *dev, struct cc2520_set_ack_data *data);
+static void interface_ioctl_set_lpl(struct cc2520_dev *dev, struct cc2520_set_lpl_data *data);
+static void interface_ioctl_set_csma(struct cc2520_dev *dev, struct cc2520_set_csma_data *data);
+static int interface_ioctl_set_tsch(struct cc2520_dev *dev, struct cc2520_set_tsch_data *data);
+static int interface_ioctl_ed_scan(struct cc2520_dev *dev, struct cc2520_ed_scan_data *data);
+static int interface_ioctl_set_rssi_monitor(struct cc2520_dev *dev, struct cc2520_set_rssi_monitor_data *data);
+static int interface_ioctl_read_rssi_samples(struct cc2520_dev *dev, struct cc2520_read_rssi_samples_data *data);
+static void interface_ioctl_get_tsch_stats(struct cc2520_dev *dev, struct cc2520_tsch_stats *data);
+static void interface_ioctl_set_print(struct cc2520_dev *dev, struct cc2520_set_print_messages_data *data);
+static void interface_ioctl_get_switch_stats(struct cc2520_dev *dev, struct cc2520_channel_switch_stats *data);
+static void interface_ioctl_set_rx_format(struct cc2520_interface_reader *reader, struct cc2520_set_rx_format_data *data);
+static void interface_ioctl_set_sniffer(struct cc2520_interface_reader *reader, struct cc2520_set_sniffer_data *data);
+static void interface_ioctl_set_rx_filter(struct cc2520_dev *dev, struct cc2520_set_rx_filter_data *data);
+static void interface_ioctl_get_rx_filter_stats(struct cc2520_dev *dev, struct cc2520_rx_filter_stats *data);
+static void interface_ioctl_set_frame_filter(struct cc2520_dev *dev, struct cc2520_set_frame_filter_data *data);
+static void interface_ioctl_set_promiscuous(struct cc2520_dev *dev, struct cc2520_set_promiscuous_data *data);
+static void interface_ioctl_set_rx_poll(struct cc2520_dev *dev, struct cc2520_set_rx_poll_data *data);
+static void interface_ioctl_get_rx_poll_stats(struct cc2520_dev *dev, struct cc2520_rx_poll_stats *data);
+static int interface_ioctl_attach_filter(struct cc2520_interface_reader *reader, struct sock_fprog *data);
+static void interface_ioctl_detach_filter(struct cc2520_interface_reader *reader);
+static void interface_ioctl_get_bpf_stats(struct cc2520_interface_reader *reader, struct cc2520_rx_bpf_stats *data);
+static void interface_ioctl_get_reader_stats(struct cc2520_interface_reader *reader, struct cc2520_reader_stats *data);
+static int interface_ioctl_set_match(struct cc2520_interface_reader *reader, struct cc2520_set_match_data *data);
+static void interface_swap_filter(struct cc2520_interface_reader *reader, struct bpf_prog *prog);
+static void interface_stop_sniffing(struct cc2520_interface_reader *reader);
 
 
 static long interface_ioctl(struct file *file,
@@ -67,23 +166,225 @@ static long interface_ioctl(struct file *file,
 ///////////////////////
 // Interface callbacks
 ///////////////////////
-void cc2520_interface_tx_done(u8 status)
+void cc2520_interface_tx_done(struct cc2520_dev *dev, u8 status)
 {
-	tx_result = status;
-	up(&tx_done_sem);
+	struct cc2520_interface_state *iface = dev->interface;
+
+	iface->tx_result = status;
+	up(&iface->tx_done_sem);
 }
 
-void cc2520_interface_rx_done(u8 *buf, u8 len)
+static void interface_frame_release(struct kref *ref)
 {
-	rx_pkt_len = (size_t)len;
-	memcpy(rx_buf_c, buf, len);
-	wake_up(&cc2520_interface_read_queue);
+	kfree(container_of(ref, struct cc2520_rx_frame, ref));
+}
+
+// Checks the rest of the reader's match rule, the frame
+// type was already taken care of by the dispatch table.
+static bool interface_reader_matches(struct cc2520_interface_reader *reader,
+	struct cc2520_packet_info *info, bool parsed)
+{
+	struct cc2520_set_match_data *match = &reader->match;
+
+	if (match->fields == 0)
+		return true;
+
+	if (!parsed)
+		return false;
+
+	if ((match->fields & CC2520_MATCH_DST_SHORT) &&
+		(info->dst_mode != IEEE154_ADDR_SHORT || info->dst_addr != match->dst_short))
+		return false;
+
+	if ((match->fields & CC2520_MATCH_DST_EXT) &&
+		(info->dst_mode != IEEE154_ADDR_EXT || info->dst_addr != match->dst_ext))
+		return false;
+
+	if ((match->fields & CC2520_MATCH_PAN) &&
+		(info->dst_mode == IEEE154_ADDR_NONE || info->dst_pan != match->pan_id))
+		return false;
+
+	if ((match->fields & CC2520_MATCH_DISPATCH) &&
+		(!info->has_dispatch || info->dispatch != match->dispatch))
+		return false;
+
+	return true;
+}
+
+// Runs the reader's BPF program, if it has one, over the
+// MAC frame in rx_skb. Returns false if the frame should
+// be dropped.
+static bool interface_filter_accepts(struct cc2520_interface_reader *reader, struct sk_buff *skb)
+{
+	struct bpf_prog *prog;
+	bool accept = true;
+
+	rcu_read_lock();
+	prog = rcu_dereference(reader->rx_prog);
+	if (prog) {
+		accept = bpf_prog_run(prog, skb) != 0;
+
+		if (accept)
+			reader->bpf_stats.accepted++;
+		else
+			reader->bpf_stats.filtered++;
+	}
+	rcu_read_unlock();
+
+	return accept;
+}
+
+// Queues a reference to the frame, or drops it if
+// the reader has fallen too far behind.
+static void interface_enqueue(struct cc2520_interface_reader *reader, struct cc2520_rx_frame *frame)
+{
+	int tail;
+
+	spin_lock(&reader->queue_sl);
+	if (reader->queue_count == CC2520_RX_QUEUE_LEN) {
+		reader->stats.dropped++;
+		cc2520_stat_inc(reader->dev, CC2520_STAT_INTERFACE_RX_DROP);
+		spin_unlock(&reader->queue_sl);
+		return;
+	}
+
+	kref_get(&frame->ref);
+	tail = (reader->queue_head + reader->queue_count) % CC2520_RX_QUEUE_LEN;
+	reader->queue[tail] = frame;
+	reader->queue_count++;
+	reader->stats.queued++;
+	spin_unlock(&reader->queue_sl);
+
+	wake_up_interruptible(&reader->read_queue);
+}
+
+static bool interface_dequeue(struct cc2520_interface_reader *reader, struct cc2520_rx_frame **frame)
+{
+	unsigned long flags;
+	bool found = false;
+
+	spin_lock_irqsave(&reader->queue_sl, flags);
+	if (reader->queue_count > 0) {
+		*frame = reader->queue[reader->queue_head];
+		reader->queue_head = (reader->queue_head + 1) % CC2520_RX_QUEUE_LEN;
+		reader->queue_count--;
+		found = true;
+	}
+	spin_unlock_irqrestore(&reader->queue_sl, flags);
+
+	return found;
+}
+
+// Hands the frame to every matching reader in a dispatch
+// bucket. The frame is copied the first time somebody
+// wants it, and only referenced after that. Returns false
+// if it couldn't be copied.
+static bool interface_deliver(struct cc2520_dev *dev, struct list_head *bucket,
+	struct cc2520_rx_frame **frame, u8 *buf, u8 len,
+	struct cc2520_packet_info *info, bool parsed)
+{
+	struct cc2520_interface_state *iface = dev->interface;
+	struct cc2520_interface_reader *reader;
+
+	list_for_each_entry(reader, bucket, list) {
+		// Rejected frames don't get copied out or
+		// wake anybody up.
+		if (!interface_reader_matches(reader, info, parsed))
+			continue;
+
+		if (!interface_filter_accepts(reader, iface->rx_skb))
+			continue;
+
+		if (!*frame) {
+			*frame = kmalloc(sizeof(struct cc2520_rx_frame), GFP_ATOMIC);
+			if (!*frame) {
+				ERR((KERN_ALERT "[cc2520] - rx frame alloc failed.\n"));
+				return false;
+			}
+
+			kref_init(&(*frame)->ref);
+			(*frame)->received = ktime_get_raw_ns();
+			(*frame)->len = len;
+			memcpy((*frame)->data, buf, len);
+			memcpy(&(*frame)->record, cc2520_radio_rx_meta(dev), sizeof(struct cc2520_rx_record));
+		}
+
+		interface_enqueue(reader, *frame);
+	}
+
+	return true;
+}
+
+void cc2520_interface_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len)
+{
+	struct cc2520_interface_state *iface = dev->interface;
+	struct cc2520_rx_frame *frame = NULL;
+	struct cc2520_packet_info info;
+	unsigned long flags;
+	bool parsed;
+
+	cc2520_wpan_rx(dev, buf, len);
+
+	if (len == 0)
+		return;
+
+	parsed = cc2520_packet_parse(buf, len, &info);
+
+	spin_lock_irqsave(&iface->readers_sl, flags);
+
+	// The filters see the MAC frame, without the length byte.
+	skb_trim(iface->rx_skb, 0);
+	skb_put_data(iface->rx_skb, buf + 1, len - 1);
+
+	// Frames we can't make sense of only go to
+	// readers that take everything.
+	if (parsed && !interface_deliver(dev, &iface->dispatch[info.frame_type],
+		&frame, buf, len, &info, parsed))
+		goto out;
+
+	interface_deliver(dev, &iface->dispatch[CC2520_DISPATCH_ANY], &frame, buf, len, &info, parsed);
+
+	out:
+		// Drop our own reference, the readers hold the rest.
+		if (frame)
+			kref_put(&frame->ref, interface_frame_release);
+
+		spin_unlock_irqrestore(&iface->readers_sl, flags);
 }
 
 ////////////////////
 // Implementation
 ////////////////////
 
+// Sends a frame on behalf of something inside the kernel,
+// taking turns with write(). Blocks until the stack is done
+// with it, returns 0 or a negated CC2520_TX_* code.
+int cc2520_interface_kernel_tx(struct cc2520_dev *dev, u8 *buf, u8 len)
+{
+	struct cc2520_interface_state *iface = dev->interface;
+	int result;
+
+	if (len > PKT_BUFF_SIZE)
+		return -CC2520_TX_LENGTH;
+
+	down(&iface->tx_sem);
+	memset(&dev->tx_opts, 0, sizeof(struct cc2520_tx_options));
+
+	memcpy(iface->tx_buf_c, buf, len);
+	iface->tx_pkt_len = len;
+
+	dev->tx_submitted = ktime_get_raw_ns();
+	dev->interface_bottom->tx(dev, iface->tx_buf_c, len);
+	down(&iface->tx_done_sem);
+
+	// Failures come back up the stack as negated
+	// codes squeezed into a u8.
+	result = (s8)iface->tx_result;
+
+	up(&iface->tx_sem);
+	return result;
+}
+
 static void interface_print_to_log(char *buf, int len, bool is_write)
 {
 	char print_buf[641];
@@ -107,123 +408,374 @@ static void interface_print_to_log(char *buf, int len, bool is_write)
 static ssize_t interface_write(
 	struct file *filp, const char *in_buf, size_t len, loff_t * off)
 {
+	struct cc2520_interface_reader *reader = filp->private_data;
+	struct cc2520_dev *dev = reader->dev;
+	struct cc2520_interface_state *iface = dev->interface;
 	int result;
 	size_t pkt_len;
+	size_t hdr_len;
+	u8 magic;
+	int prev_channel;
 
 	DBG((KERN_INFO "[cc2520] - beginning write\n"));
 
 	// Step 1: Get an exclusive lock on writing to the
 	// radio.
 	if (filp->f_flags & O_NONBLOCK) {
-		result = down_trylock(&tx_sem);
+		result = down_trylock(&iface->tx_sem);
 		if (result)
 			return -EAGAIN;
 	}
 	else {
-		result = down_interruptible(&tx_sem);
+		result = down_interruptible(&iface->tx_sem);
 		if (result)
 			return -ERESTARTSYS;
 	}
 	DBG((KERN_INFO "[cc2520] - write lock obtained.\n"));
 
-	// Step 2: Copy the packet to the incoming buffer.
-	pkt_len = min(len, (size_t)128);
-	if (copy_from_user(tx_buf_c, in_buf, pkt_len)) {
+	// Step 2: Pick off the optional per-frame options
+	// header, then copy the packet to the incoming buffer.
+	hdr_len = 0;
+	memset(&dev->tx_opts, 0, sizeof(struct cc2520_tx_options));
+
+	if (len > 0 && get_user(magic, in_buf)) {
+		result = -EFAULT;
+		goto error;
+	}
+
+	if (len > 0 && magic == CC2520_TX_OPTIONS_MAGIC) {
+		hdr_len = sizeof(struct cc2520_tx_options);
+		if (len < hdr_len) {
+			result = -EINVAL;
+			goto error;
+		}
+
+		if (copy_from_user(&dev->tx_opts, in_buf, hdr_len)) {
+			result = -EFAULT;
+			goto error;
+		}
+	}
+
+	pkt_len = min(len - hdr_len, (size_t)128);
+	if (copy_from_user(iface->tx_buf_c, in_buf + hdr_len, pkt_len)) {
 		result = -EFAULT;
 		goto error;
 	}
-	tx_pkt_len = pkt_len;
+	iface->tx_pkt_len = pkt_len;
+
+	// A frame on another channel retunes the radio for the
+	// duration of the send, including waiting for its ACK.
+	prev_channel = -1;
+	if ((dev->tx_opts.flags & CC2520_TX_OPT_CHANNEL) &&
+		dev->tx_opts.channel != cc2520_radio_get_channel(dev)) {
+		prev_channel = cc2520_radio_get_channel(dev);
+		result = cc2520_radio_switch_channel(dev, dev->tx_opts.channel);
+		if (result == -EINVAL)
+			goto error;
+	}
 
-	if (debug_print >= DEBUG_PRINT_DBG) {
-		interface_print_to_log(tx_buf_c, pkt_len, true);
+	if (DBG_ON()) {
+		interface_print_to_log(iface->tx_buf_c, pkt_len, true);
 	}
 
 	// Step 3: Launch off into sending this packet,
 	// wait for an asynchronous callback to occur in
 	// the form of a semaphore.
-	interface_bottom->tx(tx_buf_c, pkt_len);
-	down(&tx_done_sem);
+	dev->tx_submitted = ktime_get_raw_ns();
+	dev->interface_bottom->tx(dev, iface->tx_buf_c, pkt_len);
+	down(&iface->tx_done_sem);
+
+	if (prev_channel >= 0)
+		cc2520_radio_switch_channel(dev, prev_channel);
+	memset(&dev->tx_opts, 0, sizeof(struct cc2520_tx_options));
 
 	// Step 4: Finally return and allow other callers to write
 	// packets.
 	DBG((KERN_INFO "[cc2520] - wrote %d bytes.\n", pkt_len));
-	up(&tx_sem);
-	return tx_result ? tx_result : pkt_len;
+	result = iface->tx_result ? iface->tx_result : hdr_len + pkt_len;
+	up(&iface->tx_sem);
+	trace_cc2520_write(dev->id, len, result);
+	return result;
 
 	error:
-		up(&tx_sem);
-		return -EFAULT;
+		memset(&dev->tx_opts, 0, sizeof(struct cc2520_tx_options));
+		up(&iface->tx_sem);
+		trace_cc2520_write(dev->id, len, result);
+		return result;
+}
+
+// In pcap format one read() returns as many records as are
+// queued and fit in the buffer, preceded by the pcap file
+// header on the first read. It only blocks until there's
+// at least one.
+static ssize_t interface_read_pcap(struct file *filp, char __user *buf, size_t count)
+{
+	struct cc2520_interface_reader *reader = filp->private_data;
+	struct cc2520_rx_frame *frame;
+	u8 rec[CC2520_PCAP_MAX_RECORD];
+	size_t written;
+	size_t rec_len;
+	s64 realtime_offset;
+	int fault;
+
+	if (count < CC2520_PCAP_GLOBAL_HDR_LEN + CC2520_PCAP_MAX_RECORD)
+		return -EINVAL;
+
+	written = 0;
+	if (reader->pcap_header_pending) {
+		rec_len = cc2520_pcap_global_header(rec);
+		if (copy_to_user(buf, rec, rec_len))
+			return -EFAULT;
+		written += rec_len;
+		reader->pcap_header_pending = false;
+	}
+
+	if (!interface_dequeue(reader, &frame)) {
+		if (written)
+			return written;
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(reader->read_queue, interface_dequeue(reader, &frame)))
+			return -ERESTARTSYS;
+	}
+
+	// SFD timestamps are on the raw monotonic clock.
+	realtime_offset = ktime_get_real_ns() - ktime_get_raw_ns();
+
+	do {
+		rec_len = cc2520_pcap_record(rec, &frame->record, frame->data, frame->len, realtime_offset);
+		fault = copy_to_user(buf + written, rec, rec_len);
+		if (!fault)
+			cc2520_hist_record(reader->dev, CC2520_HIST_RX_READ, ktime_get_raw_ns() - frame->received);
+		kref_put(&frame->ref, interface_frame_release);
+
+		if (fault)
+			return written ? written : -EFAULT;
+
+		written += rec_len;
+		reader->stats.read++;
+	} while (count - written >= CC2520_PCAP_MAX_RECORD && interface_dequeue(reader, &frame));
+
+	return written;
 }
 
 static ssize_t interface_read(struct file *filp, char __user *buf, size_t count,
 			loff_t *offp)
 {
-	interruptible_sleep_on(&cc2520_interface_read_queue);
-	if (copy_to_user(buf, rx_buf_c, rx_pkt_len))
-		return -EFAULT;
+	struct cc2520_interface_reader *reader = filp->private_data;
+	struct cc2520_rx_frame *frame;
+	size_t hdr_len;
+	ssize_t result;
+
+	if (reader->rx_format == CC2520_RX_FORMAT_PCAP) {
+		result = interface_read_pcap(filp, buf, count);
+		trace_cc2520_read(reader->dev->id, count, result);
+		return result;
+	}
+
+	hdr_len = 0;
+	if (reader->rx_format == CC2520_RX_FORMAT_RECORD)
+		hdr_len = sizeof(struct cc2520_rx_record);
+
+	// Checked before taking a frame, so a short buffer
+	// doesn't cost the caller one.
+	if (count < hdr_len + PKT_BUFF_SIZE + 1)
+		return -EINVAL;
+
+	if (filp->f_flags & O_NONBLOCK) {
+		if (!interface_dequeue(reader, &frame))
+			return -EAGAIN;
+	}
+	else {
+		if (wait_event_interruptible(reader->read_queue, interface_dequeue(reader, &frame)))
+			return -ERESTARTSYS;
+	}
 
-	if (debug_print >= DEBUG_PRINT_DBG) {
-		interface_print_to_log(rx_buf_c, rx_pkt_len, false);
+	if (hdr_len) {
+		if (copy_to_user(buf, &frame->record, hdr_len)) {
+			result = -EFAULT;
+			goto out;
+		}
+	}
+
+	if (copy_to_user(buf + hdr_len, frame->data, frame->len)) {
+		result = -EFAULT;
+		goto out;
 	}
 
-	return rx_pkt_len;
+	if (DBG_ON()) {
+		interface_print_to_log(frame->data, frame->len, false);
+	}
+
+	cc2520_hist_record(reader->dev, CC2520_HIST_RX_READ, ktime_get_raw_ns() - frame->received);
+	reader->stats.read++;
+	result = hdr_len + frame->len;
+
+	out:
+		kref_put(&frame->ref, interface_frame_release);
+		trace_cc2520_read(reader->dev->id, count, result);
+		return result;
 }
 
 static long interface_ioctl(struct file *file,
 		 unsigned int ioctl_num,
 		 unsigned long ioctl_param)
 {
+	struct cc2520_interface_reader *reader = file->private_data;
+	struct cc2520_dev *dev = reader->dev;
+
 	switch (ioctl_num) {
 		case CC2520_IO_RADIO_INIT:
 			INFO((KERN_INFO "[cc2520] - radio starting\n"));
-			cc2520_radio_start();
+			cc2520_radio_start(dev);
 			break;
 		case CC2520_IO_RADIO_ON:
 			INFO((KERN_INFO "[cc2520] - radio turning on\n"));
-			cc2520_radio_on();
+			cc2520_radio_on(dev);
 			break;
 		case CC2520_IO_RADIO_OFF:
 			INFO((KERN_INFO "[cc2520] - radio turning off\n"));
-			cc2520_radio_off();
+			cc2520_radio_off(dev);
 			break;
 		case CC2520_IO_RADIO_SET_CHANNEL:
-			interface_ioctl_set_channel((struct cc2520_set_channel_data*) ioctl_param);
+			interface_ioctl_set_channel(dev, (struct cc2520_set_channel_data*) ioctl_param);
 			break;
 		case CC2520_IO_RADIO_SET_ADDRESS:
-			interface_ioctl_set_address((struct cc2520_set_address_data*) ioctl_param);
+			interface_ioctl_set_address(dev, (struct cc2520_set_address_data*) ioctl_param);
 			break;
 		case CC2520_IO_RADIO_SET_TXPOWER:
-			interface_ioctl_set_txpower((struct cc2520_set_txpower_data*) ioctl_param);
+			interface_ioctl_set_txpower(dev, (struct cc2520_set_txpower_data*) ioctl_param);
 			break;
 		case CC2520_IO_RADIO_SET_ACK:
-			interface_ioctl_set_ack((struct cc2520_set_ack_data*) ioctl_param);
+			interface_ioctl_set_ack(dev, (struct cc2520_set_ack_data*) ioctl_param);
 			break;
 		case CC2520_IO_RADIO_SET_LPL:
-			interface_ioctl_set_lpl((struct cc2520_set_lpl_data*) ioctl_param);
+			interface_ioctl_set_lpl(dev, (struct cc2520_set_lpl_data*) ioctl_param);
 			break;
 		case CC2520_IO_RADIO_SET_CSMA:
-			interface_ioctl_set_csma((struct cc2520_set_csma_data*) ioctl_param);
+			interface_ioctl_set_csma(dev, (struct cc2520_set_csma_data*) ioctl_param);
 			break;
 		case CC2520_IO_RADIO_SET_PRINT:
-			interface_ioctl_set_print((struct cc2520_set_print_messages_data*) ioctl_param);
+			interface_ioctl_set_print(dev, (struct cc2520_set_print_messages_data*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_GET_SWITCH_STATS:
+			interface_ioctl_get_switch_stats(dev, (struct cc2520_channel_switch_stats*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_SET_RX_FORMAT:
+			interface_ioctl_set_rx_format(reader, (struct cc2520_set_rx_format_data*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_SET_RX_FILTER:
+			interface_ioctl_set_rx_filter(dev, (struct cc2520_set_rx_filter_data*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_GET_RX_FILTER_STATS:
+			interface_ioctl_get_rx_filter_stats(dev, (struct cc2520_rx_filter_stats*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_SET_FRAME_FILTER:
+			interface_ioctl_set_frame_filter(dev, (struct cc2520_set_frame_filter_data*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_SET_PROMISCUOUS:
+			interface_ioctl_set_promiscuous(dev, (struct cc2520_set_promiscuous_data*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_SET_RX_POLL:
+			interface_ioctl_set_rx_poll(dev, (struct cc2520_set_rx_poll_data*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_GET_RX_POLL_STATS:
+			interface_ioctl_get_rx_poll_stats(dev, (struct cc2520_rx_poll_stats*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_ATTACH_FILTER:
+			return interface_ioctl_attach_filter(reader, (struct sock_fprog*) ioctl_param);
+		case CC2520_IO_RADIO_DETACH_FILTER:
+			interface_ioctl_detach_filter(reader);
+			break;
+		case CC2520_IO_RADIO_GET_BPF_STATS:
+			interface_ioctl_get_bpf_stats(reader, (struct cc2520_rx_bpf_stats*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_SET_TSCH:
+			return interface_ioctl_set_tsch(dev, (struct cc2520_set_tsch_data*) ioctl_param);
+		case CC2520_IO_RADIO_GET_TSCH_STATS:
+			interface_ioctl_get_tsch_stats(dev, (struct cc2520_tsch_stats*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_ED_SCAN:
+			return interface_ioctl_ed_scan(dev, (struct cc2520_ed_scan_data*) ioctl_param);
+		case CC2520_IO_RADIO_SET_RSSI_MONITOR:
+			return interface_ioctl_set_rssi_monitor(dev, (struct cc2520_set_rssi_monitor_data*) ioctl_param);
+		case CC2520_IO_RADIO_READ_RSSI_SAMPLES:
+			return interface_ioctl_read_rssi_samples(dev, (struct cc2520_read_rssi_samples_data*) ioctl_param);
+		case CC2520_IO_RADIO_SET_SNIFFER:
+			interface_ioctl_set_sniffer(reader, (struct cc2520_set_sniffer_data*) ioctl_param);
+			break;
+		case CC2520_IO_RADIO_SET_MATCH:
+			return interface_ioctl_set_match(reader, (struct cc2520_set_match_data*) ioctl_param);
+		case CC2520_IO_RADIO_GET_READER_STATS:
+			interface_ioctl_get_reader_stats(reader, (struct cc2520_reader_stats*) ioctl_param);
 			break;
 	}
 
 	return 0;
 }
 
+// Gives the file its own reader on the radio behind
+// the node that was opened.
+static int interface_open(struct inode *inode, struct file *filp)
+{
+	struct cc2520_interface_state *iface;
+	struct cc2520_interface_reader *reader;
+	unsigned long flags;
+
+	iface = container_of(inode->i_cdev, struct cc2520_interface_state, char_d_cdev);
+
+	reader = kzalloc(sizeof(struct cc2520_interface_reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	reader->dev = iface->dev;
+	spin_lock_init(&reader->queue_sl);
+	init_waitqueue_head(&reader->read_queue);
+	mutex_init(&reader->rx_prog_lock);
+
+	spin_lock_irqsave(&iface->readers_sl, flags);
+	list_add_tail(&reader->list, &iface->dispatch[CC2520_DISPATCH_ANY]);
+	spin_unlock_irqrestore(&iface->readers_sl, flags);
+
+	filp->private_data = reader;
+	return 0;
+}
+
+static int interface_release(struct inode *inode, struct file *filp)
+{
+	struct cc2520_interface_reader *reader = filp->private_data;
+	struct cc2520_interface_state *iface = reader->dev->interface;
+	struct cc2520_rx_frame *frame;
+	unsigned long flags;
+
+	spin_lock_irqsave(&iface->readers_sl, flags);
+	list_del(&reader->list);
+	spin_unlock_irqrestore(&iface->readers_sl, flags);
+
+	while (interface_dequeue(reader, &frame))
+		kref_put(&frame->ref, interface_frame_release);
+
+	mutex_lock(&iface->sniffer_lock);
+	interface_stop_sniffing(reader);
+	mutex_unlock(&iface->sniffer_lock);
+
+	interface_swap_filter(reader, NULL);
+	kfree(reader);
+	return 0;
+}
+
 struct file_operations fops = {
 	.read = interface_read,
 	.write = interface_write,
 	.unlocked_ioctl = interface_ioctl,
-	.open = NULL,
-	.release = NULL
+	.open = interface_open,
+	.release = interface_release
 };
 
 /////////////////
 // IOCTL Handlers
 ///////////////////
-static void interface_ioctl_set_print(struct cc2520_set_print_messages_data *data)
+static void interface_ioctl_set_print(struct cc2520_dev *dev, struct cc2520_set_print_messages_data *data)
 {
 	int result;
 	struct cc2520_set_print_messages_data ldata;
@@ -237,10 +789,10 @@ static void interface_ioctl_set_print(struct cc2520_set_print_messages_data *dat
 
 	INFO((KERN_INFO "[cc2520] - setting debug message print: %i", ldata.debug_level));
 
-	debug_print = ldata.debug_level;
+	cc2520_set_debug_level(ldata.debug_level);
 }
 
-static void interface_ioctl_set_channel(struct cc2520_set_channel_data *data)
+static void interface_ioctl_set_channel(struct cc2520_dev *dev, struct cc2520_set_channel_data *data)
 {
 	int result;
 	struct cc2520_set_channel_data ldata;
@@ -253,10 +805,28 @@ static void interface_ioctl_set_channel(struct cc2520_set_channel_data *data)
 	}
 
 	INFO((KERN_INFO "[cc2520] - Setting channel to %d\n", ldata.channel));
-	cc2520_radio_set_channel(ldata.channel);
+	result = cc2520_radio_switch_channel(dev, ldata.channel);
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - channel switch to %d failed: %d\n", ldata.channel, result));
+	}
 }
 
-static void interface_ioctl_set_address(struct cc2520_set_address_data *data)
+static void interface_ioctl_get_switch_stats(struct cc2520_dev *dev, struct cc2520_channel_switch_stats *data)
+{
+	int result;
+	struct cc2520_channel_switch_stats ldata;
+
+	cc2520_radio_get_switch_stats(dev, &ldata);
+
+	result = copy_to_user(data, &ldata, sizeof(struct cc2520_channel_switch_stats));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred reading switch stats\n"));
+	}
+}
+
+static void interface_ioctl_set_address(struct cc2520_dev *dev, struct cc2520_set_address_data *data)
 {
 	int result;
 	struct cc2520_set_address_data ldata;
@@ -269,10 +839,10 @@ static void interface_ioctl_set_address(struct cc2520_set_address_data *data)
 
 	INFO((KERN_INFO "[cc2520] - setting addr: %d ext_addr: %lld pan_id: %d\n",
 		ldata.short_addr, ldata.extended_addr, ldata.pan_id));
-	cc2520_radio_set_address(ldata.short_addr, ldata.extended_addr, ldata.pan_id);
+	cc2520_radio_set_address(dev, ldata.short_addr, ldata.extended_addr, ldata.pan_id);
 }
 
-static void interface_ioctl_set_txpower(struct cc2520_set_txpower_data *data)
+static void interface_ioctl_set_txpower(struct cc2520_dev *dev, struct cc2520_set_txpower_data *data)
 {
 	int result;
 	struct cc2520_set_txpower_data ldata;
@@ -284,10 +854,10 @@ static void interface_ioctl_set_txpower(struct cc2520_set_txpower_data *data)
 	}
 
 	INFO((KERN_INFO "[cc2520] - setting txpower: %d\n", ldata.txpower));
-	cc2520_radio_set_txpower(ldata.txpower);
+	cc2520_radio_set_txpower(dev, ldata.txpower);
 }
 
-static void interface_ioctl_set_ack(struct cc2520_set_ack_data *data)
+static void interface_ioctl_set_ack(struct cc2520_dev *dev, struct cc2520_set_ack_data *data)
 {
 	int result;
 	struct cc2520_set_ack_data ldata;
@@ -299,10 +869,10 @@ static void interface_ioctl_set_ack(struct cc2520_set_ack_data *data)
 	}
 
 	INFO((KERN_INFO "[cc2520] - setting softack timeout: %d\n", ldata.timeout));
-	cc2520_sack_set_timeout(ldata.timeout);
+	cc2520_sack_set_timeout(dev, ldata.timeout);
 }
 
-static void interface_ioctl_set_lpl(struct cc2520_set_lpl_data *data)
+static void interface_ioctl_set_lpl(struct cc2520_dev *dev, struct cc2520_set_lpl_data *data)
 {
 	int result;
 	struct cc2520_set_lpl_data ldata;
@@ -315,12 +885,12 @@ static void interface_ioctl_set_lpl(struct cc2520_set_lpl_data *data)
 
 	INFO((KERN_INFO "[cc2520] - setting lpl enabled: %d, window: %d, interval: %d\n",
 		ldata.enabled, ldata.window, ldata.interval));
-	cc2520_lpl_set_enabled(ldata.enabled);
-	cc2520_lpl_set_listen_length(ldata.window);
-	cc2520_lpl_set_wakeup_interval(ldata.interval);
+	cc2520_lpl_set_enabled(dev, ldata.enabled);
+	cc2520_lpl_set_listen_length(dev, ldata.window);
+	cc2520_lpl_set_wakeup_interval(dev, ldata.interval);
 }
 
-static void interface_ioctl_set_csma(struct cc2520_set_csma_data *data)
+static void interface_ioctl_set_csma(struct cc2520_dev *dev, struct cc2520_set_csma_data *data)
 {
 	int result;
 	struct cc2520_set_csma_data ldata;
@@ -333,69 +903,475 @@ static void interface_ioctl_set_csma(struct cc2520_set_csma_data *data)
 
 	INFO((KERN_INFO "[cc2520] - setting csma enabled: %d, min_backoff: %d, init_backoff: %d, cong_backoff_ %d\n",
 		ldata.enabled, ldata.min_backoff, ldata.init_backoff, ldata.cong_backoff));
-	cc2520_csma_set_enabled(ldata.enabled);
-	cc2520_csma_set_min_backoff(ldata.min_backoff);
-	cc2520_csma_set_init_backoff(ldata.init_backoff);
-	cc2520_csma_set_cong_backoff(ldata.cong_backoff);
+	cc2520_csma_set_enabled(dev, ldata.enabled);
+	cc2520_csma_set_min_backoff(dev, ldata.min_backoff);
+	cc2520_csma_set_init_backoff(dev, ldata.init_backoff);
+	cc2520_csma_set_cong_backoff(dev, ldata.cong_backoff);
+}
+
+// Holds off writes for the length of the scan so nothing
+// gets sent on whichever channel it happens to be on.
+static int interface_ioctl_ed_scan(struct cc2520_dev *dev, struct cc2520_ed_scan_data *data)
+{
+	struct cc2520_interface_state *iface = dev->interface;
+	struct cc2520_ed_scan_data ldata;
+	int result;
+
+	if (copy_from_user(&ldata, data, sizeof(struct cc2520_ed_scan_data))) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred starting an ed scan\n"));
+		return -EFAULT;
+	}
+
+	if (down_interruptible(&iface->tx_sem))
+		return -ERESTARTSYS;
+
+	INFO((KERN_INFO "[cc2520] - ed scan mask: 0x%08X dwell: %d interval: %d\n",
+		ldata.channel_mask, ldata.dwell, ldata.interval));
+	result = cc2520_radio_ed_scan(dev, &ldata);
+
+	up(&iface->tx_sem);
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - ed scan failed: %d\n", result));
+		return result;
+	}
+
+	if (copy_to_user(data, &ldata, sizeof(struct cc2520_ed_scan_data)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int interface_ioctl_set_rssi_monitor(struct cc2520_dev *dev, struct cc2520_set_rssi_monitor_data *data)
+{
+	struct cc2520_set_rssi_monitor_data ldata;
+
+	if (copy_from_user(&ldata, data, sizeof(struct cc2520_set_rssi_monitor_data))) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred setting the rssi monitor\n"));
+		return -EFAULT;
+	}
+
+	return cc2520_monitor_set(dev, ldata.enabled, ldata.rate);
+}
+
+static int interface_ioctl_read_rssi_samples(struct cc2520_dev *dev, struct cc2520_read_rssi_samples_data *data)
+{
+	struct cc2520_read_rssi_samples_data ldata;
+	int result;
+
+	if (copy_from_user(&ldata, data, sizeof(struct cc2520_read_rssi_samples_data))) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred reading rssi samples\n"));
+		return -EFAULT;
+	}
+
+	result = cc2520_monitor_read(dev, ldata.samples, ldata.count, &ldata.overruns);
+	if (result < 0)
+		return result;
+
+	ldata.count = result;
+	if (copy_to_user(data, &ldata, sizeof(struct cc2520_read_rssi_samples_data)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int interface_ioctl_set_tsch(struct cc2520_dev *dev, struct cc2520_set_tsch_data *data)
+{
+	struct cc2520_set_tsch_data ldata;
+	int result;
+
+	if (copy_from_user(&ldata, data, sizeof(struct cc2520_set_tsch_data))) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred setting tsch\n"));
+		return -EFAULT;
+	}
+
+	INFO((KERN_INFO "[cc2520] - setting tsch enabled: %d\n", ldata.enabled));
+	result = cc2520_tsch_set_config(dev, &ldata);
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - rejected tsch schedule: %d\n", result));
+	}
+
+	return result;
+}
+
+static void interface_ioctl_get_tsch_stats(struct cc2520_dev *dev, struct cc2520_tsch_stats *data)
+{
+	int result;
+	struct cc2520_tsch_stats ldata;
+
+	cc2520_tsch_get_stats(dev, &ldata);
+
+	result = copy_to_user(data, &ldata, sizeof(struct cc2520_tsch_stats));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred reading tsch stats\n"));
+	}
+}
+
+static void interface_ioctl_set_rx_format(struct cc2520_interface_reader *reader, struct cc2520_set_rx_format_data *data)
+{
+	int result;
+	struct cc2520_set_rx_format_data ldata;
+
+	result = copy_from_user(&ldata, data, sizeof(struct cc2520_set_rx_format_data));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred setting the rx format\n"));
+		return;
+	}
+
+	INFO((KERN_INFO "[cc2520] - setting rx format: %d\n", ldata.format));
+	reader->rx_format = ldata.format;
+	reader->pcap_header_pending = ldata.format == CC2520_RX_FORMAT_PCAP;
+}
+
+static void interface_ioctl_set_rx_filter(struct cc2520_dev *dev, struct cc2520_set_rx_filter_data *data)
+{
+	int result;
+	struct cc2520_set_rx_filter_data ldata;
+
+	result = copy_from_user(&ldata, data, sizeof(struct cc2520_set_rx_filter_data));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred setting the rx filter\n"));
+		return;
+	}
+
+	INFO((KERN_INFO "[cc2520] - setting rx filter crc: %d, min_rssi: %d, min_lqi: %d\n",
+		ldata.crc, ldata.min_rssi, ldata.min_lqi));
+	cc2520_filter_set_crc(dev, ldata.crc);
+	cc2520_filter_set_min_rssi(dev, ldata.min_rssi);
+	cc2520_filter_set_min_lqi(dev, ldata.min_lqi);
+}
+
+static void interface_ioctl_get_rx_filter_stats(struct cc2520_dev *dev, struct cc2520_rx_filter_stats *data)
+{
+	int result;
+	struct cc2520_rx_filter_stats ldata;
+
+	cc2520_filter_get_stats(dev, &ldata);
+
+	result = copy_to_user(data, &ldata, sizeof(struct cc2520_rx_filter_stats));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred reading rx filter stats\n"));
+	}
+}
+
+static void interface_ioctl_set_frame_filter(struct cc2520_dev *dev, struct cc2520_set_frame_filter_data *data)
+{
+	int result;
+	struct cc2520_set_frame_filter_data ldata;
+
+	result = copy_from_user(&ldata, data, sizeof(struct cc2520_set_frame_filter_data));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred setting the frame filter\n"));
+		return;
+	}
+
+	INFO((KERN_INFO "[cc2520] - setting frame filter enabled: %d, pan_coord: %d, max_version: %d, types: 0x%02X\n",
+		ldata.enabled, ldata.pan_coordinator, ldata.max_frame_version, ldata.frame_types));
+	cc2520_radio_set_frame_filter(dev, ldata.enabled, ldata.pan_coordinator,
+		ldata.max_frame_version, ldata.frame_types);
+}
+
+static void interface_ioctl_set_promiscuous(struct cc2520_dev *dev, struct cc2520_set_promiscuous_data *data)
+{
+	int result;
+	struct cc2520_set_promiscuous_data ldata;
+
+	result = copy_from_user(&ldata, data, sizeof(struct cc2520_set_promiscuous_data));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred setting promiscuous mode\n"));
+		return;
+	}
+
+	INFO((KERN_INFO "[cc2520] - setting promiscuous: %d\n", ldata.enabled));
+	cc2520_radio_set_promiscuous(dev, ldata.enabled);
+}
+
+static void interface_ioctl_set_rx_poll(struct cc2520_dev *dev, struct cc2520_set_rx_poll_data *data)
+{
+	int result;
+	struct cc2520_set_rx_poll_data ldata;
+
+	result = copy_from_user(&ldata, data, sizeof(struct cc2520_set_rx_poll_data));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred setting rx polling\n"));
+		return;
+	}
+
+	INFO((KERN_INFO "[cc2520] - setting rx polling: %d budget: %d\n", ldata.enabled, ldata.budget));
+	cc2520_radio_set_rx_poll(dev, ldata.enabled, ldata.budget);
+}
+
+static void interface_ioctl_get_rx_poll_stats(struct cc2520_dev *dev, struct cc2520_rx_poll_stats *data)
+{
+	int result;
+	struct cc2520_rx_poll_stats ldata;
+
+	cc2520_radio_get_rx_poll_stats(dev, &ldata);
+
+	result = copy_to_user(data, &ldata, sizeof(struct cc2520_rx_poll_stats));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred reading rx poll stats\n"));
+	}
+}
+
+// Swaps in a new program, waiting out any RX still
+// running the old one before destroying it.
+static void interface_swap_filter(struct cc2520_interface_reader *reader, struct bpf_prog *prog)
+{
+	struct bpf_prog *old;
+
+	mutex_lock(&reader->rx_prog_lock);
+	old = rcu_dereference_protected(reader->rx_prog,
+		lockdep_is_held(&reader->rx_prog_lock));
+	rcu_assign_pointer(reader->rx_prog, prog);
+	mutex_unlock(&reader->rx_prog_lock);
+
+	if (old) {
+		synchronize_rcu();
+		bpf_prog_destroy(old);
+	}
+}
+
+static int interface_ioctl_attach_filter(struct cc2520_interface_reader *reader, struct sock_fprog *data)
+{
+	struct sock_fprog ldata;
+	struct bpf_prog *prog;
+	int result;
+
+	if (copy_from_user(&ldata, data, sizeof(struct sock_fprog))) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred attaching a filter\n"));
+		return -EFAULT;
+	}
+
+	result = bpf_prog_create_from_user(&prog, &ldata, NULL, false);
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - rejected bpf filter: %d\n", result));
+		return result;
+	}
+
+	INFO((KERN_INFO "[cc2520] - attaching bpf filter, %d instructions\n", ldata.len));
+	interface_swap_filter(reader, prog);
+	memset(&reader->bpf_stats, 0, sizeof(struct cc2520_rx_bpf_stats));
+	return 0;
+}
+
+static void interface_ioctl_detach_filter(struct cc2520_interface_reader *reader)
+{
+	INFO((KERN_INFO "[cc2520] - detaching bpf filter\n"));
+	interface_swap_filter(reader, NULL);
+}
+
+static void interface_ioctl_get_bpf_stats(struct cc2520_interface_reader *reader, struct cc2520_rx_bpf_stats *data)
+{
+	int result;
+
+	result = copy_to_user(data, &reader->bpf_stats, sizeof(struct cc2520_rx_bpf_stats));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred reading bpf stats\n"));
+	}
+}
+
+static void interface_ioctl_get_reader_stats(struct cc2520_interface_reader *reader, struct cc2520_reader_stats *data)
+{
+	int result;
+
+	result = copy_to_user(data, &reader->stats, sizeof(struct cc2520_reader_stats));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred reading reader stats\n"));
+	}
+}
+
+// Moves the reader into the dispatch bucket for the
+// frame type it asked for.
+static int interface_ioctl_set_match(struct cc2520_interface_reader *reader, struct cc2520_set_match_data *data)
+{
+	struct cc2520_interface_state *iface = reader->dev->interface;
+	struct cc2520_set_match_data ldata;
+	unsigned long flags;
+	int bucket;
+
+	if (copy_from_user(&ldata, data, sizeof(struct cc2520_set_match_data))) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred setting the match rule\n"));
+		return -EFAULT;
+	}
+
+	if (ldata.frame_type > IEEE154_TYPE_MASK)
+		return -EINVAL;
+
+	INFO((KERN_INFO "[cc2520] - setting match fields: 0x%02X type: %d dst: 0x%04X ext: %lld pan: 0x%04X dispatch: 0x%02X\n",
+		ldata.fields, ldata.frame_type, ldata.dst_short, ldata.dst_ext, ldata.pan_id, ldata.dispatch));
+
+	if (ldata.fields & CC2520_MATCH_FRAME_TYPE)
+		bucket = ldata.frame_type;
+	else
+		bucket = CC2520_DISPATCH_ANY;
+
+	spin_lock_irqsave(&iface->readers_sl, flags);
+	reader->match = ldata;
+	list_move_tail(&reader->list, &iface->dispatch[bucket]);
+	spin_unlock_irqrestore(&iface->readers_sl, flags);
+
+	return 0;
+}
+
+// Sniffing is promiscuous mode plus the pcap read format.
+// Promiscuous mode is radio wide, so every other reader
+// sees the extra traffic too, for as long as any reader
+// is sniffing.
+static void interface_ioctl_set_sniffer(struct cc2520_interface_reader *reader, struct cc2520_set_sniffer_data *data)
+{
+	struct cc2520_interface_state *iface = reader->dev->interface;
+	int result;
+	struct cc2520_set_sniffer_data ldata;
+
+	result = copy_from_user(&ldata, data, sizeof(struct cc2520_set_sniffer_data));
+
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - an error occurred setting sniffer mode\n"));
+		return;
+	}
+
+	INFO((KERN_INFO "[cc2520] - setting sniffer: %d\n", ldata.enabled));
+
+	mutex_lock(&iface->sniffer_lock);
+	if (ldata.enabled && !reader->sniffer) {
+		reader->sniffer = true;
+		reader->sniffer_prev_format = reader->rx_format;
+		reader->rx_format = CC2520_RX_FORMAT_PCAP;
+		reader->pcap_header_pending = true;
+		if (iface->sniffers++ == 0)
+			cc2520_radio_set_promiscuous(reader->dev, true);
+	}
+	else if (!ldata.enabled) {
+		interface_stop_sniffing(reader);
+	}
+	mutex_unlock(&iface->sniffer_lock);
+}
+
+// Drops the reader's hold on promiscuous mode, turning it
+// off once nobody's sniffing. Called with sniffer_lock held.
+static void interface_stop_sniffing(struct cc2520_interface_reader *reader)
+{
+	struct cc2520_interface_state *iface = reader->dev->interface;
+
+	if (!reader->sniffer)
+		return;
+
+	reader->sniffer = false;
+	reader->rx_format = reader->sniffer_prev_format;
+	reader->pcap_header_pending = false;
+	if (--iface->sniffers == 0)
+		cc2520_radio_set_promiscuous(reader->dev, false);
 }
 
 /////////////////
 // init/free
 ///////////////////
 
-int cc2520_interface_init()
+int cc2520_interface_class_init()
 {
 	int result;
 
-	interface_bottom->tx_done = cc2520_interface_tx_done;
-	interface_bottom->rx_done = cc2520_interface_rx_done;
+	// Allocate a major number for all the radios
+	result = alloc_chrdev_region(&char_d_mm, 0, CC2520_MAX_RADIOS, cc2520_name);
+	if (result < 0) {
+		ERR((KERN_INFO "[cc2520] - Could not allocate a major number\n"));
+		return result;
+	}
+	major = MAJOR(char_d_mm);
+
+	cl = class_create(THIS_MODULE, "cc2520");
+	if (IS_ERR_OR_NULL(cl)) {
+		ERR((KERN_INFO "[cc2520] - Could not create device class\n"));
+		unregister_chrdev_region(char_d_mm, CC2520_MAX_RADIOS);
+		return -EFAULT;
+	}
 
-	sema_init(&tx_sem, 1);
-	sema_init(&rx_sem, 1);
+	return 0;
+}
 
-	sema_init(&tx_done_sem, 0);
-	sema_init(&rx_done_sem, 0);
+void cc2520_interface_class_free()
+{
+	class_destroy(cl);
+	unregister_chrdev_region(char_d_mm, CC2520_MAX_RADIOS);
+}
 
-	tx_buf_c = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
-	if (!tx_buf_c) {
-		result = -EFAULT;
+int cc2520_interface_init(struct cc2520_dev *dev)
+{
+	struct cc2520_interface_state *iface;
+	dev_t devno;
+	int result;
+	int i;
+
+	iface = kzalloc(sizeof(struct cc2520_interface_state), GFP_KERNEL);
+	if (!iface)
+		return -ENOMEM;
+
+	iface->dev = dev;
+	dev->interface = iface;
+
+	dev->interface_bottom->tx_done = cc2520_interface_tx_done;
+	dev->interface_bottom->rx_done = cc2520_interface_rx_done;
+
+	sema_init(&iface->tx_sem, 1);
+	sema_init(&iface->rx_sem, 1);
+
+	sema_init(&iface->tx_done_sem, 0);
+	sema_init(&iface->rx_done_sem, 0);
+
+	for (i = 0; i < CC2520_DISPATCH_BUCKETS; i++)
+		INIT_LIST_HEAD(&iface->dispatch[i]);
+	spin_lock_init(&iface->readers_sl);
+	mutex_init(&iface->sniffer_lock);
+
+	iface->rx_skb = alloc_skb(PKT_BUFF_SIZE, GFP_KERNEL);
+	if (!iface->rx_skb) {
+		result = -ENOMEM;
 		goto error;
 	}
 
-	rx_buf_c = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
-	if (!rx_buf_c) {
+	iface->tx_buf_c = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
+	if (!iface->tx_buf_c) {
 		result = -EFAULT;
 		goto error;
 	}
 
-	// Allocate a major number for this device
-	result = alloc_chrdev_region(&char_d_mm, 0, 1, cc2520_name);
-	if (result < 0) {
-		ERR((KERN_INFO "[cc2520] - Could not allocate a major number\n"));
-		goto error;
-	}
-	major = MAJOR(char_d_mm);
+	devno = MKDEV(major, dev->id);
 
 	// Register the character device
-	cdev_init(&char_d_cdev, &fops);
-	char_d_cdev.owner = THIS_MODULE;
-	result = cdev_add(&char_d_cdev, char_d_mm, 1);
+	cdev_init(&iface->char_d_cdev, &fops);
+	iface->char_d_cdev.owner = THIS_MODULE;
+	result = cdev_add(&iface->char_d_cdev, devno, 1);
 	if (result < 0) {
 		ERR((KERN_INFO "[cc2520] - Unable to register char dev\n"));
 		goto error;
 	}
-	INFO((KERN_INFO "[cc2520] - Char interface registered on %d\n", major));
+	INFO((KERN_INFO "[cc2520] - Char interface registered on %d:%d\n", major, dev->id));
 
-	cl = class_create(THIS_MODULE, "cc2520");
-	if (cl == NULL) {
-		ERR((KERN_INFO "[cc2520] - Could not create device class\n"));
+	// Create the device in /dev/radioN
+	iface->de = device_create(cl, NULL, devno, dev, "radio%d", dev->id);
+	if (IS_ERR_OR_NULL(iface->de)) {
+		ERR((KERN_INFO "[cc2520] - Could not create device\n"));
+		cdev_del(&iface->char_d_cdev);
+		result = -EFAULT;
 		goto error;
 	}
 
-	// Create the device in /dev/radio
-	de = device_create(cl, NULL, char_d_mm, NULL, "radio");
-	if (de == NULL) {
-		ERR((KERN_INFO "[cc2520] - Could not create device\n"));
+	result = cc2520_stats_register(dev, iface->de);
+	if (result) {
+		device_destroy(cl, devno);
+		cdev_del(&iface->char_d_cdev);
 		goto error;
 	}
 
@@ -403,48 +1379,48 @@ int cc2520_interface_init()
 
 	error:
 
-	if (rx_buf_c) {
-		kfree(rx_buf_c);
-		rx_buf_c = 0;
+	if (iface->tx_buf_c) {
+		kfree(iface->tx_buf_c);
+		iface->tx_buf_c = 0;
 	}
 
-	if (tx_buf_c) {
-		kfree(tx_buf_c);
-		tx_buf_c = 0;
-	}
+	if (iface->rx_skb)
+		kfree_skb(iface->rx_skb);
+
+	kfree(iface);
+	dev->interface = NULL;
 
 	return result;
 }
 
-void cc2520_interface_free()
+void cc2520_interface_free(struct cc2520_dev *dev)
 {
+	struct cc2520_interface_state *iface = dev->interface;
 	int result;
 
-	result = down_interruptible(&tx_sem);
+	result = down_interruptible(&iface->tx_sem);
 	if (result) {
 		ERR(("[cc2520] - critical error occurred on free."));
 	}
 
-	result = down_interruptible(&rx_sem);
+	result = down_interruptible(&iface->rx_sem);
 	if (result) {
 		ERR(("[cc2520] - critical error occurred on free."));
 	}
 
-	cdev_del(&char_d_cdev);
-	unregister_chrdev(char_d_mm, cc2520_name);
-	device_destroy(cl, char_d_mm);
-	class_destroy(cl);
-
+	cc2520_stats_unregister(dev, iface->de);
+	device_destroy(cl, MKDEV(major, dev->id));
+	cdev_del(&iface->char_d_cdev);
 
 	INFO((KERN_INFO "[cc2520] - Removed character device\n"));
 
-	if (rx_buf_c) {
-		kfree(rx_buf_c);
-		rx_buf_c = 0;
+	if (iface->tx_buf_c) {
+		kfree(iface->tx_buf_c);
+		iface->tx_buf_c = 0;
 	}
 
-	if (tx_buf_c) {
-		kfree(tx_buf_c);
-		tx_buf_c = 0;
-	}
+	kfree_skb(iface->rx_skb);
+
+	kfree(iface);
+	dev->interface = NULL;
 }
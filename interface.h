@@ -1,10 +1,13 @@
 #ifndef INTERFACE_H
 #define INTERFACE_H
 
-// Interface
-int cc2520_interface_init(void);
-void cc2520_interface_free(void);
+struct cc2520_dev;
 
-extern struct cc2520_interface *interface_bottom;
+// Interface
+int cc2520_interface_class_init(void);
+void cc2520_interface_class_free(void);
+int cc2520_interface_init(struct cc2520_dev *dev);
+void cc2520_interface_free(struct cc2520_dev *dev);
+int cc2520_interface_kernel_tx(struct cc2520_dev *dev, u8 *buf, u8 len);
 
 #endif
@@ -1,20 +1,37 @@
+#ifndef CC2520_IOCTL_H
+#define CC2520_IOCTL_H
+
 #include <asm/ioctl.h>
 #include <linux/types.h>
+#include <linux/filter.h>
 #define BASE 0xCC
 
 #ifndef __KERNEL__
 #include <inttypes.h>
 #include <stdbool.h>
+typedef int8_t s8;
 typedef uint8_t u8;
 typedef uint16_t u16;
+typedef int32_t s32;
 typedef uint32_t u32;
-typedef uint64_t u64;
+typedef unsigned long long u64;
 #endif
 
 struct cc2520_set_channel_data {
 	u8 channel;
 };
 
+// Cumulative channel switch timing, in nanoseconds.
+// A lock timeout means the PLL didn't report lock within
+// the poll budget, the radio is likely deaf until it does.
+struct cc2520_channel_switch_stats {
+	u32 count;
+	u32 lock_timeouts;
+	u64 last_ns;
+	u64 max_ns;
+	u64 total_ns;
+};
+
 struct cc2520_set_address_data {
 	u16 short_addr;
 	u64 extended_addr;
@@ -38,6 +55,237 @@ struct cc2520_set_csma_data {
 	bool enabled;
 };
 
+// Optional per-frame transmit options. A write() whose first byte
+// is CC2520_TX_OPTIONS_MAGIC carries this header directly ahead of
+// the frame. A valid 802.15.4 length never exceeds 127, so it can't
+// be confused with a plain frame. Only the fields flagged in flags
+// override the global configuration, and only for that one frame.
+#define CC2520_TX_OPTIONS_MAGIC 0xC5
+
+#define CC2520_TX_OPT_TXPOWER (1 << 0)
+#define CC2520_TX_OPT_CHANNEL (1 << 1)
+#define CC2520_TX_OPT_RETRIES (1 << 2)
+#define CC2520_TX_OPT_CSMA    (1 << 3)
+#define CC2520_TX_OPT_LPL     (1 << 4)
+
+struct cc2520_tx_options {
+	u8 magic;
+	u8 flags;
+	u8 txpower;
+	u8 channel;
+	u8 max_retries;
+	u8 csma_enabled;
+	u32 lpl_interval; // 0 disables LPL for this frame
+} __attribute__((packed));
+
+// Selects what read() returns. The raw format is the frame
+// as described in the manual. The record format prefixes each
+// frame with a struct cc2520_rx_record. The pcap format is
+// a pcap stream (LINKTYPE_IEEE802_15_4_TAP) with as many
+// frames per read as fit.
+#define CC2520_RX_FORMAT_RAW 0
+#define CC2520_RX_FORMAT_RECORD 1
+#define CC2520_RX_FORMAT_PCAP 2
+
+struct cc2520_set_rx_format_data {
+	u8 format;
+};
+
+struct cc2520_rx_record {
+	u64 timestamp; // SFD rising edge, raw monotonic clock in nS
+	u32 duration;  // SFD rising to falling edge in nS
+	s8 rssi;       // dBm
+	u8 lqi;
+	u8 crc_ok;
+	u8 channel;
+} __attribute__((packed));
+
+// Frames failing any enabled check are dropped right
+// after they're read out of the radio. A min_rssi of -128
+// and a min_lqi of 0 turn the respective check off.
+struct cc2520_set_rx_filter_data {
+	bool crc;
+	s8 min_rssi;
+	u8 min_lqi;
+};
+
+struct cc2520_rx_filter_stats {
+	u32 passed;
+	u32 dropped_crc;
+	u32 dropped_rssi;
+	u32 dropped_lqi;
+};
+
+// Hardware frame filtering. With it enabled the radio
+// discards frames not addressed to the PAN ID and short or
+// extended address set with CC2520_IO_RADIO_SET_ADDRESS, or
+// whose type isn't in frame_types, before they ever reach
+// the FIFO.
+#define CC2520_FRAME_TYPE_BEACON   (1 << 0)
+#define CC2520_FRAME_TYPE_DATA     (1 << 1)
+#define CC2520_FRAME_TYPE_ACK      (1 << 2)
+#define CC2520_FRAME_TYPE_MAC_CMD  (1 << 3)
+#define CC2520_FRAME_TYPE_RESERVED (1 << 4)
+#define CC2520_FRAME_TYPE_ALL      0x1F
+
+struct cc2520_set_frame_filter_data {
+	bool enabled;
+	bool pan_coordinator;
+	u8 max_frame_version;
+	u8 frame_types;
+};
+
+// Promiscuous mode turns hardware filtering off regardless
+// of the frame filter setting, for sniffing.
+struct cc2520_set_promiscuous_data {
+	bool enabled;
+};
+
+// Polling mode for RX under heavy traffic. After the first
+// FIFOP interrupt the driver masks it and reads the FIFO
+// from a kernel thread, up to budget frames at a time
+// (0 for the default), until traffic stops.
+struct cc2520_set_rx_poll_data {
+	bool enabled;
+	u8 budget;
+};
+
+struct cc2520_rx_poll_stats {
+	u32 irqs;      // FIFOP interrupts that started a session
+	u32 polled;    // frames read by the poll thread
+	u32 sessions;  // times the poll thread woke up
+};
+
+// A classic BPF program (struct sock_fprog, as used with
+// SO_ATTACH_FILTER) can be attached with
+// CC2520_IO_RADIO_ATTACH_FILTER. It sees the MAC frame
+// without the length byte, and frames it returns 0 for
+// never reach read().
+struct cc2520_rx_bpf_stats {
+	u32 accepted;
+	u32 filtered;
+};
+
+// Per open file RX queue counters. Frames are dropped when
+// the reader falls more than CC2520_RX_QUEUE_LEN behind.
+struct cc2520_reader_stats {
+	u32 queued;
+	u32 read;
+	u32 dropped;
+};
+
+// Binds an open file to the frames it cares about. Only the
+// fields flagged in fields are compared, a frame is delivered
+// if all of them match. With no fields set, the default, the
+// file gets everything. dispatch is the first payload byte
+// after the MAC header, the 6LoWPAN dispatch or TinyOS AM
+// network byte.
+#define CC2520_MATCH_FRAME_TYPE (1 << 0)
+#define CC2520_MATCH_DST_SHORT  (1 << 1)
+#define CC2520_MATCH_DST_EXT    (1 << 2)
+#define CC2520_MATCH_PAN        (1 << 3)
+#define CC2520_MATCH_DISPATCH   (1 << 4)
+
+struct cc2520_set_match_data {
+	u8 fields;
+	u8 frame_type; // 0 beacon, 1 data, 2 ack, 3 MAC command
+	u16 dst_short;
+	u64 dst_ext;
+	u16 pan_id;
+	u8 dispatch;
+};
+
+// Sniffer mode: promiscuous mode, and the pcap read
+// format for the file it's set on.
+struct cc2520_set_sniffer_data {
+	bool enabled;
+};
+
+// TSCH. The slotframe repeats every slotframe_length slots,
+// and each cell gives a slot in it to transmit or listen in.
+// A cell's channel is hopping[(asn + channel_offset) %
+// hopping_length]. time_source is the short or extended
+// address of the neighbour we keep our slots lined up with,
+// 0 if we're the one everybody else follows. asn is the
+// slot number to start counting from.
+#define CC2520_TSCH_MAX_CELLS 32
+#define CC2520_TSCH_MAX_HOPPING 16
+
+#define CC2520_TSCH_CELL_TX (1 << 0)
+#define CC2520_TSCH_CELL_RX (1 << 1)
+
+struct cc2520_tsch_cell {
+	u16 slot_offset;
+	u8 channel_offset;
+	u8 flags;
+};
+
+struct cc2520_set_tsch_data {
+	bool enabled;
+	u32 slot_length; // uS, 0 for the default
+	u32 tx_offset;   // uS from slot start to SFD, 0 for the default
+	u16 slotframe_length;
+	u8 num_cells;
+	u8 hopping_length;
+	u8 hopping[CC2520_TSCH_MAX_HOPPING];
+	struct cc2520_tsch_cell cells[CC2520_TSCH_MAX_CELLS];
+	u64 time_source;
+	u64 asn;
+};
+
+struct cc2520_tsch_stats {
+	u64 asn;
+	u32 tx;
+	u32 syncs;
+	s32 last_correction; // nS
+};
+
+// Energy detect scan. Each channel set in channel_mask
+// (bit 11 for channel 11 and so on) is listened to for dwell
+// uS, reading the RSSI every interval uS. Samples at or
+// above busy_threshold dBm count as busy. 0 for any of
+// those gets the default. Results are indexed by
+// channel - 11.
+#define CC2520_ED_CHANNELS 16
+
+struct cc2520_ed_channel_result {
+	s8 max_rssi;  // dBm
+	s8 mean_rssi; // dBm
+	u16 busy;     // fraction of busy samples, per mille
+	u16 samples;
+};
+
+struct cc2520_ed_scan_data {
+	u32 channel_mask;
+	u32 dwell;
+	u32 interval;
+	s8 busy_threshold;
+	struct cc2520_ed_channel_result results[CC2520_ED_CHANNELS];
+};
+
+// RSSI monitor. While enabled the RSSI is sampled rate
+// times a second into a ring, which is drained in batches
+// with READ_RSSI_SAMPLES. That fills in up to count samples,
+// sets count to how many it got and overruns to how many
+// were lost to a full ring since the monitor was enabled.
+struct cc2520_set_rssi_monitor_data {
+	bool enabled;
+	u32 rate; // Hz
+};
+
+struct cc2520_rssi_sample {
+	u64 timestamp; // nS, CLOCK_MONOTONIC_RAW
+	s8 rssi;       // dBm
+	u8 valid;      // RSSI_VALID at the time of the read
+	u8 reserved[6];
+};
+
+struct cc2520_read_rssi_samples_data {
+	u32 count;
+	u32 overruns;
+	struct cc2520_rssi_sample *samples;
+};
+
 struct cc2520_set_print_messages_data {
 	u8 debug_level;
 };
@@ -67,3 +315,24 @@ struct cc2520_set_txpower_data {
 #define CC2520_IO_RADIO_SET_LPL _IOW(BASE, 7, struct cc2520_set_lpl_data)
 #define CC2520_IO_RADIO_SET_CSMA _IOW(BASE, 8, struct cc2520_set_csma_data)
 #define CC2520_IO_RADIO_SET_PRINT _IOW(BASE, 9, struct cc2520_set_print_messages_data)
+#define CC2520_IO_RADIO_GET_SWITCH_STATS _IOR(BASE, 10, struct cc2520_channel_switch_stats)
+#define CC2520_IO_RADIO_SET_RX_FORMAT _IOW(BASE, 11, struct cc2520_set_rx_format_data)
+#define CC2520_IO_RADIO_SET_RX_FILTER _IOW(BASE, 12, struct cc2520_set_rx_filter_data)
+#define CC2520_IO_RADIO_GET_RX_FILTER_STATS _IOR(BASE, 13, struct cc2520_rx_filter_stats)
+#define CC2520_IO_RADIO_SET_FRAME_FILTER _IOW(BASE, 14, struct cc2520_set_frame_filter_data)
+#define CC2520_IO_RADIO_SET_PROMISCUOUS _IOW(BASE, 15, struct cc2520_set_promiscuous_data)
+#define CC2520_IO_RADIO_SET_RX_POLL _IOW(BASE, 16, struct cc2520_set_rx_poll_data)
+#define CC2520_IO_RADIO_GET_RX_POLL_STATS _IOR(BASE, 17, struct cc2520_rx_poll_stats)
+#define CC2520_IO_RADIO_ATTACH_FILTER _IOW(BASE, 18, struct sock_fprog)
+#define CC2520_IO_RADIO_DETACH_FILTER _IO(BASE, 19)
+#define CC2520_IO_RADIO_GET_BPF_STATS _IOR(BASE, 20, struct cc2520_rx_bpf_stats)
+#define CC2520_IO_RADIO_GET_READER_STATS _IOR(BASE, 21, struct cc2520_reader_stats)
+#define CC2520_IO_RADIO_SET_MATCH _IOW(BASE, 22, struct cc2520_set_match_data)
+#define CC2520_IO_RADIO_SET_SNIFFER _IOW(BASE, 23, struct cc2520_set_sniffer_data)
+#define CC2520_IO_RADIO_SET_TSCH _IOW(BASE, 24, struct cc2520_set_tsch_data)
+#define CC2520_IO_RADIO_GET_TSCH_STATS _IOR(BASE, 25, struct cc2520_tsch_stats)
+#define CC2520_IO_RADIO_ED_SCAN _IOWR(BASE, 26, struct cc2520_ed_scan_data)
+#define CC2520_IO_RADIO_SET_RSSI_MONITOR _IOW(BASE, 27, struct cc2520_set_rssi_monitor_data)
+#define CC2520_IO_RADIO_READ_RSSI_SAMPLES _IOWR(BASE, 28, struct cc2520_read_rssi_samples_data)
+
+#endif
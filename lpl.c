@@ -6,144 +6,212 @@
 #include "lpl.h"
 #include "packet.h"
 #include "cc2520.h"
+#include "stats.h"
+#include "env.h"
+#include "trace.h"
 #include "debug.h"
 
-struct cc2520_interface *lpl_top;
-struct cc2520_interface *lpl_bottom;
+struct cc2520_lpl_state {
+	struct cc2520_dev *dev;
 
-static int cc2520_lpl_tx(u8 * buf, u8 len);
-static void cc2520_lpl_tx_done(u8 status);
-static void cc2520_lpl_rx_done(u8 *buf, u8 len);
-static enum hrtimer_restart cc2520_lpl_timer_cb(struct hrtimer *timer);
-static void cc2520_lpl_start_timer(void);
-
-static int lpl_window;
-static int lpl_interval;
-static bool lpl_enabled;
+	int lpl_window;
+	int lpl_interval;
+	bool lpl_enabled;
 
-static struct hrtimer lpl_timer;
+	struct hrtimer lpl_timer;
 
-static u8* cur_tx_buf;
-static u8 cur_tx_len;
+	u8* cur_tx_buf;
+	u8 cur_tx_len;
 
-static spinlock_t state_sl;
+	// Settings for the frame in flight, which can be
+	// overridden per frame. A max_retries of -1 means
+	// keep going until the LPL window closes.
+	bool cur_tx_lpl;
+	int cur_interval;
+	int cur_max_retries;
+	int cur_retries;
 
-static unsigned long flags;
+	spinlock_t state_sl;
 
-enum cc2520_lpl_state_enum {
-	CC2520_LPL_IDLE,
-	CC2520_LPL_TX,
-	CC2520_LPL_TIMER_EXPIRED
+	int lpl_state;
 };
 
-static int lpl_state;
+static int cc2520_lpl_tx(struct cc2520_dev *dev, u8 * buf, u8 len);
+static void cc2520_lpl_tx_done(struct cc2520_dev *dev, u8 status);
+static void cc2520_lpl_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len);
+static enum hrtimer_restart cc2520_lpl_timer_cb(struct hrtimer *timer);
+static void cc2520_lpl_start_timer(struct cc2520_lpl_state *lpl);
 
-int cc2520_lpl_init()
+int cc2520_lpl_init(struct cc2520_dev *dev)
 {
-	lpl_top->tx = cc2520_lpl_tx;
-	lpl_bottom->tx_done = cc2520_lpl_tx_done;
-	lpl_bottom->rx_done = cc2520_lpl_rx_done;
+	struct cc2520_lpl_state *lpl;
+
+	lpl = kzalloc(sizeof(struct cc2520_lpl_state), GFP_KERNEL);
+	if (!lpl)
+		return -ENOMEM;
+
+	lpl->dev = dev;
+	dev->lpl = lpl;
 
-	lpl_window = CC2520_DEF_LPL_LISTEN_WINDOW;
-	lpl_interval = CC2520_DEF_LPL_WAKEUP_INTERVAL;
-	lpl_enabled = CC2520_DEF_LPL_ENABLED;
+	dev->lpl_top->tx = cc2520_lpl_tx;
+	dev->lpl_bottom->tx_done = cc2520_lpl_tx_done;
+	dev->lpl_bottom->rx_done = cc2520_lpl_rx_done;
 
-	cur_tx_buf = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
-	if (!cur_tx_buf) {
+	lpl->lpl_window = CC2520_DEF_LPL_LISTEN_WINDOW;
+	lpl->lpl_interval = CC2520_DEF_LPL_WAKEUP_INTERVAL;
+	lpl->lpl_enabled = CC2520_DEF_LPL_ENABLED;
+
+	lpl->cur_tx_buf = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
+	if (!lpl->cur_tx_buf) {
 		goto error;
 	}
 
-	spin_lock_init(&state_sl);
-	lpl_state = CC2520_LPL_IDLE;
+	spin_lock_init(&lpl->state_sl);
+	lpl->lpl_state = CC2520_LPL_IDLE;
 
-	hrtimer_init(&lpl_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	lpl_timer.function = &cc2520_lpl_timer_cb;
+	hrtimer_init(&lpl->lpl_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	lpl->lpl_timer.function = &cc2520_lpl_timer_cb;
 
 	return 0;
 
 	error:
-		if (cur_tx_buf) {
-			kfree(cur_tx_buf);
-			cur_tx_buf = NULL;
+		if (lpl->cur_tx_buf) {
+			kfree(lpl->cur_tx_buf);
+			lpl->cur_tx_buf = NULL;
 		}
 
+		kfree(lpl);
+		dev->lpl = NULL;
+
 		return -EFAULT;
 }
 
-void cc2520_lpl_free()
+void cc2520_lpl_free(struct cc2520_dev *dev)
 {
-	if (cur_tx_buf) {
-		kfree(cur_tx_buf);
-		cur_tx_buf = NULL;
+	struct cc2520_lpl_state *lpl = dev->lpl;
+
+	if (lpl->cur_tx_buf) {
+		kfree(lpl->cur_tx_buf);
+		lpl->cur_tx_buf = NULL;
 	}
 
-	hrtimer_cancel(&lpl_timer);
+	cc2520_env_timer_cancel(dev, &lpl->lpl_timer);
+
+	kfree(lpl);
+	dev->lpl = NULL;
 }
 
-static int cc2520_lpl_tx(u8 * buf, u8 len)
+static int cc2520_lpl_tx(struct cc2520_dev *dev, u8 * buf, u8 len)
 {
-	if (lpl_enabled) {
-		spin_lock_irqsave(&state_sl, flags);
-		if (lpl_state == CC2520_LPL_IDLE) {
-			lpl_state = CC2520_LPL_TX;
-			spin_unlock_irqrestore(&state_sl, flags);
-
-			memcpy(cur_tx_buf, buf, len);
-			cur_tx_len = len;
-
-			lpl_bottom->tx(cur_tx_buf, cur_tx_len);
-			cc2520_lpl_start_timer();
+	struct cc2520_lpl_state *lpl = dev->lpl;
+	unsigned long flags;
+	int interval;
+	int max_retries;
+
+	interval = lpl->lpl_enabled ? lpl->lpl_interval : 0;
+	if (dev->tx_opts.flags & CC2520_TX_OPT_LPL)
+		interval = dev->tx_opts.lpl_interval;
+
+	max_retries = interval ? -1 : 0;
+	if (dev->tx_opts.flags & CC2520_TX_OPT_RETRIES)
+		max_retries = dev->tx_opts.max_retries;
+
+	lpl->cur_tx_lpl = interval || max_retries;
+
+	if (lpl->cur_tx_lpl) {
+		spin_lock_irqsave(&lpl->state_sl, flags);
+		if (lpl->lpl_state == CC2520_LPL_IDLE) {
+			lpl->lpl_state = CC2520_LPL_TX;
+			trace_cc2520_lpl_state(dev->id, lpl->lpl_state);
+			spin_unlock_irqrestore(&lpl->state_sl, flags);
+
+			memcpy(lpl->cur_tx_buf, buf, len);
+			lpl->cur_tx_len = len;
+			lpl->cur_interval = interval;
+			lpl->cur_max_retries = max_retries;
+			lpl->cur_retries = 0;
+
+			dev->lpl_bottom->tx(dev, lpl->cur_tx_buf, lpl->cur_tx_len);
+			if (lpl->cur_interval) {
+				cc2520_stat_inc(dev, CC2520_STAT_LPL_TRAIN);
+				cc2520_lpl_start_timer(lpl);
+			}
 		}
 		else {
-			spin_unlock_irqrestore(&state_sl, flags);
+			spin_unlock_irqrestore(&lpl->state_sl, flags);
 			INFO(("[cc2520] - lpl tx busy.\n"));
-			lpl_top->tx_done(-CC2520_TX_BUSY);
+			dev->lpl_top->tx_done(dev, -CC2520_TX_BUSY);
 		}
 
 		return 0;
 	}
 	else {
-		return lpl_bottom->tx(buf, len);
+		return dev->lpl_bottom->tx(dev, buf, len);
 	}
 }
 
-static void cc2520_lpl_tx_done(u8 status)
+static void cc2520_lpl_tx_done(struct cc2520_dev *dev, u8 status)
 {
-	if (lpl_enabled) {
-		spin_lock_irqsave(&state_sl, flags);
-		if (cc2520_packet_requires_ack_wait(cur_tx_buf)) {
+	struct cc2520_lpl_state *lpl = dev->lpl;
+	unsigned long flags;
+	bool retries_left;
+
+	if (lpl->cur_tx_lpl) {
+		spin_lock_irqsave(&lpl->state_sl, flags);
+		retries_left = lpl->cur_max_retries < 0 || lpl->cur_retries < lpl->cur_max_retries;
+
+		// Without an LPL window there's no train to send, we only
+		// retry frames that failed.
+		if (cc2520_packet_requires_ack_wait(lpl->cur_tx_buf) || !lpl->cur_interval) {
 			if (status == CC2520_TX_SUCCESS) {
-				lpl_state = CC2520_LPL_IDLE;
-				spin_unlock_irqrestore(&state_sl, flags);
+				lpl->lpl_state = CC2520_LPL_IDLE;
+				trace_cc2520_lpl_state(dev->id, lpl->lpl_state);
+				spin_unlock_irqrestore(&lpl->state_sl, flags);
 
-				hrtimer_cancel(&lpl_timer);
-				lpl_top->tx_done(status);
+				cc2520_env_timer_cancel(dev, &lpl->lpl_timer);
+				dev->lpl_top->tx_done(dev, status);
+			}
+			else if (lpl->lpl_state == CC2520_LPL_TIMER_EXPIRED) {
+				lpl->lpl_state = CC2520_LPL_IDLE;
+				trace_cc2520_lpl_state(dev->id, lpl->lpl_state);
+				spin_unlock_irqrestore(&lpl->state_sl, flags);
+				dev->lpl_top->tx_done(dev, -CC2520_TX_FAILED);
 			}
-			else if (lpl_state == CC2520_LPL_TIMER_EXPIRED) {
-				lpl_state = CC2520_LPL_IDLE;
-				spin_unlock_irqrestore(&state_sl, flags);
-				lpl_top->tx_done(-CC2520_TX_FAILED);
+			else if (!retries_left) {
+				lpl->lpl_state = CC2520_LPL_IDLE;
+				trace_cc2520_lpl_state(dev->id, lpl->lpl_state);
+				spin_unlock_irqrestore(&lpl->state_sl, flags);
+
+				cc2520_env_timer_cancel(dev, &lpl->lpl_timer);
+				dev->lpl_top->tx_done(dev, status);
 			}
 			else {
-				spin_unlock_irqrestore(&state_sl, flags);
+				lpl->cur_retries++;
+				spin_unlock_irqrestore(&lpl->state_sl, flags);
 				DBG((KERN_INFO "[cc2520] - lpl retransmit.\n"));
-				lpl_bottom->tx(cur_tx_buf, cur_tx_len);
+				cc2520_stat_inc(dev, CC2520_STAT_LPL_RETRANSMIT);
+				dev->lpl_bottom->tx(dev, lpl->cur_tx_buf, lpl->cur_tx_len);
 			}
 		}
 		else {
-			if (lpl_state == CC2520_LPL_TIMER_EXPIRED) {
-				lpl_state = CC2520_LPL_IDLE;
-				spin_unlock_irqrestore(&state_sl, flags);
-				lpl_top->tx_done(CC2520_TX_SUCCESS);
+			if (lpl->lpl_state == CC2520_LPL_TIMER_EXPIRED || !retries_left) {
+				lpl->lpl_state = CC2520_LPL_IDLE;
+				trace_cc2520_lpl_state(dev->id, lpl->lpl_state);
+				spin_unlock_irqrestore(&lpl->state_sl, flags);
+
+				cc2520_env_timer_cancel(dev, &lpl->lpl_timer);
+				dev->lpl_top->tx_done(dev, CC2520_TX_SUCCESS);
 			}
 			else {
-				spin_unlock_irqrestore(&state_sl, flags);
-				lpl_bottom->tx(cur_tx_buf, cur_tx_len);
+				lpl->cur_retries++;
+				spin_unlock_irqrestore(&lpl->state_sl, flags);
+				cc2520_stat_inc(dev, CC2520_STAT_LPL_RETRANSMIT);
+				dev->lpl_bottom->tx(dev, lpl->cur_tx_buf, lpl->cur_tx_len);
 			}
 		}
 	}
 	else {
-		lpl_top->tx_done(status);
+		dev->lpl_top->tx_done(dev, status);
 	}
 	// if packet requires ack, examine status.
 	//    if success terminate LPL window
@@ -151,44 +219,52 @@ static void cc2520_lpl_tx_done(u8 status)
 	// else resend
 }
 
-static void cc2520_lpl_rx_done(u8 *buf, u8 len)
+static void cc2520_lpl_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len)
 {
-	lpl_top->rx_done(buf, len);
+	dev->lpl_top->rx_done(dev, buf, len);
 }
 
-static void cc2520_lpl_start_timer()
+static void cc2520_lpl_start_timer(struct cc2520_lpl_state *lpl)
 {
-    ktime_t kt;
-    kt = ktime_set(0, 1000 * (lpl_interval + 2 * lpl_window));
-	hrtimer_start(&lpl_timer, kt, HRTIMER_MODE_REL);
+	cc2520_env_timer_start(lpl->dev, &lpl->lpl_timer, lpl->cur_interval + 2 * lpl->lpl_window);
 }
 
 static enum hrtimer_restart cc2520_lpl_timer_cb(struct hrtimer *timer)
 {
-	spin_lock_irqsave(&state_sl, flags);
-	if (lpl_state == CC2520_LPL_TX) {
-		lpl_state = CC2520_LPL_TIMER_EXPIRED;
-		spin_unlock_irqrestore(&state_sl, flags);
+	struct cc2520_lpl_state *lpl =
+		container_of(timer, struct cc2520_lpl_state, lpl_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&lpl->state_sl, flags);
+	if (lpl->lpl_state == CC2520_LPL_TX) {
+		lpl->lpl_state = CC2520_LPL_TIMER_EXPIRED;
+		trace_cc2520_lpl_state(lpl->dev->id, lpl->lpl_state);
+		spin_unlock_irqrestore(&lpl->state_sl, flags);
 	}
 	else {
-		spin_unlock_irqrestore(&state_sl, flags);
+		spin_unlock_irqrestore(&lpl->state_sl, flags);
 		INFO((KERN_INFO "[cc2520] - lpl timer in improbable state.\n"));
 	}
 
 	return HRTIMER_NORESTART;
 }
 
-void cc2520_lpl_set_enabled(bool enabled)
+void cc2520_lpl_set_enabled(struct cc2520_dev *dev, bool enabled)
+{
+	dev->lpl->lpl_enabled = enabled;
+}
+
+bool cc2520_lpl_get_enabled(struct cc2520_dev *dev)
 {
-	lpl_enabled = enabled;
+	return dev->lpl->lpl_enabled;
 }
 
-void cc2520_lpl_set_listen_length(int length)
+void cc2520_lpl_set_listen_length(struct cc2520_dev *dev, int length)
 {
-	lpl_window = length;
+	dev->lpl->lpl_window = length;
 }
 
-void cc2520_lpl_set_wakeup_interval(int interval)
+void cc2520_lpl_set_wakeup_interval(struct cc2520_dev *dev, int interval)
 {
-	lpl_interval = interval;
+	dev->lpl->lpl_interval = interval;
 }
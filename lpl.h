@@ -3,14 +3,19 @@
 
 #include "cc2520.h"
 
-extern struct cc2520_interface *lpl_top;
-extern struct cc2520_interface *lpl_bottom;
+int cc2520_lpl_init(struct cc2520_dev *dev);
+void cc2520_lpl_free(struct cc2520_dev *dev);
 
-int cc2520_lpl_init(void);
-void cc2520_lpl_free(void);
+void cc2520_lpl_set_enabled(struct cc2520_dev *dev, bool enabled);
+bool cc2520_lpl_get_enabled(struct cc2520_dev *dev);
+void cc2520_lpl_set_listen_length(struct cc2520_dev *dev, int length);
+void cc2520_lpl_set_wakeup_interval(struct cc2520_dev *dev, int interval);
 
-void cc2520_lpl_set_enabled(bool enabled);
-void cc2520_lpl_set_listen_length(int length);
-void cc2520_lpl_set_wakeup_interval(int interval);
+// States as they show in the cc2520_lpl_state tracepoint.
+enum cc2520_lpl_state_enum {
+	CC2520_LPL_IDLE,
+	CC2520_LPL_TX,
+	CC2520_LPL_TIMER_EXPIRED
+};
 
 #endif
\ No newline at end of file
@@ -16,126 +16,389 @@
 #include "interface.h"
 #include "sack.h"
 #include "csma.h"
+#include "tsch.h"
+#include "monitor.h"
+#include "stats.h"
+#include "flight.h"
 #include "unique.h"
+#include "filter.h"
+#include "wpan.h"
+#include "emu.h"
+#include "cc2520_test.h"
 #include "debug.h"
 
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
 #define DRIVER_AUTHOR  "Andrew Robinson <androbin@umich.edu>"
 #define DRIVER_DESC    "A driver for the CC2520 radio."
 #define DRIVER_VERSION "0.5"
 
 uint8_t debug_print;
 
-struct cc2520_state state;
+DEFINE_STATIC_KEY_FALSE(cc2520_debug_err);
+DEFINE_STATIC_KEY_FALSE(cc2520_debug_info);
+DEFINE_STATIC_KEY_FALSE(cc2520_debug_dbg);
+
+// Flips the keys for each level, which patches code,
+// so this can sleep.
+void cc2520_set_debug_level(uint8_t level)
+{
+	debug_print = level;
+
+	if (level >= DEBUG_PRINT_ERR)
+		static_branch_enable(&cc2520_debug_err);
+	else
+		static_branch_disable(&cc2520_debug_err);
+
+	if (level >= DEBUG_PRINT_INFO)
+		static_branch_enable(&cc2520_debug_info);
+	else
+		static_branch_disable(&cc2520_debug_info);
+
+	if (level >= DEBUG_PRINT_DBG)
+		static_branch_enable(&cc2520_debug_dbg);
+	else
+		static_branch_disable(&cc2520_debug_dbg);
+}
+
 const char cc2520_name[] = "cc2520";
 
-struct cc2520_interface interface_to_unique;
-struct cc2520_interface unique_to_lpl;
-struct cc2520_interface lpl_to_csma;
-struct cc2520_interface csma_to_sack;
-struct cc2520_interface sack_to_radio;
+// Radio 0 sits on the default wiring, any additional
+// radios have to be described on the command line, e.g.
+// insmod cc2520.ko num_radios=2 spi_cs=0,1 gpio_fifo=25,5 ...
+static int num_radios = 1;
+static int spi_bus[CC2520_MAX_HW_RADIOS] = { SPI_BUS, SPI_BUS, SPI_BUS, SPI_BUS };
+static int spi_cs[CC2520_MAX_HW_RADIOS] = { SPI_BUS_CS0, -1, -1, -1 };
+static int gpio_fifo[CC2520_MAX_HW_RADIOS] = { CC2520_FIFO, -1, -1, -1 };
+static int gpio_fifop[CC2520_MAX_HW_RADIOS] = { CC2520_FIFOP, -1, -1, -1 };
+static int gpio_cca[CC2520_MAX_HW_RADIOS] = { CC2520_CCA, -1, -1, -1 };
+static int gpio_sfd[CC2520_MAX_HW_RADIOS] = { CC2520_SFD, -1, -1, -1 };
+static int gpio_reset[CC2520_MAX_HW_RADIOS] = { CC2520_RESET, -1, -1, -1 };
+
+module_param(num_radios, int, S_IRUGO);
+MODULE_PARM_DESC(num_radios, "Number of CC2520 radios attached (1-4, or 1-64 emulated)");
+module_param_array(spi_bus, int, NULL, S_IRUGO);
+MODULE_PARM_DESC(spi_bus, "SPI bus of each radio");
+module_param_array(spi_cs, int, NULL, S_IRUGO);
+MODULE_PARM_DESC(spi_cs, "SPI chip select of each radio");
+module_param_array(gpio_fifo, int, NULL, S_IRUGO);
+MODULE_PARM_DESC(gpio_fifo, "FIFO GPIO of each radio");
+module_param_array(gpio_fifop, int, NULL, S_IRUGO);
+MODULE_PARM_DESC(gpio_fifop, "FIFOP GPIO of each radio");
+module_param_array(gpio_cca, int, NULL, S_IRUGO);
+MODULE_PARM_DESC(gpio_cca, "CCA GPIO of each radio");
+module_param_array(gpio_sfd, int, NULL, S_IRUGO);
+MODULE_PARM_DESC(gpio_sfd, "SFD GPIO of each radio");
+module_param_array(gpio_reset, int, NULL, S_IRUGO);
+MODULE_PARM_DESC(gpio_reset, "RESET GPIO of each radio");
+
+// Also register every radio with mac802154 so the kernel's
+// own 802.15.4 stack can use it.
+static bool wpan;
+module_param(wpan, bool, S_IRUGO);
+MODULE_PARM_DESC(wpan, "Register the radios as IEEE 802.15.4 (wpan) devices");
+
+// Run every radio on the emulator instead of real
+// hardware, the SPI and GPIO parameters are ignored.
+static bool emulate;
+module_param(emulate, bool, S_IRUGO);
+MODULE_PARM_DESC(emulate, "Emulate the radios instead of driving real CC2520s");
+
+static struct cc2520_dev *devs[CC2520_MAX_RADIOS];
 
-void setup_bindings(void)
+void setup_bindings(struct cc2520_dev *dev)
 {
-	radio_top = &sack_to_radio;
-	sack_bottom = &sack_to_radio;
-	sack_top = &csma_to_sack;
-	csma_bottom = &csma_to_sack;
-	csma_top = &lpl_to_csma;
-	lpl_bottom = &lpl_to_csma;
-	lpl_top = &unique_to_lpl;
-	unique_bottom = &unique_to_lpl;
-	unique_top = &interface_to_unique;
-	interface_bottom = &interface_to_unique;
+	dev->radio_top = &dev->filter_to_radio;
+	dev->filter_bottom = &dev->filter_to_radio;
+	dev->filter_top = &dev->sack_to_filter;
+	dev->sack_bottom = &dev->sack_to_filter;
+	dev->sack_top = &dev->tsch_to_sack;
+	dev->tsch_bottom = &dev->tsch_to_sack;
+	dev->tsch_top = &dev->csma_to_tsch;
+	dev->csma_bottom = &dev->csma_to_tsch;
+	dev->csma_top = &dev->lpl_to_csma;
+	dev->lpl_bottom = &dev->lpl_to_csma;
+	dev->lpl_top = &dev->unique_to_lpl;
+	dev->unique_bottom = &dev->unique_to_lpl;
+	dev->unique_top = &dev->interface_to_unique;
+	dev->interface_bottom = &dev->interface_to_unique;
 }
 
-int init_module()
+static int cc2520_dev_check_params(int id)
+{
+	if (emulate)
+		return 0;
+
+	if (spi_cs[id] < 0 || gpio_fifo[id] < 0 || gpio_fifop[id] < 0 ||
+		gpio_cca[id] < 0 || gpio_sfd[id] < 0 || gpio_reset[id] < 0) {
+		ERR((KERN_ALERT "[cc2520] - radio%d is missing spi_cs or gpio parameters.\n", id));
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+// Brings up one complete stack. The layers come up before
+// the hardware so that nothing can call into them half built.
+static int cc2520_dev_init(struct cc2520_dev *dev)
 {
 	int err = 0;
 
-	debug_print = DEBUG_PRINT_INFO;
+	setup_bindings(dev);
 
-	setup_bindings();
+	err = cc2520_stats_init(dev);
+	if (err) {
+		ERR((KERN_ALERT "[cc2520] - stats init error. aborting.\n"));
+		goto error13;
+	}
 
-	memset(&state, 0, sizeof(struct cc2520_state));
+	err = cc2520_flight_init(dev);
+	if (err) {
+		ERR((KERN_ALERT "[cc2520] - flight recorder init error. aborting.\n"));
+		goto error12;
+	}
 
-	INFO((KERN_INFO "[CC2520] - Loading kernel module v%s\n", DRIVER_VERSION));
+	err = cc2520_radio_init(dev);
+	if (err) {
+		ERR((KERN_ALERT "[cc2520] - radio init error. aborting.\n"));
+		goto error11;
+	}
 
-	err = cc2520_plat_gpio_init();
+	err = cc2520_monitor_init(dev);
 	if (err) {
-		ERR((KERN_ALERT "[CC2520] - gpio driver error. aborting.\n"));
+		ERR((KERN_ALERT "[cc2520] - monitor init error. aborting.\n"));
+		goto error10;
+	}
+
+	err = cc2520_filter_init(dev);
+	if (err) {
+		ERR((KERN_ALERT "[cc2520] - filter init error. aborting.\n"));
+		goto error9;
+	}
+
+	err = cc2520_sack_init(dev);
+	if (err) {
+		ERR((KERN_ALERT "[cc2520] - sack init error. aborting.\n"));
+		goto error8;
+	}
+
+	err = cc2520_tsch_init(dev);
+	if (err) {
+		ERR((KERN_ALERT "[cc2520] - tsch init error. aborting.\n"));
 		goto error7;
 	}
 
-	err = cc2520_plat_spi_init();
+	err = cc2520_csma_init(dev);
 	if (err) {
-		ERR((KERN_ALERT "[cc2520] - spi driver error. aborting.\n"));
+		ERR((KERN_ALERT "[cc2520] - csma init error. aborting.\n"));
 		goto error6;
 	}
 
-	err = cc2520_interface_init();
+	err = cc2520_lpl_init(dev);
 	if (err) {
-		ERR((KERN_ALERT "[cc2520] - char driver error. aborting.\n"));
+		ERR((KERN_ALERT "[cc2520] - lpl init error. aborting.\n"));
 		goto error5;
 	}
 
-	err = cc2520_radio_init();
+	err = cc2520_unique_init(dev);
 	if (err) {
-		ERR((KERN_ALERT "[cc2520] - radio init error. aborting.\n"));
+		ERR((KERN_ALERT "[cc2520] - unique init error. aborting.\n"));
 		goto error4;
 	}
 
-	err = cc2520_lpl_init();
+	err = cc2520_plat_spi_init(dev);
 	if (err) {
-		ERR((KERN_ALERT "[cc2520] - lpl init error. aborting.\n"));
+		ERR((KERN_ALERT "[cc2520] - spi driver error. aborting.\n"));
 		goto error3;
 	}
 
-	err = cc2520_sack_init();
+	err = cc2520_plat_gpio_init(dev);
 	if (err) {
-		ERR((KERN_ALERT "[cc2520] - sack init error. aborting.\n"));
+		ERR((KERN_ALERT "[CC2520] - gpio driver error. aborting.\n"));
 		goto error2;
 	}
 
-	err = cc2520_csma_init();
+	err = cc2520_interface_init(dev);
 	if (err) {
-		ERR((KERN_ALERT "[cc2520] - csma init error. aborting.\n"));
+		ERR((KERN_ALERT "[cc2520] - char driver error. aborting.\n"));
 		goto error1;
 	}
 
-	err = cc2520_unique_init();
-	if (err) {
-		ERR((KERN_ALERT "[cc2520] - unique init error. aborting.\n"));
-		goto error0;
+	if (wpan) {
+		err = cc2520_wpan_init(dev);
+		if (err) {
+			ERR((KERN_ALERT "[cc2520] - wpan init error. aborting.\n"));
+			goto error0;
+		}
 	}
 
-	state.wq = create_singlethread_workqueue(cc2520_name);
-
 	return 0;
 
 	error0:
-		cc2520_csma_free();
+		cc2520_interface_free(dev);
 	error1:
-		cc2520_sack_free();
+		cc2520_plat_gpio_free(dev);
 	error2:
-		cc2520_lpl_free();
+		cc2520_plat_spi_free(dev);
 	error3:
-		cc2520_radio_free();
+		cc2520_unique_free(dev);
 	error4:
-		cc2520_interface_free();
+		cc2520_lpl_free(dev);
 	error5:
-		cc2520_plat_spi_free();
+		cc2520_csma_free(dev);
 	error6:
-		cc2520_plat_gpio_free();
+		cc2520_tsch_free(dev);
 	error7:
-		return -1;
+		cc2520_sack_free(dev);
+	error8:
+		cc2520_filter_free(dev);
+	error9:
+		cc2520_monitor_free(dev);
+	error10:
+		cc2520_radio_free(dev);
+	error11:
+		cc2520_flight_free(dev);
+	error12:
+		cc2520_stats_free(dev);
+	error13:
+		return err;
+}
+
+static void cc2520_dev_free(struct cc2520_dev *dev)
+{
+	cc2520_wpan_free(dev);
+	cc2520_interface_free(dev);
+	cc2520_plat_gpio_free(dev);
+	cc2520_plat_spi_free(dev);
+	cc2520_unique_free(dev);
+	cc2520_lpl_free(dev);
+	cc2520_csma_free(dev);
+	cc2520_tsch_free(dev);
+	cc2520_sack_free(dev);
+	cc2520_filter_free(dev);
+	cc2520_monitor_free(dev);
+	cc2520_radio_free(dev);
+	cc2520_flight_free(dev);
+	cc2520_stats_free(dev);
+}
+
+int init_module()
+{
+	struct cc2520_dev *dev;
+	struct dentry *debugfs;
+	int max_radios;
+	int err = 0;
+	int i;
+
+	cc2520_set_debug_level(DEBUG_PRINT_INFO);
+
+	INFO((KERN_INFO "[CC2520] - Loading kernel module v%s\n", DRIVER_VERSION));
+
+	max_radios = emulate ? CC2520_MAX_RADIOS : CC2520_MAX_HW_RADIOS;
+	if (num_radios < 1 || num_radios > max_radios) {
+		ERR((KERN_ALERT "[cc2520] - num_radios must be between 1 and %d.\n", max_radios));
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num_radios; i++) {
+		err = cc2520_dev_check_params(i);
+		if (err)
+			return err;
+	}
+
+	if (!emulate) {
+		err = cc2520_plat_spi_register();
+		if (err) {
+			ERR((KERN_ALERT "[cc2520] - spi driver error. aborting.\n"));
+			goto error2;
+		}
+	}
+
+	err = cc2520_interface_class_init();
+	if (err) {
+		ERR((KERN_ALERT "[cc2520] - char driver error. aborting.\n"));
+		goto error1;
+	}
+
+	debugfs = cc2520_stats_debugfs_init();
+	if (emulate)
+		cc2520_emu_medium_init(debugfs);
+
+	for (i = 0; i < num_radios; i++) {
+		dev = kzalloc(sizeof(struct cc2520_dev), GFP_KERNEL);
+		if (!dev) {
+			err = -ENOMEM;
+			goto error0;
+		}
+
+		dev->id = i;
+		dev->emulated = emulate;
+
+		// Past the wiring parameters only emulated
+		// radios, which don't use them.
+		if (i < CC2520_MAX_HW_RADIOS) {
+			dev->spi_bus = spi_bus[i];
+			dev->spi_cs = spi_cs[i];
+			dev->gpios.fifo = gpio_fifo[i];
+			dev->gpios.fifop = gpio_fifop[i];
+			dev->gpios.cca = gpio_cca[i];
+			dev->gpios.sfd = gpio_sfd[i];
+			dev->gpios.reset = gpio_reset[i];
+		}
+
+		err = cc2520_dev_init(dev);
+		if (err) {
+			ERR((KERN_ALERT "[cc2520] - radio%d failed to initialize.\n", i));
+			kfree(dev);
+			goto error0;
+		}
+
+		devs[i] = dev;
+		if (emulate)
+			INFO((KERN_INFO "[cc2520] - radio%d emulated\n", i));
+		else
+			INFO((KERN_INFO "[cc2520] - radio%d on spi%d.%d\n", i, dev->spi_bus, dev->spi_cs));
+	}
+
+	// Nothing without KUnit, see cc2520_test.c.
+	cc2520_test_run();
+
+	return 0;
+
+	error0:
+		while (--i >= 0) {
+			cc2520_dev_free(devs[i]);
+			kfree(devs[i]);
+			devs[i] = NULL;
+		}
+		cc2520_stats_debugfs_free();
+		cc2520_interface_class_free();
+	error1:
+		if (!emulate)
+			cc2520_plat_spi_unregister();
+	error2:
+		return err;
 }
 
 void cleanup_module()
 {
-	destroy_workqueue(state.wq);
-	cc2520_interface_free();
-	cc2520_plat_gpio_free();
-	cc2520_plat_spi_free();
+	int i;
+
+	cc2520_test_free();
+
+	for (i = 0; i < num_radios; i++) {
+		if (devs[i]) {
+			cc2520_dev_free(devs[i]);
+			kfree(devs[i]);
+			devs[i] = NULL;
+		}
+	}
+
+	cc2520_stats_debugfs_free();
+	cc2520_interface_class_free();
+	if (!emulate)
+		cc2520_plat_spi_unregister();
 	INFO((KERN_INFO "[cc2520] - Unloading kernel module\n"));
 }
 
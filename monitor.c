@@ -0,0 +1,240 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/spi/spi.h>
+#include <asm/uaccess.h>
+
+#include "monitor.h"
+#include "cc2520.h"
+#include "platform.h"
+#include "trace.h"
+#include "debug.h"
+
+// RSSI monitor for watching the energy on a channel over
+// time, say to spot Wi-Fi bursts. An hrtimer fires at the
+// sample rate and starts a single async SPI transaction
+// that burst reads RSSI and RSSISTAT, and the completion
+// drops the sample into a ring for userspace to collect
+// in batches.
+//
+// This doesn't go through the radio lock or touch any
+// radio state, a sample is just one more read queued on
+// the bus between the RX and TX traffic, so normal
+// operation carries on underneath it. If the previous
+// sample hasn't come back by the next tick the tick is
+// skipped rather than letting reads pile up.
+//
+// The ring has a single producer, the SPI completion, and
+// a single consumer, serialised by read_lock, so it gets
+// by with ordered head and tail updates and no lock.
+
+struct cc2520_monitor_state {
+	struct cc2520_dev *dev;
+
+	bool running;
+	u64 period; // nS
+	struct hrtimer timer;
+
+	struct spi_message msg;
+	struct spi_transfer tsfer;
+	u8 *tx_buf;
+	u8 *rx_buf;
+	atomic_t in_flight;
+	u64 sample_ts;
+
+	struct cc2520_rssi_sample *ring;
+	unsigned int head;
+	unsigned int tail;
+	struct mutex read_lock;
+
+	u32 overruns;
+	u32 skipped;
+};
+
+static enum hrtimer_restart cc2520_monitor_timer_cb(struct hrtimer *timer);
+static void cc2520_monitor_complete(void *arg);
+
+int cc2520_monitor_init(struct cc2520_dev *dev)
+{
+	struct cc2520_monitor_state *monitor;
+
+	monitor = kzalloc(sizeof(struct cc2520_monitor_state), GFP_KERNEL);
+	if (!monitor)
+		return -ENOMEM;
+
+	monitor->dev = dev;
+	dev->monitor = monitor;
+
+	mutex_init(&monitor->read_lock);
+	atomic_set(&monitor->in_flight, 0);
+
+	// Both go over the bus, keep them out of the
+	// state struct so they're DMA safe.
+	monitor->tx_buf = kzalloc(3, GFP_KERNEL);
+	monitor->rx_buf = kzalloc(3, GFP_KERNEL);
+	if (!monitor->tx_buf || !monitor->rx_buf)
+		goto error;
+
+	monitor->ring = vzalloc(CC2520_RSSI_RING_LEN * sizeof(struct cc2520_rssi_sample));
+	if (!monitor->ring)
+		goto error;
+
+	hrtimer_init(&monitor->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	monitor->timer.function = &cc2520_monitor_timer_cb;
+
+	return 0;
+
+	error:
+		kfree(monitor->tx_buf);
+		kfree(monitor->rx_buf);
+		kfree(monitor);
+		dev->monitor = NULL;
+
+		return -ENOMEM;
+}
+
+void cc2520_monitor_free(struct cc2520_dev *dev)
+{
+	struct cc2520_monitor_state *monitor = dev->monitor;
+
+	cc2520_monitor_set(dev, false, 0);
+
+	vfree(monitor->ring);
+	kfree(monitor->tx_buf);
+	kfree(monitor->rx_buf);
+	kfree(monitor);
+	dev->monitor = NULL;
+}
+
+static enum hrtimer_restart cc2520_monitor_timer_cb(struct hrtimer *timer)
+{
+	struct cc2520_monitor_state *monitor =
+		container_of(timer, struct cc2520_monitor_state, timer);
+
+	if (atomic_cmpxchg(&monitor->in_flight, 0, 1) == 0) {
+		monitor->sample_ts = ktime_get_raw_ns();
+
+		spi_message_init(&monitor->msg);
+		monitor->msg.complete = cc2520_monitor_complete;
+		monitor->msg.context = monitor;
+		spi_message_add_tail(&monitor->tsfer, &monitor->msg);
+
+		trace_cc2520_spi_submit(monitor->dev->id, &monitor->msg, monitor->msg.complete);
+		cc2520_plat_spi_async(monitor->dev, &monitor->msg);
+	}
+	else {
+		monitor->skipped++;
+	}
+
+	hrtimer_forward_now(timer, ns_to_ktime(monitor->period));
+	return HRTIMER_RESTART;
+}
+
+static void cc2520_monitor_complete(void *arg)
+{
+	struct cc2520_monitor_state *monitor = arg;
+	struct cc2520_rssi_sample *sample;
+	unsigned int head;
+
+	trace_cc2520_spi_complete(monitor->dev->id, &monitor->msg);
+
+	head = monitor->head;
+	if (head - READ_ONCE(monitor->tail) >= CC2520_RSSI_RING_LEN) {
+		monitor->overruns++;
+	}
+	else {
+		sample = &monitor->ring[head & (CC2520_RSSI_RING_LEN - 1)];
+		sample->timestamp = monitor->sample_ts;
+		sample->rssi = (s8)monitor->rx_buf[1] - CC2520_RSSI_OFFSET;
+		sample->valid = monitor->rx_buf[2] & 0x01;
+
+		// Publish the sample before the new head.
+		smp_store_release(&monitor->head, head + 1);
+	}
+
+	atomic_set(&monitor->in_flight, 0);
+}
+
+int cc2520_monitor_set(struct cc2520_dev *dev, bool enabled, u32 rate)
+{
+	struct cc2520_monitor_state *monitor = dev->monitor;
+
+	if (monitor->running) {
+		hrtimer_cancel(&monitor->timer);
+		while (atomic_read(&monitor->in_flight))
+			usleep_range(100, 200);
+		monitor->running = false;
+	}
+
+	if (!enabled)
+		return 0;
+
+	if (rate == 0 || rate > CC2520_MAX_RSSI_MONITOR_RATE)
+		return -EINVAL;
+
+	// RSSI, then RSSISTAT right behind it
+	// in the same register read.
+	monitor->tx_buf[0] = CC2520_CMD_REGISTER_READ | CC2520_RSSI;
+	monitor->tx_buf[1] = 0;
+	monitor->tx_buf[2] = 0;
+
+	memset(&monitor->tsfer, 0, sizeof(struct spi_transfer));
+	monitor->tsfer.tx_buf = monitor->tx_buf;
+	monitor->tsfer.rx_buf = monitor->rx_buf;
+	monitor->tsfer.len = 3;
+	monitor->tsfer.cs_change = 1;
+
+	monitor->period = div_u64(NSEC_PER_SEC, rate);
+	monitor->overruns = 0;
+	monitor->skipped = 0;
+	monitor->running = true;
+
+	INFO((KERN_INFO "[cc2520] - rssi monitor on radio%d at %d Hz\n", dev->id, rate));
+	hrtimer_start(&monitor->timer, ns_to_ktime(monitor->period), HRTIMER_MODE_REL);
+	return 0;
+}
+
+// Copies out up to count of the oldest samples and
+// returns how many, without waiting for more.
+int cc2520_monitor_read(struct cc2520_dev *dev, struct cc2520_rssi_sample __user *samples,
+	u32 count, u32 *overruns)
+{
+	struct cc2520_monitor_state *monitor = dev->monitor;
+	unsigned int head;
+	unsigned int tail;
+	unsigned int index;
+	unsigned int chunk;
+	unsigned int n;
+	int result;
+
+	mutex_lock(&monitor->read_lock);
+
+	head = smp_load_acquire(&monitor->head);
+	tail = monitor->tail;
+	n = min_t(unsigned int, head - tail, count);
+
+	// At most two copies, either side of the wrap.
+	index = tail & (CC2520_RSSI_RING_LEN - 1);
+	chunk = min_t(unsigned int, n, CC2520_RSSI_RING_LEN - index);
+	result = 0;
+	if (copy_to_user(samples, &monitor->ring[index], chunk * sizeof(struct cc2520_rssi_sample)) ||
+		copy_to_user(samples + chunk, &monitor->ring[0], (n - chunk) * sizeof(struct cc2520_rssi_sample)))
+		result = -EFAULT;
+
+	if (!result) {
+		// Let the producer have the slots back.
+		smp_store_release(&monitor->tail, tail + n);
+		result = n;
+	}
+
+	*overruns = monitor->overruns;
+	mutex_unlock(&monitor->read_lock);
+
+	return result;
+}
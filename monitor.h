@@ -0,0 +1,13 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include "cc2520.h"
+
+int cc2520_monitor_init(struct cc2520_dev *dev);
+void cc2520_monitor_free(struct cc2520_dev *dev);
+
+int cc2520_monitor_set(struct cc2520_dev *dev, bool enabled, u32 rate);
+int cc2520_monitor_read(struct cc2520_dev *dev, struct cc2520_rssi_sample __user *samples,
+	u32 count, u32 *overruns);
+
+#endif
@@ -115,6 +115,74 @@ u64 cc2520_packet_get_src(u8 *buf)
 	return ret;
 }
 
+// Walks the addressing fields of a received frame, which
+// still has the RSSI and CRC/LQI bytes where the FCS was.
+// Unlike cc2520_packet_get_src this doesn't assume any
+// layout, and returns false if the frame is too short
+// for the header it claims to have.
+bool cc2520_packet_parse(u8 *buf, u8 len, struct cc2520_packet_info *info)
+{
+	u16 fcf;
+	u8 src_addr_mode;
+	bool pan_compression;
+	int offset;
+	int end;
+
+	memset(info, 0, sizeof(struct cc2520_packet_info));
+
+	// Length, FCF and DSN at the very least.
+	if (len < 4)
+		return false;
+
+	fcf = buf[1] | (buf[2] << 8);
+	info->frame_type = (fcf >> IEEE154_FCF_FRAME_TYPE) & IEEE154_TYPE_MASK;
+	info->dst_mode = (fcf >> IEEE154_FCF_DEST_ADDR_MODE) & IEEE154_ADDR_MASK;
+	src_addr_mode = (fcf >> IEEE154_FCF_SRC_ADDR_MODE) & IEEE154_ADDR_MASK;
+	pan_compression = ((fcf >> IEEE154_FCF_INTRAPAN) & 0x01) == 1;
+
+	offset = 4;
+	end = len - 2;
+
+	if (info->dst_mode == IEEE154_ADDR_SHORT || info->dst_mode == IEEE154_ADDR_EXT) {
+		if (offset + 2 > end)
+			return false;
+		info->dst_pan = buf[offset] | (buf[offset + 1] << 8);
+		offset += 2;
+
+		if (info->dst_mode == IEEE154_ADDR_SHORT) {
+			if (offset + 2 > end)
+				return false;
+			info->dst_addr = buf[offset] | (buf[offset + 1] << 8);
+			offset += 2;
+		}
+		else {
+			if (offset + 8 > end)
+				return false;
+			// NOTE: Assuming we're on LE arch.
+			memcpy(&info->dst_addr, buf + offset, 8);
+			offset += 8;
+		}
+	}
+
+	if (src_addr_mode == IEEE154_ADDR_SHORT || src_addr_mode == IEEE154_ADDR_EXT) {
+		if (!pan_compression)
+			offset += 2;
+		offset += src_addr_mode == IEEE154_ADDR_SHORT ? 2 : 8;
+	}
+
+	if (offset > end)
+		return false;
+
+	// The auxiliary security header sits between the
+	// addressing and the payload, don't look past it.
+	if (!(fcf & (1 << IEEE154_FCF_SECURITY_ENABLED)) && offset < end) {
+		info->has_dispatch = true;
+		info->dispatch = buf[offset];
+	}
+
+	return true;
+}
+
 ieee154_simple_header_t* cc2520_packet_get_header(u8 *buf)
 {
 	// Ignore the length
@@ -84,6 +84,16 @@ enum
 	IEEE154_ACK_FRAME_VALUE = (IEEE154_TYPE_ACK << IEEE154_FCF_FRAME_TYPE),
 };
 
+// What the RX demux needs to know about a received frame.
+struct cc2520_packet_info {
+	u8 frame_type;
+	u8 dst_mode;
+	u16 dst_pan;
+	u64 dst_addr;
+	bool has_dispatch;
+	u8 dispatch;
+};
+
 ieee154_simple_header_t* cc2520_packet_get_header(u8 *buf);
 u8* cc2520_packet_get_length_field(u8 * buf);
 u8* cc2520_packet_get_payload(u8 * buf);
@@ -94,5 +104,6 @@ void cc2520_packet_create_ack(u8 *pkt, u8 *buf);
 bool cc2520_packet_is_ack(u8* buf);
 bool cc2520_packet_is_ack_to(u8* pending, u8 * buf);
 u64 cc2520_packet_get_src(u8 *buf);
+bool cc2520_packet_parse(u8 *buf, u8 len, struct cc2520_packet_info *info);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#include <asm/unaligned.h>
+
+#include "pcap.h"
+#include "cc2520.h"
+
+// Builds pcap records for the sniffer. Frames are written
+// with LINKTYPE_IEEE802_15_4_TAP, which puts a TLV header in
+// front of each frame for the radio metadata, so Wireshark
+// can show RSSI, LQI, channel and the SFD timestamp next to
+// the decoded frame. Everything is little endian, the TAP
+// header has to be and readers work out the byte order of
+// the pcap headers from the magic number.
+
+#define PCAP_MAGIC_NANOS 0xA1B23C4D
+#define PCAP_VERSION_MAJOR 2
+#define PCAP_VERSION_MINOR 4
+#define PCAP_SNAPLEN 65535
+#define LINKTYPE_IEEE802_15_4_TAP 283
+
+enum cc2520_tap_tlv_types {
+	TAP_TLV_FCS_TYPE = 0,
+	TAP_TLV_RSS = 1,
+	TAP_TLV_CHANNEL = 3,
+	TAP_TLV_SOF_TS = 5,
+	TAP_TLV_LQI = 10,
+};
+
+// The radio swaps the FCS for RSSI and CRC/LQI bytes,
+// so the frames we hand out have none.
+#define TAP_FCS_NONE 0
+
+// TAP wants the RSS as a float, which we can't use in
+// here. Whole dBm values are easy enough to encode by hand.
+static u32 cc2520_pcap_dbm_to_float(s8 dbm)
+{
+	u32 sign;
+	u32 mag;
+	int exp;
+
+	if (dbm == 0)
+		return 0;
+
+	sign = dbm < 0 ? 1 : 0;
+	mag = dbm < 0 ? -dbm : dbm;
+	exp = fls(mag) - 1;
+
+	return (sign << 31) | ((exp + 127) << 23) | ((mag << (23 - exp)) & 0x7FFFFF);
+}
+
+// Writes one TLV header, values are padded out to
+// four bytes by the caller's zeroed buffer.
+static u8 *cc2520_pcap_tlv(u8 *ptr, u16 type, u16 len)
+{
+	put_unaligned_le16(type, ptr);
+	put_unaligned_le16(len, ptr + 2);
+	return ptr + 4;
+}
+
+size_t cc2520_pcap_global_header(u8 *buf)
+{
+	put_unaligned_le32(PCAP_MAGIC_NANOS, buf);
+	put_unaligned_le16(PCAP_VERSION_MAJOR, buf + 4);
+	put_unaligned_le16(PCAP_VERSION_MINOR, buf + 6);
+	put_unaligned_le32(0, buf + 8);  // thiszone
+	put_unaligned_le32(0, buf + 12); // sigfigs
+	put_unaligned_le32(PCAP_SNAPLEN, buf + 16);
+	put_unaligned_le32(LINKTYPE_IEEE802_15_4_TAP, buf + 20);
+
+	return CC2520_PCAP_GLOBAL_HDR_LEN;
+}
+
+// frame is a received frame as handed up the stack, length
+// byte first and the two metadata bytes last. The record
+// timestamp is the SFD edge moved onto the wall clock
+// by realtime_offset.
+size_t cc2520_pcap_record(u8 *buf, const struct cc2520_rx_record *record,
+	const u8 *frame, size_t len, s64 realtime_offset)
+{
+	u8 *ptr;
+	size_t psdu_len;
+	u64 ts;
+	u32 rem;
+
+	psdu_len = len >= 3 ? len - 3 : 0;
+	ts = record->timestamp + realtime_offset;
+
+	memset(buf, 0, CC2520_PCAP_REC_HDR_LEN + CC2520_PCAP_TAP_HDR_LEN);
+
+	// Record header
+	put_unaligned_le32((u32)div_u64_rem(ts, NSEC_PER_SEC, &rem), buf);
+	put_unaligned_le32(rem, buf + 4);
+	put_unaligned_le32(CC2520_PCAP_TAP_HDR_LEN + psdu_len, buf + 8);
+	put_unaligned_le32(CC2520_PCAP_TAP_HDR_LEN + psdu_len, buf + 12);
+
+	// TAP header: version, reserved, total header length.
+	ptr = buf + CC2520_PCAP_REC_HDR_LEN;
+	ptr[0] = 0;
+	ptr[1] = 0;
+	put_unaligned_le16(CC2520_PCAP_TAP_HDR_LEN, ptr + 2);
+	ptr += 4;
+
+	ptr = cc2520_pcap_tlv(ptr, TAP_TLV_FCS_TYPE, 1);
+	ptr[0] = TAP_FCS_NONE;
+	ptr += 4;
+
+	ptr = cc2520_pcap_tlv(ptr, TAP_TLV_RSS, 4);
+	put_unaligned_le32(cc2520_pcap_dbm_to_float(record->rssi), ptr);
+	ptr += 4;
+
+	// Channel number, then the page, always 0 for us.
+	ptr = cc2520_pcap_tlv(ptr, TAP_TLV_CHANNEL, 3);
+	put_unaligned_le16(record->channel, ptr);
+	ptr[2] = 0;
+	ptr += 4;
+
+	ptr = cc2520_pcap_tlv(ptr, TAP_TLV_LQI, 1);
+	ptr[0] = record->lqi;
+	ptr += 4;
+
+	ptr = cc2520_pcap_tlv(ptr, TAP_TLV_SOF_TS, 8);
+	put_unaligned_le64(ts, ptr);
+	ptr += 8;
+
+	memcpy(ptr, frame + 1, psdu_len);
+
+	return CC2520_PCAP_REC_HDR_LEN + CC2520_PCAP_TAP_HDR_LEN + psdu_len;
+}
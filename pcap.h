@@ -0,0 +1,20 @@
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <linux/types.h>
+
+#include "ioctl.h"
+#include "packet.h"
+
+#define CC2520_PCAP_GLOBAL_HDR_LEN 24
+#define CC2520_PCAP_REC_HDR_LEN 16
+#define CC2520_PCAP_TAP_HDR_LEN 48
+
+// Largest record cc2520_pcap_record will produce.
+#define CC2520_PCAP_MAX_RECORD (CC2520_PCAP_REC_HDR_LEN + CC2520_PCAP_TAP_HDR_LEN + IEEE154_LINK_MTU)
+
+size_t cc2520_pcap_global_header(u8 *buf);
+size_t cc2520_pcap_record(u8 *buf, const struct cc2520_rx_record *record,
+	const u8 *frame, size_t len, s64 realtime_offset);
+
+#endif
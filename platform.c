@@ -13,13 +13,16 @@
 #include "cc2520.h"
 #include "radio.h"
 #include "platform.h"
+#include "trace.h"
+#include "flight.h"
 #include "debug.h"
+#include "emu.h"
 
 //////////////////////////
 // SPI Stuff
 //////////////////////////
 
-static int cc2520_spi_add_to_bus(void)
+static int cc2520_spi_add_to_bus(struct cc2520_dev *dev)
 {
     struct spi_master *spi_master;
     struct spi_device *spi_device;
@@ -27,10 +30,10 @@ static int cc2520_spi_add_to_bus(void)
     char buff[64];
     int status = 0;
 
-    spi_master = spi_busnum_to_master(SPI_BUS);
+    spi_master = spi_busnum_to_master(dev->spi_bus);
     if (!spi_master) {
         ERR((KERN_ALERT "[cc2520] - spi_busnum_to_master(%d) returned NULL\n",
-            SPI_BUS));
+            dev->spi_bus));
         ERR((KERN_ALERT "[cc2520] - Missing modprobe spi-bcm2708?\n"));
         return -1;
     }
@@ -42,7 +45,7 @@ static int cc2520_spi_add_to_bus(void)
         return -1;
     }
 
-    spi_device->chip_select = SPI_BUS_CS0;
+    spi_device->chip_select = dev->spi_cs;
 
     /* Check whether this SPI bus.cs is already claimed */
     snprintf(buff, sizeof(buff), "%s.%u",
@@ -74,6 +77,8 @@ Nuking from orbit.\n"));
 
     spi_device->controller_state = NULL;
     spi_device->controller_data = NULL;
+    // Lets probe find which radio this chip select belongs to.
+    spi_device->dev.platform_data = dev;
     strlcpy(spi_device->modalias, cc2520_name, SPI_NAME_SIZE);
 
     status = spi_add_device(spi_device);
@@ -89,15 +94,23 @@ Nuking from orbit.\n"));
 
 static int cc2520_spi_probe(struct spi_device *spi_device)
 {
+    struct cc2520_dev *dev = spi_device->dev.platform_data;
+
     ERR((KERN_INFO "[cc2520] - Inserting SPI protocol driver.\n"));
-    state.spi_device = spi_device;
+    if (!dev)
+        return -ENODEV;
+
+    dev->spi_device = spi_device;
     return 0;
 }
 
 static int cc2520_spi_remove(struct spi_device *spi_device)
 {
+    struct cc2520_dev *dev = spi_device->dev.platform_data;
+
     ERR((KERN_INFO "[cc2520] - Removing SPI protocol driver."));
-    state.spi_device = NULL;
+    if (dev)
+        dev->spi_device = NULL;
     return 0;
 }
 
@@ -110,31 +123,108 @@ static struct spi_driver cc2520_spi_driver = {
         .remove = cc2520_spi_remove,
 };
 
-int cc2520_plat_spi_init()
+// The protocol driver is shared by every radio, each
+// radio then hangs its own device off of it.
+int cc2520_plat_spi_register()
+{
+    return spi_register_driver(&cc2520_spi_driver);
+}
+
+void cc2520_plat_spi_unregister()
+{
+    spi_unregister_driver(&cc2520_spi_driver);
+}
+
+int cc2520_plat_spi_init(struct cc2520_dev *dev)
 {
     int result;
 
-    result = cc2520_spi_add_to_bus();
-    if (result < 0)
-        goto error;
+    if (dev->emulated)
+        return cc2520_emu_init(dev);
 
-    result = spi_register_driver(&cc2520_spi_driver);
+    result = cc2520_spi_add_to_bus(dev);
     if (result < 0)
-        goto error;
+        return result;
+
+    if (!dev->spi_device) {
+        ERR((KERN_ALERT "[cc2520] - radio%d spi device never probed\n", dev->id));
+        return -ENODEV;
+    }
 
     return 0;
+}
 
-    error:
-        spi_unregister_driver(&cc2520_spi_driver);
-        return result;
+void cc2520_plat_spi_free(struct cc2520_dev *dev)
+{
+    if (dev->emulated) {
+        cc2520_emu_free(dev);
+        return;
+    }
+
+    if (dev->spi_device)
+        spi_unregister_device(dev->spi_device);
 }
 
-void cc2520_plat_spi_free()
+int cc2520_plat_spi_async(struct cc2520_dev *dev, struct spi_message *msg)
 {
-    if (state.spi_device)
-        spi_unregister_device(state.spi_device);
+    if (dev->emulated)
+        return cc2520_emu_spi_async(dev, msg);
 
-    spi_unregister_driver(&cc2520_spi_driver);
+    return spi_async(dev->spi_device, msg);
+}
+
+int cc2520_plat_spi_sync(struct cc2520_dev *dev, struct spi_message *msg)
+{
+    if (dev->emulated)
+        return cc2520_emu_spi_sync(dev, msg);
+
+    return spi_sync(dev->spi_device, msg);
+}
+
+//////////////////////////
+// Pins
+//////////////////////////
+
+int cc2520_plat_pin_get(struct cc2520_dev *dev, enum cc2520_pin pin)
+{
+    if (dev->emulated)
+        return cc2520_emu_pin_get(dev, pin);
+
+    switch (pin) {
+        case CC2520_PIN_FIFO:
+            return gpio_get_value(dev->gpios.fifo);
+        case CC2520_PIN_FIFOP:
+            return gpio_get_value(dev->gpios.fifop);
+        case CC2520_PIN_CCA:
+            return gpio_get_value(dev->gpios.cca);
+        case CC2520_PIN_SFD:
+            return gpio_get_value(dev->gpios.sfd);
+        default:
+            return 0;
+    }
+}
+
+void cc2520_plat_pin_set(struct cc2520_dev *dev, enum cc2520_pin pin, int value)
+{
+    if (dev->emulated) {
+        cc2520_emu_pin_set(dev, pin, value);
+        return;
+    }
+
+    if (pin == CC2520_PIN_RESET)
+        gpio_set_value(dev->gpios.reset, value);
+}
+
+// Masks FIFOP without waiting for a running handler,
+// so it's safe from the handler itself.
+void cc2520_plat_fifop_irq(struct cc2520_dev *dev, bool enabled)
+{
+    if (dev->emulated)
+        cc2520_emu_fifop_irq(dev, enabled);
+    else if (enabled)
+        enable_irq(dev->gpios.fifop_irq);
+    else
+        disable_irq_nosync(dev->gpios.fifop_irq);
 }
 
 //////////////////////////
@@ -143,76 +233,98 @@ void cc2520_plat_spi_free()
 
 static irqreturn_t cc2520_sfd_handler(int irq, void *dev_id)
 {
+    struct cc2520_dev *dev = dev_id;
     int gpio_val;
-    struct timespec ts;
     s64 nanos;
 
     // NOTE: For now we're assuming no delay between SFD called
     // and actual SFD received. The TinyOS implementations call
     // for a few uS of delay, but it's likely not needed.
-    getrawmonotonic(&ts);
-    nanos = timespec_to_ns(&ts);
-    gpio_val = gpio_get_value(CC2520_SFD);
+    nanos = ktime_get_raw_ns();
+    gpio_val = cc2520_plat_pin_get(dev, CC2520_PIN_SFD);
 
     //DBG((KERN_INFO "[cc2520] - sfd interrupt occurred at %lld, %d\n", (long long int)nanos, gpio_val));
 
-    cc2520_radio_sfd_occurred(nanos, gpio_val);
+    trace_cc2520_sfd_irq(dev->id, nanos, gpio_val);
+    cc2520_flight_record(dev, CC2520_FLIGHT_SFD, gpio_val, NULL, 0);
+    cc2520_radio_sfd_occurred(dev, nanos, gpio_val);
     return IRQ_HANDLED;
 }
 
 static irqreturn_t cc2520_fifop_handler(int irq, void *dev_id)
 {
-    if (gpio_get_value(CC2520_FIFOP) == 1) {
+    struct cc2520_dev *dev = dev_id;
+
+    if (cc2520_plat_pin_get(dev, CC2520_PIN_FIFOP) == 1) {
         DBG((KERN_INFO "[cc2520] - fifop interrupt occurred\n"));
-        cc2520_radio_fifop_occurred();
+        trace_cc2520_fifop_irq(dev->id);
+        cc2520_flight_record(dev, CC2520_FLIGHT_FIFOP, 0, NULL, 0);
+        cc2520_radio_fifop_occurred(dev);
     }
     return IRQ_HANDLED;
 }
 
+void cc2520_plat_sfd_edge(struct cc2520_dev *dev)
+{
+    cc2520_sfd_handler(0, dev);
+}
+
+void cc2520_plat_fifop_edge(struct cc2520_dev *dev)
+{
+    cc2520_fifop_handler(0, dev);
+}
+
 //////////////////////////////
 // Interface Initialization
 //////////////////////////////
 
 // Sets up the GPIO pins needed for the CC2520
 // and initializes any interrupt handlers needed.
-int cc2520_plat_gpio_init()
+// The debug pins are only wired up on the first radio.
+int cc2520_plat_gpio_init(struct cc2520_dev *dev)
 {
     int err = 0;
     int irq = 0;
 
+    // The emulator raises its own edges.
+    if (dev->emulated)
+        return 0;
+
     // Setup GPIO In/Out
-    err = gpio_request_one(CC2520_FIFO, GPIOF_DIR_IN, NULL);
+    err = gpio_request_one(dev->gpios.fifo, GPIOF_DIR_IN, NULL);
     if (err)
         goto fail;
 
-    err = gpio_request_one(CC2520_FIFOP, GPIOF_DIR_IN, NULL);
+    err = gpio_request_one(dev->gpios.fifop, GPIOF_DIR_IN, NULL);
     if (err)
         goto fail;
 
-    err = gpio_request_one(CC2520_CCA, GPIOF_DIR_IN, NULL);
+    err = gpio_request_one(dev->gpios.cca, GPIOF_DIR_IN, NULL);
     if (err)
         goto fail;
 
-    err = gpio_request_one(CC2520_SFD, GPIOF_DIR_IN, NULL);
+    err = gpio_request_one(dev->gpios.sfd, GPIOF_DIR_IN, NULL);
     if (err)
         goto fail;
 
-    err = gpio_request_one(CC2520_RESET, GPIOF_DIR_OUT, NULL);
+    err = gpio_request_one(dev->gpios.reset, GPIOF_DIR_OUT, NULL);
     if (err)
         goto fail;
 
-    err = gpio_request_one(CC2520_DEBUG_0, GPIOF_DIR_OUT, NULL);
-    if (err)
-        goto fail;
+    if (dev->id == 0) {
+        err = gpio_request_one(CC2520_DEBUG_0, GPIOF_DIR_OUT, NULL);
+        if (err)
+            goto fail;
 
-    err = gpio_request_one(CC2520_DEBUG_1, GPIOF_DIR_OUT, NULL);
-    if (err)
-        goto fail;
+        err = gpio_request_one(CC2520_DEBUG_1, GPIOF_DIR_OUT, NULL);
+        if (err)
+            goto fail;
 
-    gpio_set_value(CC2520_DEBUG_0, 0);
+        gpio_set_value(CC2520_DEBUG_0, 0);
+    }
 
     // Setup FIFOP Interrupt
-    irq = gpio_to_irq(CC2520_FIFOP);
+    irq = gpio_to_irq(dev->gpios.fifop);
     if (irq < 0) {
         err = irq;
         goto fail;
@@ -223,14 +335,14 @@ int cc2520_plat_gpio_init()
         cc2520_fifop_handler,
         IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING,
         "fifopHandler",
-        NULL
+        dev
     );
     if (err)
         goto fail;
-    state.gpios.fifop_irq = irq;
+    dev->gpios.fifop_irq = irq;
 
     // Setup SFD Interrupt
-    irq = gpio_to_irq(CC2520_SFD);
+    irq = gpio_to_irq(dev->gpios.sfd);
     if (irq < 0) {
         err = irq;
         goto fail;
@@ -241,32 +353,43 @@ int cc2520_plat_gpio_init()
         cc2520_sfd_handler,
         IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING,
         "sfdHandler",
-        NULL
+        dev
     );
     if (err)
         goto fail;
-    state.gpios.sfd_irq = irq;
+    dev->gpios.sfd_irq = irq;
 
     return err;
 
     fail:
         ERR((KERN_ALERT "[cc2520] - failed to init GPIOs\n"));
-        cc2520_plat_gpio_free();
+        cc2520_plat_gpio_free(dev);
         return err;
 }
 
-void cc2520_plat_gpio_free()
+void cc2520_plat_gpio_free(struct cc2520_dev *dev)
 {
-    gpio_free(CC2520_CLOCK);
-    gpio_free(CC2520_FIFO);
-    gpio_free(CC2520_FIFOP);
-    gpio_free(CC2520_CCA);
-    gpio_free(CC2520_SFD);
-    gpio_free(CC2520_RESET);
-
-    gpio_free(CC2520_DEBUG_0);
-    gpio_free(CC2520_DEBUG_1);
-
-    free_irq(state.gpios.fifop_irq, NULL);
-    free_irq(state.gpios.sfd_irq, NULL);
+    if (dev->emulated)
+        return;
+
+    gpio_free(dev->gpios.fifo);
+    gpio_free(dev->gpios.fifop);
+    gpio_free(dev->gpios.cca);
+    gpio_free(dev->gpios.sfd);
+    gpio_free(dev->gpios.reset);
+
+    if (dev->id == 0) {
+        gpio_free(CC2520_DEBUG_0);
+        gpio_free(CC2520_DEBUG_1);
+    }
+
+    if (dev->gpios.fifop_irq) {
+        free_irq(dev->gpios.fifop_irq, dev);
+        dev->gpios.fifop_irq = 0;
+    }
+
+    if (dev->gpios.sfd_irq) {
+        free_irq(dev->gpios.sfd_irq, dev);
+        dev->gpios.sfd_irq = 0;
+    }
 }
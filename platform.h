@@ -1,10 +1,40 @@
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
+#include <linux/types.h>
+
+struct cc2520_dev;
+struct spi_message;
+
+// The radio pins the driver reads and drives. Radios
+// loaded with emulate=1 have them backed by the emulator
+// instead of real GPIOs, see emu.h.
+enum cc2520_pin {
+	CC2520_PIN_FIFO,
+	CC2520_PIN_FIFOP,
+	CC2520_PIN_CCA,
+	CC2520_PIN_SFD,
+	CC2520_PIN_RESET,
+};
+
 // Platform
-int cc2520_plat_gpio_init(void);
-void cc2520_plat_gpio_free(void);
-int cc2520_plat_spi_init(void);
-void cc2520_plat_spi_free(void);
+int cc2520_plat_gpio_init(struct cc2520_dev *dev);
+void cc2520_plat_gpio_free(struct cc2520_dev *dev);
+int cc2520_plat_spi_init(struct cc2520_dev *dev);
+void cc2520_plat_spi_free(struct cc2520_dev *dev);
+int cc2520_plat_spi_register(void);
+void cc2520_plat_spi_unregister(void);
+
+// Everything the radio does to the chip goes through these.
+int cc2520_plat_spi_async(struct cc2520_dev *dev, struct spi_message *msg);
+int cc2520_plat_spi_sync(struct cc2520_dev *dev, struct spi_message *msg);
+int cc2520_plat_pin_get(struct cc2520_dev *dev, enum cc2520_pin pin);
+void cc2520_plat_pin_set(struct cc2520_dev *dev, enum cc2520_pin pin, int value);
+void cc2520_plat_fifop_irq(struct cc2520_dev *dev, bool enabled);
+
+// Edge callbacks for the emulator, run the same
+// handlers the GPIO interrupts do.
+void cc2520_plat_sfd_edge(struct cc2520_dev *dev);
+void cc2520_plat_fifop_edge(struct cc2520_dev *dev);
 
-#endif
\ No newline at end of file
+#endif
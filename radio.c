@@ -13,51 +13,97 @@
 #include <linux/spinlock.h>
 #include <linux/sched.h>
 #include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/bitops.h>
 
 #include "cc2520.h"
 #include "radio.h"
 #include "radio_config.h"
 #include "interface.h"
+#include "packet.h"
+#include "platform.h"
+#include "stats.h"
+#include "flight.h"
+#include "trace.h"
 #include "debug.h"
 
-static u16 short_addr;
-static u64 extended_addr;
-static u16 pan_id;
-static u8 channel;
-
-static struct spi_message msg;
-static struct spi_transfer tsfer;
-static struct spi_transfer tsfer1;
-static struct spi_transfer tsfer2;
-static struct spi_transfer tsfer3;
-static struct spi_transfer tsfer4;
-
-static struct spi_message rx_msg;
-static struct spi_transfer rx_tsfer;
-
-static u8 *tx_buf;
-static u8 *rx_buf;
-
-static u8 *rx_out_buf;
-static u8 *rx_in_buf;
-
-static u8 *tx_buf_r;
-static u8 *rx_buf_r;
-static u8 tx_buf_r_len;
-
-static u64 sfd_nanos_ts;
-
-static spinlock_t radio_sl;
-
-static spinlock_t pending_rx_sl;
-static bool pending_rx;
-
-static spinlock_t rx_buf_sl;
-
-static int radio_state;
-
-static unsigned long flags;
-static unsigned long flags1;
+struct cc2520_radio_state {
+	u16 short_addr;
+	u64 extended_addr;
+	u16 pan_id;
+	u8 channel;
+	u8 txpower;
+
+	// Hardware frame filter configuration, promiscuous
+	// mode overrides the filter enable bit.
+	cc2520_frmfilt0_t frmfilt0;
+	cc2520_frmfilt1_t frmfilt1;
+	bool promiscuous;
+
+	// What's actually programmed into TXPOWER, which differs
+	// from txpower after sending a frame with its own power.
+	u8 hw_txpower;
+
+	struct spi_message msg;
+	struct spi_transfer tsfer;
+	struct spi_transfer tsfer1;
+	struct spi_transfer tsfer2;
+	struct spi_transfer tsfer3;
+	struct spi_transfer tsfer4;
+
+	struct spi_message rx_msg;
+	struct spi_transfer rx_tsfer;
+
+	u8 *tx_buf;
+	u8 *rx_buf;
+
+	u8 *rx_out_buf;
+	u8 *rx_in_buf;
+
+	u8 *tx_buf_r;
+	u8 *rx_buf_r;
+	u8 tx_buf_r_len;
+	u8 rx_len;
+
+	u64 sfd_rise_nanos_ts;
+	u64 sfd_fall_nanos_ts;
+
+	// For the latency histograms.
+	u64 fifop_nanos_ts;
+	u64 tx_sfd_nanos_ts;
+
+	// Metadata for the frame currently held in rx_buf_r.
+	struct cc2520_rx_record rx_meta;
+
+	spinlock_t radio_sl;
+
+	spinlock_t pending_rx_sl;
+	bool pending_rx;
+
+	spinlock_t rx_buf_sl;
+
+	int state;
+	bool radio_on;
+
+	// Adaptive RX polling. Once enabled the first FIFOP
+	// masks the interrupt and hands the FIFO to rx_thread,
+	// which drains it until it's been idle for a while.
+	struct task_struct *rx_thread;
+	wait_queue_head_t rx_poll_wq;
+	spinlock_t rx_poll_sl;
+	bool rx_poll;
+	bool rx_poll_active;
+	int rx_poll_budget;
+	struct cc2520_rx_poll_stats rx_poll_stats;
+
+	// Channel switch accounting, all times in nanoseconds.
+	u32 switch_count;
+	u32 switch_lock_timeouts;
+	u64 switch_last_ns;
+	u64 switch_max_ns;
+	u64 switch_total_ns;
+};
 
 enum cc2520_radio_state_enum {
     CC2520_RADIO_STATE_IDLE,
@@ -68,305 +114,704 @@ enum cc2520_radio_state_enum {
     CC2520_RADIO_STATE_CONFIG
 };
 
-static cc2520_status_t cc2520_radio_strobe(u8 cmd);
-static void cc2520_radio_writeRegister(u8 reg, u8 value);
-static void cc2520_radio_writeMemory(u16 mem_addr, u8 *value, u8 len);
+static cc2520_status_t cc2520_radio_strobe(struct cc2520_dev *dev, u8 cmd);
+static void cc2520_radio_writeRegister(struct cc2520_dev *dev, u8 reg, u8 value);
+static u8 cc2520_radio_readRegister(struct cc2520_dev *dev, u8 reg);
+static cc2520_frmfilt0_t cc2520_radio_frmfilt0(struct cc2520_dev *dev);
+static void cc2520_radio_writeMemory(struct cc2520_dev *dev, u16 mem_addr, u8 *value, u8 len);
 
-static void cc2520_radio_beginRx(void);
+static void cc2520_radio_claimRx(struct cc2520_dev *dev);
+static void cc2520_radio_releaseRx(struct cc2520_dev *dev);
+static void cc2520_radio_beginRx(struct cc2520_dev *dev);
 static void cc2520_radio_continueRx(void *arg);
 static void cc2520_radio_finishRx(void *arg);
+static void cc2520_radio_stampRx(struct cc2520_dev *dev);
+static void cc2520_radio_deliverRx(struct cc2520_dev *dev, int len);
+static int cc2520_radio_rx_poll_thread(void *arg);
+static void cc2520_radio_pollRx(struct cc2520_dev *dev);
+static void cc2520_radio_rx_sync(struct cc2520_dev *dev, u8 cmd, int len);
+static void cc2520_radio_flushRx_sync(struct cc2520_dev *dev);
 
 
-static int cc2520_radio_tx(u8 *buf, u8 len);
-static void cc2520_radio_beginTx(void);
+static int cc2520_radio_tx(struct cc2520_dev *dev, u8 *buf, u8 len);
+static void cc2520_radio_beginTx(struct cc2520_dev *dev);
 static void cc2520_radio_continueTx_check(void *arg);
 static void cc2520_radio_continueTx(void *arg);
-static void cc2520_radio_completeTx(void);
+static void cc2520_radio_completeTx(struct cc2520_dev *dev);
 
-static void cc2520_radio_flushRx(void);
+static void cc2520_radio_flushRx(struct cc2520_dev *dev);
 static void cc2520_radio_continueFlushRx(void *arg);
 static void cc2520_radio_completeFlushRx(void *arg);
-static void cc2520_radio_flushTx(void);
+static void cc2520_radio_flushTx(struct cc2520_dev *dev);
 static void cc2520_radio_completeFlushTx(void *arg);
 
-struct cc2520_interface *radio_top;
-
 // TODO: These methods are stupid
 // and make things more confusing.
 // Refactor them out.
 
-void cc2520_radio_lock(int state)
+void cc2520_radio_lock(struct cc2520_dev *dev, int state)
 {
-	spin_lock_irqsave(&radio_sl, flags1);
-	while (radio_state != CC2520_RADIO_STATE_IDLE) {
-		spin_unlock_irqrestore(&radio_sl, flags1);
-		spin_lock_irqsave(&radio_sl, flags1);
+	struct cc2520_radio_state *radio = dev->radio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&radio->radio_sl, flags);
+	while (radio->state != CC2520_RADIO_STATE_IDLE) {
+		spin_unlock_irqrestore(&radio->radio_sl, flags);
+		spin_lock_irqsave(&radio->radio_sl, flags);
 	}
-	radio_state = state;
-	spin_unlock_irqrestore(&radio_sl, flags1);
+	radio->state = state;
+	trace_cc2520_radio_state(dev->id, radio->state);
+	spin_unlock_irqrestore(&radio->radio_sl, flags);
 }
 
-void cc2520_radio_unlock(void)
+void cc2520_radio_unlock(struct cc2520_dev *dev)
 {
-	spin_lock_irqsave(&radio_sl, flags1);
-	radio_state = CC2520_RADIO_STATE_IDLE;
-	spin_unlock_irqrestore(&radio_sl, flags1);
+	struct cc2520_radio_state *radio = dev->radio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&radio->radio_sl, flags);
+	radio->state = CC2520_RADIO_STATE_IDLE;
+	trace_cc2520_radio_state(dev->id, radio->state);
+	spin_unlock_irqrestore(&radio->radio_sl, flags);
 }
 
-int cc2520_radio_tx_unlock_spi(void)
+int cc2520_radio_tx_unlock_spi(struct cc2520_dev *dev)
 {
-	spin_lock_irqsave(&radio_sl, flags1);
-	if (radio_state == CC2520_RADIO_STATE_TX) {
-		radio_state = CC2520_RADIO_STATE_TX_SPI_DONE;
-		spin_unlock_irqrestore(&radio_sl, flags1);
+	struct cc2520_radio_state *radio = dev->radio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&radio->radio_sl, flags);
+	if (radio->state == CC2520_RADIO_STATE_TX) {
+		radio->state = CC2520_RADIO_STATE_TX_SPI_DONE;
+		trace_cc2520_radio_state(dev->id, radio->state);
+		spin_unlock_irqrestore(&radio->radio_sl, flags);
 		return 0;
 	}
-	else if (radio_state == CC2520_RADIO_STATE_TX_SFD_DONE) {
-		radio_state = CC2520_RADIO_STATE_TX_2_RX;
-		spin_unlock_irqrestore(&radio_sl, flags1);
+	else if (radio->state == CC2520_RADIO_STATE_TX_SFD_DONE) {
+		radio->state = CC2520_RADIO_STATE_TX_2_RX;
+		trace_cc2520_radio_state(dev->id, radio->state);
+		spin_unlock_irqrestore(&radio->radio_sl, flags);
 		return 1;
 	}
-	spin_unlock_irqrestore(&radio_sl, flags1);
+	spin_unlock_irqrestore(&radio->radio_sl, flags);
 	return 0;
 }
 
-int cc2520_radio_tx_unlock_sfd(void)
+int cc2520_radio_tx_unlock_sfd(struct cc2520_dev *dev)
 {
-	spin_lock_irqsave(&radio_sl, flags1);
-	if (radio_state == CC2520_RADIO_STATE_TX) {
-		radio_state = CC2520_RADIO_STATE_TX_SFD_DONE;
-		spin_unlock_irqrestore(&radio_sl, flags1);
+	struct cc2520_radio_state *radio = dev->radio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&radio->radio_sl, flags);
+	if (radio->state == CC2520_RADIO_STATE_TX) {
+		radio->state = CC2520_RADIO_STATE_TX_SFD_DONE;
+		trace_cc2520_radio_state(dev->id, radio->state);
+		spin_unlock_irqrestore(&radio->radio_sl, flags);
 		return 0;
 	}
-	else if (radio_state == CC2520_RADIO_STATE_TX_SPI_DONE) {
-		radio_state = CC2520_RADIO_STATE_TX_2_RX;
-		spin_unlock_irqrestore(&radio_sl, flags1);
+	else if (radio->state == CC2520_RADIO_STATE_TX_SPI_DONE) {
+		radio->state = CC2520_RADIO_STATE_TX_2_RX;
+		trace_cc2520_radio_state(dev->id, radio->state);
+		spin_unlock_irqrestore(&radio->radio_sl, flags);
 		return 1;
 	}
-	spin_unlock_irqrestore(&radio_sl, flags1);
+	spin_unlock_irqrestore(&radio->radio_sl, flags);
 	return 0;
 }
 
+// Every async message goes out and comes back through
+// these so it shows up in the traces and flight recorder.
+static int cc2520_radio_spi_async(struct cc2520_dev *dev, struct spi_message *msg)
+{
+	trace_cc2520_spi_submit(dev->id, msg, msg->complete);
+	cc2520_flight_spi(dev, CC2520_FLIGHT_SPI, msg);
+	return cc2520_plat_spi_async(dev, msg);
+}
+
+static void cc2520_radio_spi_done(struct cc2520_dev *dev, struct spi_message *msg)
+{
+	trace_cc2520_spi_complete(dev->id, msg);
+	cc2520_flight_spi(dev, CC2520_FLIGHT_SPI_DONE, msg);
+}
+
 //////////////////////////////
 // Initialization & On/Off
 /////////////////////////////
 
-int cc2520_radio_init()
+int cc2520_radio_init(struct cc2520_dev *dev)
 {
+	struct cc2520_radio_state *radio;
 	int result;
 
-	radio_top->tx = cc2520_radio_tx;
+	radio = kzalloc(sizeof(struct cc2520_radio_state), GFP_KERNEL);
+	if (!radio)
+		return -ENOMEM;
 
-	short_addr = CC2520_DEF_SHORT_ADDR;
-	extended_addr = CC2520_DEF_EXT_ADDR;
-	pan_id = CC2520_DEF_PAN;
-	channel = CC2520_DEF_CHANNEL;
+	dev->radio = radio;
 
-	spin_lock_init(&radio_sl);
-	spin_lock_init(&rx_buf_sl);
-	spin_lock_init(&pending_rx_sl);
+	dev->radio_top->tx = cc2520_radio_tx;
 
-	radio_state = CC2520_RADIO_STATE_IDLE;
+	radio->short_addr = CC2520_DEF_SHORT_ADDR;
+	radio->extended_addr = CC2520_DEF_EXT_ADDR;
+	radio->pan_id = CC2520_DEF_PAN;
+	radio->channel = CC2520_DEF_CHANNEL;
+	radio->txpower = cc2520_txpower_default.f.pa_power;
+	radio->frmfilt0 = cc2520_frmfilt0_default;
+	radio->frmfilt1 = cc2520_frmfilt1_default;
+	radio->promiscuous = false;
 
-	tx_buf = kmalloc(SPI_BUFF_SIZE, GFP_KERNEL | GFP_DMA);
-	if (!tx_buf) {
+	spin_lock_init(&radio->radio_sl);
+	spin_lock_init(&radio->rx_buf_sl);
+	spin_lock_init(&radio->pending_rx_sl);
+	spin_lock_init(&radio->rx_poll_sl);
+	init_waitqueue_head(&radio->rx_poll_wq);
+
+	radio->state = CC2520_RADIO_STATE_IDLE;
+	radio->rx_poll_budget = CC2520_DEF_RX_POLL_BUDGET;
+
+	radio->tx_buf = kmalloc(SPI_BUFF_SIZE, GFP_KERNEL | GFP_DMA);
+	if (!radio->tx_buf) {
 		result = -EFAULT;
 		goto error;
 	}
 
-	rx_buf = kmalloc(SPI_BUFF_SIZE, GFP_KERNEL | GFP_DMA);
-	if (!rx_buf) {
+	radio->rx_buf = kmalloc(SPI_BUFF_SIZE, GFP_KERNEL | GFP_DMA);
+	if (!radio->rx_buf) {
 		result = -EFAULT;
 		goto error;
 	}
 
-	rx_out_buf = kmalloc(SPI_BUFF_SIZE, GFP_KERNEL | GFP_DMA);
-	if (!rx_out_buf) {
+	radio->rx_out_buf = kmalloc(SPI_BUFF_SIZE, GFP_KERNEL | GFP_DMA);
+	if (!radio->rx_out_buf) {
 		result = -EFAULT;
 		goto error;
 	}
 
-	rx_in_buf = kmalloc(SPI_BUFF_SIZE, GFP_KERNEL | GFP_DMA);
-	if (!rx_in_buf) {
+	radio->rx_in_buf = kmalloc(SPI_BUFF_SIZE, GFP_KERNEL | GFP_DMA);
+	if (!radio->rx_in_buf) {
 		result = -EFAULT;
 		goto error;
 	}
 
-	tx_buf_r = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
-	if (!tx_buf_r) {
+	radio->tx_buf_r = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
+	if (!radio->tx_buf_r) {
 		result = -EFAULT;
 		goto error;
 	}
 
-	rx_buf_r = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
-	if (!rx_buf_r) {
+	radio->rx_buf_r = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
+	if (!radio->rx_buf_r) {
 		result = -EFAULT;
 		goto error;
 	}
 
+	radio->rx_thread = kthread_run(cc2520_radio_rx_poll_thread, dev, "cc2520_rx%d", dev->id);
+	if (IS_ERR(radio->rx_thread)) {
+		result = PTR_ERR(radio->rx_thread);
+		radio->rx_thread = NULL;
+		goto error;
+	}
+
 	return 0;
 
 	error:
-		if (rx_buf_r) {
-			kfree(rx_buf_r);
-			rx_buf_r = NULL;
+		if (radio->rx_buf_r) {
+			kfree(radio->rx_buf_r);
+			radio->rx_buf_r = NULL;
 		}
 
-		if (tx_buf_r) {
-			kfree(tx_buf_r);
-			tx_buf_r = NULL;
+		if (radio->tx_buf_r) {
+			kfree(radio->tx_buf_r);
+			radio->tx_buf_r = NULL;
 		}
 
-		if (rx_buf) {
-			kfree(rx_buf);
-			rx_buf = NULL;
+		if (radio->rx_buf) {
+			kfree(radio->rx_buf);
+			radio->rx_buf = NULL;
 		}
 
-		if (tx_buf) {
-			kfree(tx_buf);
-			tx_buf = NULL;
+		if (radio->tx_buf) {
+			kfree(radio->tx_buf);
+			radio->tx_buf = NULL;
 		}
 
-		if (rx_in_buf) {
-			kfree(rx_in_buf);
-			rx_in_buf = NULL;
+		if (radio->rx_in_buf) {
+			kfree(radio->rx_in_buf);
+			radio->rx_in_buf = NULL;
 		}
 
-		if (rx_out_buf) {
-			kfree(rx_out_buf);
-			rx_out_buf = NULL;
+		if (radio->rx_out_buf) {
+			kfree(radio->rx_out_buf);
+			radio->rx_out_buf = NULL;
 		}
 
+		kfree(radio);
+		dev->radio = NULL;
+
 		return result;
 }
 
-void cc2520_radio_free()
+void cc2520_radio_free(struct cc2520_dev *dev)
 {
-	if (rx_buf_r) {
-		kfree(rx_buf_r);
-		rx_buf_r = NULL;
+	struct cc2520_radio_state *radio = dev->radio;
+
+	if (radio->rx_thread)
+		kthread_stop(radio->rx_thread);
+
+	if (radio->rx_buf_r) {
+		kfree(radio->rx_buf_r);
+		radio->rx_buf_r = NULL;
 	}
 
-	if (tx_buf_r) {
-		kfree(tx_buf_r);
-		tx_buf_r = NULL;
+	if (radio->tx_buf_r) {
+		kfree(radio->tx_buf_r);
+		radio->tx_buf_r = NULL;
 	}
 
-	if (rx_buf) {
-		kfree(rx_buf);
-		rx_buf = NULL;
+	if (radio->rx_buf) {
+		kfree(radio->rx_buf);
+		radio->rx_buf = NULL;
 	}
 
-	if (tx_buf) {
-		kfree(tx_buf);
-		tx_buf = NULL;
+	if (radio->tx_buf) {
+		kfree(radio->tx_buf);
+		radio->tx_buf = NULL;
 	}
 
-	if (rx_in_buf) {
-		kfree(rx_in_buf);
-		rx_in_buf = NULL;
+	if (radio->rx_in_buf) {
+		kfree(radio->rx_in_buf);
+		radio->rx_in_buf = NULL;
 	}
 
-	if (rx_out_buf) {
-		kfree(rx_out_buf);
-		rx_out_buf = NULL;
+	if (radio->rx_out_buf) {
+		kfree(radio->rx_out_buf);
+		radio->rx_out_buf = NULL;
 	}
+
+	kfree(radio);
+	dev->radio = NULL;
 }
 
-void cc2520_radio_start()
+void cc2520_radio_start(struct cc2520_dev *dev)
 {
-	cc2520_radio_lock(CC2520_RADIO_STATE_CONFIG);
-	tsfer.cs_change = 1;
+	struct cc2520_radio_state *radio = dev->radio;
+
+	cc2520_radio_lock(dev, CC2520_RADIO_STATE_CONFIG);
+	radio->tsfer.cs_change = 1;
 
 	// 200uS Reset Pulse.
-	gpio_set_value(CC2520_RESET, 0);
+	cc2520_plat_pin_set(dev, CC2520_PIN_RESET, 0);
 	udelay(200);
-	gpio_set_value(CC2520_RESET, 1);
+	cc2520_plat_pin_set(dev, CC2520_PIN_RESET, 1);
 	udelay(200);
 
-	cc2520_radio_writeRegister(CC2520_TXPOWER, cc2520_txpower_default.value);
-	cc2520_radio_writeRegister(CC2520_CCACTRL0, cc2520_ccactrl0_default.value);
-	cc2520_radio_writeRegister(CC2520_MDMCTRL0, cc2520_mdmctrl0_default.value);
-	cc2520_radio_writeRegister(CC2520_MDMCTRL1, cc2520_mdmctrl1_default.value);
-	cc2520_radio_writeRegister(CC2520_RXCTRL, cc2520_rxctrl_default.value);
-	cc2520_radio_writeRegister(CC2520_FSCTRL, cc2520_fsctrl_default.value);
-	cc2520_radio_writeRegister(CC2520_FSCAL1, cc2520_fscal1_default.value);
-	cc2520_radio_writeRegister(CC2520_AGCCTRL1, cc2520_agcctrl1_default.value);
-	cc2520_radio_writeRegister(CC2520_ADCTEST0, cc2520_adctest0_default.value);
-	cc2520_radio_writeRegister(CC2520_ADCTEST1, cc2520_adctest1_default.value);
-	cc2520_radio_writeRegister(CC2520_ADCTEST2, cc2520_adctest2_default.value);
-	cc2520_radio_writeRegister(CC2520_FIFOPCTRL, cc2520_fifopctrl_default.value);
-	cc2520_radio_writeRegister(CC2520_FRMCTRL0, cc2520_frmctrl0_default.value);
-	cc2520_radio_writeRegister(CC2520_FRMFILT1, cc2520_frmfilt1_default.value);
-	cc2520_radio_writeRegister(CC2520_SRCMATCH, cc2520_srcmatch_default.value);
-	cc2520_radio_unlock();
+	cc2520_radio_writeRegister(dev, CC2520_TXPOWER, cc2520_txpower_default.value);
+	radio->hw_txpower = cc2520_txpower_default.f.pa_power;
+	cc2520_radio_writeRegister(dev, CC2520_CCACTRL0, cc2520_ccactrl0_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_MDMCTRL0, cc2520_mdmctrl0_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_MDMCTRL1, cc2520_mdmctrl1_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_RXCTRL, cc2520_rxctrl_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_FSCTRL, cc2520_fsctrl_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_FSCAL1, cc2520_fscal1_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_AGCCTRL1, cc2520_agcctrl1_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_ADCTEST0, cc2520_adctest0_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_ADCTEST1, cc2520_adctest1_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_ADCTEST2, cc2520_adctest2_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_FIFOPCTRL, cc2520_fifopctrl_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_FRMCTRL0, cc2520_frmctrl0_default.value);
+	cc2520_radio_writeRegister(dev, CC2520_FRMFILT0, cc2520_radio_frmfilt0(dev).value);
+	cc2520_radio_writeRegister(dev, CC2520_FRMFILT1, radio->frmfilt1.value);
+	cc2520_radio_writeRegister(dev, CC2520_SRCMATCH, cc2520_srcmatch_default.value);
+	cc2520_radio_unlock(dev);
 }
 
-void cc2520_radio_on()
+void cc2520_radio_on(struct cc2520_dev *dev)
 {
-	cc2520_radio_lock(CC2520_RADIO_STATE_CONFIG);
-	cc2520_radio_set_channel(channel & CC2520_CHANNEL_MASK);
-	cc2520_radio_set_address(short_addr, extended_addr, pan_id);
-	cc2520_radio_strobe(CC2520_CMD_SRXON);
-	cc2520_radio_unlock();
+	struct cc2520_radio_state *radio = dev->radio;
+
+	cc2520_radio_lock(dev, CC2520_RADIO_STATE_CONFIG);
+	cc2520_radio_set_channel(dev, radio->channel & CC2520_CHANNEL_MASK);
+	cc2520_radio_set_address(dev, radio->short_addr, radio->extended_addr, radio->pan_id);
+	cc2520_radio_strobe(dev, CC2520_CMD_SRXON);
+	radio->radio_on = true;
+	cc2520_radio_unlock(dev);
 }
 
-void cc2520_radio_off()
+void cc2520_radio_off(struct cc2520_dev *dev)
 {
-	cc2520_radio_lock(CC2520_RADIO_STATE_CONFIG);
-	cc2520_radio_strobe(CC2520_CMD_SRFOFF);
-	cc2520_radio_unlock();
+	struct cc2520_radio_state *radio = dev->radio;
+
+	cc2520_radio_lock(dev, CC2520_RADIO_STATE_CONFIG);
+	cc2520_radio_strobe(dev, CC2520_CMD_SRFOFF);
+	radio->radio_on = false;
+	cc2520_radio_unlock(dev);
 }
 
 //////////////////////////////
 // Configuration Commands
 /////////////////////////////
 
-bool cc2520_radio_is_clear()
+bool cc2520_radio_is_clear(struct cc2520_dev *dev)
+{
+	return cc2520_plat_pin_get(dev, CC2520_PIN_CCA) == 1;
+}
+
+void cc2520_radio_set_channel(struct cc2520_dev *dev, int new_channel)
 {
-	return gpio_get_value(CC2520_CCA) == 1;
+	struct cc2520_radio_state *radio = dev->radio;
+	cc2520_freqctrl_t freqctrl;
+
+	radio->channel = new_channel;
+	freqctrl = cc2520_freqctrl_default;
+
+	freqctrl.f.freq = 11 + 5 * (radio->channel - 11);
+
+	cc2520_radio_writeRegister(dev, CC2520_FREQCTRL, freqctrl.value);
 }
 
-void cc2520_radio_set_channel(int new_channel)
+// Retunes the radio, safe to call while it's on. RX is idled,
+// the synthesizer retuned, anything half-received on the old
+// channel flushed and RX restarted. We then poll FSMSTAT1
+// until the PLL reports lock, which bounds the switch to the
+// lock poll budget.
+int cc2520_radio_switch_channel(struct cc2520_dev *dev, int new_channel)
 {
+	struct cc2520_radio_state *radio = dev->radio;
 	cc2520_freqctrl_t freqctrl;
+	cc2520_fsmstat1_t fsmstat1;
+	ktime_t start;
+	u64 elapsed;
+	int status;
+	int i;
 
-	channel = new_channel;
+	if (new_channel < 11 || new_channel > 26)
+		return -EINVAL;
+
+	cc2520_radio_lock(dev, CC2520_RADIO_STATE_CONFIG);
+
+	if (!radio->radio_on) {
+		cc2520_radio_set_channel(dev, new_channel);
+		cc2520_radio_unlock(dev);
+		return 0;
+	}
+
+	// Keep the receive engine from starting a read
+	// while we flush the FIFO out from under it.
+	cc2520_radio_claimRx(dev);
+
+	start = ktime_get();
+
+	radio->channel = new_channel;
 	freqctrl = cc2520_freqctrl_default;
+	freqctrl.f.freq = 11 + 5 * (radio->channel - 11);
+
+	// The register write runs on until chip select
+	// drops, so the strobes after it get their own
+	// transfer.
+	radio->tsfer1.tx_buf = radio->tx_buf;
+	radio->tsfer1.rx_buf = radio->rx_buf;
+	radio->tsfer1.len = 0;
+	radio->tsfer1.cs_change = 1;
+
+	radio->tx_buf[radio->tsfer1.len++] = CC2520_CMD_SRFOFF;
+	radio->tx_buf[radio->tsfer1.len++] = CC2520_CMD_REGISTER_WRITE | CC2520_FREQCTRL;
+	radio->tx_buf[radio->tsfer1.len++] = freqctrl.value;
+
+	radio->tsfer2.tx_buf = radio->tx_buf + radio->tsfer1.len;
+	radio->tsfer2.rx_buf = radio->rx_buf + radio->tsfer1.len;
+	radio->tsfer2.len = 0;
+	radio->tsfer2.cs_change = 1;
+
+	// Double flush, see cc2520_radio_continueFlushRx.
+	radio->tx_buf[radio->tsfer1.len + radio->tsfer2.len++] = CC2520_CMD_SFLUSHRX;
+	radio->tx_buf[radio->tsfer1.len + radio->tsfer2.len++] = CC2520_CMD_SFLUSHRX;
+	radio->tx_buf[radio->tsfer1.len + radio->tsfer2.len++] = CC2520_CMD_SRXON;
+
+	spi_message_init(&radio->msg);
+	radio->msg.context = dev;
+	spi_message_add_tail(&radio->tsfer1, &radio->msg);
+	spi_message_add_tail(&radio->tsfer2, &radio->msg);
+
+	status = cc2520_plat_spi_sync(dev, &radio->msg);
+
+	fsmstat1.value = 0;
+	for (i = 0; i < CC2520_SWITCH_LOCK_POLLS; i++) {
+		udelay(CC2520_SWITCH_LOCK_POLL_DELAY);
+		fsmstat1.value = cc2520_radio_readRegister(dev, CC2520_FSMSTAT1);
+		if (fsmstat1.f.lock_status && fsmstat1.f.rx_active)
+			break;
+	}
+
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	radio->switch_count++;
+	radio->switch_last_ns = elapsed;
+	radio->switch_total_ns += elapsed;
+	if (elapsed > radio->switch_max_ns)
+		radio->switch_max_ns = elapsed;
+
+	if (i == CC2520_SWITCH_LOCK_POLLS) {
+		radio->switch_lock_timeouts++;
+		INFO((KERN_INFO "[cc2520] - pll failed to lock on channel %d.\n", radio->channel));
+	}
+
+	cc2520_radio_releaseRx(dev);
+	cc2520_radio_unlock(dev);
+
+	DBG((KERN_INFO "[cc2520] - switched to channel %d in %lld nS.\n",
+		radio->channel, (long long)elapsed));
 
-	freqctrl.f.freq = 11 + 5 * (channel - 11);
+	return i == CC2520_SWITCH_LOCK_POLLS ? -ETIMEDOUT : 0;
+}
 
-	cc2520_radio_writeRegister(CC2520_FREQCTRL, freqctrl.value);
+void cc2520_radio_get_switch_stats(struct cc2520_dev *dev, struct cc2520_channel_switch_stats *stats)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	cc2520_radio_lock(dev, CC2520_RADIO_STATE_CONFIG);
+	stats->count = radio->switch_count;
+	stats->lock_timeouts = radio->switch_lock_timeouts;
+	stats->last_ns = radio->switch_last_ns;
+	stats->max_ns = radio->switch_max_ns;
+	stats->total_ns = radio->switch_total_ns;
+	cc2520_radio_unlock(dev);
 }
 
 // Sets the short address
-void cc2520_radio_set_address(u16 new_short_addr, u64 new_extended_addr, u16 new_pan_id)
+void cc2520_radio_set_address(struct cc2520_dev *dev, u16 new_short_addr, u64 new_extended_addr, u16 new_pan_id)
 {
+	struct cc2520_radio_state *radio = dev->radio;
 	char addr_mem[12];
 
-	short_addr = new_short_addr;
-	extended_addr = new_extended_addr;
-	pan_id = new_pan_id;
+	radio->short_addr = new_short_addr;
+	radio->extended_addr = new_extended_addr;
+	radio->pan_id = new_pan_id;
+
+	memcpy(addr_mem, &radio->extended_addr, 8);
+
+	addr_mem[9] = (radio->pan_id >> 8) & 0xFF;
+	addr_mem[8] = (radio->pan_id) & 0xFF;
+
+	addr_mem[11] = (radio->short_addr >> 8) & 0xFF;
+	addr_mem[10] = (radio->short_addr) & 0xFF;
+
+	cc2520_radio_writeMemory(dev, CC2520_MEM_ADDR_BASE, addr_mem, 12);
+}
+
+void cc2520_radio_get_address(struct cc2520_dev *dev, u16 *short_addr, u64 *extended_addr, u16 *pan_id)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	*short_addr = radio->short_addr;
+	*extended_addr = radio->extended_addr;
+	*pan_id = radio->pan_id;
+}
+
+void cc2520_radio_set_frame_filter(struct cc2520_dev *dev, bool enabled, bool pan_coordinator,
+	u8 max_frame_version, u8 frame_types)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	radio->frmfilt0.f.frame_filter_en = enabled;
+	radio->frmfilt0.f.pan_coordinator = pan_coordinator;
+	radio->frmfilt0.f.max_frame_version = max_frame_version;
+
+	radio->frmfilt1.f.accept_ft_0_beacon = (frame_types & CC2520_FRAME_TYPE_BEACON) != 0;
+	radio->frmfilt1.f.accept_ft_1_data = (frame_types & CC2520_FRAME_TYPE_DATA) != 0;
+	radio->frmfilt1.f.accept_ft_2_ack = (frame_types & CC2520_FRAME_TYPE_ACK) != 0;
+	radio->frmfilt1.f.accept_ft_3_mac_cmd = (frame_types & CC2520_FRAME_TYPE_MAC_CMD) != 0;
+	radio->frmfilt1.f.accept_ft_4to7_reserved = (frame_types & CC2520_FRAME_TYPE_RESERVED) != 0;
+
+	cc2520_radio_lock(dev, CC2520_RADIO_STATE_CONFIG);
+	cc2520_radio_writeRegister(dev, CC2520_FRMFILT0, cc2520_radio_frmfilt0(dev).value);
+	cc2520_radio_writeRegister(dev, CC2520_FRMFILT1, radio->frmfilt1.value);
+	cc2520_radio_unlock(dev);
+}
+
+void cc2520_radio_set_promiscuous(struct cc2520_dev *dev, bool enabled)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	cc2520_radio_lock(dev, CC2520_RADIO_STATE_CONFIG);
+	radio->promiscuous = enabled;
+	cc2520_radio_writeRegister(dev, CC2520_FRMFILT0, cc2520_radio_frmfilt0(dev).value);
+	cc2520_radio_unlock(dev);
+}
+
+void cc2520_radio_set_pan_coordinator(struct cc2520_dev *dev, bool pan_coordinator)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	cc2520_radio_lock(dev, CC2520_RADIO_STATE_CONFIG);
+	radio->frmfilt0.f.pan_coordinator = pan_coordinator;
+	cc2520_radio_writeRegister(dev, CC2520_FRMFILT0, cc2520_radio_frmfilt0(dev).value);
+	cc2520_radio_unlock(dev);
+}
+
+bool cc2520_radio_is_promiscuous(struct cc2520_dev *dev)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	return radio->promiscuous;
+}
+
+void cc2520_radio_set_rx_poll(struct cc2520_dev *dev, bool enabled, u8 budget)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	radio->rx_poll_budget = budget ? budget : CC2520_DEF_RX_POLL_BUDGET;
+
+	// Turning it off while a session is running is fine,
+	// the thread notices and hands FIFOP back to the IRQ.
+	radio->rx_poll = enabled;
+}
+
+void cc2520_radio_get_rx_poll_stats(struct cc2520_dev *dev, struct cc2520_rx_poll_stats *stats)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	*stats = radio->rx_poll_stats;
+}
+
+// The FRMFILT0 value that should actually be in the radio.
+static cc2520_frmfilt0_t cc2520_radio_frmfilt0(struct cc2520_dev *dev)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+	cc2520_frmfilt0_t value;
+
+	value = radio->frmfilt0;
+	if (radio->promiscuous)
+		value.f.frame_filter_en = 0;
+
+	return value;
+}
+
+int cc2520_radio_get_channel(struct cc2520_dev *dev)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	return radio->channel;
+}
+
+// Samples the in-band signal strength in dBm, the radio
+// has to be in RX for the reading to mean anything.
+int cc2520_radio_read_rssi(struct cc2520_dev *dev, s8 *rssi)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+	int i;
+
+	if (!radio->radio_on)
+		return -ENETDOWN;
+
+	cc2520_radio_lock(dev, CC2520_RADIO_STATE_CONFIG);
 
-	memcpy(addr_mem, &extended_addr, 8);
+	for (i = 0; i < CC2520_RSSI_VALID_POLLS; i++) {
+		if (cc2520_radio_readRegister(dev, CC2520_RSSISTAT) & 0x01)
+			break;
+		udelay(CC2520_RSSI_VALID_POLL_DELAY);
+	}
+
+	*rssi = (s8)cc2520_radio_readRegister(dev, CC2520_RSSI) - CC2520_RSSI_OFFSET;
 
-	addr_mem[9] = (pan_id >> 8) & 0xFF;
-	addr_mem[8] = (pan_id) & 0xFF;
+	cc2520_radio_unlock(dev);
+
+	return i == CC2520_RSSI_VALID_POLLS ? -EAGAIN : 0;
+}
+
+// Sweeps the channels in the mask, sampling the RSSI on
+// each, then goes back to the channel we started on. Frames
+// that arrive meanwhile are received on whatever channel
+// the scan is on. A signal cuts the scan short.
+int cc2520_radio_ed_scan(struct cc2520_dev *dev, struct cc2520_ed_scan_data *scan)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+	struct cc2520_ed_channel_result *res;
+	ktime_t end;
+	int prev_channel;
+	int channel;
+	int result;
+	u32 busy;
+	s64 sum;
+	s8 rssi;
+	int channels;
+
+	if (!radio->radio_on)
+		return -ENETDOWN;
+
+	if (!scan->dwell)
+		scan->dwell = CC2520_DEF_ED_DWELL;
+	if (!scan->interval)
+		scan->interval = CC2520_DEF_ED_INTERVAL;
+	if (!scan->busy_threshold)
+		scan->busy_threshold = CC2520_DEF_ED_BUSY_THRESHOLD;
+	scan->dwell = min_t(u32, scan->dwell, CC2520_MAX_ED_DWELL);
+
+	channels = hweight32(scan->channel_mask & CC2520_ED_CHANNEL_MASK);
+	if (channels)
+		scan->dwell = min_t(u32, scan->dwell, CC2520_MAX_ED_SCAN / channels);
+
+	memset(scan->results, 0, sizeof(scan->results));
+	prev_channel = radio->channel;
+	result = 0;
+
+	for (channel = 11; channel <= 26; channel++) {
+		if (!(scan->channel_mask & (1 << channel)))
+			continue;
+
+		result = cc2520_radio_switch_channel(dev, channel);
+		if (result)
+			break;
+
+		res = &scan->results[channel - 11];
+		res->max_rssi = S8_MIN;
+		sum = 0;
+		busy = 0;
+
+		end = ktime_add_us(ktime_get(), scan->dwell);
+		do {
+			if (signal_pending(current)) {
+				result = -EINTR;
+				break;
+			}
+
+			if (cc2520_radio_read_rssi(dev, &rssi) == 0) {
+				res->samples++;
+				sum += rssi;
+				if (rssi > res->max_rssi)
+					res->max_rssi = rssi;
+				if (rssi >= scan->busy_threshold)
+					busy++;
+			}
+
+			usleep_range(scan->interval, scan->interval + 10);
+		} while (ktime_before(ktime_get(), end) && res->samples < U16_MAX);
+
+		if (res->samples) {
+			res->mean_rssi = div_s64(sum, res->samples);
+			res->busy = busy * 1000 / res->samples;
+		}
 
-	addr_mem[11] = (short_addr >> 8) & 0xFF;
-	addr_mem[10] = (short_addr) & 0xFF;
+		if (result)
+			break;
+	}
 
-	cc2520_radio_writeMemory(CC2520_MEM_ADDR_BASE, addr_mem, 12);
+	cc2520_radio_switch_channel(dev, prev_channel);
+	return result;
 }
 
-void cc2520_radio_set_txpower(u8 power)
+void cc2520_radio_set_txpower(struct cc2520_dev *dev, u8 power)
 {
-	cc2520_txpower_t txpower;
-	txpower = cc2520_txpower_default;
+	struct cc2520_radio_state *radio = dev->radio;
+	cc2520_txpower_t txpower_reg;
+	txpower_reg = cc2520_txpower_default;
 
-	txpower.f.pa_power = power;
+	txpower_reg.f.pa_power = power;
 
-	cc2520_radio_writeRegister(CC2520_TXPOWER, txpower.value);
+	cc2520_radio_lock(dev, CC2520_RADIO_STATE_CONFIG);
+	radio->txpower = power;
+	radio->hw_txpower = power;
+	cc2520_radio_writeRegister(dev, CC2520_TXPOWER, txpower_reg.value);
+	cc2520_radio_unlock(dev);
 }
 
 //////////////////////////////
@@ -374,38 +819,66 @@ void cc2520_radio_set_txpower(u8 power)
 /////////////////////////////
 
 // context: interrupt
-void cc2520_radio_sfd_occurred(u64 nano_timestamp, u8 is_high)
+void cc2520_radio_sfd_occurred(struct cc2520_dev *dev, u64 nano_timestamp, u8 is_high)
 {
-	// Store the SFD time for use later in timestamping
-	// incoming/outgoing packets. To be used later...
-	sfd_nanos_ts = nano_timestamp;
+	struct cc2520_radio_state *radio = dev->radio;
+
+	// Store the SFD edge times for timestamping
+	// incoming packets.
+	if (is_high) {
+		radio->sfd_rise_nanos_ts = nano_timestamp;
+		if (radio->state == CC2520_RADIO_STATE_TX ||
+			radio->state == CC2520_RADIO_STATE_TX_SPI_DONE)
+			radio->tx_sfd_nanos_ts = nano_timestamp;
+	}
+	else
+		radio->sfd_fall_nanos_ts = nano_timestamp;
 
 	if (!is_high) {
 		// SFD falling indicates TX completion
 		// if we're currently in TX mode, unlock.
-		if (cc2520_radio_tx_unlock_sfd()) {
-			cc2520_radio_completeTx();
+		if (cc2520_radio_tx_unlock_sfd(dev)) {
+			cc2520_radio_completeTx(dev);
 		}
 	}
 }
 
 // context: interrupt
-void cc2520_radio_fifop_occurred()
+void cc2520_radio_fifop_occurred(struct cc2520_dev *dev)
 {
+	struct cc2520_radio_state *radio = dev->radio;
+	unsigned long flags;
+
+	if (radio->rx_poll) {
+		// Mask FIFOP and let the poll thread take
+		// it from here, it turns it back on once
+		// traffic dies down.
+		spin_lock_irqsave(&radio->rx_poll_sl, flags);
+		if (!radio->rx_poll_active) {
+			radio->rx_poll_active = true;
+			radio->rx_poll_stats.irqs++;
+			cc2520_plat_fifop_irq(dev, false);
+		}
+		spin_unlock_irqrestore(&radio->rx_poll_sl, flags);
 
-	spin_lock_irqsave(&pending_rx_sl, flags);;
+		wake_up(&radio->rx_poll_wq);
+		return;
+	}
+
+	spin_lock_irqsave(&radio->pending_rx_sl, flags);;
 
-	if (pending_rx) {
-		spin_unlock_irqrestore(&pending_rx_sl, flags);;
+	if (radio->pending_rx) {
+		spin_unlock_irqrestore(&radio->pending_rx_sl, flags);;
 	}
 	else {
-		pending_rx = true;
-		spin_unlock_irqrestore(&pending_rx_sl, flags);;
-		cc2520_radio_beginRx();
+		radio->pending_rx = true;
+		spin_unlock_irqrestore(&radio->pending_rx_sl, flags);;
+		radio->fifop_nanos_ts = ktime_get_raw_ns();
+		cc2520_radio_beginRx(dev);
 	}
 }
 
-void cc2520_radio_reset(void)
+void cc2520_radio_reset(struct cc2520_dev *dev)
 {
 	// TODO.
 }
@@ -415,8 +888,10 @@ void cc2520_radio_reset(void)
 /////////////////////////////
 
 // context: process?
-static int cc2520_radio_tx(u8 *buf, u8 len)
+static int cc2520_radio_tx(struct cc2520_dev *dev, u8 *buf, u8 len)
 {
+	struct cc2520_radio_state *radio = dev->radio;
+
 	DBG((KERN_INFO "[cc2520] - beginning write op.\n"));
 	// capture exclusive radio rights to send
 	// build the transmit command seq
@@ -429,234 +904,279 @@ static int cc2520_radio_tx(u8 *buf, u8 len)
 	// 5- On SFD falling edge give up lock
 
 	// Beginning of TX critical section
-	cc2520_radio_lock(CC2520_RADIO_STATE_TX);
+	cc2520_radio_lock(dev, CC2520_RADIO_STATE_TX);
 
-	memcpy(tx_buf_r, buf, len);
-	tx_buf_r_len = len;
+	memcpy(radio->tx_buf_r, buf, len);
+	radio->tx_buf_r_len = len;
+	cc2520_flight_record(dev, CC2520_FLIGHT_TX, len, buf, len);
 
-	cc2520_radio_beginTx();
+	cc2520_radio_beginTx(dev);
 	return 0;
 }
 
 // Tx Part 1: Turn off the RF engine.
-static void cc2520_radio_beginTx()
+static void cc2520_radio_beginTx(struct cc2520_dev *dev)
 {
+	struct cc2520_radio_state *radio = dev->radio;
 	int status;
+	u8 power;
+
+	radio->tsfer1.tx_buf = radio->tx_buf;
+	radio->tsfer1.rx_buf = radio->rx_buf;
+	radio->tsfer1.len = 0;
+	radio->tsfer1.cs_change = 1;
+	radio->tx_buf[radio->tsfer1.len++] = CC2520_CMD_SRFOFF;
+
+	// Per-frame TX power, soft-acks always go out at
+	// the configured power. Whatever was left behind by
+	// the last frame gets put back here. Register writes
+	// run on until chip select drops, so this has to be
+	// the last thing in the transfer.
+	power = radio->txpower;
+	if ((dev->tx_opts.flags & CC2520_TX_OPT_TXPOWER) && !cc2520_packet_is_ack(radio->tx_buf_r))
+		power = dev->tx_opts.txpower;
+
+	if (power != radio->hw_txpower) {
+		radio->tx_buf[radio->tsfer1.len++] = CC2520_CMD_REGISTER_WRITE | CC2520_TXPOWER;
+		radio->tx_buf[radio->tsfer1.len++] = power;
+		radio->hw_txpower = power;
+	}
 
-	tsfer1.tx_buf = tx_buf;
-	tsfer1.rx_buf = rx_buf;
-	tsfer1.len = 0;
-	tsfer1.cs_change = 1;
-	tx_buf[tsfer1.len++] = CC2520_CMD_SRFOFF;
-
-	spi_message_init(&msg);
-	msg.complete = cc2520_radio_continueTx_check;
-	msg.context = NULL;
+	spi_message_init(&radio->msg);
+	radio->msg.complete = cc2520_radio_continueTx_check;
+	radio->msg.context = dev;
 
-	spi_message_add_tail(&tsfer1, &msg);
+	spi_message_add_tail(&radio->tsfer1, &radio->msg);
 
-	status = spi_async(state.spi_device, &msg);
+	status = cc2520_radio_spi_async(dev, &radio->msg);
 }
 
 // Tx Part 2: Check for missed RX transmission
 // and flush the buffer, actually write the data.
 static void cc2520_radio_continueTx_check(void *arg)
 {
+	struct cc2520_dev *dev = arg;
+	struct cc2520_radio_state *radio = dev->radio;
 	int status;
 	int buf_offset;
 	int i;
 
+	cc2520_radio_spi_done(dev, &radio->msg);
+
 	buf_offset = 0;
 
-	tsfer1.tx_buf = tx_buf + buf_offset;
-	tsfer1.rx_buf = rx_buf + buf_offset;
-	tsfer1.len = 0;
-	tsfer1.cs_change = 1;
+	radio->tsfer1.tx_buf = radio->tx_buf + buf_offset;
+	radio->tsfer1.rx_buf = radio->rx_buf + buf_offset;
+	radio->tsfer1.len = 0;
+	radio->tsfer1.cs_change = 1;
 
-	if (gpio_get_value(CC2520_FIFO) == 1) {
+	if (cc2520_plat_pin_get(dev, CC2520_PIN_FIFO) == 1) {
 		INFO((KERN_INFO "[cc2520] - tx/rx race condition adverted.\n"));
-		tx_buf[buf_offset + tsfer1.len++] = CC2520_CMD_SFLUSHRX;
+		radio->tx_buf[buf_offset + radio->tsfer1.len++] = CC2520_CMD_SFLUSHRX;
 	}
 
-	tx_buf[buf_offset + tsfer1.len++] = CC2520_CMD_TXBUF;
+	radio->tx_buf[buf_offset + radio->tsfer1.len++] = CC2520_CMD_TXBUF;
 
 	// Length + FCF
 	for (i = 0; i < 3; i++)
-		tx_buf[buf_offset + tsfer1.len++] = tx_buf_r[i];
-	buf_offset += tsfer1.len;
+		radio->tx_buf[buf_offset + radio->tsfer1.len++] = radio->tx_buf_r[i];
+	buf_offset += radio->tsfer1.len;
 
-	tsfer2.tx_buf = tx_buf + buf_offset;
-	tsfer2.rx_buf = rx_buf + buf_offset;
-	tsfer2.len = 0;
-	tsfer2.cs_change = 1;
-	tx_buf[buf_offset + tsfer2.len++] = CC2520_CMD_STXON;
-	buf_offset += tsfer2.len;
+	radio->tsfer2.tx_buf = radio->tx_buf + buf_offset;
+	radio->tsfer2.rx_buf = radio->rx_buf + buf_offset;
+	radio->tsfer2.len = 0;
+	radio->tsfer2.cs_change = 1;
+	radio->tx_buf[buf_offset + radio->tsfer2.len++] = CC2520_CMD_STXON;
+	buf_offset += radio->tsfer2.len;
 
 	// We're keeping these two SPI transactions separated
 	// in case we later want to encode timestamp
 	// information in the packet itself after seeing SFD
 	// flag.
-	if (tx_buf_r_len > 3) {
-		tsfer3.tx_buf = tx_buf + buf_offset;
-		tsfer3.rx_buf = rx_buf + buf_offset;
-		tsfer3.len = 0;
-		tsfer3.cs_change = 1;
-		tx_buf[buf_offset + tsfer3.len++] = CC2520_CMD_TXBUF;
-		for (i = 3; i < tx_buf_r_len; i++)
-			tx_buf[buf_offset + tsfer3.len++] = tx_buf_r[i];
-
-		buf_offset += tsfer3.len;
+	if (radio->tx_buf_r_len > 3) {
+		radio->tsfer3.tx_buf = radio->tx_buf + buf_offset;
+		radio->tsfer3.rx_buf = radio->rx_buf + buf_offset;
+		radio->tsfer3.len = 0;
+		radio->tsfer3.cs_change = 1;
+		radio->tx_buf[buf_offset + radio->tsfer3.len++] = CC2520_CMD_TXBUF;
+		for (i = 3; i < radio->tx_buf_r_len; i++)
+			radio->tx_buf[buf_offset + radio->tsfer3.len++] = radio->tx_buf_r[i];
+
+		buf_offset += radio->tsfer3.len;
 	}
 
-	tsfer4.tx_buf = tx_buf + buf_offset;
-	tsfer4.rx_buf = rx_buf + buf_offset;
-	tsfer4.len = 0;
-	tsfer4.cs_change = 1;
-	tx_buf[buf_offset + tsfer4.len++] = CC2520_CMD_REGISTER_READ | CC2520_EXCFLAG0;
-	tx_buf[buf_offset + tsfer4.len++] = 0;
+	radio->tsfer4.tx_buf = radio->tx_buf + buf_offset;
+	radio->tsfer4.rx_buf = radio->rx_buf + buf_offset;
+	radio->tsfer4.len = 0;
+	radio->tsfer4.cs_change = 1;
+	radio->tx_buf[buf_offset + radio->tsfer4.len++] = CC2520_CMD_REGISTER_READ | CC2520_EXCFLAG0;
+	radio->tx_buf[buf_offset + radio->tsfer4.len++] = 0;
 
-	spi_message_init(&msg);
-	msg.complete = cc2520_radio_continueTx;
-	msg.context = NULL;
+	spi_message_init(&radio->msg);
+	radio->msg.complete = cc2520_radio_continueTx;
+	radio->msg.context = dev;
 
-	spi_message_add_tail(&tsfer1, &msg);
-	spi_message_add_tail(&tsfer2, &msg);
+	spi_message_add_tail(&radio->tsfer1, &radio->msg);
+	spi_message_add_tail(&radio->tsfer2, &radio->msg);
 
-	if (tx_buf_r_len > 3)
-		spi_message_add_tail(&tsfer3, &msg);
+	if (radio->tx_buf_r_len > 3)
+		spi_message_add_tail(&radio->tsfer3, &radio->msg);
 
-	spi_message_add_tail(&tsfer4, &msg);
+	spi_message_add_tail(&radio->tsfer4, &radio->msg);
 
-	status = spi_async(state.spi_device, &msg);
+	status = cc2520_radio_spi_async(dev, &radio->msg);
 }
 
 static void cc2520_radio_continueTx(void *arg)
 {
+	struct cc2520_dev *dev = arg;
+	struct cc2520_radio_state *radio = dev->radio;
+
+	cc2520_radio_spi_done(dev, &radio->msg);
+
 	DBG((KERN_INFO "[cc2520] - tx spi write callback complete.\n"));
 
-	if ((((u8*)tsfer4.rx_buf)[1] & CC2520_TX_UNDERFLOW) > 0) {
-		cc2520_radio_flushTx();
+	if ((((u8*)radio->tsfer4.rx_buf)[1] & CC2520_TX_UNDERFLOW) > 0) {
+		cc2520_radio_flushTx(dev);
 	}
-	else if (cc2520_radio_tx_unlock_spi()) {
+	else if (cc2520_radio_tx_unlock_spi(dev)) {
 		// To prevent race conditions between the SPI engine and the
 		// SFD interrupt we unlock in two stages. If this is the last
 		// thing to complete we signal TX complete.
-		cc2520_radio_completeTx();
+		cc2520_radio_completeTx(dev);
 	}
 }
 
-static void cc2520_radio_flushTx()
+static void cc2520_radio_flushTx(struct cc2520_dev *dev)
 {
+	struct cc2520_radio_state *radio = dev->radio;
 	int status;
 	INFO((KERN_INFO "[cc2520] - tx underrun occurred.\n"));
+	cc2520_stat_inc(dev, CC2520_STAT_RADIO_TX_UNDERFLOW);
 
-	tsfer1.tx_buf = tx_buf;
-	tsfer1.rx_buf = rx_buf;
-	tsfer1.len = 0;
-	tsfer1.cs_change = 1;
-	tx_buf[tsfer1.len++] = CC2520_CMD_SFLUSHTX;
-	tx_buf[tsfer1.len++] = CC2520_CMD_REGISTER_WRITE | CC2520_EXCFLAG0;
-	tx_buf[tsfer1.len++] = 0;
+	radio->tsfer1.tx_buf = radio->tx_buf;
+	radio->tsfer1.rx_buf = radio->rx_buf;
+	radio->tsfer1.len = 0;
+	radio->tsfer1.cs_change = 1;
+	radio->tx_buf[radio->tsfer1.len++] = CC2520_CMD_SFLUSHTX;
+	radio->tx_buf[radio->tsfer1.len++] = CC2520_CMD_REGISTER_WRITE | CC2520_EXCFLAG0;
+	radio->tx_buf[radio->tsfer1.len++] = 0;
 
-	spi_message_init(&msg);
-	msg.complete = cc2520_radio_completeFlushTx;
-	msg.context = NULL;
+	spi_message_init(&radio->msg);
+	radio->msg.complete = cc2520_radio_completeFlushTx;
+	radio->msg.context = dev;
 
-	spi_message_add_tail(&tsfer1, &msg);
+	spi_message_add_tail(&radio->tsfer1, &radio->msg);
 
-	status = spi_async(state.spi_device, &msg);
+	status = cc2520_radio_spi_async(dev, &radio->msg);
 }
 
 static void cc2520_radio_completeFlushTx(void *arg)
 {
-	cc2520_radio_unlock();
+	struct cc2520_dev *dev = arg;
+
+	cc2520_radio_spi_done(dev, &dev->radio->msg);
+
+	cc2520_radio_unlock(dev);
 	DBG((KERN_INFO "[cc2520] - write op complete.\n"));
-	radio_top->tx_done(-CC2520_TX_FAILED);
+	dev->radio_top->tx_done(dev, -CC2520_TX_FAILED);
 }
 
-static void cc2520_radio_completeTx()
+static void cc2520_radio_completeTx(struct cc2520_dev *dev)
 {
-	cc2520_radio_unlock();
+	cc2520_radio_unlock(dev);
 	DBG((KERN_INFO "[cc2520] - write op complete.\n"));
-	radio_top->tx_done(CC2520_TX_SUCCESS);
+	cc2520_stat_inc(dev, CC2520_STAT_RADIO_TX_OK);
+	dev->radio_top->tx_done(dev, CC2520_TX_SUCCESS);
 }
 
 //////////////////////////////
 // Receiver Engine
 /////////////////////////////
 
-static void cc2520_radio_beginRx()
+static void cc2520_radio_beginRx(struct cc2520_dev *dev)
 {
+	struct cc2520_radio_state *radio = dev->radio;
 	int status;
 
-	rx_tsfer.tx_buf = rx_out_buf;
-	rx_tsfer.rx_buf = rx_in_buf;
-	rx_tsfer.len = 0;
-	rx_out_buf[rx_tsfer.len++] = CC2520_CMD_RXBUF;
-	rx_out_buf[rx_tsfer.len++] = 0;
+	cc2520_radio_stampRx(dev);
+
+	radio->rx_tsfer.tx_buf = radio->rx_out_buf;
+	radio->rx_tsfer.rx_buf = radio->rx_in_buf;
+	radio->rx_tsfer.len = 0;
+	radio->rx_out_buf[radio->rx_tsfer.len++] = CC2520_CMD_RXBUF;
+	radio->rx_out_buf[radio->rx_tsfer.len++] = 0;
 
-	rx_tsfer.cs_change = 1;
+	radio->rx_tsfer.cs_change = 1;
 
-	memset(rx_in_buf, 0, SPI_BUFF_SIZE);
+	memset(radio->rx_in_buf, 0, SPI_BUFF_SIZE);
 
-	spi_message_init(&rx_msg);
-	rx_msg.complete = cc2520_radio_continueRx;
-	rx_msg.context = NULL;
-	spi_message_add_tail(&rx_tsfer, &rx_msg);
+	spi_message_init(&radio->rx_msg);
+	radio->rx_msg.complete = cc2520_radio_continueRx;
+	radio->rx_msg.context = dev;
+	spi_message_add_tail(&radio->rx_tsfer, &radio->rx_msg);
 
-	status = spi_async(state.spi_device, &rx_msg);
+	status = cc2520_radio_spi_async(dev, &radio->rx_msg);
 }
 
 static void cc2520_radio_continueRx(void *arg)
 {
+	struct cc2520_dev *dev = arg;
+	struct cc2520_radio_state *radio = dev->radio;
 	int status;
 	int i;
 	int len;
 
+	cc2520_radio_spi_done(dev, &radio->rx_msg);
+
+	cc2520_hist_record(dev, CC2520_HIST_FIFOP_SPI,
+		ktime_get_raw_ns() - radio->fifop_nanos_ts);
+
 	// Length of what we're reading is stored
 	// in the received spi buffer, read from the
 	// async operation called in beginRxRead.
-	len = rx_in_buf[1];
+	len = radio->rx_in_buf[1];
 
 	if (len > 127) {
-		cc2520_radio_flushRx();
+		cc2520_stat_inc(dev, CC2520_STAT_RADIO_RX_OVERLENGTH);
+		cc2520_radio_flushRx(dev);
 	}
 	else {
-		rx_tsfer.len = 0;
-		rx_out_buf[rx_tsfer.len++] = CC2520_CMD_RXBUF;
+		radio->rx_tsfer.len = 0;
+		radio->rx_out_buf[radio->rx_tsfer.len++] = CC2520_CMD_RXBUF;
 		for (i = 0; i < len; i++)
-			rx_out_buf[rx_tsfer.len++] = 0;
+			radio->rx_out_buf[radio->rx_tsfer.len++] = 0;
 
-		rx_tsfer.cs_change = 1;
+		radio->rx_tsfer.cs_change = 1;
 
-		spi_message_init(&rx_msg);
-		rx_msg.complete = cc2520_radio_finishRx;
-		// Platform dependent?
-		rx_msg.context = (void*)len;
-		spi_message_add_tail(&rx_tsfer, &rx_msg);
+		spi_message_init(&radio->rx_msg);
+		radio->rx_msg.complete = cc2520_radio_finishRx;
+		radio->rx_len = len;
+		radio->rx_msg.context = dev;
+		spi_message_add_tail(&radio->rx_tsfer, &radio->rx_msg);
 
-		status = spi_async(state.spi_device, &rx_msg);
+		status = cc2520_radio_spi_async(dev, &radio->rx_msg);
 	}
 }
 
-static void cc2520_radio_flushRx()
+static void cc2520_radio_flushRx(struct cc2520_dev *dev)
 {
-
+	struct cc2520_radio_state *radio = dev->radio;
 	int status;
 
 	INFO((KERN_INFO "[cc2520] - flush RX FIFO (part 1).\n"));
 
-	rx_tsfer.len = 0;
-	rx_tsfer.cs_change = 1;
-	rx_out_buf[rx_tsfer.len++] = CC2520_CMD_SFLUSHRX;
+	radio->rx_tsfer.len = 0;
+	radio->rx_tsfer.cs_change = 1;
+	radio->rx_out_buf[radio->rx_tsfer.len++] = CC2520_CMD_SFLUSHRX;
 
-	spi_message_init(&rx_msg);
-	rx_msg.complete = cc2520_radio_continueFlushRx;
-	rx_msg.context = NULL;
+	spi_message_init(&radio->rx_msg);
+	radio->rx_msg.complete = cc2520_radio_continueFlushRx;
+	radio->rx_msg.context = dev;
 
-	spi_message_add_tail(&rx_tsfer, &rx_msg);
+	spi_message_add_tail(&radio->rx_tsfer, &radio->rx_msg);
 
-	status = spi_async(state.spi_device, &rx_msg);
+	status = cc2520_radio_spi_async(dev, &radio->rx_msg);
 }
 
 // Flush RX twice. This is due to Errata Bug 1 and to try to fix an issue where
@@ -666,52 +1186,105 @@ static void cc2520_radio_flushRx()
 // Also, both the TinyOS and Contiki implementations do this.
 static void cc2520_radio_continueFlushRx(void* arg)
 {
+	struct cc2520_dev *dev = arg;
+	struct cc2520_radio_state *radio = dev->radio;
 	int status;
 
+	cc2520_radio_spi_done(dev, &radio->rx_msg);
+
 	INFO((KERN_INFO "[cc2520] - flush RX FIFO (part 2).\n"));
 
-	rx_tsfer.len = 0;
-	rx_tsfer.cs_change = 1;
-	rx_out_buf[rx_tsfer.len++] = CC2520_CMD_SFLUSHRX;
+	radio->rx_tsfer.len = 0;
+	radio->rx_tsfer.cs_change = 1;
+	radio->rx_out_buf[radio->rx_tsfer.len++] = CC2520_CMD_SFLUSHRX;
 
-	spi_message_init(&rx_msg);
-	rx_msg.complete = cc2520_radio_completeFlushRx;
-	rx_msg.context = NULL;
+	spi_message_init(&radio->rx_msg);
+	radio->rx_msg.complete = cc2520_radio_completeFlushRx;
+	radio->rx_msg.context = dev;
 
-	spi_message_add_tail(&rx_tsfer, &rx_msg);
+	spi_message_add_tail(&radio->rx_tsfer, &radio->rx_msg);
 
-	status = spi_async(state.spi_device, &rx_msg);
+	status = cc2520_radio_spi_async(dev, &radio->rx_msg);
 }
 
 static void cc2520_radio_completeFlushRx(void *arg)
 {
-	spin_lock_irqsave(&pending_rx_sl, flags);
-	pending_rx = false;
-	spin_unlock_irqrestore(&pending_rx_sl, flags);
+	struct cc2520_dev *dev = arg;
+	struct cc2520_radio_state *radio = dev->radio;
+	unsigned long flags;
+
+	cc2520_radio_spi_done(dev, &radio->rx_msg);
+
+	spin_lock_irqsave(&radio->pending_rx_sl, flags);
+	radio->pending_rx = false;
+	spin_unlock_irqrestore(&radio->pending_rx_sl, flags);
 }
 
-static void cc2520_radio_finishRx(void *arg)
+// FIFOP only goes high once the whole frame is in,
+// so the last pair of SFD edges belongs to it.
+static void cc2520_radio_stampRx(struct cc2520_dev *dev)
 {
-	int len;
+	struct cc2520_radio_state *radio = dev->radio;
 
-	len = (int)arg;
+	radio->rx_meta.timestamp = radio->sfd_rise_nanos_ts;
+	if (radio->sfd_fall_nanos_ts > radio->sfd_rise_nanos_ts)
+		radio->rx_meta.duration = radio->sfd_fall_nanos_ts - radio->sfd_rise_nanos_ts;
+	else
+		radio->rx_meta.duration = 0;
+}
+
+// Hands the frame sitting in rx_in_buf up the stack.
+static void cc2520_radio_deliverRx(struct cc2520_dev *dev, int len)
+{
+	struct cc2520_radio_state *radio = dev->radio;
 
 	// we keep a lock on the RX buffer separately
 	// to allow for another rx packet to pile up
 	// behind the current one.
-	spin_lock(&rx_buf_sl);
+	spin_lock(&radio->rx_buf_sl);
 
 	// Note: we place the len at the beginning
 	// of the packet to make the interface symmetric
 	// with the TX interface.
-	rx_buf_r[0] = len;
+	radio->rx_buf_r[0] = len;
 
 	// Make sure to ignore the command return byte.
-	memcpy(rx_buf_r + 1, rx_in_buf + 1, len);
+	memcpy(radio->rx_buf_r + 1, radio->rx_in_buf + 1, len);
+
+	// The last two bytes are the RSSI and CRC/LQI
+	// metadata the radio puts in place of the FCS.
+	radio->rx_meta.channel = radio->channel;
+	if (len >= 2) {
+		radio->rx_meta.rssi = (s8)radio->rx_buf_r[len - 1] - CC2520_RSSI_OFFSET;
+		radio->rx_meta.lqi = radio->rx_buf_r[len] & CC2520_META_LQI_MASK;
+		radio->rx_meta.crc_ok = (radio->rx_buf_r[len] & CC2520_META_CRC_OK) != 0;
+	}
+	else {
+		radio->rx_meta.rssi = S8_MIN;
+		radio->rx_meta.lqi = 0;
+		radio->rx_meta.crc_ok = 0;
+	}
+
+	cc2520_stat_inc(dev, CC2520_STAT_RADIO_RX_OK);
+	cc2520_flight_record(dev, CC2520_FLIGHT_RX, len, radio->rx_buf_r, len + 1);
 
 	// Pass length of entire buffer to
 	// upper layers.
-	radio_top->rx_done(rx_buf_r, len + 1);
+	dev->radio_top->rx_done(dev, radio->rx_buf_r, len + 1);
+}
+
+static void cc2520_radio_finishRx(void *arg)
+{
+	struct cc2520_dev *dev = arg;
+	struct cc2520_radio_state *radio = dev->radio;
+	unsigned long flags;
+	int len;
+
+	cc2520_radio_spi_done(dev, &radio->rx_msg);
+
+	len = radio->rx_len;
+
+	cc2520_radio_deliverRx(dev, len);
 
 	DBG((KERN_INFO "[cc2520] - Read %d bytes from radio.\n", len));
 
@@ -719,21 +1292,219 @@ static void cc2520_radio_finishRx(void *arg)
 	// clear the buffer, in the future we can move back to the scheme
 	// where pending_rx is actually a FIFOP toggle counter and continue
 	// to receive another packet. Only do this if it becomes a problem.
-	if (gpio_get_value(CC2520_FIFO) == 1) {
+	if (cc2520_plat_pin_get(dev, CC2520_PIN_FIFO) == 1) {
 		INFO((KERN_INFO "[cc2520] - more than one RX packet received, flushing buffer\n"));
-		cc2520_radio_flushRx();
+		cc2520_stat_inc(dev, CC2520_STAT_RADIO_RX_FLUSH);
+		cc2520_radio_flushRx(dev);
 	}
 	else {
 		// Allow for subsequent FIFOP
-		spin_lock_irqsave(&pending_rx_sl, flags);
-		pending_rx = false;
-		spin_unlock_irqrestore(&pending_rx_sl, flags);
+		spin_lock_irqsave(&radio->pending_rx_sl, flags);
+		radio->pending_rx = false;
+		spin_unlock_irqrestore(&radio->pending_rx_sl, flags);
+	}
+}
+
+// SFD rising edge of the last frame we sent.
+u64 cc2520_radio_tx_sfd_time(struct cc2520_dev *dev)
+{
+	return dev->radio->tx_sfd_nanos_ts;
+}
+
+// Only valid from within the rx_done chain, the
+// receive engine won't overwrite it until that returns.
+const struct cc2520_rx_record *cc2520_radio_rx_meta(struct cc2520_dev *dev)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	return &radio->rx_meta;
+}
+
+void cc2520_radio_release_rx(struct cc2520_dev *dev)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	spin_unlock(&radio->rx_buf_sl);
+}
+
+// Stands in for the receive engine when something other
+// than the chip feeds frames to the layers, see bench.c.
+// Claims the RX buffer the way a real read does, so the
+// layers' release_rx balances out, and sets the metadata
+// the frame would have come with.
+void cc2520_radio_hold_rx(struct cc2520_dev *dev, const struct cc2520_rx_record *meta)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+
+	spin_lock(&radio->rx_buf_sl);
+	radio->rx_meta = *meta;
+}
+
+//////////////////////////////
+// Polled Receive
+/////////////////////////////
+
+// Under sustained traffic taking an interrupt, bouncing
+// through three SPI completions and then flushing anything
+// that piled up behind the frame loses a lot of frames.
+// In polling mode the first FIFOP masks the interrupt and
+// wakes rx_thread, which reads frames out of the FIFO back
+// to back, up to rx_poll_budget per round, for as long as
+// they keep coming. After CC2520_RX_POLL_IDLE_ROUNDS empty
+// rounds it unmasks FIFOP and goes back to sleep.
+
+static void cc2520_radio_rx_sync(struct cc2520_dev *dev, u8 cmd, int len)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+	int i;
+
+	radio->rx_tsfer.tx_buf = radio->rx_out_buf;
+	radio->rx_tsfer.rx_buf = radio->rx_in_buf;
+	radio->rx_tsfer.len = 0;
+	radio->rx_tsfer.cs_change = 1;
+	radio->rx_out_buf[radio->rx_tsfer.len++] = cmd;
+	for (i = 0; i < len; i++)
+		radio->rx_out_buf[radio->rx_tsfer.len++] = 0;
+
+	spi_message_init(&radio->rx_msg);
+	radio->rx_msg.complete = NULL;
+	radio->rx_msg.context = NULL;
+	spi_message_add_tail(&radio->rx_tsfer, &radio->rx_msg);
+
+	cc2520_flight_spi(dev, CC2520_FLIGHT_SPI, &radio->rx_msg);
+	cc2520_plat_spi_sync(dev, &radio->rx_msg);
+	cc2520_flight_spi(dev, CC2520_FLIGHT_SPI_DONE, &radio->rx_msg);
+}
+
+// Same double flush as the interrupt path, see
+// cc2520_radio_continueFlushRx.
+static void cc2520_radio_flushRx_sync(struct cc2520_dev *dev)
+{
+	INFO((KERN_INFO "[cc2520] - flush RX FIFO (polled).\n"));
+	cc2520_radio_rx_sync(dev, CC2520_CMD_SFLUSHRX, 0);
+	cc2520_radio_rx_sync(dev, CC2520_CMD_SFLUSHRX, 0);
+}
+
+// context: rx_thread
+static void cc2520_radio_pollRx(struct cc2520_dev *dev)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+	unsigned long flags;
+	int len;
+
+	cc2520_radio_claimRx(dev);
+
+	// FIFOP high with FIFO low means the FIFO overflowed.
+	if (cc2520_plat_pin_get(dev, CC2520_PIN_FIFO) == 0) {
+		cc2520_radio_flushRx_sync(dev);
+		cc2520_radio_releaseRx(dev);
+		return;
+	}
+
+	// Only the newest SFD edges are kept, so when several
+	// frames are queued up they all get its timestamp.
+	cc2520_radio_stampRx(dev);
+
+	memset(radio->rx_in_buf, 0, SPI_BUFF_SIZE);
+	cc2520_radio_rx_sync(dev, CC2520_CMD_RXBUF, 1);
+	len = radio->rx_in_buf[1];
+
+	if (len > 127) {
+		cc2520_stat_inc(dev, CC2520_STAT_RADIO_RX_OVERLENGTH);
+		cc2520_radio_flushRx_sync(dev);
+		cc2520_radio_releaseRx(dev);
+		return;
+	}
+
+	cc2520_radio_rx_sync(dev, CC2520_CMD_RXBUF, len);
+
+	// The layers above expect to be called with
+	// interrupts off, as they are from an SPI completion.
+	local_irq_save(flags);
+	cc2520_radio_deliverRx(dev, len);
+	local_irq_restore(flags);
+
+	radio->rx_poll_stats.polled++;
+	DBG((KERN_INFO "[cc2520] - Polled %d bytes from radio.\n", len));
+
+	cc2520_radio_releaseRx(dev);
+}
+
+static int cc2520_radio_rx_poll_thread(void *arg)
+{
+	struct cc2520_dev *dev = arg;
+	struct cc2520_radio_state *radio = dev->radio;
+	unsigned long flags;
+	int budget;
+	int idle;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(radio->rx_poll_wq,
+			radio->rx_poll_active || kthread_should_stop());
+
+		if (kthread_should_stop())
+			break;
+
+		radio->rx_poll_stats.sessions++;
+		idle = 0;
+
+		while (radio->rx_poll && idle < CC2520_RX_POLL_IDLE_ROUNDS) {
+			if (kthread_should_stop())
+				return 0;
+
+			budget = radio->rx_poll_budget;
+			while (budget > 0 && cc2520_plat_pin_get(dev, CC2520_PIN_FIFOP) == 1) {
+				cc2520_radio_pollRx(dev);
+				budget--;
+			}
+
+			if (budget == radio->rx_poll_budget)
+				idle++;
+			else
+				idle = 0;
+
+			usleep_range(CC2520_RX_POLL_INTERVAL, CC2520_RX_POLL_INTERVAL * 2);
+		}
+
+		spin_lock_irqsave(&radio->rx_poll_sl, flags);
+		radio->rx_poll_active = false;
+		cc2520_plat_fifop_irq(dev, true);
+		spin_unlock_irqrestore(&radio->rx_poll_sl, flags);
+
+		// A frame that landed between the last poll and
+		// unmasking won't have raised an edge.
+		if (cc2520_plat_pin_get(dev, CC2520_PIN_FIFOP) == 1)
+			cc2520_radio_fifop_occurred(dev);
+	}
+
+	return 0;
+}
+
+// Takes ownership of the receive engine, waiting out
+// any read that's currently in flight. FIFOP edges that
+// arrive while it's held are ignored.
+static void cc2520_radio_claimRx(struct cc2520_dev *dev)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&radio->pending_rx_sl, flags);
+	while (radio->pending_rx) {
+		spin_unlock_irqrestore(&radio->pending_rx_sl, flags);
+		spin_lock_irqsave(&radio->pending_rx_sl, flags);
 	}
+	radio->pending_rx = true;
+	spin_unlock_irqrestore(&radio->pending_rx_sl, flags);
 }
 
-void cc2520_radio_release_rx()
+static void cc2520_radio_releaseRx(struct cc2520_dev *dev)
 {
-	spin_unlock(&rx_buf_sl);
+	struct cc2520_radio_state *radio = dev->radio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&radio->pending_rx_sl, flags);
+	radio->pending_rx = false;
+	spin_unlock_irqrestore(&radio->pending_rx_sl, flags);
 }
 
 //////////////////////////////
@@ -741,78 +1512,111 @@ void cc2520_radio_release_rx()
 /////////////////////////////
 
 // Memory address MUST be >= 200.
-static void cc2520_radio_writeMemory(u16 mem_addr, u8 *value, u8 len)
+static void cc2520_radio_writeMemory(struct cc2520_dev *dev, u16 mem_addr, u8 *value, u8 len)
 {
+	struct cc2520_radio_state *radio = dev->radio;
 	int status;
 	int i;
 
-	tsfer.tx_buf = tx_buf;
-	tsfer.rx_buf = rx_buf;
-	tsfer.len = 0;
+	radio->tsfer.tx_buf = radio->tx_buf;
+	radio->tsfer.rx_buf = radio->rx_buf;
+	radio->tsfer.len = 0;
 
-	tx_buf[tsfer.len++] = CC2520_CMD_MEMORY_WRITE | ((mem_addr >> 8) & 0xFF);
-	tx_buf[tsfer.len++] = mem_addr & 0xFF;
+	radio->tx_buf[radio->tsfer.len++] = CC2520_CMD_MEMORY_WRITE | ((mem_addr >> 8) & 0xFF);
+	radio->tx_buf[radio->tsfer.len++] = mem_addr & 0xFF;
 
 	for (i=0; i<len; i++) {
-		tx_buf[tsfer.len++] = value[i];
+		radio->tx_buf[radio->tsfer.len++] = value[i];
+	}
+
+	memset(radio->rx_buf, 0, SPI_BUFF_SIZE);
+
+	spi_message_init(&radio->msg);
+	radio->msg.context = dev;
+	spi_message_add_tail(&radio->tsfer, &radio->msg);
+
+	status = cc2520_plat_spi_sync(dev, &radio->msg);
+}
+
+static void cc2520_radio_writeRegister(struct cc2520_dev *dev, u8 reg, u8 value)
+{
+	struct cc2520_radio_state *radio = dev->radio;
+	int status;
+
+	radio->tsfer.tx_buf = radio->tx_buf;
+	radio->tsfer.rx_buf = radio->rx_buf;
+	radio->tsfer.len = 0;
+
+	if (reg <= CC2520_FREG_MASK) {
+		radio->tx_buf[radio->tsfer.len++] = CC2520_CMD_REGISTER_WRITE | reg;
 	}
+	else {
+		radio->tx_buf[radio->tsfer.len++] = CC2520_CMD_MEMORY_WRITE;
+		radio->tx_buf[radio->tsfer.len++] = reg;
+	}
+
+	radio->tx_buf[radio->tsfer.len++] = value;
 
-	memset(rx_buf, 0, SPI_BUFF_SIZE);
+	memset(radio->rx_buf, 0, SPI_BUFF_SIZE);
 
-	spi_message_init(&msg);
-	msg.context = NULL;
-	spi_message_add_tail(&tsfer, &msg);
+	spi_message_init(&radio->msg);
+	radio->msg.context = dev;
+	spi_message_add_tail(&radio->tsfer, &radio->msg);
 
-	status = spi_sync(state.spi_device, &msg);
+	status = cc2520_plat_spi_sync(dev, &radio->msg);
 }
 
-static void cc2520_radio_writeRegister(u8 reg, u8 value)
+static u8 cc2520_radio_readRegister(struct cc2520_dev *dev, u8 reg)
 {
+	struct cc2520_radio_state *radio = dev->radio;
 	int status;
 
-	tsfer.tx_buf = tx_buf;
-	tsfer.rx_buf = rx_buf;
-	tsfer.len = 0;
+	radio->tsfer.tx_buf = radio->tx_buf;
+	radio->tsfer.rx_buf = radio->rx_buf;
+	radio->tsfer.len = 0;
 
 	if (reg <= CC2520_FREG_MASK) {
-		tx_buf[tsfer.len++] = CC2520_CMD_REGISTER_WRITE | reg;
+		radio->tx_buf[radio->tsfer.len++] = CC2520_CMD_REGISTER_READ | reg;
 	}
 	else {
-		tx_buf[tsfer.len++] = CC2520_CMD_MEMORY_WRITE;
-		tx_buf[tsfer.len++] = reg;
+		radio->tx_buf[radio->tsfer.len++] = CC2520_CMD_MEMORY_READ;
+		radio->tx_buf[radio->tsfer.len++] = reg;
 	}
 
-	tx_buf[tsfer.len++] = value;
+	radio->tx_buf[radio->tsfer.len++] = 0;
+
+	memset(radio->rx_buf, 0, SPI_BUFF_SIZE);
 
-	memset(rx_buf, 0, SPI_BUFF_SIZE);
+	spi_message_init(&radio->msg);
+	radio->msg.context = dev;
+	spi_message_add_tail(&radio->tsfer, &radio->msg);
 
-	spi_message_init(&msg);
-	msg.context = NULL;
-	spi_message_add_tail(&tsfer, &msg);
+	status = cc2520_plat_spi_sync(dev, &radio->msg);
 
-	status = spi_sync(state.spi_device, &msg);
+	return radio->rx_buf[radio->tsfer.len - 1];
 }
 
-static cc2520_status_t cc2520_radio_strobe(u8 cmd)
+static cc2520_status_t cc2520_radio_strobe(struct cc2520_dev *dev, u8 cmd)
 {
+	struct cc2520_radio_state *radio = dev->radio;
 	int status;
 	cc2520_status_t ret;
 
-	tsfer.tx_buf = tx_buf;
-	tsfer.rx_buf = rx_buf;
-	tsfer.len = 0;
+	radio->tsfer.tx_buf = radio->tx_buf;
+	radio->tsfer.rx_buf = radio->rx_buf;
+	radio->tsfer.len = 0;
 
-	tx_buf[0] = cmd;
-	tsfer.len = 1;
+	radio->tx_buf[0] = cmd;
+	radio->tsfer.len = 1;
 
-	memset(rx_buf, 0, SPI_BUFF_SIZE);
+	memset(radio->rx_buf, 0, SPI_BUFF_SIZE);
 
-	spi_message_init(&msg);
-	msg.context = NULL;
-	spi_message_add_tail(&tsfer, &msg);
+	spi_message_init(&radio->msg);
+	radio->msg.context = dev;
+	spi_message_add_tail(&radio->tsfer, &radio->msg);
 
-	status = spi_sync(state.spi_device, &msg);
+	status = cc2520_plat_spi_sync(dev, &radio->msg);
 
-	ret.value = rx_buf[0];
+	ret.value = radio->rx_buf[0];
 	return ret;
 }
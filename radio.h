@@ -6,25 +6,43 @@
 #include <linux/workqueue.h>
 #include <linux/spinlock.h>
 
+#include "ioctl.h"
+
+struct cc2520_dev;
+
 // Radio Initializers
-int cc2520_radio_init(void);
-void cc2520_radio_free(void);
+int cc2520_radio_init(struct cc2520_dev *dev);
+void cc2520_radio_free(struct cc2520_dev *dev);
 
 // Radio Commands
-void cc2520_radio_start(void);
-void cc2520_radio_on(void);
-void cc2520_radio_off(void);
-void cc2520_radio_set_channel(int channel);
-void cc2520_radio_set_address(u16 short_addr, u64 extended_addr, u16 pan_id);
-void cc2520_radio_set_txpower(u8 power);
+void cc2520_radio_start(struct cc2520_dev *dev);
+void cc2520_radio_on(struct cc2520_dev *dev);
+void cc2520_radio_off(struct cc2520_dev *dev);
+void cc2520_radio_set_channel(struct cc2520_dev *dev, int channel);
+int cc2520_radio_switch_channel(struct cc2520_dev *dev, int channel);
+int cc2520_radio_get_channel(struct cc2520_dev *dev);
+void cc2520_radio_get_switch_stats(struct cc2520_dev *dev, struct cc2520_channel_switch_stats *stats);
+void cc2520_radio_set_address(struct cc2520_dev *dev, u16 short_addr, u64 extended_addr, u16 pan_id);
+void cc2520_radio_set_txpower(struct cc2520_dev *dev, u8 power);
+void cc2520_radio_set_frame_filter(struct cc2520_dev *dev, bool enabled, bool pan_coordinator,
+	u8 max_frame_version, u8 frame_types);
+void cc2520_radio_set_promiscuous(struct cc2520_dev *dev, bool enabled);
+bool cc2520_radio_is_promiscuous(struct cc2520_dev *dev);
+void cc2520_radio_set_pan_coordinator(struct cc2520_dev *dev, bool pan_coordinator);
+void cc2520_radio_get_address(struct cc2520_dev *dev, u16 *short_addr, u64 *extended_addr, u16 *pan_id);
+int cc2520_radio_read_rssi(struct cc2520_dev *dev, s8 *rssi);
+int cc2520_radio_ed_scan(struct cc2520_dev *dev, struct cc2520_ed_scan_data *scan);
+void cc2520_radio_set_rx_poll(struct cc2520_dev *dev, bool enabled, u8 budget);
+void cc2520_radio_get_rx_poll_stats(struct cc2520_dev *dev, struct cc2520_rx_poll_stats *stats);
 
-void cc2520_radio_release_rx(void);
-bool cc2520_radio_is_clear(void);
+void cc2520_radio_release_rx(struct cc2520_dev *dev);
+void cc2520_radio_hold_rx(struct cc2520_dev *dev, const struct cc2520_rx_record *meta);
+const struct cc2520_rx_record *cc2520_radio_rx_meta(struct cc2520_dev *dev);
+u64 cc2520_radio_tx_sfd_time(struct cc2520_dev *dev);
+bool cc2520_radio_is_clear(struct cc2520_dev *dev);
 
 // Radio Interrupt Callbacks
-void cc2520_radio_sfd_occurred(u64 nano_timestamp, u8 is_high);
-void cc2520_radio_fifop_occurred(void);
-
-extern struct cc2520_interface *radio_top;
+void cc2520_radio_sfd_occurred(struct cc2520_dev *dev, u64 nano_timestamp, u8 is_high);
+void cc2520_radio_fifop_occurred(struct cc2520_dev *dev);
 
 #endif
\ No newline at end of file
@@ -7,16 +7,16 @@
 #include "cc2520.h"
 #include "packet.h"
 #include "radio.h"
+#include "env.h"
+#include "stats.h"
+#include "trace.h"
 #include "debug.h"
 
-struct cc2520_interface *sack_top;
-struct cc2520_interface *sack_bottom;
-
-static int cc2520_sack_tx(u8 * buf, u8 len);
-static void cc2520_sack_tx_done(u8 status);
-static void cc2520_sack_rx_done(u8 *buf, u8 len);
+static int cc2520_sack_tx(struct cc2520_dev *dev, u8 * buf, u8 len);
+static void cc2520_sack_tx_done(struct cc2520_dev *dev, u8 status);
+static void cc2520_sack_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len);
 static enum hrtimer_restart cc2520_sack_timer_cb(struct hrtimer *timer);
-static void cc2520_sack_start_timer(void);
+static void cc2520_sack_start_timer(struct cc2520_sack_state *sack);
 
 // Two pieces to software acknowledgements:
 // 1 - Taking packets we're transmitting, setting an ACK flag
@@ -33,146 +33,184 @@ static void cc2520_sack_start_timer(void);
 //     - Concurrency mechanism to prevent transmission
 //       during ACKing.
 
-static u8 *ack_buf;
-static u8 *cur_tx_buf;
+struct cc2520_sack_state {
+	struct cc2520_dev *dev;
 
-static u8 *cur_rx_buf;
-static u8 cur_rx_buf_len;
+	u8 *ack_buf;
+	u8 *cur_tx_buf;
 
-static struct hrtimer timeout_timer;
-static int ack_timeout; //in microseconds
-static int sack_state;
-static spinlock_t sack_sl;
+	u8 *cur_rx_buf;
+	u8 cur_rx_buf_len;
 
-static unsigned long flags;
+	struct hrtimer timeout_timer;
+	int ack_timeout; //in microseconds
+	int sack_state;
+	spinlock_t sack_sl;
 
-enum cc2520_sack_state_enum {
-	CC2520_SACK_IDLE,
-	CC2520_SACK_TX, // Waiting for a tx to complete
-	CC2520_SACK_TX_WAIT, // Waiting for an ack to be received
-	CC2520_SACK_TX_ACK, // Waiting for a sent ack to finish
+	u64 tx_sfd; // SFD of the frame waiting on an ACK
 };
 
-int cc2520_sack_init()
+int cc2520_sack_init(struct cc2520_dev *dev)
 {
-	sack_top->tx = cc2520_sack_tx;
-	sack_bottom->tx_done = cc2520_sack_tx_done;
-	sack_bottom->rx_done = cc2520_sack_rx_done;
+	struct cc2520_sack_state *sack;
+
+	sack = kzalloc(sizeof(struct cc2520_sack_state), GFP_KERNEL);
+	if (!sack)
+		return -ENOMEM;
+
+	sack->dev = dev;
+	dev->sack = sack;
+
+	dev->sack_top->tx = cc2520_sack_tx;
+	dev->sack_bottom->tx_done = cc2520_sack_tx_done;
+	dev->sack_bottom->rx_done = cc2520_sack_rx_done;
 
-	ack_buf = kmalloc(IEEE154_ACK_FRAME_LENGTH + 1, GFP_KERNEL);
-	if (!ack_buf) {
+	sack->ack_buf = kmalloc(IEEE154_ACK_FRAME_LENGTH + 1, GFP_KERNEL);
+	if (!sack->ack_buf) {
 		goto error;
 	}
 
-	cur_tx_buf = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
-	if (!cur_tx_buf) {
+	sack->cur_tx_buf = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
+	if (!sack->cur_tx_buf) {
 		goto error;
 	}
 
-	cur_rx_buf = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
-	if (!cur_rx_buf) {
+	sack->cur_rx_buf = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
+	if (!sack->cur_rx_buf) {
 		goto error;
 	}
 
-	hrtimer_init(&timeout_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-    timeout_timer.function = &cc2520_sack_timer_cb;
+	hrtimer_init(&sack->timeout_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    sack->timeout_timer.function = &cc2520_sack_timer_cb;
 
-	spin_lock_init(&sack_sl);
-	sack_state = CC2520_SACK_IDLE;
+	spin_lock_init(&sack->sack_sl);
+	sack->sack_state = CC2520_SACK_IDLE;
 
-	ack_timeout = CC2520_DEF_ACK_TIMEOUT;
+	sack->ack_timeout = CC2520_DEF_ACK_TIMEOUT;
 
 	return 0;
 
 	error:
-		if (ack_buf) {
-			kfree(ack_buf);
-			ack_buf = NULL;
+		if (sack->ack_buf) {
+			kfree(sack->ack_buf);
+			sack->ack_buf = NULL;
 		}
 
-		if (cur_tx_buf) {
-			kfree(cur_tx_buf);
-			cur_tx_buf = NULL;
+		if (sack->cur_tx_buf) {
+			kfree(sack->cur_tx_buf);
+			sack->cur_tx_buf = NULL;
 		}
 
+		kfree(sack);
+		dev->sack = NULL;
+
 		return -EFAULT;
 }
 
-void cc2520_sack_free()
+void cc2520_sack_free(struct cc2520_dev *dev)
 {
-	if (ack_buf) {
-		kfree(ack_buf);
+	struct cc2520_sack_state *sack = dev->sack;
+
+	if (sack->ack_buf) {
+		kfree(sack->ack_buf);
+	}
+
+	if (sack->cur_tx_buf) {
+		kfree(sack->cur_tx_buf);
 	}
 
-	if (cur_tx_buf) {
-		kfree(cur_tx_buf);
+	if (sack->cur_rx_buf) {
+		kfree(sack->cur_rx_buf);
 	}
 
-	hrtimer_cancel(&timeout_timer);
+	cc2520_env_timer_cancel(dev, &sack->timeout_timer);
+
+	kfree(sack);
+	dev->sack = NULL;
 }
 
-void cc2520_sack_set_timeout(int timeout)
+void cc2520_sack_set_timeout(struct cc2520_dev *dev, int timeout)
 {
-	ack_timeout = timeout;
+	dev->sack->ack_timeout = timeout;
 }
 
-static void cc2520_sack_start_timer()
+static void cc2520_sack_start_timer(struct cc2520_sack_state *sack)
 {
-    ktime_t kt;
-    kt = ktime_set(0, 1000 * ack_timeout);
-	hrtimer_start(&timeout_timer, kt, HRTIMER_MODE_REL);
+	cc2520_env_timer_start(sack->dev, &sack->timeout_timer, sack->ack_timeout);
 }
 
-static int cc2520_sack_tx(u8 * buf, u8 len)
+static int cc2520_sack_tx(struct cc2520_dev *dev, u8 * buf, u8 len)
 {
-	spin_lock_irqsave(&sack_sl, flags);
+	struct cc2520_sack_state *sack = dev->sack;
+	unsigned long flags;
 
-	if (sack_state != CC2520_SACK_IDLE) {
+	spin_lock_irqsave(&sack->sack_sl, flags);
+
+	if (sack->sack_state != CC2520_SACK_IDLE) {
 		INFO((KERN_INFO "[cc2520] - Ut oh! Tx spinlocking.\n"));
 	}
 
-	while (sack_state != CC2520_SACK_IDLE) {
-		spin_unlock_irqrestore(&sack_sl, flags);
-		spin_lock_irqsave(&sack_sl, flags);
+	while (sack->sack_state != CC2520_SACK_IDLE) {
+		spin_unlock_irqrestore(&sack->sack_sl, flags);
+		spin_lock_irqsave(&sack->sack_sl, flags);
 	}
-	sack_state = CC2520_SACK_TX;
-	spin_unlock_irqrestore(&sack_sl, flags);
+	sack->sack_state = CC2520_SACK_TX;
+	trace_cc2520_sack_state(dev->id, sack->sack_state);
+	spin_unlock_irqrestore(&sack->sack_sl, flags);
 
-	memcpy(cur_tx_buf, buf, len);
-	return sack_bottom->tx(cur_tx_buf, len);
+	memcpy(sack->cur_tx_buf, buf, len);
+	return dev->sack_bottom->tx(dev, sack->cur_tx_buf, len);
 }
 
-static void cc2520_sack_tx_done(u8 status)
+static void cc2520_sack_tx_done(struct cc2520_dev *dev, u8 status)
 {
-	spin_lock_irqsave(&sack_sl, flags);
-	if (sack_state == CC2520_SACK_TX) {
-		if (cc2520_packet_requires_ack_wait(cur_tx_buf)) {
+	struct cc2520_sack_state *sack = dev->sack;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sack->sack_sl, flags);
+	if (sack->sack_state == CC2520_SACK_TX) {
+		// The first time a written frame makes it out,
+		// LPL may send it again.
+		sack->tx_sfd = cc2520_radio_tx_sfd_time(dev);
+		if (status == CC2520_TX_SUCCESS && dev->tx_submitted &&
+			sack->tx_sfd > dev->tx_submitted) {
+			cc2520_hist_record(dev, CC2520_HIST_WRITE_SFD, sack->tx_sfd - dev->tx_submitted);
+			dev->tx_submitted = 0;
+		}
+
+		if (cc2520_packet_requires_ack_wait(sack->cur_tx_buf)) {
 			DBG((KERN_INFO "[cc2520] - Entering TX wait state.\n"));
-			sack_state = CC2520_SACK_TX_WAIT;
-			cc2520_sack_start_timer();
-			spin_unlock_irqrestore(&sack_sl, flags);
+			sack->sack_state = CC2520_SACK_TX_WAIT;
+			trace_cc2520_sack_state(dev->id, sack->sack_state);
+			cc2520_sack_start_timer(sack);
+			spin_unlock_irqrestore(&sack->sack_sl, flags);
 		}
 		else {
-			sack_state = CC2520_SACK_IDLE;
-			spin_unlock_irqrestore(&sack_sl, flags);
-			sack_top->tx_done(status);
+			sack->sack_state = CC2520_SACK_IDLE;
+			trace_cc2520_sack_state(dev->id, sack->sack_state);
+			spin_unlock_irqrestore(&sack->sack_sl, flags);
+			dev->sack_top->tx_done(dev, status);
 		}
 	}
-	else if (sack_state == CC2520_SACK_TX_ACK) {
-		sack_state = CC2520_SACK_IDLE;
-		spin_unlock_irqrestore(&sack_sl, flags);
+	else if (sack->sack_state == CC2520_SACK_TX_ACK) {
+		sack->sack_state = CC2520_SACK_IDLE;
+		trace_cc2520_sack_state(dev->id, sack->sack_state);
+		spin_unlock_irqrestore(&sack->sack_sl, flags);
 	}
 	else {
 		ERR((KERN_ALERT "[cc2520] - ERROR: tx_done state engine in impossible state.\n"));
 	}
 }
 
-static void cc2520_sack_rx_done(u8 *buf, u8 len)
+static void cc2520_sack_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len)
 {
+	struct cc2520_sack_state *sack = dev->sack;
+	unsigned long flags;
+
 	// if this packet we just received requires
 	// an ACK, trasmit it.
-	memcpy(cur_rx_buf, buf, len);
-	cur_rx_buf_len = len;
+	memcpy(sack->cur_rx_buf, buf, len);
+	sack->cur_rx_buf_len = len;
 
 	// NOTE: this is a big hack right now,
 	// and I'm not sure if it's even needed.
@@ -183,58 +221,75 @@ static void cc2520_sack_rx_done(u8 *buf, u8 len)
 	// a terrible concurrency bug I added this
 	// as a possible solution, but I don't
 	// think it's needed anymore.
-	cc2520_radio_release_rx();
+	cc2520_radio_release_rx(dev);
 
-	spin_lock_irqsave(&sack_sl, flags);
+	spin_lock_irqsave(&sack->sack_sl, flags);
 
-	if (cc2520_packet_is_ack(cur_rx_buf)) {
-		if (sack_state == CC2520_SACK_TX_WAIT &&
-			cc2520_packet_is_ack_to(cur_rx_buf, cur_tx_buf)) {
-			sack_state = CC2520_SACK_IDLE;
-			spin_unlock_irqrestore(&sack_sl, flags);
+	if (cc2520_packet_is_ack(sack->cur_rx_buf)) {
+		if (sack->sack_state == CC2520_SACK_TX_WAIT &&
+			cc2520_packet_is_ack_to(sack->cur_rx_buf, sack->cur_tx_buf)) {
+			sack->sack_state = CC2520_SACK_IDLE;
+			trace_cc2520_sack_state(dev->id, sack->sack_state);
+			spin_unlock_irqrestore(&sack->sack_sl, flags);
 
-			hrtimer_cancel(&timeout_timer);
-			sack_top->tx_done(CC2520_TX_SUCCESS);
+			cc2520_env_timer_cancel(dev, &sack->timeout_timer);
+			cc2520_stat_inc(dev, CC2520_STAT_SACK_ACK_OK);
+			cc2520_hist_record(dev, CC2520_HIST_SFD_ACK, cc2520_env_now(dev) - sack->tx_sfd);
+			dev->sack_top->tx_done(dev, CC2520_TX_SUCCESS);
 		}
 		else {
-			spin_unlock_irqrestore(&sack_sl, flags);
+			spin_unlock_irqrestore(&sack->sack_sl, flags);
 			INFO((KERN_INFO "[cc2520] - stray ack received.\n"));
+			cc2520_stat_inc(dev, CC2520_STAT_SACK_STRAY_ACK);
 		}
 	}
 	else {
-		if (cc2520_packet_requires_ack_reply(cur_rx_buf)) {
-			if (sack_state == CC2520_SACK_IDLE) {
-				cc2520_packet_create_ack(cur_rx_buf, ack_buf);
-				sack_state = CC2520_SACK_TX_ACK;
-				spin_unlock_irqrestore(&sack_sl, flags);
-				sack_bottom->tx(ack_buf, IEEE154_ACK_FRAME_LENGTH + 1);
-				sack_top->rx_done(cur_rx_buf, cur_rx_buf_len);
+		// In promiscuous mode most frames asking for an
+		// ACK aren't for us, so don't answer any of them.
+		if (cc2520_packet_requires_ack_reply(sack->cur_rx_buf) &&
+			!cc2520_radio_is_promiscuous(dev)) {
+			if (sack->sack_state == CC2520_SACK_IDLE) {
+				cc2520_packet_create_ack(sack->cur_rx_buf, sack->ack_buf);
+				sack->sack_state = CC2520_SACK_TX_ACK;
+				trace_cc2520_sack_state(dev->id, sack->sack_state);
+				spin_unlock_irqrestore(&sack->sack_sl, flags);
+				cc2520_stat_inc(dev, CC2520_STAT_SACK_ACK_SENT);
+				dev->sack_bottom->tx(dev, sack->ack_buf, IEEE154_ACK_FRAME_LENGTH + 1);
+				dev->sack_top->rx_done(dev, sack->cur_rx_buf, sack->cur_rx_buf_len);
 			}
 			else {
-				spin_unlock_irqrestore(&sack_sl, flags);
-				INFO((KERN_INFO "[cc2520] - ACK skipped, soft-ack layer busy. %d \n", sack_state));
+				spin_unlock_irqrestore(&sack->sack_sl, flags);
+				INFO((KERN_INFO "[cc2520] - ACK skipped, soft-ack layer busy. %d \n", sack->sack_state));
+				cc2520_stat_inc(dev, CC2520_STAT_SACK_ACK_SKIPPED);
 			}
 		}
 		else {
-			spin_unlock_irqrestore(&sack_sl, flags);
-			sack_top->rx_done(cur_rx_buf, cur_rx_buf_len);
+			spin_unlock_irqrestore(&sack->sack_sl, flags);
+			dev->sack_top->rx_done(dev, sack->cur_rx_buf, sack->cur_rx_buf_len);
 		}
 	}
 }
 
 static enum hrtimer_restart cc2520_sack_timer_cb(struct hrtimer *timer)
 {
-	spin_lock_irqsave(&sack_sl, flags);
+	struct cc2520_sack_state *sack =
+		container_of(timer, struct cc2520_sack_state, timeout_timer);
+	struct cc2520_dev *dev = sack->dev;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sack->sack_sl, flags);
 
-	if (sack_state == CC2520_SACK_TX_WAIT) {
+	if (sack->sack_state == CC2520_SACK_TX_WAIT) {
 		INFO((KERN_INFO "[cc2520] - tx ack timeout exceeded.\n"));
-		sack_state = CC2520_SACK_IDLE;
-		spin_unlock_irqrestore(&sack_sl, flags);
+		cc2520_stat_inc(dev, CC2520_STAT_SACK_ACK_TIMEOUT);
+		sack->sack_state = CC2520_SACK_IDLE;
+		trace_cc2520_sack_state(dev->id, sack->sack_state);
+		spin_unlock_irqrestore(&sack->sack_sl, flags);
 
-		sack_top->tx_done(-CC2520_TX_ACK_TIMEOUT);
+		dev->sack_top->tx_done(dev, -CC2520_TX_ACK_TIMEOUT);
 	}
 	else {
-		spin_unlock_irqrestore(&sack_sl, flags);
+		spin_unlock_irqrestore(&sack->sack_sl, flags);
 	}
 
 	return HRTIMER_NORESTART;
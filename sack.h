@@ -3,11 +3,16 @@
 
 #include "cc2520.h"
 
-extern struct cc2520_interface *sack_top;
-extern struct cc2520_interface *sack_bottom;
+int cc2520_sack_init(struct cc2520_dev *dev);
+void cc2520_sack_free(struct cc2520_dev *dev);
+void cc2520_sack_set_timeout(struct cc2520_dev *dev, int timeout);
 
-int cc2520_sack_init(void);
-void cc2520_sack_free(void);
-void cc2520_sack_set_timeout(int timeout);
+// States as they show in the cc2520_sack_state tracepoint.
+enum cc2520_sack_state_enum {
+	CC2520_SACK_IDLE,
+	CC2520_SACK_TX, // Waiting for a tx to complete
+	CC2520_SACK_TX_WAIT, // Waiting for an ack to be received
+	CC2520_SACK_TX_ACK, // Waiting for a sent ack to finish
+};
 
 #endif
\ No newline at end of file
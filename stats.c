@@ -0,0 +1,257 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/device.h>
+#include <linux/sysfs.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "cc2520.h"
+#include "stats.h"
+#include "flight.h"
+#include "debug.h"
+
+// Counters are kept per CPU so bumping one from the
+// interrupt and SPI paths costs a single increment with
+// no locks or shared cache lines, which means they can
+// stay on all the time. Reading sums every CPU's copy.
+//
+// Each counter is a file under the radio's stats
+// directory in sysfs, and writing anything to
+// stats/reset zeroes the lot. The latency histograms are
+// too much for sysfs, they're printed together in a
+// debugfs file instead, which is also cleared by writing
+// to it.
+
+static struct dentry *cc2520_debugfs_root;
+
+static const char * const cc2520_hist_names[CC2520_HIST_COUNT] = {
+	[CC2520_HIST_FIFOP_SPI] = "fifop_spi",
+	[CC2520_HIST_RX_READ] = "rx_read",
+	[CC2520_HIST_WRITE_SFD] = "write_sfd",
+	[CC2520_HIST_SFD_ACK] = "sfd_ack",
+	[CC2520_HIST_CSMA_LATE] = "csma_late",
+};
+
+static ssize_t cc2520_stats_show(struct device *de,
+	struct device_attribute *attr, char *buf)
+{
+	struct cc2520_dev *dev = dev_get_drvdata(de);
+	struct dev_ext_attribute *ea =
+		container_of(attr, struct dev_ext_attribute, attr);
+
+	return sprintf(buf, "%llu\n", cc2520_stats_read(dev, (uintptr_t)ea->var));
+}
+
+static ssize_t cc2520_stats_reset_store(struct device *de,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct cc2520_dev *dev = dev_get_drvdata(de);
+
+	cc2520_stats_reset(dev);
+	return count;
+}
+
+#define CC2520_STAT_ATTR(_name, _stat) \
+	static struct dev_ext_attribute cc2520_stat_attr_##_name = \
+		{ __ATTR(_name, 0444, cc2520_stats_show, NULL), (void *)_stat }
+
+CC2520_STAT_ATTR(radio_tx_ok, CC2520_STAT_RADIO_TX_OK);
+CC2520_STAT_ATTR(radio_tx_underflow, CC2520_STAT_RADIO_TX_UNDERFLOW);
+CC2520_STAT_ATTR(radio_rx_ok, CC2520_STAT_RADIO_RX_OK);
+CC2520_STAT_ATTR(radio_rx_flush, CC2520_STAT_RADIO_RX_FLUSH);
+CC2520_STAT_ATTR(radio_rx_overlength, CC2520_STAT_RADIO_RX_OVERLENGTH);
+CC2520_STAT_ATTR(sack_ack_ok, CC2520_STAT_SACK_ACK_OK);
+CC2520_STAT_ATTR(sack_ack_timeout, CC2520_STAT_SACK_ACK_TIMEOUT);
+CC2520_STAT_ATTR(sack_ack_sent, CC2520_STAT_SACK_ACK_SENT);
+CC2520_STAT_ATTR(sack_ack_skipped, CC2520_STAT_SACK_ACK_SKIPPED);
+CC2520_STAT_ATTR(sack_stray_ack, CC2520_STAT_SACK_STRAY_ACK);
+CC2520_STAT_ATTR(csma_backoff, CC2520_STAT_CSMA_BACKOFF);
+CC2520_STAT_ATTR(csma_cong_backoff, CC2520_STAT_CSMA_CONG_BACKOFF);
+CC2520_STAT_ATTR(csma_busy, CC2520_STAT_CSMA_BUSY);
+CC2520_STAT_ATTR(lpl_train, CC2520_STAT_LPL_TRAIN);
+CC2520_STAT_ATTR(lpl_retransmit, CC2520_STAT_LPL_RETRANSMIT);
+CC2520_STAT_ATTR(unique_drop, CC2520_STAT_UNIQUE_DROP);
+CC2520_STAT_ATTR(interface_rx_drop, CC2520_STAT_INTERFACE_RX_DROP);
+
+static struct device_attribute cc2520_stat_attr_reset =
+	__ATTR(reset, 0200, NULL, cc2520_stats_reset_store);
+
+static struct attribute *cc2520_stats_attrs[] = {
+	&cc2520_stat_attr_radio_tx_ok.attr.attr,
+	&cc2520_stat_attr_radio_tx_underflow.attr.attr,
+	&cc2520_stat_attr_radio_rx_ok.attr.attr,
+	&cc2520_stat_attr_radio_rx_flush.attr.attr,
+	&cc2520_stat_attr_radio_rx_overlength.attr.attr,
+	&cc2520_stat_attr_sack_ack_ok.attr.attr,
+	&cc2520_stat_attr_sack_ack_timeout.attr.attr,
+	&cc2520_stat_attr_sack_ack_sent.attr.attr,
+	&cc2520_stat_attr_sack_ack_skipped.attr.attr,
+	&cc2520_stat_attr_sack_stray_ack.attr.attr,
+	&cc2520_stat_attr_csma_backoff.attr.attr,
+	&cc2520_stat_attr_csma_cong_backoff.attr.attr,
+	&cc2520_stat_attr_csma_busy.attr.attr,
+	&cc2520_stat_attr_lpl_train.attr.attr,
+	&cc2520_stat_attr_lpl_retransmit.attr.attr,
+	&cc2520_stat_attr_unique_drop.attr.attr,
+	&cc2520_stat_attr_interface_rx_drop.attr.attr,
+	&cc2520_stat_attr_reset.attr,
+	NULL,
+};
+
+static const struct attribute_group cc2520_stats_group = {
+	.name = "stats",
+	.attrs = cc2520_stats_attrs,
+};
+
+int cc2520_stats_init(struct cc2520_dev *dev)
+{
+	dev->stats = alloc_percpu(struct cc2520_stats);
+	if (!dev->stats)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void cc2520_stats_free(struct cc2520_dev *dev)
+{
+	free_percpu(dev->stats);
+	dev->stats = NULL;
+}
+
+static void cc2520_hist_sum(struct cc2520_dev *dev, enum cc2520_hist hist, struct cc2520_histogram *total)
+{
+	struct cc2520_histogram *h;
+	int cpu;
+	int i;
+
+	memset(total, 0, sizeof(struct cc2520_histogram));
+
+	for_each_possible_cpu(cpu) {
+		h = &per_cpu_ptr(dev->stats, cpu)->hist[hist];
+		for (i = 0; i < CC2520_HIST_BUCKETS; i++)
+			total->buckets[i] += h->buckets[i];
+		total->count += h->count;
+		total->sum += h->sum;
+		total->max = max(total->max, h->max);
+	}
+}
+
+// One header line per histogram, then a line per
+// bucket with its lower bound in uS and count.
+static int cc2520_latency_show(struct seq_file *s, void *unused)
+{
+	struct cc2520_dev *dev = s->private;
+	struct cc2520_histogram total;
+	int hist;
+	int i;
+
+	for (hist = 0; hist < CC2520_HIST_COUNT; hist++) {
+		cc2520_hist_sum(dev, hist, &total);
+
+		seq_printf(s, "%s count %llu mean_us %llu max_us %llu\n",
+			cc2520_hist_names[hist], total.count,
+			total.count ? div64_u64(total.sum, total.count * 1000) : 0,
+			div_u64(total.max, 1000));
+
+		for (i = 0; i < CC2520_HIST_BUCKETS; i++)
+			seq_printf(s, "  %llu %llu\n", i ? 1ULL << (i - 1) : 0ULL, total.buckets[i]);
+	}
+
+	return 0;
+}
+
+static int cc2520_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cc2520_latency_show, inode->i_private);
+}
+
+static ssize_t cc2520_latency_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+
+	cc2520_hist_reset(s->private);
+	return count;
+}
+
+static const struct file_operations cc2520_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = cc2520_latency_open,
+	.read = seq_read,
+	.write = cc2520_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+// Nothing else depends on debugfs, so if it isn't
+// there the radios carry on without it. Hands back the
+// directory for anything module wide.
+struct dentry *cc2520_stats_debugfs_init()
+{
+	cc2520_debugfs_root = debugfs_create_dir("cc2520", NULL);
+	return cc2520_debugfs_root;
+}
+
+void cc2520_stats_debugfs_free()
+{
+	debugfs_remove_recursive(cc2520_debugfs_root);
+	cc2520_debugfs_root = NULL;
+}
+
+int cc2520_stats_register(struct cc2520_dev *dev, struct device *de)
+{
+	char name[16];
+	int result;
+
+	result = sysfs_create_group(&de->kobj, &cc2520_stats_group);
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - could not create stats for radio%d\n", dev->id));
+		return result;
+	}
+
+	snprintf(name, sizeof(name), "radio%d", dev->id);
+	dev->debugfs = debugfs_create_dir(name, cc2520_debugfs_root);
+	debugfs_create_file("latency", 0600, dev->debugfs, dev, &cc2520_latency_fops);
+	cc2520_flight_debugfs(dev, dev->debugfs);
+
+	return 0;
+}
+
+void cc2520_stats_unregister(struct cc2520_dev *dev, struct device *de)
+{
+	debugfs_remove_recursive(dev->debugfs);
+	dev->debugfs = NULL;
+	sysfs_remove_group(&de->kobj, &cc2520_stats_group);
+}
+
+u64 cc2520_stats_read(struct cc2520_dev *dev, enum cc2520_stat stat)
+{
+	u64 total = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		total += per_cpu_ptr(dev->stats, cpu)->count[stat];
+
+	return total;
+}
+
+// Not synchronised with the increments, an event landing
+// mid-reset may survive it. That's fine for monitoring.
+void cc2520_stats_reset(struct cc2520_dev *dev)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(dev->stats, cpu)->count, 0, sizeof(u64) * CC2520_STAT_COUNT);
+}
+
+void cc2520_hist_reset(struct cc2520_dev *dev)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(dev->stats, cpu)->hist, 0, sizeof(struct cc2520_histogram) * CC2520_HIST_COUNT);
+}
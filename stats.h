@@ -0,0 +1,100 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+
+#include "cc2520.h"
+
+struct device;
+
+// Event counters for every layer of the stack, readable
+// and resettable through sysfs under
+// /sys/class/cc2520/radioN/stats.
+enum cc2520_stat {
+	CC2520_STAT_RADIO_TX_OK,
+	CC2520_STAT_RADIO_TX_UNDERFLOW,
+	CC2520_STAT_RADIO_RX_OK,
+	CC2520_STAT_RADIO_RX_FLUSH,
+	CC2520_STAT_RADIO_RX_OVERLENGTH,
+	CC2520_STAT_SACK_ACK_OK,
+	CC2520_STAT_SACK_ACK_TIMEOUT,
+	CC2520_STAT_SACK_ACK_SENT,
+	CC2520_STAT_SACK_ACK_SKIPPED,
+	CC2520_STAT_SACK_STRAY_ACK,
+	CC2520_STAT_CSMA_BACKOFF,
+	CC2520_STAT_CSMA_CONG_BACKOFF,
+	CC2520_STAT_CSMA_BUSY,
+	CC2520_STAT_LPL_TRAIN,
+	CC2520_STAT_LPL_RETRANSMIT,
+	CC2520_STAT_UNIQUE_DROP,
+	CC2520_STAT_INTERFACE_RX_DROP,
+	CC2520_STAT_COUNT,
+};
+
+// Latency histograms, readable and resettable through
+// debugfs at cc2520/radioN/latency.
+enum cc2520_hist {
+	CC2520_HIST_FIFOP_SPI,  // FIFOP IRQ to the first RX SPI completion
+	CC2520_HIST_RX_READ,    // frame handed to the interface to read()
+	CC2520_HIST_WRITE_SFD,  // write() to the frame's SFD going out
+	CC2520_HIST_SFD_ACK,    // SFD going out to the soft-ack layer seeing the ACK
+	CC2520_HIST_CSMA_LATE,  // CSMA backoff timer firing past what was asked for
+	CC2520_HIST_COUNT,
+};
+
+// Log2 buckets in uS, bucket 0 is under 1uS and bucket
+// n covers [2^(n-1), 2^n) uS. The last one takes
+// everything over about 4 seconds.
+#define CC2520_HIST_BUCKETS 24
+
+struct cc2520_histogram {
+	u64 buckets[CC2520_HIST_BUCKETS];
+	u64 count;
+	u64 sum; // nS
+	u64 max; // nS
+};
+
+struct cc2520_stats {
+	u64 count[CC2520_STAT_COUNT];
+	struct cc2520_histogram hist[CC2520_HIST_COUNT];
+};
+
+int cc2520_stats_init(struct cc2520_dev *dev);
+void cc2520_stats_free(struct cc2520_dev *dev);
+
+struct dentry *cc2520_stats_debugfs_init(void);
+void cc2520_stats_debugfs_free(void);
+
+int cc2520_stats_register(struct cc2520_dev *dev, struct device *de);
+void cc2520_stats_unregister(struct cc2520_dev *dev, struct device *de);
+
+u64 cc2520_stats_read(struct cc2520_dev *dev, enum cc2520_stat stat);
+void cc2520_stats_reset(struct cc2520_dev *dev);
+void cc2520_hist_reset(struct cc2520_dev *dev);
+
+// Safe from any context, each CPU only ever
+// touches its own copy of the counters.
+static inline void cc2520_stat_inc(struct cc2520_dev *dev, enum cc2520_stat stat)
+{
+	this_cpu_inc(dev->stats->count[stat]);
+}
+
+static inline void cc2520_hist_record(struct cc2520_dev *dev, enum cc2520_hist hist, u64 nanos)
+{
+	struct cc2520_histogram *h = &dev->stats->hist[hist];
+	u64 micros = div_u64(nanos, 1000);
+	int bucket = micros ? min(fls64(micros), CC2520_HIST_BUCKETS - 1) : 0;
+
+	this_cpu_inc(h->buckets[bucket]);
+	this_cpu_inc(h->count);
+	this_cpu_add(h->sum, nanos);
+
+	// Racy against another record on the same CPU,
+	// at worst a max gets lost.
+	if (nanos > this_cpu_read(h->max))
+		this_cpu_write(h->max, nanos);
+}
+
+#endif
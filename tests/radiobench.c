@@ -0,0 +1,699 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "ioctl.h"
+#include <unistd.h>
+
+// Throughput, latency and loss over a pair of radios.
+// One end sends sequence numbered frames, the other
+// reflects them back or just counts them:
+//
+//   radiobench -d /dev/radio1 -a 2 reflect
+//   radiobench -d /dev/radio0 -a 1 -t 2 -s 40 -r 100 -T 10 send
+//
+// The sender reports what it got written and what came
+// back: packets per second, goodput, loss, reordering,
+// duplicates and round trip time percentiles. The
+// reflector reports what it heard when it's stopped with
+// ^C, or after -T seconds or -n frames. In sink mode it
+// doesn't answer, for one way loss. -j prints a single
+// JSON object instead, for keeping track of runs.
+//
+// Build with:
+//   gcc -O2 -I.. radiobench.c -o radiobench -lpthread
+
+// write() errors, as the driver's cc2520.h has them.
+#define CC2520_TX_BUSY 1
+#define CC2520_TX_ACK_TIMEOUT 3
+
+#define BENCH_MAGIC 0xCB42
+#define BENCH_PING 1
+#define BENCH_PONG 2
+
+// Length, FCF, DSN, PAN, destination, source.
+#define MAC_HDR_LEN 9
+#define MAC_FCS_LEN 2
+#define MAX_PAYLOAD (127 - MAC_HDR_LEN - MAC_FCS_LEN + 1)
+
+// FCF for an intra-PAN data frame with short addresses.
+#define FCF_DATA 0x8841
+#define FCF_ACK_REQ (1 << 5)
+
+struct bench_payload {
+	uint16_t magic;
+	uint8_t type;
+	uint8_t pad;
+	uint16_t run;    // picked by the sender, replies to other runs are ignored
+	uint32_t seq;
+	uint64_t sent;   // sender's CLOCK_MONOTONIC_RAW at write(), nS
+} __attribute__((packed));
+
+// CSMA and LPL settings, in the driver's terms.
+struct bench_preset {
+	const char *name;
+	bool csma;
+	bool lpl;
+};
+
+static const struct bench_preset presets[] = {
+	{ "raw", false, false },
+	{ "csma", true, false },
+	{ "lpl", true, true },
+};
+
+// The driver's defaults, see cc2520.h.
+#define DEF_MIN_BACKOFF 320
+#define DEF_INIT_BACKOFF 4960
+#define DEF_CONG_BACKOFF 2240
+#define DEF_LPL_WINDOW 5120
+#define DEF_LPL_INTERVAL 512000
+
+struct bench_config {
+	const char *device;
+	const char *mode;
+	const struct bench_preset *preset;
+	int channel;
+	uint16_t addr;
+	uint16_t peer;
+	uint16_t pan;
+	int payload;
+	int rate;       // frames a second, 0 for as fast as it'll go
+	uint32_t count; // 0 for no limit
+	int duration;   // seconds, 0 for no limit
+	int linger;     // mS to wait for stragglers once sending stops
+	bool ack;
+	bool json;
+};
+
+// Sequence numbers seen by a receiver.
+struct seq_stats {
+	uint32_t frames;
+	uint32_t unique;
+	uint32_t dups;
+	uint32_t reordered;
+	uint32_t highest;
+	uint8_t *seen;
+	uint32_t seen_len; // bytes
+	int32_t rssi_sum;
+	uint32_t lqi_sum;
+};
+
+struct tx_stats {
+	uint32_t written;
+	uint32_t ok;
+	uint32_t busy;
+	uint32_t noack;
+	uint32_t failed;
+};
+
+static volatile sig_atomic_t stopping;
+static int fd;
+static uint16_t run_id;
+
+static struct bench_config config = {
+	.device = "/dev/radio0",
+	.channel = 26,
+	.addr = 1,
+	.peer = 2,
+	.pan = 0x22,
+	.payload = sizeof(struct bench_payload),
+	.rate = 0,
+	.count = 1000,
+	.duration = 0,
+	.linger = 1000,
+	.preset = &presets[1],
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void on_signal(int sig)
+{
+	stopping = 1;
+}
+
+//////////////////////////////
+// Radio
+/////////////////////////////
+
+static int radio_setup(void)
+{
+	struct cc2520_set_channel_data chan_data;
+	struct cc2520_set_address_data addr_data;
+	struct cc2520_set_csma_data csma_data;
+	struct cc2520_set_lpl_data lpl_data;
+	struct cc2520_set_rx_format_data format_data;
+
+	fd = open(config.device, O_RDWR);
+	if (fd < 0) {
+		perror(config.device);
+		return -1;
+	}
+
+	chan_data.channel = config.channel;
+	addr_data.short_addr = config.addr;
+	addr_data.extended_addr = config.addr;
+	addr_data.pan_id = config.pan;
+
+	// CSMA and LPL only take while the radio's off.
+	csma_data.min_backoff = DEF_MIN_BACKOFF;
+	csma_data.init_backoff = DEF_INIT_BACKOFF;
+	csma_data.cong_backoff = DEF_CONG_BACKOFF;
+	csma_data.enabled = config.preset->csma;
+
+	lpl_data.window = DEF_LPL_WINDOW;
+	lpl_data.interval = DEF_LPL_INTERVAL;
+	lpl_data.enabled = config.preset->lpl;
+
+	// Records carry the SFD time, which the round
+	// trip is measured to.
+	format_data.format = CC2520_RX_FORMAT_RECORD;
+
+	if (ioctl(fd, CC2520_IO_RADIO_INIT, NULL) < 0 ||
+		ioctl(fd, CC2520_IO_RADIO_OFF, NULL) < 0 ||
+		ioctl(fd, CC2520_IO_RADIO_SET_CHANNEL, &chan_data) < 0 ||
+		ioctl(fd, CC2520_IO_RADIO_SET_ADDRESS, &addr_data) < 0 ||
+		ioctl(fd, CC2520_IO_RADIO_SET_CSMA, &csma_data) < 0 ||
+		ioctl(fd, CC2520_IO_RADIO_SET_LPL, &lpl_data) < 0 ||
+		ioctl(fd, CC2520_IO_RADIO_SET_RX_FORMAT, &format_data) < 0 ||
+		ioctl(fd, CC2520_IO_RADIO_ON, NULL) < 0) {
+		perror("ioctl");
+		close(fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void radio_teardown(void)
+{
+	ioctl(fd, CC2520_IO_RADIO_OFF, NULL);
+	close(fd);
+}
+
+// Returns the frame length, payload filled in by the caller.
+static int frame_build(uint8_t *buf, uint16_t dest, uint8_t dsn, bool ack, int payload)
+{
+	uint16_t fcf = FCF_DATA | (ack ? FCF_ACK_REQ : 0);
+
+	buf[0] = MAC_HDR_LEN - 1 + payload + MAC_FCS_LEN;
+	buf[1] = fcf & 0xFF;
+	buf[2] = fcf >> 8;
+	buf[3] = dsn;
+	buf[4] = config.pan & 0xFF;
+	buf[5] = config.pan >> 8;
+	buf[6] = dest & 0xFF;
+	buf[7] = dest >> 8;
+	buf[8] = config.addr & 0xFF;
+	buf[9] = config.addr >> 8;
+
+	return MAC_HDR_LEN + payload;
+}
+
+static void tx_count(struct tx_stats *tx, int result)
+{
+	tx->written++;
+	if (result >= 0)
+		tx->ok++;
+	else if (errno == CC2520_TX_BUSY)
+		tx->busy++;
+	else if (errno == CC2520_TX_ACK_TIMEOUT)
+		tx->noack++;
+	else
+		tx->failed++;
+}
+
+// Reads the next benchmark frame of the given type for
+// our run. Returns 0 if interrupted.
+static int frame_read(uint8_t type, struct cc2520_rx_record *rec,
+	struct bench_payload *p, uint16_t *src, bool *ack, uint8_t *payload_len)
+{
+	uint8_t buf[sizeof(struct cc2520_rx_record) + 128];
+	uint8_t *frame = buf + sizeof(struct cc2520_rx_record);
+	int result;
+	int len;
+
+	while (!stopping) {
+		result = read(fd, buf, sizeof(buf));
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result < 0) {
+			perror("read");
+			return -1;
+		}
+
+		// Record, header, payload and the RSSI/LQI bytes.
+		len = result - (int)sizeof(struct cc2520_rx_record);
+		if (len < MAC_HDR_LEN + (int)sizeof(struct bench_payload) + MAC_FCS_LEN)
+			continue;
+
+		memcpy(rec, buf, sizeof(struct cc2520_rx_record));
+		memcpy(p, frame + MAC_HDR_LEN, sizeof(struct bench_payload));
+		if (p->magic != BENCH_MAGIC || p->type != type)
+			continue;
+		if (type == BENCH_PONG && p->run != run_id)
+			continue;
+
+		*src = frame[8] | (frame[9] << 8);
+		*ack = (frame[1] & FCF_ACK_REQ) != 0;
+		*payload_len = len - MAC_HDR_LEN - MAC_FCS_LEN;
+		return 1;
+	}
+
+	return 0;
+}
+
+//////////////////////////////
+// Stats
+/////////////////////////////
+
+static void seq_record(struct seq_stats *s, uint32_t seq, const struct cc2520_rx_record *rec)
+{
+	uint32_t byte = seq / 8;
+	uint32_t len;
+
+	s->frames++;
+	s->rssi_sum += rec->rssi;
+	s->lqi_sum += rec->lqi;
+
+	if (byte >= s->seen_len) {
+		len = s->seen_len ? s->seen_len : 1024;
+		while (len <= byte)
+			len *= 2;
+		s->seen = realloc(s->seen, len);
+		if (!s->seen) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		memset(s->seen + s->seen_len, 0, len - s->seen_len);
+		s->seen_len = len;
+	}
+
+	if (s->seen[byte] & (1 << (seq % 8))) {
+		s->dups++;
+		return;
+	}
+	s->seen[byte] |= 1 << (seq % 8);
+
+	if (s->unique && seq < s->highest)
+		s->reordered++;
+	if (!s->unique || seq > s->highest)
+		s->highest = seq;
+	s->unique++;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t *sorted, uint32_t n, int pct)
+{
+	if (!n)
+		return 0;
+	return sorted[((uint64_t)n * pct + 99) / 100 - 1];
+}
+
+static double per_second(uint64_t n, uint64_t ns)
+{
+	return ns ? n * 1e9 / ns : 0;
+}
+
+static void print_common(const struct seq_stats *s, uint32_t expected, uint64_t elapsed)
+{
+	double loss = expected ? 100.0 * (expected - (s->unique < expected ? s->unique : expected)) / expected : 0;
+	double goodput = per_second((uint64_t)s->unique * config.payload * 8, elapsed);
+
+	if (config.json) {
+		printf("\"elapsed_s\": %.3f, \"frames\": %u, \"unique\": %u, \"expected\": %u, "
+			"\"loss_pct\": %.3f, \"reordered\": %u, \"duplicates\": %u, "
+			"\"goodput_bps\": %.0f, \"rssi_mean\": %.1f, \"lqi_mean\": %.1f",
+			elapsed / 1e9, s->frames, s->unique, expected, loss, s->reordered, s->dups,
+			goodput, s->frames ? (double)s->rssi_sum / s->frames : 0,
+			s->frames ? (double)s->lqi_sum / s->frames : 0);
+	}
+	else {
+		printf("elapsed %.3f s\n", elapsed / 1e9);
+		printf("received %u unique %u of %u, loss %.2f%%, reordered %u, duplicates %u\n",
+			s->frames, s->unique, expected, loss, s->reordered, s->dups);
+		printf("goodput %.0f bps, rssi %.1f dBm, lqi %.1f\n", goodput,
+			s->frames ? (double)s->rssi_sum / s->frames : 0,
+			s->frames ? (double)s->lqi_sum / s->frames : 0);
+	}
+}
+
+//////////////////////////////
+// Sender
+/////////////////////////////
+
+struct sender_rx {
+	pthread_t thread;
+	struct seq_stats seq;
+	uint64_t *rtts;
+	uint32_t rtt_count;
+	uint32_t rtt_len;
+};
+
+static void *sender_rx_thread(void *arg)
+{
+	struct sender_rx *rx = arg;
+	struct cc2520_rx_record rec;
+	struct bench_payload p;
+	uint8_t payload_len;
+	uint16_t src;
+	bool ack;
+
+	while (frame_read(BENCH_PONG, &rec, &p, &src, &ack, &payload_len) > 0) {
+		seq_record(&rx->seq, p.seq, &rec);
+
+		if (rx->rtt_count == rx->rtt_len) {
+			rx->rtt_len = rx->rtt_len ? rx->rtt_len * 2 : 1024;
+			rx->rtts = realloc(rx->rtts, rx->rtt_len * sizeof(uint64_t));
+			if (!rx->rtts) {
+				fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+		}
+
+		// The reply's SFD, when it started arriving.
+		rx->rtts[rx->rtt_count++] = rec.timestamp - p.sent;
+	}
+
+	return NULL;
+}
+
+static int run_sender(void)
+{
+	struct sender_rx rx;
+	struct tx_stats tx;
+	struct bench_payload *p;
+	struct timespec next;
+	uint8_t buf[128];
+	uint64_t start, end, period, deadline, sum;
+	uint32_t seq;
+	uint32_t sent;
+	uint32_t i;
+	int len;
+	int result;
+
+	memset(&rx, 0, sizeof(rx));
+	memset(&tx, 0, sizeof(tx));
+	memset(buf, 0xA5, sizeof(buf));
+
+	if (pthread_create(&rx.thread, NULL, sender_rx_thread, &rx)) {
+		fprintf(stderr, "couldn't start the receive thread\n");
+		return 1;
+	}
+
+	len = frame_build(buf, config.peer, 0, config.ack, config.payload);
+	p = (struct bench_payload *)(buf + MAC_HDR_LEN);
+	p->magic = BENCH_MAGIC;
+	p->type = BENCH_PING;
+	p->run = run_id;
+
+	period = config.rate ? 1000000000ULL / config.rate : 0;
+	start = now_ns();
+	deadline = config.duration ? start + config.duration * 1000000000ULL : 0;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for (seq = 0; !stopping && (!config.count || seq < config.count); seq++) {
+		if (deadline && now_ns() >= deadline)
+			break;
+
+		// Paced against the schedule rather than the
+		// last send, so a slow write doesn't drag the
+		// rate down.
+		if (period) {
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+			next.tv_nsec += period;
+			while (next.tv_nsec >= 1000000000L) {
+				next.tv_nsec -= 1000000000L;
+				next.tv_sec++;
+			}
+		}
+
+		buf[3] = seq;
+		p->seq = seq;
+		p->sent = now_ns();
+		result = write(fd, buf, len);
+		tx_count(&tx, result);
+	}
+	end = now_ns();
+
+	usleep(config.linger * 1000);
+	stopping = 1;
+	pthread_cancel(rx.thread);
+	pthread_join(rx.thread, NULL);
+
+	// Frames that went out, acked or not.
+	sent = tx.ok + tx.noack;
+	qsort(rx.rtts, rx.rtt_count, sizeof(uint64_t), cmp_u64);
+	for (sum = 0, i = 0; i < rx.rtt_count; i++)
+		sum += rx.rtts[i];
+
+	if (config.json) {
+		printf("{\"mode\": \"send\", \"preset\": \"%s\", \"channel\": %d, \"payload\": %d, "
+			"\"rate\": %d, \"ack\": %s, \"written\": %u, \"ok\": %u, \"busy\": %u, "
+			"\"noack\": %u, \"failed\": %u, \"pps\": %.1f, ",
+			config.preset->name, config.channel, config.payload, config.rate,
+			config.ack ? "true" : "false", tx.written, tx.ok, tx.busy, tx.noack, tx.failed,
+			per_second(sent, end - start));
+		print_common(&rx.seq, sent, end - start);
+		printf(", \"rtt_us\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+			"\"max\": %.1f, \"mean\": %.1f}}\n",
+			rx.rtt_count ? rx.rtts[0] / 1e3 : 0, percentile(rx.rtts, rx.rtt_count, 50) / 1e3,
+			percentile(rx.rtts, rx.rtt_count, 90) / 1e3, percentile(rx.rtts, rx.rtt_count, 99) / 1e3,
+			rx.rtt_count ? rx.rtts[rx.rtt_count - 1] / 1e3 : 0,
+			rx.rtt_count ? sum / 1e3 / rx.rtt_count : 0);
+	}
+	else {
+		printf("written %u: ok %u, busy %u, no ack %u, failed %u\n",
+			tx.written, tx.ok, tx.busy, tx.noack, tx.failed);
+		printf("sent %.1f pps\n", per_second(sent, end - start));
+		print_common(&rx.seq, sent, end - start);
+		if (rx.rtt_count) {
+			printf("rtt us: min %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f, mean %.1f\n",
+				rx.rtts[0] / 1e3, percentile(rx.rtts, rx.rtt_count, 50) / 1e3,
+				percentile(rx.rtts, rx.rtt_count, 90) / 1e3,
+				percentile(rx.rtts, rx.rtt_count, 99) / 1e3,
+				rx.rtts[rx.rtt_count - 1] / 1e3, sum / 1e3 / rx.rtt_count);
+		}
+	}
+
+	free(rx.rtts);
+	free(rx.seq.seen);
+	return 0;
+}
+
+//////////////////////////////
+// Reflector
+/////////////////////////////
+
+static int run_reflector(bool reply)
+{
+	struct cc2520_rx_record rec;
+	struct bench_payload p;
+	struct seq_stats seq;
+	struct tx_stats tx;
+	uint8_t buf[128];
+	uint64_t start = 0;
+	uint64_t last = 0;
+	uint8_t payload_len;
+	uint16_t src;
+	uint16_t run = 0;
+	bool ack;
+	int len;
+	int result;
+
+	memset(&seq, 0, sizeof(seq));
+	memset(&tx, 0, sizeof(tx));
+
+	if (config.duration)
+		alarm(config.duration);
+
+	while (!config.count || seq.frames < config.count) {
+		result = frame_read(BENCH_PING, &rec, &p, &src, &ack, &payload_len);
+		if (result <= 0)
+			break;
+
+		// A new sender run starts the count over.
+		if (!seq.frames || p.run != run) {
+			free(seq.seen);
+			memset(&seq, 0, sizeof(seq));
+			memset(&tx, 0, sizeof(tx));
+			run = p.run;
+			start = rec.timestamp;
+		}
+		seq_record(&seq, p.seq, &rec);
+		last = rec.timestamp;
+		config.payload = payload_len;
+
+		if (!reply)
+			continue;
+
+		// Same size and ACK request straight back, with
+		// the sender's timestamp untouched.
+		memset(buf, 0xA5, sizeof(buf));
+		len = frame_build(buf, src, p.seq, ack, payload_len);
+		p.type = BENCH_PONG;
+		memcpy(buf + MAC_HDR_LEN, &p, sizeof(p));
+		tx_count(&tx, write(fd, buf, len));
+	}
+
+	if (config.json) {
+		printf("{\"mode\": \"%s\", \"preset\": \"%s\", \"channel\": %d, \"payload\": %d, "
+			"\"written\": %u, \"ok\": %u, \"busy\": %u, \"noack\": %u, \"failed\": %u, ",
+			reply ? "reflect" : "sink", config.preset->name, config.channel, config.payload,
+			tx.written, tx.ok, tx.busy, tx.noack, tx.failed);
+		print_common(&seq, seq.unique ? seq.highest + 1 : 0, last - start);
+		printf("}\n");
+	}
+	else {
+		if (reply)
+			printf("reflected %u: ok %u, busy %u, no ack %u, failed %u\n",
+				tx.written, tx.ok, tx.busy, tx.noack, tx.failed);
+		print_common(&seq, seq.unique ? seq.highest + 1 : 0, last - start);
+	}
+
+	free(seq.seen);
+	return 0;
+}
+
+//////////////////////////////
+// Main
+/////////////////////////////
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [options] send|reflect|sink\n"
+		"  -d dev      radio device (/dev/radio0)\n"
+		"  -c channel  channel, 11-26 (26)\n"
+		"  -a addr     our short address (1)\n"
+		"  -t addr     peer's short address, send only (2)\n"
+		"  -p pan      PAN ID (0x22)\n"
+		"  -s bytes    payload size, %d-%d (%d)\n"
+		"  -r rate     frames a second, 0 to saturate (0)\n"
+		"  -n count    frames to send or receive, 0 for no limit (1000)\n"
+		"  -T seconds  stop after this long, 0 for no limit (0)\n"
+		"  -L ms       wait for replies after sending (1000)\n"
+		"  -A          request ACKs\n"
+		"  -P preset   raw (no CSMA or LPL), csma or lpl (csma)\n"
+		"  -j          print the results as JSON\n",
+		name, (int)sizeof(struct bench_payload), MAX_PAYLOAD, (int)sizeof(struct bench_payload));
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct sigaction sa;
+	int result;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "d:c:a:t:p:s:r:n:T:L:AP:j")) != -1) {
+		switch (opt) {
+			case 'd':
+				config.device = optarg;
+				break;
+			case 'c':
+				config.channel = atoi(optarg);
+				break;
+			case 'a':
+				config.addr = strtoul(optarg, NULL, 0);
+				break;
+			case 't':
+				config.peer = strtoul(optarg, NULL, 0);
+				break;
+			case 'p':
+				config.pan = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				config.payload = atoi(optarg);
+				break;
+			case 'r':
+				config.rate = atoi(optarg);
+				break;
+			case 'n':
+				config.count = strtoul(optarg, NULL, 0);
+				break;
+			case 'T':
+				config.duration = atoi(optarg);
+				break;
+			case 'L':
+				config.linger = atoi(optarg);
+				break;
+			case 'A':
+				config.ack = true;
+				break;
+			case 'P':
+				config.preset = NULL;
+				for (i = 0; i < (int)(sizeof(presets) / sizeof(presets[0])); i++) {
+					if (!strcmp(optarg, presets[i].name))
+						config.preset = &presets[i];
+				}
+				if (!config.preset)
+					usage(argv[0]);
+				break;
+			case 'j':
+				config.json = true;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
+	config.mode = argv[optind];
+
+	if (config.payload < (int)sizeof(struct bench_payload) || config.payload > MAX_PAYLOAD ||
+		config.channel < 11 || config.channel > 26 || config.rate < 0)
+		usage(argv[0]);
+
+	// No SA_RESTART, so ^C and the alarm get a
+	// blocked read() out.
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGALRM, &sa, NULL);
+
+	srand(now_ns() ^ getpid());
+	run_id = rand();
+
+	if (radio_setup())
+		return 1;
+
+	if (!strcmp(config.mode, "send"))
+		result = run_sender();
+	else if (!strcmp(config.mode, "reflect"))
+		result = run_reflector(true);
+	else if (!strcmp(config.mode, "sink"))
+		result = run_reflector(false);
+	else
+		result = -1;
+
+	radio_teardown();
+
+	if (result < 0)
+		usage(argv[0]);
+
+	return result;
+}
@@ -0,0 +1,50 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include "ioctl.h"
+#include <unistd.h>
+
+// Captures everything on a channel as pcap to stdout:
+//   sniff 26 > trace.pcap
+//   sniff 26 | wireshark -k -i -
+int main(int argc, char **argv)
+{
+	int result = 0;
+	int file_desc;
+	static char buf[65536];
+
+	file_desc = open("/dev/radio0", O_RDWR);
+	if (file_desc < 0) {
+		perror("open");
+		return 1;
+	}
+
+	fprintf(stderr, "Setting channel\n");
+	struct cc2520_set_channel_data chan_data;
+	chan_data.channel = argc > 1 ? atoi(argv[1]) : 26;
+	ioctl(file_desc, CC2520_IO_RADIO_SET_CHANNEL, &chan_data);
+
+	fprintf(stderr, "Turning on the radio...\n");
+	ioctl(file_desc, CC2520_IO_RADIO_INIT, NULL);
+	ioctl(file_desc, CC2520_IO_RADIO_ON, NULL);
+
+	struct cc2520_set_sniffer_data sniff_data;
+	sniff_data.enabled = true;
+	ioctl(file_desc, CC2520_IO_RADIO_SET_SNIFFER, &sniff_data);
+
+	fprintf(stderr, "Sniffing on channel %d\n", chan_data.channel);
+
+	while ((result = read(file_desc, buf, sizeof(buf))) > 0) {
+		if (fwrite(buf, 1, result, stdout) != result)
+			break;
+		fflush(stdout);
+	}
+
+	sniff_data.enabled = false;
+	ioctl(file_desc, CC2520_IO_RADIO_SET_SNIFFER, &sniff_data);
+	ioctl(file_desc, CC2520_IO_RADIO_OFF, NULL);
+
+	close(file_desc);
+	return 0;
+}
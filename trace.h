@@ -0,0 +1,175 @@
+// Tracepoints for following the stack through a send or
+// receive with ftrace or perf, without the timing hit of
+// the debug printing. They cost next to nothing while
+// they're off. For example:
+//
+//   echo 1 > /sys/kernel/debug/tracing/events/cc2520/enable
+//   cat /sys/kernel/debug/tracing/trace_pipe
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cc2520
+
+#if !defined(_CC2520_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _CC2520_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Layer state changes. States are the values of each
+// layer's own state enum.
+DECLARE_EVENT_CLASS(cc2520_state,
+	TP_PROTO(int id, int state),
+	TP_ARGS(id, state),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(int, state)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->state = state;
+	),
+	TP_printk("radio%d state=%d", __entry->id, __entry->state)
+);
+
+DEFINE_EVENT(cc2520_state, cc2520_radio_state,
+	TP_PROTO(int id, int state),
+	TP_ARGS(id, state)
+);
+
+DEFINE_EVENT(cc2520_state, cc2520_sack_state,
+	TP_PROTO(int id, int state),
+	TP_ARGS(id, state)
+);
+
+DEFINE_EVENT(cc2520_state, cc2520_csma_state,
+	TP_PROTO(int id, int state),
+	TP_ARGS(id, state)
+);
+
+DEFINE_EVENT(cc2520_state, cc2520_lpl_state,
+	TP_PROTO(int id, int state),
+	TP_ARGS(id, state)
+);
+
+DEFINE_EVENT(cc2520_state, cc2520_tsch_state,
+	TP_PROTO(int id, int state),
+	TP_ARGS(id, state)
+);
+
+// Async SPI messages, matched up by msg. Submit
+// names the completion that's going to run.
+TRACE_EVENT(cc2520_spi_submit,
+	TP_PROTO(int id, const void *msg, const void *complete),
+	TP_ARGS(id, msg, complete),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(const void *, msg)
+		__field(const void *, complete)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->msg = msg;
+		__entry->complete = complete;
+	),
+	TP_printk("radio%d msg=%p complete=%ps", __entry->id, __entry->msg, __entry->complete)
+);
+
+TRACE_EVENT(cc2520_spi_complete,
+	TP_PROTO(int id, const void *msg),
+	TP_ARGS(id, msg),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(const void *, msg)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->msg = msg;
+	),
+	TP_printk("radio%d msg=%p", __entry->id, __entry->msg)
+);
+
+TRACE_EVENT(cc2520_fifop_irq,
+	TP_PROTO(int id),
+	TP_ARGS(id),
+	TP_STRUCT__entry(
+		__field(int, id)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+	),
+	TP_printk("radio%d", __entry->id)
+);
+
+TRACE_EVENT(cc2520_sfd_irq,
+	TP_PROTO(int id, u64 timestamp, int high),
+	TP_ARGS(id, timestamp, high),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(u64, timestamp)
+		__field(int, high)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->timestamp = timestamp;
+		__entry->high = high;
+	),
+	TP_printk("radio%d timestamp=%llu %s", __entry->id,
+		(unsigned long long)__entry->timestamp, __entry->high ? "rise" : "fall")
+);
+
+// Every frame the duplicate filter looks at.
+TRACE_EVENT(cc2520_unique,
+	TP_PROTO(int id, u64 src, u8 dsn, bool drop),
+	TP_ARGS(id, src, dsn, drop),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(u64, src)
+		__field(u8, dsn)
+		__field(bool, drop)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->src = src;
+		__entry->dsn = dsn;
+		__entry->drop = drop;
+	),
+	TP_printk("radio%d src=0x%llx dsn=%u%s", __entry->id,
+		(unsigned long long)__entry->src, __entry->dsn, __entry->drop ? " dropped" : "")
+);
+
+// Character device reads and writes, with
+// what they returned.
+DECLARE_EVENT_CLASS(cc2520_io,
+	TP_PROTO(int id, size_t len, ssize_t result),
+	TP_ARGS(id, len, result),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(size_t, len)
+		__field(ssize_t, result)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->len = len;
+		__entry->result = result;
+	),
+	TP_printk("radio%d len=%zu result=%zd", __entry->id, __entry->len, __entry->result)
+);
+
+DEFINE_EVENT(cc2520_io, cc2520_read,
+	TP_PROTO(int id, size_t len, ssize_t result),
+	TP_ARGS(id, len, result)
+);
+
+DEFINE_EVENT(cc2520_io, cc2520_write,
+	TP_PROTO(int id, size_t len, ssize_t result),
+	TP_ARGS(id, len, result)
+);
+
+#endif
+
+// The header isn't in the kernel's include path.
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+
+#include <trace/define_trace.h>
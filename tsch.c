@@ -0,0 +1,418 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include "tsch.h"
+#include "cc2520.h"
+#include "radio.h"
+#include "csma.h"
+#include "lpl.h"
+#include "packet.h"
+#include "trace.h"
+#include "debug.h"
+
+// Time slotted channel hopping, loosely after 802.15.4e.
+// Time is cut into fixed length slots counted by the ASN
+// (absolute slot number), and slots are grouped into a
+// repeating slotframe. Userspace hands us a cell table
+// saying which slots of the slotframe we transmit or
+// listen in and at which channel offset, and the channel
+// for a cell hops with the ASN through the hopping
+// sequence. Frames written while TSCH is on are held here
+// until the next TX cell and sent tx_offset into it.
+//
+// Nodes stay in step by timing frames from their time
+// source neighbour: its frames should start tx_offset into
+// the slot, and however far off they are gets taken out
+// of the length of the next slot. The soft-ack layer
+// doesn't put time correction IEs in ACKs, so only frames
+// the time source sends us count, not our ACKs from it.
+// Agreeing on the ASN in the first place (enhanced
+// beacons) is left to userspace.
+
+enum cc2520_tsch_tx_state_enum {
+	CC2520_TSCH_TX_IDLE,
+	CC2520_TSCH_TX_PENDING,
+	CC2520_TSCH_TX_ACTIVE
+};
+
+struct cc2520_tsch_state {
+	struct cc2520_dev *dev;
+
+	bool enabled;
+	struct cc2520_set_tsch_data config;
+	int tx_cells;
+
+	// What CSMA and LPL were set to before the schedule
+	// took over, put back when it stops.
+	bool csma_was_enabled;
+	bool lpl_was_enabled;
+
+	struct hrtimer slot_timer;
+	struct workqueue_struct *wq;
+	struct work_struct slot_work;
+
+	// Updated from the slot timer, read by the slot
+	// work and the RX path.
+	spinlock_t state_sl;
+	u64 asn;
+	u64 slot_start; // raw monotonic nS, same clock as SFD timestamps
+	s64 correction;
+
+	u8 *tx_buf;
+	u8 tx_len;
+	int tx_state;
+
+	struct cc2520_tsch_stats stats;
+};
+
+static int cc2520_tsch_tx(struct cc2520_dev *dev, u8 * buf, u8 len);
+static void cc2520_tsch_tx_done(struct cc2520_dev *dev, u8 status);
+static void cc2520_tsch_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len);
+static enum hrtimer_restart cc2520_tsch_timer_cb(struct hrtimer *timer);
+static void cc2520_tsch_slot_wq(struct work_struct *work);
+static void cc2520_tsch_stop(struct cc2520_tsch_state *tsch);
+
+int cc2520_tsch_init(struct cc2520_dev *dev)
+{
+	struct cc2520_tsch_state *tsch;
+
+	tsch = kzalloc(sizeof(struct cc2520_tsch_state), GFP_KERNEL);
+	if (!tsch)
+		return -ENOMEM;
+
+	tsch->dev = dev;
+	dev->tsch = tsch;
+
+	dev->tsch_top->tx = cc2520_tsch_tx;
+	dev->tsch_bottom->tx_done = cc2520_tsch_tx_done;
+	dev->tsch_bottom->rx_done = cc2520_tsch_rx_done;
+
+	spin_lock_init(&tsch->state_sl);
+	tsch->tx_state = CC2520_TSCH_TX_IDLE;
+
+	tsch->tx_buf = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
+	if (!tsch->tx_buf) {
+		goto error;
+	}
+
+	tsch->wq = alloc_workqueue("tsch_wq", WQ_HIGHPRI, 1);
+	if (!tsch->wq) {
+		goto error;
+	}
+	INIT_WORK(&tsch->slot_work, cc2520_tsch_slot_wq);
+
+	hrtimer_init(&tsch->slot_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	tsch->slot_timer.function = &cc2520_tsch_timer_cb;
+
+	return 0;
+
+	error:
+		if (tsch->tx_buf) {
+			kfree(tsch->tx_buf);
+			tsch->tx_buf = NULL;
+		}
+
+		kfree(tsch);
+		dev->tsch = NULL;
+
+		return -EFAULT;
+}
+
+void cc2520_tsch_free(struct cc2520_dev *dev)
+{
+	struct cc2520_tsch_state *tsch = dev->tsch;
+
+	// Nothing can be waiting to send by now, the
+	// interface above has already gone.
+	tsch->enabled = false;
+	hrtimer_cancel(&tsch->slot_timer);
+
+	if (tsch->wq) {
+		destroy_workqueue(tsch->wq);
+	}
+
+	if (tsch->tx_buf) {
+		kfree(tsch->tx_buf);
+		tsch->tx_buf = NULL;
+	}
+
+	kfree(tsch);
+	dev->tsch = NULL;
+}
+
+static struct cc2520_tsch_cell *cc2520_tsch_find_cell(struct cc2520_tsch_state *tsch, u64 asn)
+{
+	u16 offset;
+	int i;
+
+	offset = do_div(asn, tsch->config.slotframe_length);
+
+	for (i = 0; i < tsch->config.num_cells; i++) {
+		if (tsch->config.cells[i].slot_offset == offset)
+			return &tsch->config.cells[i];
+	}
+
+	return NULL;
+}
+
+static u8 cc2520_tsch_cell_channel(struct cc2520_tsch_state *tsch, struct cc2520_tsch_cell *cell, u64 asn)
+{
+	u64 index = asn + cell->channel_offset;
+
+	return tsch->config.hopping[do_div(index, tsch->config.hopping_length)];
+}
+
+// Runs at the start of every slot. The slot length is
+// the nominal one plus whatever correction the last frame
+// from our time source asked for, which is used only once.
+static enum hrtimer_restart cc2520_tsch_timer_cb(struct hrtimer *timer)
+{
+	struct cc2520_tsch_state *tsch =
+		container_of(timer, struct cc2520_tsch_state, slot_timer);
+	unsigned long flags;
+	s64 late;
+	s64 period;
+
+	late = ktime_to_ns(ktime_sub(ktime_get(), hrtimer_get_expires(timer)));
+
+	spin_lock_irqsave(&tsch->state_sl, flags);
+	tsch->asn++;
+	tsch->stats.asn = tsch->asn;
+	tsch->slot_start = ktime_get_raw_ns() - late;
+	period = (s64)tsch->config.slot_length * NSEC_PER_USEC + tsch->correction;
+	tsch->correction = 0;
+	spin_unlock_irqrestore(&tsch->state_sl, flags);
+
+	// Same as CSMA, we can't send from here.
+	queue_work(tsch->wq, &tsch->slot_work);
+
+	hrtimer_set_expires(timer, ktime_add_ns(hrtimer_get_expires(timer), period));
+	return HRTIMER_RESTART;
+}
+
+static void cc2520_tsch_slot_wq(struct work_struct *work)
+{
+	struct cc2520_tsch_state *tsch =
+		container_of(work, struct cc2520_tsch_state, slot_work);
+	struct cc2520_dev *dev = tsch->dev;
+	struct cc2520_tsch_cell *cell;
+	unsigned long flags;
+	u64 asn;
+	u64 slot_start;
+	s64 wait;
+	u8 channel;
+
+	spin_lock_irqsave(&tsch->state_sl, flags);
+	asn = tsch->asn;
+	slot_start = tsch->slot_start;
+	spin_unlock_irqrestore(&tsch->state_sl, flags);
+
+	cell = cc2520_tsch_find_cell(tsch, asn);
+	if (!cell)
+		return;
+
+	channel = cc2520_tsch_cell_channel(tsch, cell, asn);
+	if (channel != cc2520_radio_get_channel(dev))
+		cc2520_radio_switch_channel(dev, channel);
+
+	if (!(cell->flags & CC2520_TSCH_CELL_TX))
+		return;
+
+	spin_lock_irqsave(&tsch->state_sl, flags);
+	if (tsch->tx_state != CC2520_TSCH_TX_PENDING) {
+		spin_unlock_irqrestore(&tsch->state_sl, flags);
+		return;
+	}
+	tsch->tx_state = CC2520_TSCH_TX_ACTIVE;
+	trace_cc2520_tsch_state(dev->id, tsch->tx_state);
+	spin_unlock_irqrestore(&tsch->state_sl, flags);
+
+	// Line the start of the frame up with tx_offset so
+	// the receiver can time us.
+	wait = (s64)(slot_start + tsch->config.tx_offset * NSEC_PER_USEC) - (s64)ktime_get_raw_ns();
+	if (wait > 0)
+		usleep_range(div_u64(wait, NSEC_PER_USEC), div_u64(wait, NSEC_PER_USEC) + 20);
+
+	tsch->stats.tx++;
+	dev->tsch_bottom->tx(dev, tsch->tx_buf, tsch->tx_len);
+}
+
+static int cc2520_tsch_tx(struct cc2520_dev *dev, u8 * buf, u8 len)
+{
+	struct cc2520_tsch_state *tsch = dev->tsch;
+	unsigned long flags;
+
+	if (!tsch->enabled) {
+		return dev->tsch_bottom->tx(dev, buf, len);
+	}
+
+	spin_lock_irqsave(&tsch->state_sl, flags);
+	if (tsch->tx_state != CC2520_TSCH_TX_IDLE || tsch->tx_cells == 0) {
+		spin_unlock_irqrestore(&tsch->state_sl, flags);
+		DBG((KERN_INFO "[cc2520] - tsch layer busy.\n"));
+		dev->tsch_top->tx_done(dev, -CC2520_TX_BUSY);
+		return 0;
+	}
+
+	memcpy(tsch->tx_buf, buf, len);
+	tsch->tx_len = len;
+	tsch->tx_state = CC2520_TSCH_TX_PENDING;
+	trace_cc2520_tsch_state(dev->id, tsch->tx_state);
+	spin_unlock_irqrestore(&tsch->state_sl, flags);
+
+	return 0;
+}
+
+static void cc2520_tsch_tx_done(struct cc2520_dev *dev, u8 status)
+{
+	struct cc2520_tsch_state *tsch = dev->tsch;
+	unsigned long flags;
+
+	spin_lock_irqsave(&tsch->state_sl, flags);
+	tsch->tx_state = CC2520_TSCH_TX_IDLE;
+	trace_cc2520_tsch_state(dev->id, tsch->tx_state);
+	spin_unlock_irqrestore(&tsch->state_sl, flags);
+
+	dev->tsch_top->tx_done(dev, status);
+}
+
+static void cc2520_tsch_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len)
+{
+	struct cc2520_tsch_state *tsch = dev->tsch;
+	const struct cc2520_rx_record *meta;
+	s64 offset;
+	s64 limit;
+
+	if (tsch->enabled && tsch->config.time_source &&
+		!cc2520_packet_is_ack(buf) &&
+		cc2520_packet_get_src(buf) == tsch->config.time_source) {
+
+		meta = cc2520_radio_rx_meta(dev);
+
+		spin_lock(&tsch->state_sl);
+		offset = (s64)meta->timestamp -
+			(s64)(tsch->slot_start + tsch->config.tx_offset * NSEC_PER_USEC);
+		limit = (s64)tsch->config.slot_length * NSEC_PER_USEC / 2;
+
+		// Positive means the time source is behind us,
+		// so stretch our next slot to match.
+		if (offset > -limit && offset < limit) {
+			tsch->correction = offset;
+			tsch->stats.syncs++;
+			tsch->stats.last_correction = offset;
+		}
+		spin_unlock(&tsch->state_sl);
+	}
+
+	dev->tsch_top->rx_done(dev, buf, len);
+}
+
+static void cc2520_tsch_stop(struct cc2520_tsch_state *tsch)
+{
+	struct cc2520_dev *dev = tsch->dev;
+	unsigned long flags;
+	bool pending;
+	bool was_enabled;
+
+	was_enabled = tsch->enabled;
+	tsch->enabled = false;
+	hrtimer_cancel(&tsch->slot_timer);
+	if (tsch->wq)
+		flush_workqueue(tsch->wq);
+
+	if (was_enabled) {
+		cc2520_csma_set_enabled(dev, tsch->csma_was_enabled);
+		cc2520_lpl_set_enabled(dev, tsch->lpl_was_enabled);
+	}
+
+	// A frame still waiting for its cell is failed back
+	// up, one already sent finishes normally.
+	spin_lock_irqsave(&tsch->state_sl, flags);
+	pending = tsch->tx_state == CC2520_TSCH_TX_PENDING;
+	if (pending) {
+		tsch->tx_state = CC2520_TSCH_TX_IDLE;
+		trace_cc2520_tsch_state(dev->id, tsch->tx_state);
+	}
+	spin_unlock_irqrestore(&tsch->state_sl, flags);
+
+	if (pending)
+		dev->tsch_top->tx_done(dev, -CC2520_TX_BUSY);
+}
+
+int cc2520_tsch_set_config(struct cc2520_dev *dev, struct cc2520_set_tsch_data *config)
+{
+	struct cc2520_tsch_state *tsch = dev->tsch;
+	ktime_t start;
+	int i;
+
+	if (config->enabled) {
+		if (!config->slot_length)
+			config->slot_length = CC2520_DEF_TSCH_SLOT_LENGTH;
+		if (!config->tx_offset)
+			config->tx_offset = CC2520_DEF_TSCH_TX_OFFSET;
+
+		if (config->tx_offset >= config->slot_length ||
+			config->slotframe_length == 0 ||
+			config->hopping_length == 0 || config->hopping_length > CC2520_TSCH_MAX_HOPPING ||
+			config->num_cells > CC2520_TSCH_MAX_CELLS)
+			return -EINVAL;
+
+		for (i = 0; i < config->hopping_length; i++) {
+			if (config->hopping[i] < 11 || config->hopping[i] > 26)
+				return -EINVAL;
+		}
+
+		for (i = 0; i < config->num_cells; i++) {
+			if (config->cells[i].slot_offset >= config->slotframe_length)
+				return -EINVAL;
+		}
+	}
+
+	cc2520_tsch_stop(tsch);
+
+	if (!config->enabled)
+		return 0;
+
+	tsch->config = *config;
+
+	tsch->tx_cells = 0;
+	for (i = 0; i < tsch->config.num_cells; i++) {
+		if (tsch->config.cells[i].flags & CC2520_TSCH_CELL_TX)
+			tsch->tx_cells++;
+	}
+
+	// The schedule does the job of both of these, and
+	// LPL resending a frame across slots would wreck it.
+	tsch->csma_was_enabled = cc2520_csma_get_enabled(dev);
+	tsch->lpl_was_enabled = cc2520_lpl_get_enabled(dev);
+	cc2520_csma_set_enabled(dev, false);
+	cc2520_lpl_set_enabled(dev, false);
+
+	memset(&tsch->stats, 0, sizeof(struct cc2520_tsch_stats));
+	tsch->asn = config->asn;
+	tsch->correction = 0;
+	tsch->enabled = true;
+
+	start = ktime_add_us(ktime_get(), tsch->config.slot_length);
+	hrtimer_start(&tsch->slot_timer, start, HRTIMER_MODE_ABS);
+
+	INFO((KERN_INFO "[cc2520] - tsch on: %d slots of %d uS, %d cells\n",
+		tsch->config.slotframe_length, tsch->config.slot_length, tsch->config.num_cells));
+	return 0;
+}
+
+void cc2520_tsch_get_stats(struct cc2520_dev *dev, struct cc2520_tsch_stats *stats)
+{
+	struct cc2520_tsch_state *tsch = dev->tsch;
+	unsigned long flags;
+
+	spin_lock_irqsave(&tsch->state_sl, flags);
+	*stats = tsch->stats;
+	spin_unlock_irqrestore(&tsch->state_sl, flags);
+}
@@ -0,0 +1,12 @@
+#ifndef TSCH_H
+#define TSCH_H
+
+#include "cc2520.h"
+
+int cc2520_tsch_init(struct cc2520_dev *dev);
+void cc2520_tsch_free(struct cc2520_dev *dev);
+
+int cc2520_tsch_set_config(struct cc2520_dev *dev, struct cc2520_set_tsch_data *config);
+void cc2520_tsch_get_stats(struct cc2520_dev *dev, struct cc2520_tsch_stats *stats);
+
+#endif
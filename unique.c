@@ -7,6 +7,8 @@
 #include "unique.h"
 #include "packet.h"
 #include "cc2520.h"
+#include "stats.h"
+#include "trace.h"
 #include "debug.h"
 
 struct node_list{
@@ -15,49 +17,61 @@ struct node_list{
 	u8 dsn;
 };
 
-struct list_head nodes;
-
-struct cc2520_interface *unique_top;
-struct cc2520_interface *unique_bottom;
+struct cc2520_unique_state {
+	struct list_head nodes;
+};
 
-static int cc2520_unique_tx(u8 * buf, u8 len);
-static void cc2520_unique_tx_done(u8 status);
-static void cc2520_unique_rx_done(u8 *buf, u8 len);
+static int cc2520_unique_tx(struct cc2520_dev *dev, u8 * buf, u8 len);
+static void cc2520_unique_tx_done(struct cc2520_dev *dev, u8 status);
+static void cc2520_unique_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len);
 
-int cc2520_unique_init()
+int cc2520_unique_init(struct cc2520_dev *dev)
 {
-	unique_top->tx = cc2520_unique_tx;
-	unique_bottom->tx_done = cc2520_unique_tx_done;
-	unique_bottom->rx_done = cc2520_unique_rx_done;
+	struct cc2520_unique_state *unique;
+
+	unique = kzalloc(sizeof(struct cc2520_unique_state), GFP_KERNEL);
+	if (!unique)
+		return -ENOMEM;
+
+	dev->unique = unique;
 
-	INIT_LIST_HEAD(&nodes);
+	dev->unique_top->tx = cc2520_unique_tx;
+	dev->unique_bottom->tx_done = cc2520_unique_tx_done;
+	dev->unique_bottom->rx_done = cc2520_unique_rx_done;
+
+	INIT_LIST_HEAD(&unique->nodes);
 	return 0;
 }
 
-void cc2520_unique_free()
+void cc2520_unique_free(struct cc2520_dev *dev)
 {
+	struct cc2520_unique_state *unique = dev->unique;
 	struct node_list *tmp;
 	struct list_head *pos, *q;
 
-	list_for_each_safe(pos, q, &nodes){
+	list_for_each_safe(pos, q, &unique->nodes){
 		tmp = list_entry(pos, struct node_list, list);
 		list_del(pos);
 		kfree(tmp);
 	}
+
+	kfree(unique);
+	dev->unique = NULL;
 }
 
-static int cc2520_unique_tx(u8 * buf, u8 len)
+static int cc2520_unique_tx(struct cc2520_dev *dev, u8 * buf, u8 len)
 {
-	return unique_bottom->tx(buf, len);
+	return dev->unique_bottom->tx(dev, buf, len);
 }
 
-static void cc2520_unique_tx_done(u8 status)
+static void cc2520_unique_tx_done(struct cc2520_dev *dev, u8 status)
 {
-	unique_top->tx_done(status);
+	dev->unique_top->tx_done(dev, status);
 }
 
-static void cc2520_unique_rx_done(u8 *buf, u8 len)
+static void cc2520_unique_rx_done(struct cc2520_dev *dev, u8 *buf, u8 len)
 {
+	struct cc2520_unique_state *unique = dev->unique;
 	struct node_list *tmp;
 	u8 dsn;
 	u64 src;
@@ -71,7 +85,7 @@ static void cc2520_unique_rx_done(u8 *buf, u8 len)
 	found = false;
 	drop = false;
 
-	list_for_each_entry(tmp, &nodes, list) {
+	list_for_each_entry(tmp, &unique->nodes, list) {
 		if (tmp->src == src) {
 			found = true;
 			if (tmp->dsn != dsn) {
@@ -89,7 +103,7 @@ static void cc2520_unique_rx_done(u8 *buf, u8 len)
 		if (tmp) {
 			tmp->dsn = dsn;
 			tmp->src = src;
-			list_add(&(tmp->list), &nodes);
+			list_add(&(tmp->list), &unique->nodes);
 			INFO((KERN_INFO "[cc2520] - unique found new mote: %lld\n", src));
 		}
 		else {
@@ -97,6 +111,10 @@ static void cc2520_unique_rx_done(u8 *buf, u8 len)
 		}
 	}
 
-	if (!drop)
-		unique_top->rx_done(buf, len);
+	trace_cc2520_unique(dev->id, src, dsn, drop);
+
+	if (drop)
+		cc2520_stat_inc(dev, CC2520_STAT_UNIQUE_DROP);
+	else
+		dev->unique_top->rx_done(dev, buf, len);
 }
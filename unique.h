@@ -3,10 +3,7 @@
 
 #include "cc2520.h"
 
-extern struct cc2520_interface *unique_top;
-extern struct cc2520_interface *unique_bottom;
-
-int cc2520_unique_init(void);
-void cc2520_unique_free(void);
+int cc2520_unique_init(struct cc2520_dev *dev);
+void cc2520_unique_free(struct cc2520_dev *dev);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,334 @@
+#ifndef CC2520_USER_KERNEL_H
+#define CC2520_USER_KERNEL_H
+
+// Just enough of the kernel for the MAC layers to build
+// and run as an ordinary program. Every linux/ header the
+// layers include lands here.
+//
+// Locks are plain spinlocks with nothing to disable, and
+// work runs inline when it's queued. Timers are never
+// armed for real: the bench's scratch radios keep their
+// own clock and run their timers from it, see env.h.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+typedef int8_t s8;
+typedef uint8_t u8;
+typedef int16_t s16;
+typedef uint16_t u16;
+typedef int32_t s32;
+typedef uint32_t u32;
+typedef long long s64;
+typedef unsigned long long u64;
+
+#define __percpu
+#define __user
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BIT(n) (1UL << (n))
+#define BUILD_BUG_ON(c) ((void)sizeof(char[1 - 2 * !!(c)]))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) min((t)(a), (t)(b))
+#define max_t(t, a, b) max((t)(a), (t)(b))
+#define clamp(v, lo, hi) min(max(v, lo), hi)
+
+#define S8_MIN INT8_MIN
+
+#define MAX_ERRNO 4095
+
+static inline void *ERR_PTR(long error)
+{
+	return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+	return (long)ptr;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+	return (unsigned long)ptr >= (unsigned long)-MAX_ERRNO;
+}
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline int fls64(u64 x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+// Printing
+
+#define KERN_ALERT ""
+#define KERN_INFO ""
+#define printk printf
+
+// Memory
+
+#define GFP_KERNEL 0
+#define GFP_ATOMIC 0
+#define GFP_DMA 0
+
+#define kmalloc(size, flags) malloc(size)
+#define kzalloc(size, flags) calloc(1, size)
+#define kfree(ptr) free(ptr)
+
+// Per CPU, there's only the one.
+
+#define this_cpu_inc(x) ((x)++)
+#define this_cpu_add(x, v) ((x) += (v))
+#define this_cpu_read(x) (x)
+#define this_cpu_write(x, v) ((x) = (v))
+
+// Static keys, as plain flags.
+
+struct static_key_false {
+	bool enabled;
+};
+
+#define DECLARE_STATIC_KEY_FALSE(name) extern struct static_key_false name
+#define DEFINE_STATIC_KEY_FALSE(name) struct static_key_false name = { false }
+#define static_branch_unlikely(key) unlikely((key)->enabled)
+#define static_branch_enable(key) ((key)->enabled = true)
+#define static_branch_disable(key) ((key)->enabled = false)
+
+// Locking
+
+typedef struct {
+	volatile bool locked;
+} spinlock_t;
+
+#define DEFINE_SPINLOCK(name) spinlock_t name = { false }
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+	lock->locked = false;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	while (__atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE))
+		;
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	__atomic_clear(&lock->locked, __ATOMIC_RELEASE);
+}
+
+#define spin_lock_irqsave(lock, flags) do { (flags) = 0; spin_lock(lock); } while (0)
+#define spin_unlock_irqrestore(lock, flags) do { (void)(flags); spin_unlock(lock); } while (0)
+
+// Lists
+
+struct list_head {
+	struct list_head *next;
+	struct list_head *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *entry, struct list_head *prev,
+	struct list_head *next)
+{
+	next->prev = entry;
+	entry->next = next;
+	entry->prev = prev;
+	prev->next = entry;
+}
+
+static inline void list_add(struct list_head *entry, struct list_head *head)
+{
+	__list_add(entry, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *entry, struct list_head *head)
+{
+	__list_add(entry, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define list_for_each_safe(pos, n, head) \
+	for (pos = (head)->next, n = pos->next; pos != (head); pos = n, n = pos->next)
+
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_entry((head)->next, __typeof__(*pos), member); \
+		&pos->member != (head); \
+		pos = list_entry(pos->member.next, __typeof__(*pos), member))
+
+// Time
+
+typedef s64 ktime_t;
+
+static inline ktime_t ktime_set(s64 secs, unsigned long nsecs)
+{
+	return secs * 1000000000LL + nsecs;
+}
+
+static inline u64 ktime_get_raw_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ktime_set(ts.tv_sec, ts.tv_nsec);
+}
+
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+enum hrtimer_mode {
+	HRTIMER_MODE_ABS,
+	HRTIMER_MODE_REL,
+};
+
+struct hrtimer {
+	enum hrtimer_restart (*function)(struct hrtimer *timer);
+	ktime_t expires;
+	bool active;
+};
+
+static inline void hrtimer_init(struct hrtimer *timer, clockid_t clock, enum hrtimer_mode mode)
+{
+	timer->active = false;
+}
+
+static inline void hrtimer_start(struct hrtimer *timer, ktime_t kt, enum hrtimer_mode mode)
+{
+	timer->expires = kt;
+	timer->active = true;
+}
+
+static inline int hrtimer_cancel(struct hrtimer *timer)
+{
+	bool active = timer->active;
+
+	timer->active = false;
+	return active;
+}
+
+static inline u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval)
+{
+	timer->expires = interval;
+	return 1;
+}
+
+// Work runs as soon as it's queued.
+
+#define WQ_HIGHPRI 0
+
+struct work_struct {
+	void (*func)(struct work_struct *work);
+};
+
+struct workqueue_struct {
+	const char *name;
+};
+
+#define INIT_WORK(work, fn) ((work)->func = (fn))
+
+static inline struct workqueue_struct *alloc_workqueue(const char *name, unsigned int flags,
+	int max_active)
+{
+	struct workqueue_struct *wq = calloc(1, sizeof(struct workqueue_struct));
+
+	if (wq)
+		wq->name = name;
+	return wq;
+}
+
+static inline void destroy_workqueue(struct workqueue_struct *wq)
+{
+	free(wq);
+}
+
+static inline bool queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+	work->func(work);
+	return true;
+}
+
+static inline void flush_workqueue(struct workqueue_struct *wq)
+{
+}
+
+// Randomness
+
+static inline void get_random_bytes(void *buf, int len)
+{
+	u8 *p = buf;
+
+	while (len--)
+		*p++ = rand();
+}
+
+static inline u32 prandom_u32(void)
+{
+	return ((u32)rand() << 16) ^ rand();
+}
+
+// Tracepoints compile away.
+
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args) \
+	static inline void trace_##name(proto) { }
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) { }
+
+#endif
@@ -0,0 +1,99 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <unistd.h>
+
+#include "cc2520.h"
+#include "bench.h"
+#include "debug.h"
+
+// Runs the same per-layer benchmark as the module's KUnit
+// tests, on a workstation. Each run prints a line per
+// layer, nS per frame received and sent and frames per
+// second through it, and the best of the runs is what
+// gets printed last.
+//
+//   ./layer_bench [-n frames] [-r runs] [-v]
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n frames] [-r runs] [-v]\n", name);
+	exit(1);
+}
+
+static u64 rate(u64 ns)
+{
+	return ns ? 1000000000ULL / ns : 0;
+}
+
+static void print_results(const char *title, u32 frames, struct cc2520_bench_result *results)
+{
+	int i;
+
+	printf("%s frames %u\n", title, frames);
+	printf("%-8s %8s %8s %10s %10s %s\n", "layer", "rx_ns", "tx_ns", "rx_fps", "tx_fps", "result");
+	for (i = 0; i < CC2520_BENCH_ROWS; i++) {
+		printf("%-8s %8llu %8llu %10llu %10llu %s\n", results[i].name,
+			(unsigned long long)results[i].rx_ns, (unsigned long long)results[i].tx_ns,
+			(unsigned long long)rate(results[i].rx_ns), (unsigned long long)rate(results[i].tx_ns),
+			results[i].ok ? "ok" : "FAIL");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct cc2520_bench_result results[CC2520_BENCH_ROWS];
+	struct cc2520_bench_result best[CC2520_BENCH_ROWS];
+	u32 frames = 1000000;
+	int runs = 3;
+	bool ok = true;
+	char title[16];
+	int opt;
+	int run;
+	int i;
+
+	while ((opt = getopt(argc, argv, "n:r:v")) != -1) {
+		switch (opt) {
+			case 'n':
+				frames = strtoul(optarg, NULL, 0);
+				break;
+			case 'r':
+				runs = atoi(optarg);
+				break;
+			case 'v':
+				cc2520_set_debug_level(DEBUG_PRINT_DBG);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (!frames || runs < 1)
+		usage(argv[0]);
+
+	for (run = 0; run < runs; run++) {
+		if (cc2520_bench_run(frames, results)) {
+			fprintf(stderr, "bench failed to set up\n");
+			return 1;
+		}
+
+		snprintf(title, sizeof(title), "run %d", run + 1);
+		print_results(title, frames, results);
+
+		for (i = 0; i < CC2520_BENCH_ROWS; i++) {
+			if (!run) {
+				best[i] = results[i];
+				continue;
+			}
+			best[i].rx_ns = min(best[i].rx_ns, results[i].rx_ns);
+			best[i].tx_ns = min(best[i].tx_ns, results[i].tx_ns);
+			best[i].ok = best[i].ok && results[i].ok;
+		}
+	}
+
+	print_results("best", frames, best);
+
+	for (i = 0; i < CC2520_BENCH_ROWS; i++)
+		ok = ok && best[i].ok;
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+
+#include "cc2520.h"
+#include "radio.h"
+#include "stats.h"
+#include "debug.h"
+
+// What the layers use of the rest of the module. There's
+// no chip, so the radio is only the bits of its state the
+// layers look at.
+
+uint8_t debug_print;
+
+DEFINE_STATIC_KEY_FALSE(cc2520_debug_err);
+DEFINE_STATIC_KEY_FALSE(cc2520_debug_info);
+DEFINE_STATIC_KEY_FALSE(cc2520_debug_dbg);
+
+void cc2520_set_debug_level(uint8_t level)
+{
+	debug_print = level;
+	cc2520_debug_err.enabled = level >= DEBUG_PRINT_ERR;
+	cc2520_debug_info.enabled = level >= DEBUG_PRINT_INFO;
+	cc2520_debug_dbg.enabled = level >= DEBUG_PRINT_DBG;
+}
+
+//////////////////////////////
+// Radio
+/////////////////////////////
+
+struct cc2520_radio_state {
+	struct cc2520_rx_record rx_meta;
+	spinlock_t rx_buf_sl;
+	bool promiscuous;
+};
+
+int cc2520_radio_init(struct cc2520_dev *dev)
+{
+	struct cc2520_radio_state *radio;
+
+	radio = kzalloc(sizeof(struct cc2520_radio_state), GFP_KERNEL);
+	if (!radio)
+		return -ENOMEM;
+
+	spin_lock_init(&radio->rx_buf_sl);
+	dev->radio = radio;
+	return 0;
+}
+
+void cc2520_radio_free(struct cc2520_dev *dev)
+{
+	kfree(dev->radio);
+	dev->radio = NULL;
+}
+
+void cc2520_radio_hold_rx(struct cc2520_dev *dev, const struct cc2520_rx_record *meta)
+{
+	spin_lock(&dev->radio->rx_buf_sl);
+	dev->radio->rx_meta = *meta;
+}
+
+void cc2520_radio_release_rx(struct cc2520_dev *dev)
+{
+	spin_unlock(&dev->radio->rx_buf_sl);
+}
+
+const struct cc2520_rx_record *cc2520_radio_rx_meta(struct cc2520_dev *dev)
+{
+	return &dev->radio->rx_meta;
+}
+
+bool cc2520_radio_is_promiscuous(struct cc2520_dev *dev)
+{
+	return dev->radio->promiscuous;
+}
+
+u64 cc2520_radio_tx_sfd_time(struct cc2520_dev *dev)
+{
+	return 0;
+}
+
+bool cc2520_radio_is_clear(struct cc2520_dev *dev)
+{
+	return true;
+}
+
+//////////////////////////////
+// Stats
+/////////////////////////////
+
+int cc2520_stats_init(struct cc2520_dev *dev)
+{
+	dev->stats = kzalloc(sizeof(struct cc2520_stats), GFP_KERNEL);
+	if (!dev->stats)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void cc2520_stats_free(struct cc2520_dev *dev)
+{
+	kfree(dev->stats);
+	dev->stats = NULL;
+}
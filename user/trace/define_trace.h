@@ -0,0 +1 @@
+// Tracepoints are stubbed out in kernel.h.
@@ -0,0 +1,350 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/skbuff.h>
+#include <linux/workqueue.h>
+#include <linux/version.h>
+
+#include "cc2520.h"
+#include "radio.h"
+#include "csma.h"
+#include "interface.h"
+#include "packet.h"
+#include "wpan.h"
+#include "debug.h"
+
+#if IS_ENABLED(CONFIG_MAC802154)
+
+#include <net/mac802154.h>
+
+// Exposes a radio to the kernel's 802.15.4 stack so 6LoWPAN
+// and IPv6 can run on top of it without going through
+// userspace. Frames go through the same layers as the
+// character interface does, so CSMA, soft-acks and LPL
+// still apply. mac802154 is told the hardware handles
+// acks, checksums and address filtering, which between the
+// radio and the soft-ack layer it does.
+
+// One unit backoff period, 20 symbols.
+#define CC2520_WPAN_UNIT_BACKOFF 320 // uS
+
+// Page 0, channels 11 through 26.
+#define CC2520_WPAN_CHANNELS 0x7FFF800
+
+struct cc2520_wpan_state {
+	struct cc2520_dev *dev;
+	struct ieee802154_hw *hw;
+
+	// xmit_async can't sleep, but the send path has to
+	// wait its turn behind write(), so sends are pushed
+	// out to a worker.
+	struct workqueue_struct *wq;
+	struct work_struct tx_work;
+	struct sk_buff *tx_skb;
+	u8 *tx_buf;
+
+	bool started;
+};
+
+// TXPOWER register settings from the datasheet and the
+// output power they give, in mBm.
+static const s32 cc2520_wpan_powers[] = {
+	500, 300, 200, 100, 0, -200, -400, -700, -1800,
+};
+
+static const u8 cc2520_wpan_power_regs[] = {
+	0xF7, 0xF2, 0xAB, 0x13, 0x32, 0x81, 0x88, 0x2C, 0x03,
+};
+
+// mac802154 only learned to take failed frames back, with
+// a reason, in 5.18. Before that drivers dropped them and
+// restarted the queue themselves.
+static void cc2520_wpan_xmit_failed(struct cc2520_wpan_state *wpan, struct sk_buff *skb, int result)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+	switch (result) {
+		case -CC2520_TX_BUSY:
+			ieee802154_xmit_error(wpan->hw, skb, IEEE802154_CHANNEL_ACCESS_FAILURE);
+			break;
+		case -CC2520_TX_ACK_TIMEOUT:
+			ieee802154_xmit_error(wpan->hw, skb, IEEE802154_NO_ACK);
+			break;
+		default:
+			ieee802154_xmit_error(wpan->hw, skb, IEEE802154_SYSTEM_ERROR);
+			break;
+	}
+#else
+	ieee802154_wake_queue(wpan->hw);
+	dev_kfree_skb_any(skb);
+#endif
+}
+
+static void cc2520_wpan_tx_work(struct work_struct *work)
+{
+	struct cc2520_wpan_state *wpan =
+		container_of(work, struct cc2520_wpan_state, tx_work);
+	struct sk_buff *skb = wpan->tx_skb;
+	int result;
+
+	// The PHY length counts the FCS the radio appends.
+	wpan->tx_buf[0] = skb->len + 2;
+	memcpy(wpan->tx_buf + 1, skb->data, skb->len);
+
+	result = cc2520_interface_kernel_tx(wpan->dev, wpan->tx_buf, skb->len + 1);
+
+	if (result == CC2520_TX_SUCCESS)
+		ieee802154_xmit_complete(wpan->hw, skb, false);
+	else
+		cc2520_wpan_xmit_failed(wpan, skb, result);
+}
+
+static int cc2520_wpan_start(struct ieee802154_hw *hw)
+{
+	struct cc2520_wpan_state *wpan = hw->priv;
+
+	INFO((KERN_INFO "[cc2520] - wpan starting radio%d\n", wpan->dev->id));
+	cc2520_radio_start(wpan->dev);
+	cc2520_radio_on(wpan->dev);
+	wpan->started = true;
+	return 0;
+}
+
+static void cc2520_wpan_stop(struct ieee802154_hw *hw)
+{
+	struct cc2520_wpan_state *wpan = hw->priv;
+
+	INFO((KERN_INFO "[cc2520] - wpan stopping radio%d\n", wpan->dev->id));
+	wpan->started = false;
+	flush_workqueue(wpan->wq);
+	cc2520_radio_off(wpan->dev);
+}
+
+static int cc2520_wpan_xmit_async(struct ieee802154_hw *hw, struct sk_buff *skb)
+{
+	struct cc2520_wpan_state *wpan = hw->priv;
+
+	if (skb->len > IEEE154_LINK_MTU - 2)
+		return -EMSGSIZE;
+
+	// mac802154 keeps the queue stopped until we
+	// complete this one, so there's only ever one.
+	wpan->tx_skb = skb;
+	queue_work(wpan->wq, &wpan->tx_work);
+	return 0;
+}
+
+static int cc2520_wpan_ed(struct ieee802154_hw *hw, u8 *level)
+{
+	struct cc2520_wpan_state *wpan = hw->priv;
+	s8 rssi;
+	int result;
+
+	result = cc2520_radio_read_rssi(wpan->dev, &rssi);
+	if (result)
+		return result;
+
+	// Slide the signed dBm reading onto the 0-255 ED scale.
+	*level = (u8)(rssi + 128);
+	return 0;
+}
+
+static int cc2520_wpan_set_channel(struct ieee802154_hw *hw, u8 page, u8 channel)
+{
+	struct cc2520_wpan_state *wpan = hw->priv;
+
+	if (page != 0)
+		return -EINVAL;
+
+	return cc2520_radio_switch_channel(wpan->dev, channel);
+}
+
+static int cc2520_wpan_set_hw_addr_filt(struct ieee802154_hw *hw,
+	struct ieee802154_hw_addr_filt *filt, unsigned long changed)
+{
+	struct cc2520_wpan_state *wpan = hw->priv;
+	u16 short_addr;
+	u64 extended_addr;
+	u16 pan_id;
+
+	cc2520_radio_get_address(wpan->dev, &short_addr, &extended_addr, &pan_id);
+
+	if (changed & IEEE802154_AFILT_SADDR_CHANGED)
+		short_addr = le16_to_cpu(filt->short_addr);
+
+	if (changed & IEEE802154_AFILT_IEEEADDR_CHANGED)
+		extended_addr = le64_to_cpu(filt->ieee_addr);
+
+	if (changed & IEEE802154_AFILT_PANID_CHANGED)
+		pan_id = le16_to_cpu(filt->pan_id);
+
+	cc2520_radio_set_address(wpan->dev, short_addr, extended_addr, pan_id);
+
+	if (changed & IEEE802154_AFILT_PANC_CHANGED)
+		cc2520_radio_set_pan_coordinator(wpan->dev, filt->pan_coord);
+
+	return 0;
+}
+
+static int cc2520_wpan_set_txpower(struct ieee802154_hw *hw, s32 mbm)
+{
+	struct cc2520_wpan_state *wpan = hw->priv;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(cc2520_wpan_powers); i++) {
+		if (cc2520_wpan_powers[i] == mbm) {
+			cc2520_radio_set_txpower(wpan->dev, cc2520_wpan_power_regs[i]);
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+// Our CSMA layer works in microseconds and only backs off
+// once more on a busy channel, so the backoff exponents
+// become its initial and congestion windows and the retry
+// count isn't used.
+static int cc2520_wpan_set_csma_params(struct ieee802154_hw *hw,
+	u8 min_be, u8 max_be, u8 retries)
+{
+	struct cc2520_wpan_state *wpan = hw->priv;
+
+	cc2520_csma_set_min_backoff(wpan->dev, CC2520_WPAN_UNIT_BACKOFF);
+	cc2520_csma_set_init_backoff(wpan->dev, (1 << min_be) * CC2520_WPAN_UNIT_BACKOFF);
+	cc2520_csma_set_cong_backoff(wpan->dev, (1 << max_be) * CC2520_WPAN_UNIT_BACKOFF);
+	return 0;
+}
+
+static int cc2520_wpan_set_promiscuous_mode(struct ieee802154_hw *hw, const bool on)
+{
+	struct cc2520_wpan_state *wpan = hw->priv;
+
+	cc2520_radio_set_promiscuous(wpan->dev, on);
+	return 0;
+}
+
+static const struct ieee802154_ops cc2520_wpan_ops = {
+	.owner = THIS_MODULE,
+	.start = cc2520_wpan_start,
+	.stop = cc2520_wpan_stop,
+	.xmit_async = cc2520_wpan_xmit_async,
+	.ed = cc2520_wpan_ed,
+	.set_channel = cc2520_wpan_set_channel,
+	.set_hw_addr_filt = cc2520_wpan_set_hw_addr_filt,
+	.set_txpower = cc2520_wpan_set_txpower,
+	.set_csma_params = cc2520_wpan_set_csma_params,
+	.set_promiscuous_mode = cc2520_wpan_set_promiscuous_mode,
+};
+
+// context: interrupt, from the top of the stack.
+void cc2520_wpan_rx(struct cc2520_dev *dev, u8 *buf, u8 len)
+{
+	struct cc2520_wpan_state *wpan = dev->wpan;
+	const struct cc2520_rx_record *meta;
+	struct sk_buff *skb;
+	u8 psdu_len;
+
+	if (!wpan || !wpan->started)
+		return;
+
+	// Drop the length byte, and the RSSI/LQI bytes the
+	// radio puts where the FCS was.
+	if (len < 3)
+		return;
+	psdu_len = len - 3;
+
+	skb = dev_alloc_skb(psdu_len);
+	if (!skb) {
+		INFO((KERN_INFO "[cc2520] - wpan rx skb alloc failed.\n"));
+		return;
+	}
+
+	memcpy(skb_put(skb, psdu_len), buf + 1, psdu_len);
+
+	meta = cc2520_radio_rx_meta(dev);
+
+	// Queued to mac802154's tasklet, which takes the
+	// frames off in batches.
+	ieee802154_rx_irqsafe(wpan->hw, skb, meta->lqi);
+}
+
+int cc2520_wpan_init(struct cc2520_dev *dev)
+{
+	struct ieee802154_hw *hw;
+	struct cc2520_wpan_state *wpan;
+	int result;
+
+	hw = ieee802154_alloc_hw(sizeof(struct cc2520_wpan_state), &cc2520_wpan_ops);
+	if (!hw)
+		return -ENOMEM;
+
+	wpan = hw->priv;
+	wpan->hw = hw;
+	wpan->dev = dev;
+
+	wpan->tx_buf = kmalloc(PKT_BUFF_SIZE, GFP_KERNEL);
+	if (!wpan->tx_buf) {
+		result = -ENOMEM;
+		goto error;
+	}
+
+	wpan->wq = alloc_workqueue("cc2520_wpan", WQ_HIGHPRI, 1);
+	if (!wpan->wq) {
+		result = -ENOMEM;
+		goto error;
+	}
+	INIT_WORK(&wpan->tx_work, cc2520_wpan_tx_work);
+
+	// Emulated radios have no SPI device to hang off.
+	if (dev->spi_device)
+		hw->parent = &dev->spi_device->dev;
+	hw->flags = IEEE802154_HW_TX_OMIT_CKSUM | IEEE802154_HW_RX_OMIT_CKSUM |
+		IEEE802154_HW_AACK | IEEE802154_HW_CSMA_PARAMS |
+		IEEE802154_HW_AFILT | IEEE802154_HW_PROMISCUOUS;
+
+	hw->phy->flags = WPAN_PHY_FLAG_TXPOWER;
+	hw->phy->supported.channels[0] = CC2520_WPAN_CHANNELS;
+	hw->phy->current_page = 0;
+	hw->phy->current_channel = cc2520_radio_get_channel(dev);
+	hw->phy->supported.tx_powers = cc2520_wpan_powers;
+	hw->phy->supported.tx_powers_size = ARRAY_SIZE(cc2520_wpan_powers);
+	hw->phy->transmit_power = 0;
+	ieee802154_random_extended_addr(&hw->phy->perm_extended_addr);
+
+	dev->wpan = wpan;
+
+	result = ieee802154_register_hw(hw);
+	if (result) {
+		ERR((KERN_ALERT "[cc2520] - wpan registration failed: %d\n", result));
+		dev->wpan = NULL;
+		goto error;
+	}
+
+	INFO((KERN_INFO "[cc2520] - radio%d registered with mac802154\n", dev->id));
+	return 0;
+
+	error:
+		if (wpan->wq)
+			destroy_workqueue(wpan->wq);
+
+		kfree(wpan->tx_buf);
+		ieee802154_free_hw(hw);
+		return result;
+}
+
+void cc2520_wpan_free(struct cc2520_dev *dev)
+{
+	struct cc2520_wpan_state *wpan = dev->wpan;
+
+	if (!wpan)
+		return;
+
+	ieee802154_unregister_hw(wpan->hw);
+	dev->wpan = NULL;
+
+	destroy_workqueue(wpan->wq);
+	kfree(wpan->tx_buf);
+	ieee802154_free_hw(wpan->hw);
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef WPAN_H
+#define WPAN_H
+
+#include <linux/errno.h>
+
+#include "cc2520.h"
+
+// Registration with the kernel's IEEE 802.15.4 stack, only
+// available when it's built with mac802154.
+#if IS_ENABLED(CONFIG_MAC802154)
+
+int cc2520_wpan_init(struct cc2520_dev *dev);
+void cc2520_wpan_free(struct cc2520_dev *dev);
+void cc2520_wpan_rx(struct cc2520_dev *dev, u8 *buf, u8 len);
+
+#else
+
+static inline int cc2520_wpan_init(struct cc2520_dev *dev)
+{
+	return -ENODEV;
+}
+
+static inline void cc2520_wpan_free(struct cc2520_dev *dev)
+{
+}
+
+static inline void cc2520_wpan_rx(struct cc2520_dev *dev, u8 *buf, u8 len)
+{
+}
+
+#endif
+
+#endif